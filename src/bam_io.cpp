@@ -1,9 +1,11 @@
 // Taken from https://github.com/tfwillems/HipSTR/blob/master/src/bam_io.cpp
 
+#include <pthread.h>
 #include <sstream>
 
 #include "bam_io.h"
 //#include "error.h"
+#include "stats.h"
 #include "stringops.h"
 
 void BamAlignment::ExtractSequenceFields(){
@@ -34,6 +36,22 @@ void BamAlignment::ExtractSequenceFields(){
   built_ = true;
 }
 
+void BamAlignmentView::ExtractSequenceFields() const {
+  int32_t length = b_->core.l_qseq;
+  bases_.resize(length);
+  qualities_.resize(length);
+
+  uint8_t* quals = bam_get_qual(b_);
+  for (int32_t i = 0; i < length; ++i)
+    qualities_[i] = (char)(quals[i] + 33);
+
+  uint8_t *bases = bam_get_seq(b_);
+  for (int32_t i = 0; i < length; ++i)
+    bases_[i] = HTSLIB_INT_TO_BASE[bam_seqi(bases, i)];
+
+  built_ = true;
+}
+
 
 void BamHeader::parse_read_groups(){
   assert(read_groups_.empty());
@@ -58,8 +76,58 @@ void BamHeader::parse_read_groups(){
   }
 }
 
+namespace {
+// Owners of the shared CRAM references, by FASTA path
+std::map<std::string, samFile*> cram_ref_owners;
+pthread_mutex_t cram_ref_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Closes the owners at exit
+struct CramRefOwnersCleanup {
+  ~CramRefOwnersCleanup(){
+    for (std::map<std::string, samFile*>::iterator it = cram_ref_owners.begin();
+	 it != cram_ref_owners.end(); it++)
+      sam_close(it->second);
+  }
+} cram_ref_owners_cleanup;
+}
+
+void CramRefCache::Attach(samFile* fp, const std::string& path, const std::string& fasta_path){
+  pthread_mutex_lock(&cram_ref_mutex);
+  std::map<std::string, samFile*>::iterator owner = cram_ref_owners.find(fasta_path);
+  if (owner == cram_ref_owners.end()){
+    samFile* owner_fp = sam_open(path.c_str(), "r");
+    if (owner_fp == NULL)
+      PrintMessageDieOnError("Failed to open file " + path, M_ERROR);
+    if (hts_set_fai_filename(owner_fp, fasta_path.c_str()) != 0)
+      PrintMessageDieOnError("Failed to open FASTA reference file " + fasta_path + " for CRAM file " + path, M_ERROR);
+    // Reading the header sets up the references
+    bam_hdr_t* hdr = sam_hdr_read(owner_fp);
+    if (hdr == NULL)
+      PrintMessageDieOnError("Failed to read the header for file " + path, M_ERROR);
+    bam_hdr_destroy(hdr);
+    owner = cram_ref_owners.insert(std::pair<std::string, samFile*>(fasta_path, owner_fp)).first;
+  }
+  if (hts_set_opt(fp, CRAM_OPT_SHARED_REF, cram_get_refs(owner->second)) != 0)
+    PrintMessageDieOnError("Failed to share CRAM references for file " + path, M_ERROR);
+  pthread_mutex_unlock(&cram_ref_mutex);
+}
+
+void BamCramReader::SetCramOptions(samFile* fp){
+  if (hts_set_fai_filename(fp, fasta_path_.c_str()) != 0)
+    PrintMessageDieOnError("Failed to open FASTA reference file " + fasta_path_ + " for CRAM file " + path_, M_ERROR);
+  // Only decode the fields GangSTR uses. Auxiliary tags (and MD/NM,
+  // which CRAM would otherwise rebuild from the reference) are skipped
+  int fields = (SAM_QNAME | SAM_FLAG | SAM_RNAME | SAM_POS | SAM_MAPQ | SAM_CIGAR |
+		SAM_RNEXT | SAM_PNEXT | SAM_TLEN | SAM_SEQ | SAM_QUAL);
+  hts_set_opt(fp, CRAM_OPT_REQUIRED_FIELDS, fields);
+  hts_set_opt(fp, CRAM_OPT_DECODE_MD, 0);
+  CramRefCache::Attach(fp, path_, fasta_path_);
+}
+
 bool BamCramReader::SetRegion(const std::string& chrom, int32_t start, int32_t end){
-  bool reuse_offset = (min_offset_ != 0 && chrom.compare(chrom_) == 0 && start >= start_);
+  use_window_ = false;
+  // Resuming from the offset of a previous region only works with BGZF offsets
+  bool reuse_offset = (!in_->is_cram && min_offset_ != 0 && chrom.compare(chrom_) == 0 && start >= start_);
   if (reuse_offset && first_aln_.GetEndPosition() > start && first_aln_.Position() < end)
     reuse_offset = false;
   //std::cerr << chrom << "\t" << start << std::endl;
@@ -88,7 +156,18 @@ bool BamCramReader::SetRegion(const std::string& chrom, int32_t start, int32_t e
   }
 }
 
+bool BamCramReader::SetWholeFile(){
+  use_window_ = false;
+  hts_itr_destroy(iter_);
+  iter_       = sam_itr_queryi(idx_, HTS_IDX_START, 0, 0);
+  chrom_      = "";
+  start_      = -1;
+  min_offset_ = 0;
+  return iter_ != NULL;
+}
+
 bool BamCramReader::GetNextAlignment(BamAlignment& aln){
+  if (use_window_) return GetNextWindowAlignment(aln);
   if (iter_ == NULL) return false;
 
   if (sam_itr_next(in_, iter_, aln.b_) < 0){
@@ -96,6 +175,7 @@ bool BamCramReader::GetNextAlignment(BamAlignment& aln){
     iter_ = NULL;
     return false;
   }
+  AddDecompressedBytes(aln.b_);
 
   if (min_offset_ == 0){
     first_aln_  = aln;
@@ -112,46 +192,210 @@ bool BamCramReader::GetNextAlignment(BamAlignment& aln){
 }
 
 
+void BamCramReader::ResetWindow(){
+  while (!window_.empty()){
+    window_spare_.push_back(window_.front());
+    window_.pop_front();
+  }
+  if (window_iter_ != NULL)
+    hts_itr_destroy(window_iter_);
+  window_iter_      = NULL;
+  window_exhausted_ = false;
+  window_chrom_     = "";
+}
+
+bool BamCramReader::SetWindowRegion(const std::string& chrom, int32_t start, int32_t end){
+  use_window_  = true;
+  window_next_ = 0;
+  bool restart = (chrom.compare(window_chrom_) != 0 || start < window_start_ ||
+		  (!window_exhausted_ && (window_.empty() || window_.back()->Position() < start)));
+  window_start_ = start;
+  window_end_   = end;
+
+  if (restart){
+    ResetWindow();
+    if (window_in_ == NULL){
+      window_in_ = sam_open(path_.c_str(), "r");
+      if (window_in_ == NULL)
+	PrintMessageDieOnError("Failed to open file " + path_, M_ERROR);
+      if (thread_pool_ != NULL && hts_set_opt(window_in_, HTS_OPT_THREAD_POOL, thread_pool_) != 0)
+	PrintMessageDieOnError("Failed to attach the I/O thread pool to file " + path_, M_ERROR);
+      if (window_in_->is_cram)
+	SetCramOptions(window_in_);
+      bam_hdr_t* hdr = sam_hdr_read(window_in_);
+      if (hdr == NULL)
+	PrintMessageDieOnError("Failed to read the header for file " + path_, M_ERROR);
+      bam_hdr_destroy(hdr);
+      window_idx_ = sam_index_load(window_in_, path_.c_str());
+      if (window_idx_ == NULL)
+	PrintMessageDieOnError("Failed to load the index for file " + path_, M_ERROR);
+    }
+    // Open ended, so the stream can follow later regions
+    std::stringstream region;
+    region << chrom << ":" << start+1;
+    window_iter_ = sam_itr_querys(window_idx_, hdr_, region.str().c_str());
+    if (window_iter_ == NULL)
+      return false;
+    window_chrom_ = chrom;
+    return true;
+  }
+
+  // Drop reads that end before the region. Reads are in start order, so
+  // a few that end early may stay behind longer ones until those go too
+  while (!window_.empty() && window_.front()->GetEndPosition() <= start){
+    window_spare_.push_back(window_.front());
+    window_.pop_front();
+  }
+  return true;
+}
+
+bool BamCramReader::FetchWindowAlignment(){
+  if (window_iter_ == NULL) return false;
+  BamAlignment* aln;
+  if (window_spare_.empty())
+    aln = new BamAlignment();
+  else {
+    aln = window_spare_.back();
+    window_spare_.pop_back();
+  }
+  if (sam_itr_next(window_in_, window_iter_, aln->b_) < 0){
+    window_spare_.push_back(aln);
+    hts_itr_destroy(window_iter_);
+    window_iter_      = NULL;
+    window_exhausted_ = true;
+    return false;
+  }
+  AddDecompressedBytes(aln->b_);
+  aln->built_   = false;
+  aln->file_    = path_;
+  aln->length_  = aln->b_->core.l_qseq;
+  aln->pos_     = aln->b_->core.pos;
+  aln->end_pos_ = bam_endpos(aln->b_);
+  window_.push_back(aln);
+  return true;
+}
+
+const BamAlignment* BamCramReader::NextWindowAlignment(){
+  while (true){
+    if (window_next_ == window_.size() && !FetchWindowAlignment())
+      return NULL;
+    const BamAlignment* next = window_[window_next_];
+    // Keep the first read past the region for the next one
+    if (next->Position() >= window_end_)
+      return NULL;
+    window_next_++;
+    // Same overlap test as the htslib region iterator
+    if (next->GetEndPosition() > window_start_)
+      return next;
+  }
+}
+
+bool BamCramReader::GetNextWindowAlignment(BamAlignment& aln){
+  // Later regions may overlap this read too, so the window keeps it and
+  // the caller gets a copy. BamCramMultiReader views it in place instead
+  const BamAlignment* next = NextWindowAlignment();
+  if (next == NULL)
+    return false;
+  aln = *next;
+  return true;
+}
+
 
 bool BamCramMultiReader::SetRegion(const std::string& chrom, int32_t start, int32_t end){
+  return StartRegion(chrom, start, end, false);
+}
+
+bool BamCramMultiReader::SetWindowRegion(const std::string& chrom, int32_t start, int32_t end){
+  return StartRegion(chrom, start, end, true);
+}
+
+bool BamCramMultiReader::StartRegion(const std::string& chrom, int32_t start, int32_t end, bool use_window){
   aln_heap_.clear();
+  use_window_ = use_window;
   for (int32_t reader_index = 0; reader_index < bam_readers_.size(); reader_index++){
-    if (!bam_readers_[reader_index]->SetRegion(chrom, start, end))
+    bool region_set = (use_window ?
+		       bam_readers_[reader_index]->SetWindowRegion(chrom, start, end) :
+		       bam_readers_[reader_index]->SetRegion(chrom, start, end));
+    if (!region_set)
       return false;
-    if (bam_readers_[reader_index]->GetNextAlignment(cached_alns_[reader_index])){
-      if (merge_type_ == ORDER_ALNS_BY_POSITION)
-	aln_heap_.push_back(std::pair<int32_t, int32_t>(-cached_alns_[reader_index].Position(), reader_index));
-      else if (merge_type_ == ORDER_ALNS_BY_FILE)
-	aln_heap_.push_back(std::pair<int32_t, int32_t>(-reader_index, reader_index));
-      else
-	PrintMessageDieOnError("Invalid merge order in SetRegion()", M_ERROR);
+    if (use_window){
+      window_alns_[reader_index] = bam_readers_[reader_index]->NextWindowAlignment();
+      if (window_alns_[reader_index] != NULL)
+	PushReader(reader_index, window_alns_[reader_index]->Position());
     }
+    else if (bam_readers_[reader_index]->GetNextAlignment(cached_alns_[reader_index]))
+      PushReader(reader_index, cached_alns_[reader_index].Position());
   }
   std::make_heap(aln_heap_.begin(), aln_heap_.end());
   return true;
 }
 
+void BamCramMultiReader::PushReader(int32_t reader_index, int32_t position){
+  if (merge_type_ == ORDER_ALNS_BY_POSITION)
+    aln_heap_.push_back(std::pair<int32_t, int32_t>(-position, reader_index));
+  else if (merge_type_ == ORDER_ALNS_BY_FILE)
+    aln_heap_.push_back(std::pair<int32_t, int32_t>(-reader_index, reader_index));
+  else
+    PrintMessageDieOnError("Invalid merge order in BamCramMultiReader", M_ERROR);
+}
+
+const BamAlignment* BamCramMultiReader::NextWindowAlignment(){
+  if (aln_heap_.empty())
+    return NULL;
+  std::pop_heap(aln_heap_.begin(), aln_heap_.end());
+  int32_t reader_index = aln_heap_.back().second;
+  aln_heap_.pop_back();
+
+  // Reading ahead only appends to the window, so next stays where it is
+  const BamAlignment* next = window_alns_[reader_index];
+  window_alns_[reader_index] = bam_readers_[reader_index]->NextWindowAlignment();
+  if (window_alns_[reader_index] != NULL){
+    PushReader(reader_index, window_alns_[reader_index]->Position());
+    std::push_heap(aln_heap_.begin(), aln_heap_.end());
+  }
+  STATS_COUNT(STATS_READS_FETCHED, 1);
+  return next;
+}
+
 bool BamCramMultiReader::GetNextAlignment(BamAlignment& aln){
+  if (use_window_){
+    const BamAlignment* next = NextWindowAlignment();
+    if (next == NULL)
+      return false;
+    aln = *next;
+    return true;
+  }
   if (aln_heap_.empty())
     return false;
   std::pop_heap(aln_heap_.begin(), aln_heap_.end());
   int32_t reader_index = aln_heap_.back().second;
   aln_heap_.pop_back();
 
-  // Assign optimal alignment to provided reference
-  aln = cached_alns_[reader_index];
+  // Hand the optimal alignment to the caller. Swapping instead of copying
+  // gives the cache the caller's old buffers to read the next alignment into
+  aln.Swap(cached_alns_[reader_index]);
 
   // Add reader's next alignment to the cache
   if (bam_readers_[reader_index]->GetNextAlignment(cached_alns_[reader_index])){
-    if (merge_type_ == ORDER_ALNS_BY_POSITION)
-      aln_heap_.push_back(std::pair<int32_t, int32_t>(-cached_alns_[reader_index].Position(), reader_index));
-    else if (merge_type_ == ORDER_ALNS_BY_FILE)
-      aln_heap_.push_back(std::pair<int32_t, int32_t>(-reader_index, reader_index));
-    else
-      PrintMessageDieOnError("Invalid merge order in GetNextAlignment()", M_ERROR);
-
+    PushReader(reader_index, cached_alns_[reader_index].Position());
     std::push_heap(aln_heap_.begin(), aln_heap_.end());
   }
+  STATS_COUNT(STATS_READS_FETCHED, 1);
+  return true;
+}
+
+
+bool BamCramMultiReader::GetNextAlignment(BamAlignmentView* view){
+  if (use_window_){
+    const BamAlignment* next = NextWindowAlignment();
+    if (next == NULL)
+      return false;
+    view->Reset(*next);
+    return true;
+  }
+  if (!GetNextAlignment(current_aln_))
+    return false;
+  view->Reset(current_aln_);
   return true;
 }
 
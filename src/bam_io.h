@@ -8,15 +8,17 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <deque>
 #include <map>
 #include <sstream>
 #include <vector>
 #include <sys/stat.h>
 
 #include "htslib/bgzf.h"
-//#include "htslib/cram.h"
+#include "htslib/cram.h"
 #define bam_ins_size(b)  (b)->core.isize;
 #include "htslib/sam.h"
+#include "htslib/thread_pool.h"
 
 #include "src/common.h"
 
@@ -91,6 +93,19 @@ class BamAlignment {
     bam_destroy1(b_);
   }
 
+  /* Exchange contents with another alignment without copying any data */
+  void Swap(BamAlignment& aln){
+    std::swap(b_, aln.b_);
+    file_.swap(aln.file_);
+    std::swap(built_, aln.built_);
+    std::swap(length_, aln.length_);
+    std::swap(pos_, aln.pos_);
+    std::swap(end_pos_, aln.end_pos_);
+    bases_.swap(aln.bases_);
+    qualities_.swap(aln.qualities_);
+    cigar_ops_.swap(aln.cigar_ops_);
+  }
+
   /* Number of bases */
   int32_t Length()              const { return length_;  }
 
@@ -317,6 +332,104 @@ class BamAlignment {
 
 
 
+/*
+ * Read-only view of an alignment owned by someone else, usually the reader
+ * that produced it. Making a view copies nothing; bases and qualities are
+ * decoded from the borrowed bam1_t on first use. A view is only valid until
+ * its owner reads the next alignment.
+ */
+class BamAlignmentView {
+ private:
+  const bam1_t* b_;
+  const std::string* file_;
+  int32_t length_;
+  int32_t pos_, end_pos_;
+  mutable bool built_;
+  mutable std::string bases_;
+  mutable std::string qualities_;
+
+  void ExtractSequenceFields() const;
+
+ public:
+  BamAlignmentView()
+    : b_(NULL), file_(NULL), length_(-1), pos_(0), end_pos_(-1), built_(false){}
+
+  BamAlignmentView(const BamAlignment& aln){
+    Reset(aln);
+  }
+
+  /* Point the view at another alignment */
+  void Reset(const BamAlignment& aln){
+    b_       = aln.b_;
+    file_    = &aln.file_;
+    length_  = aln.length_;
+    pos_     = aln.pos_;
+    end_pos_ = aln.end_pos_;
+    built_   = false;
+  }
+
+  int32_t Length()              const { return length_;  }
+  int32_t Position()            const { return pos_;     }
+  int32_t GetEndPosition()      const { return end_pos_; }
+  int32_t TemplateLength()      const { return bam_ins_size(b_); }
+  std::string Name()            const { return std::string(bam_get_qname(b_)); }
+  /* Null terminated name, without copying it */
+  const char* NameData()        const { return bam_get_qname(b_); }
+  /* Bases in the 4-bit BAM encoding, Length() of them */
+  const uint8_t* PackedBases()  const { return bam_get_seq(b_); }
+  int32_t RefID()               const { return b_->core.tid;      }
+  uint16_t MapQuality()         const { return b_->core.qual;     }
+  int32_t MateRefID()           const { return b_->core.mtid;     }
+  int32_t MatePosition()        const { return b_->core.mpos;     }
+  const std::string& Filename() const { return *file_;            }
+
+  const std::string& QueryBases() const {
+    if (!built_) ExtractSequenceFields();
+    return bases_;
+  }
+
+  const std::string& Qualities() const {
+    if (!built_) ExtractSequenceFields();
+    return qualities_;
+  }
+
+  bool GetIntTag(const char tag[2], int64_t& value) const {
+    uint8_t* tag_data = bam_aux_get(b_, tag);
+    if (tag_data == NULL)
+      return false;
+    value = bam_aux2i(tag_data);
+    return true; // TO DO: Check errno
+  }
+
+  bool IsDuplicate()         const { return (b_->core.flag & BAM_FDUP)         != 0;}
+  bool IsFailedQC()          const { return (b_->core.flag & BAM_FQCFAIL)      != 0;}
+  bool IsMapped()            const { return (b_->core.flag & BAM_FUNMAP)       == 0;}
+  bool IsMateMapped()        const { return (b_->core.flag & BAM_FMUNMAP)      == 0;}
+  bool IsReverseStrand()     const { return (b_->core.flag & BAM_FREVERSE)     != 0;}
+  bool IsMateReverseStrand() const { return (b_->core.flag & BAM_FMREVERSE)    != 0;}
+  bool IsPaired()            const { return (b_->core.flag & BAM_FPAIRED)      != 0;}
+  bool IsProperPair()        const { return (b_->core.flag & BAM_FPROPER_PAIR) != 0;}
+  bool IsFirstMate()         const { return (b_->core.flag & BAM_FREAD1)       != 0;}
+  bool IsSecondMate()        const { return (b_->core.flag & BAM_FREAD2)       != 0;}
+  bool IsSupplementary()     const { return (b_->core.flag & BAM_FSUPPLEMENTARY) != 0;}
+  bool IsSecondary()         const { return (b_->core.flag & BAM_FSECONDARY)   != 0;}
+
+  /* Read straight from the CIGAR, so nothing is decoded */
+  bool StartsWithSoftClip() const {
+    if (b_->core.n_cigar == 0)
+      return false;
+    return bam_cigar_op(bam_get_cigar(b_)[0]) == BAM_CSOFT_CLIP;
+  }
+
+  bool EndsWithSoftClip() const {
+    if (b_->core.n_cigar == 0)
+      return false;
+    return bam_cigar_op(bam_get_cigar(b_)[b_->core.n_cigar-1]) == BAM_CSOFT_CLIP;
+  }
+};
+
+
+
 
 
 
@@ -428,12 +541,28 @@ class BamHeader {
 
 
 
+/*
+ * Decoded reference sequences shared by every CRAM reader in the process,
+ * one set per FASTA file. The first CRAM file opened with a FASTA file is
+ * opened once more and kept open as the owner of its references. Later
+ * handles, including those of other threads, attach to them
+ * (CRAM_OPT_SHARED_REF), so each reference slice is fetched and decoded
+ * once instead of once per handle.
+ */
+class CramRefCache {
+ public:
+  // Share the references of fasta_path with fp, an open CRAM handle for
+  // path whose header has not been read yet
+  static void Attach(samFile* fp, const std::string& path, const std::string& fasta_path);
+};
+
 class BamCramReader {
  private:
   samFile   *in_;
   bam_hdr_t *hdr_;
   hts_idx_t *idx_;
   std::string path_;
+  std::string fasta_path_;
   BamHeader*  header_;
 
   // Instance variables for the most recently set region
@@ -443,6 +572,29 @@ class BamCramReader {
   uint64_t    min_offset_; // Offset after first alignment
   BamAlignment first_aln_; // First alignment
 
+  // Sliding window of decoded alignments shared by neighbouring regions (SetWindowRegion).
+  // It streams through its own file handle, so SetRegion calls in between are free to seek
+  bool        use_window_;       // Whether GetNextAlignment reads from the window
+  samFile*    window_in_;
+  hts_idx_t*  window_idx_;       // Index loaded through window_in_ (a CRAM index reads through its own file)
+  hts_itr_t*  window_iter_;      // Iterator from the window start to the end of the chromosome
+  bool        window_exhausted_; // Whether window_iter_ reached the end of the chromosome
+  std::string window_chrom_;
+  int32_t     window_start_;     // Current region
+  int32_t     window_end_;
+  size_t      window_next_;      // Next window alignment to consider for the current region
+  std::deque<BamAlignment*> window_;        // Alignments in file order
+  std::vector<BamAlignment*> window_spare_; // Evicted alignments, reused for new reads
+
+  htsThreadPool* thread_pool_;  // Shared decompression threads (may be NULL)
+  int64_t decompressed_bytes_;  // Uncompressed size of all records read
+
+  // Count a record that was just read
+  void AddDecompressedBytes(const bam1_t* b){
+    // 4 byte block_size, 32 bytes of fixed fields, then the variable length data
+    decompressed_bytes_ += 36 + b->l_data;
+  }
+
   // Private unimplemented copy constructor and assignment operator to prevent operations
   BamCramReader(const BamCramReader& other);
   BamCramReader& operator=(const BamCramReader& other);
@@ -451,9 +603,22 @@ class BamCramReader {
     return (access(path.c_str(), F_OK) != -1);
   }
 
+  // Set the reference and decoding options of a CRAM handle, before its header is read
+  void SetCramOptions(samFile* fp);
+
+  // Decode the next alignment of the window stream and append it to the window
+  bool FetchWindowAlignment();
+  void ResetWindow();
+  bool GetNextWindowAlignment(BamAlignment& aln);
+
  public:
-  BamCramReader(const std::string& path, std::string fasta_path = "")
-    : path_(path), chrom_(""){
+  /*
+   * If thread_pool is given, BGZF blocks are decompressed by its threads,
+   * ahead of the records being read
+   */
+  BamCramReader(const std::string& path, std::string fasta_path = "",
+		htsThreadPool* thread_pool = NULL)
+    : path_(path), fasta_path_(fasta_path), chrom_(""), thread_pool_(thread_pool), decompressed_bytes_(0){
 
     // Open the file itself
     if (!file_exists(path))
@@ -461,22 +626,13 @@ class BamCramReader {
     in_ = sam_open(path.c_str(), "r");
     if (in_ == NULL)
       PrintMessageDieOnError("Failed to open file " + path, M_ERROR);
+    if (thread_pool_ != NULL && hts_set_opt(in_, HTS_OPT_THREAD_POOL, thread_pool_) != 0)
+      PrintMessageDieOnError("Failed to attach the I/O thread pool to file " + path, M_ERROR);
 
     if (in_->is_cram){
-      PrintMessageDieOnError("No support for CRAM files yet", M_ERROR);
-      /*
       if (fasta_path.empty())
 	PrintMessageDieOnError("Must specify a FASTA reference file path for CRAM file " + path, M_ERROR);
-      
-      // Open the FASTA reference file for the CRAM
-      char* fasta = new char[fasta_path.size()+1];
-      for (size_t i = 0; i < fasta_path.size(); ++i)
-	fasta[i] = fasta_path[i];
-      fasta[fasta_path.size()] = '\0';
-      if (cram_load_reference(in_->fp.cram, fasta) < 0)
-	PrintMessageDieOnError("Failed to open FASTA reference file for CRAM file", M_ERROR);
-      delete [] fasta;
-      */
+      SetCramOptions(in_);
     }
 
     // Read the header
@@ -492,10 +648,20 @@ class BamCramReader {
     iter_       = NULL;
     start_      = -1;
     min_offset_ = 0;
+
+    use_window_       = false;
+    window_in_        = NULL;
+    window_idx_       = NULL;
+    window_iter_      = NULL;
+    window_exhausted_ = false;
+    window_start_     = -1;
+    window_end_       = -1;
+    window_next_      = 0;
   }
 
   const BamHeader* bam_header() const { return header_; }
   const std::string& path()     const { return path_;   }
+  int64_t decompressed_bytes()  const { return decompressed_bytes_; }
   
   ~BamCramReader(){
     bam_hdr_destroy(hdr_);
@@ -506,12 +672,41 @@ class BamCramReader {
     
     if (iter_ != NULL)
       hts_itr_destroy(iter_);
-    
+
+    ResetWindow();
+    for (size_t i = 0; i < window_spare_.size(); i++)
+      delete window_spare_[i];
+    if (window_idx_ != NULL)
+      hts_idx_destroy(window_idx_);
+    if (window_in_ != NULL)
+      sam_close(window_in_);
   }
 
   bool GetNextAlignment(BamAlignment& aln);
   
   bool SetRegion(const std::string& chrom, int32_t start, int32_t end);
+
+  /*
+   * Iterate over every record in the file, including the unmapped reads
+   * at the end of it
+   */
+  bool SetWholeFile();
+
+  /*
+   * Same alignments as SetRegion, but served from a window of decoded alignments
+   * that slides along the chromosome. When regions are visited in coordinate order,
+   * each record is decoded once no matter how many regions overlap it. A region
+   * on another chromosome, behind the previous one or past the decoded reads
+   * restarts the window.
+   */
+  bool SetWindowRegion(const std::string& chrom, int32_t start, int32_t end);
+
+  /*
+   * Next alignment of the current window region, left in the window
+   * instead of being copied out. It stays valid until the next
+   * SetWindowRegion call. NULL at the end of the region
+   */
+  const BamAlignment* NextWindowAlignment();
 };
 
 
@@ -527,27 +722,41 @@ class BamCramMultiReader {
   std::vector<BamCramReader*> bam_readers_;
   std::vector<BamAlignment> cached_alns_;
   std::vector<std::pair<int32_t, int32_t> > aln_heap_;
+  BamAlignment current_aln_; // Alignment behind the last view handed out
   int merge_type_;
+  // Window regions leave the alignments in each reader's window, so the
+  // readers' next alignments are pointers into them instead of cached_alns_
+  bool use_window_;
+  std::vector<const BamAlignment*> window_alns_;
 
   // Private unimplemented copy constructor and assignment operator to prevent operations
   BamCramMultiReader(const BamCramMultiReader& other);
   BamCramMultiReader& operator=(const BamCramMultiReader& other);
 
+  bool StartRegion(const std::string& chrom, int32_t start, int32_t end, bool use_window);
+  // Add a reader whose next alignment is at position to the merge heap
+  void PushReader(int32_t reader_index, int32_t position);
+  // Next alignment of a window region, in merge order. NULL at the end
+  const BamAlignment* NextWindowAlignment();
+
  public:
   const static int ORDER_ALNS_BY_POSITION = 0;
   const static int ORDER_ALNS_BY_FILE     = 1;
 
-  BamCramMultiReader(const std::vector<std::string>& paths, std::string fasta_path = "", int merge_type = ORDER_ALNS_BY_POSITION){
+  BamCramMultiReader(const std::vector<std::string>& paths, std::string fasta_path = "", int merge_type = ORDER_ALNS_BY_POSITION,
+		     htsThreadPool* thread_pool = NULL){
     if (paths.empty())
       PrintMessageDieOnError("Must provide at least one file to BamCramMultiReader constructor", M_ERROR);
     if (merge_type != ORDER_ALNS_BY_POSITION && merge_type != ORDER_ALNS_BY_FILE)
       PrintMessageDieOnError("Invalid merge type provided to BamCramMultiReader constructor", M_ERROR);
     for (size_t i = 0; i < paths.size(); i++){
       cached_alns_.push_back(BamAlignment());
-      bam_readers_.push_back(new BamCramReader(paths[i], fasta_path));
+      window_alns_.push_back(NULL);
+      bam_readers_.push_back(new BamCramReader(paths[i], fasta_path, thread_pool));
       compare_bam_headers(bam_readers_[0]->bam_header(), bam_readers_[i]->bam_header(), paths[0], paths[i]);
     }
     merge_type_ = merge_type;
+    use_window_ = false;
   }
 
   ~BamCramMultiReader(){
@@ -557,6 +766,14 @@ class BamCramMultiReader {
 
   int get_merge_type() const { return merge_type_; }
 
+  // Uncompressed size of all records read from all files so far
+  int64_t decompressed_bytes() const {
+    int64_t total = 0;
+    for (size_t i = 0; i < bam_readers_.size(); i++)
+      total += bam_readers_[i]->decompressed_bytes();
+    return total;
+  }
+
   const BamHeader* bam_header() const {
     return bam_readers_[0]->bam_header();
   }
@@ -569,7 +786,17 @@ class BamCramMultiReader {
 
   bool SetRegion(const std::string& chrom, int32_t start, int32_t end);
 
+  // Same as SetRegion, using each reader's sliding window (see BamCramReader)
+  bool SetWindowRegion(const std::string& chrom, int32_t start, int32_t end);
+
   bool GetNextAlignment(BamAlignment& aln);
+
+  /*
+   * Next alignment without copying it. The view stays valid until the
+   * next call to GetNextAlignment. Alignments of a window region are
+   * viewed where they sit in the window.
+   */
+  bool GetNextAlignment(BamAlignmentView* view);
 };
 
 
@@ -579,6 +806,38 @@ class BamCramMultiReader {
 
 
 
+/*
+ * htslib thread pool for BGZF decompression, shared by every reader it is
+ * given to. It must outlive those readers.
+ */
+class IOThreadPool {
+ private:
+  htsThreadPool pool_;
+
+  // Private unimplemented copy constructor and assignment operator to prevent operations
+  IOThreadPool(const IOThreadPool& other);
+  IOThreadPool& operator=(const IOThreadPool& other);
+
+ public:
+  // No threads (and a NULL get()) if num_threads is 0
+  explicit IOThreadPool(int32_t num_threads){
+    pool_.pool  = NULL;
+    pool_.qsize = 0;
+    if (num_threads > 0){
+      pool_.pool = hts_tpool_init(num_threads);
+      if (pool_.pool == NULL)
+	PrintMessageDieOnError("Failed to create the I/O thread pool", M_ERROR);
+    }
+  }
+
+  ~IOThreadPool(){
+    if (pool_.pool != NULL)
+      hts_tpool_destroy(pool_.pool);
+  }
+
+  htsThreadPool* get(){ return (pool_.pool == NULL ? NULL : &pool_); }
+};
+
 class BamWriter {
  private:
   BGZF* output_;
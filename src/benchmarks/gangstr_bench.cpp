@@ -0,0 +1,353 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  End-to-end benchmark on simulated expanded loci.
+
+  For each case of a grid over depth, motif length and expansion size,
+  the read simulator writes a synthetic reference (flanks from the
+  template FASTA around the simulated repeat) and an indexed BAM of a
+  heterozygous sample, and the locus is genotyped as GangSTR would. Data
+  only depends on the seed, so results of two releases can be diffed.
+
+  Output is a tab separated table with one row per case: the true and
+  called genotype, the wall time of the locus and, from the --stats
+  instrumentation, the time and work of the hot kernels (realignment,
+  class likelihood evaluations in the optimizer, bootstrap).
+
+  With --screen, loci are genotyped in --screen mode. Cases that pass
+  the screen are genotyped again, untimed, with the full model, and the
+  concordance of both calls with the simulated truth is printed at the
+  end of the table.
+
+  Usage: gangstr_bench [--template tests/test.fa] [--workdir dir]
+                       [--out results.tsv] [--repeats n] [--quick] [--screen]
+                       [--optimizer nlopt|discrete]
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "src/benchmarks/read_simulator.h"
+#include "src/bam_io.h"
+#include "src/genotyper.h"
+#include "src/locus.h"
+#include "src/options.h"
+#include "src/ref_genome.h"
+#include "src/stats.h"
+#include "src/stringops.h"
+
+using namespace std;
+
+const int32_t BENCH_READ_LEN = 150;
+const double BENCH_DIST_MEAN = 400;
+const double BENCH_DIST_SDEV = 50;
+const uint32_t BENCH_SEED = 12345;
+// Repeat of the template locus (tests/test.fa, chrom 3)
+const char BENCH_TEMPLATE_CHROM[] = "3";
+const int32_t BENCH_TEMPLATE_START = 201;
+const int32_t BENCH_TEMPLATE_END = 230;
+// Reference repeat length, in bp, of the simulated loci
+const int32_t BENCH_REF_REPEAT_LEN = 30;
+// Motif of each motif length
+const char* BENCH_MOTIFS[] = {"A", "AC", "CAG", "AAAG", "ATTCT", "GGGGCC"};
+// Grid of cases. Expansions are in read lengths, 0 for a normal allele
+const int32_t BENCH_DEPTHS[] = {10, 50, 100, 200};
+const int32_t BENCH_MOTIF_LENS[] = {1, 2, 3, 4, 5, 6};
+const int32_t BENCH_EXPANSIONS[] = {0, 1, 2, 3};
+const int32_t BENCH_QUICK_DEPTHS[] = {10, 50};
+const int32_t BENCH_QUICK_MOTIF_LENS[] = {1, 3, 6};
+const int32_t BENCH_QUICK_EXPANSIONS[] = {0, 3};
+
+// Genotypes are unordered
+bool SameGenotype(const int32_t& a1, const int32_t& a2, const int32_t& b1, const int32_t& b2) {
+  return std::min(a1, a2) == std::min(b1, b2) && std::max(a1, a2) == std::max(b1, b2);
+}
+
+void show_help() {
+  std::stringstream help_msg;
+  help_msg << "\nUsage: gangstr_bench [OPTIONS]\n\n"
+	   << "\t" << "--template <file.fa>          " << "\t" << "Template reference for the flanks. Default: tests/test.fa" << "\n"
+	   << "\t" << "--workdir  <dir>              " << "\t" << "Directory for the simulated data. Default: bench_data" << "\n"
+	   << "\t" << "--out      <file.tsv>         " << "\t" << "Results table. Default: stdout" << "\n"
+	   << "\t" << "--repeats  <int>              " << "\t" << "Genotype each case n times and keep the fastest. Default: 1" << "\n"
+	   << "\t" << "--quick                       " << "\t" << "Small grid (depth 10/50, motif length 1/3/6, normal/3x read length)" << "\n"
+	   << "\t" << "--screen                      " << "\t" << "Genotype with GangSTR --screen and report its concordance with the full model and the truth" << "\n"
+	   << "\t" << "--optimizer <nlopt,discrete>  " << "\t" << "Genotype search engine. Default: nlopt" << "\n"
+	   << "\n";
+  cerr << help_msg.str();
+  exit(1);
+}
+
+int main(int argc, char* argv[]) {
+  std::string template_fa = "tests/test.fa";
+  std::string workdir = "bench_data";
+  std::string outfile = "";
+  int32_t repeats = 1;
+  bool quick = false;
+  bool screen = false;
+  std::string optimizer = "nlopt";
+
+  enum LONG_OPTIONS {
+    OPT_TEMPLATE,
+    OPT_WORKDIR,
+    OPT_OUT,
+    OPT_REPEATS,
+    OPT_QUICK,
+    OPT_SCREEN,
+    OPT_OPTIMIZER,
+    OPT_HELP,
+  };
+  static struct option long_options[] = {
+    {"template", required_argument, NULL, OPT_TEMPLATE},
+    {"workdir",  required_argument, NULL, OPT_WORKDIR},
+    {"out",      required_argument, NULL, OPT_OUT},
+    {"repeats",  required_argument, NULL, OPT_REPEATS},
+    {"quick",    no_argument,       NULL, OPT_QUICK},
+    {"screen",   no_argument,       NULL, OPT_SCREEN},
+    {"optimizer", required_argument, NULL, OPT_OPTIMIZER},
+    {"help",     no_argument,       NULL, OPT_HELP},
+    {NULL,       no_argument,       NULL, 0},
+  };
+  int ch;
+  int option_index = 0;
+  while ((ch = getopt_long(argc, argv, "h", long_options, &option_index)) != -1) {
+    switch (ch) {
+    case OPT_TEMPLATE:
+      template_fa = optarg;
+      break;
+    case OPT_WORKDIR:
+      workdir = optarg;
+      break;
+    case OPT_OUT:
+      outfile = optarg;
+      break;
+    case OPT_REPEATS:
+      repeats = atoi(optarg);
+      break;
+    case OPT_QUICK:
+      quick = true;
+      break;
+    case OPT_SCREEN:
+      screen = true;
+      break;
+    case OPT_OPTIMIZER:
+      optimizer = optarg;
+      break;
+    default:
+      show_help();
+    }
+  }
+  if (repeats < 1) {
+    PrintMessageDieOnError("--repeats must be at least 1", M_ERROR);
+  }
+  if (optimizer != "nlopt" && optimizer != "discrete") {
+    PrintMessageDieOnError("--optimizer must be nlopt or discrete", M_ERROR);
+  }
+  if (mkdir(workdir.c_str(), 0755) != 0 && errno != EEXIST) {
+    PrintMessageDieOnError("Could not create " + workdir, M_ERROR);
+  }
+
+  std::vector<int32_t> depths, motif_lens, expansions;
+  if (quick) {
+    depths.assign(BENCH_QUICK_DEPTHS, BENCH_QUICK_DEPTHS + 2);
+    motif_lens.assign(BENCH_QUICK_MOTIF_LENS, BENCH_QUICK_MOTIF_LENS + 3);
+    expansions.assign(BENCH_QUICK_EXPANSIONS, BENCH_QUICK_EXPANSIONS + 2);
+  } else {
+    depths.assign(BENCH_DEPTHS, BENCH_DEPTHS + 4);
+    motif_lens.assign(BENCH_MOTIF_LENS, BENCH_MOTIF_LENS + 6);
+    expansions.assign(BENCH_EXPANSIONS, BENCH_EXPANSIONS + 4);
+  }
+
+  ReadSimulator simulator(BENCH_READ_LEN, BENCH_DIST_MEAN, BENCH_DIST_SDEV, BENCH_SEED);
+  if (!simulator.LoadTemplate(template_fa, BENCH_TEMPLATE_CHROM,
+			      BENCH_TEMPLATE_START, BENCH_TEMPLATE_END)) {
+    PrintMessageDieOnError("Could not load template locus from " + template_fa, M_ERROR);
+  }
+
+  std::ofstream outfile_stream;
+  if (!outfile.empty()) {
+    outfile_stream.open(outfile.c_str());
+    if (!outfile_stream.is_open()) {
+      PrintMessageDieOnError("Could not open " + outfile, M_ERROR);
+    }
+  }
+  std::ostream& out = (outfile.empty() ? cout : outfile_stream);
+  out << "#gangstr_bench version=" << _GIT_VERSION << " read_len=" << BENCH_READ_LEN
+      << " insert=" << BENCH_DIST_MEAN << "+-" << BENCH_DIST_SDEV << " seed=" << BENCH_SEED
+      << " optimizer=" << optimizer
+      << (screen ? " screen=on" : "")
+#ifdef GANGSTR_NO_STATS
+      << " stats=off"
+#endif
+      << "\n";
+  out << "case\tdepth\tmotif\tref_count\texpansion\ttrue_allele1\ttrue_allele2"
+      << "\tallele1\tallele2\tscreened\tfull_allele1\tfull_allele2\treads_fetched\twall_sec\treads_per_sec"
+      << "\trealign_sec\treads_realigned\tssw_calls"
+      << "\toptimize_sec\tlikelihood_evals\tusec_per_likelihood_eval\tnlopt_evals\tdiscrete_evals"
+      << "\tdiscrete_bound_evals\tdiscrete_table_alleles"
+      << "\tbootstrap_sec" << endl;
+
+  double total_wall = 0;
+  // Screened cases, and how many of them the screen, the full model
+  // and the truth agree on
+  int32_t num_screened = 0, screen_full = 0, screen_truth = 0, full_truth = 0;
+  for (size_t d = 0; d < depths.size(); d++) {
+    for (size_t m = 0; m < motif_lens.size(); m++) {
+      for (size_t e = 0; e < expansions.size(); e++) {
+	int32_t period = motif_lens[m];
+	SimulatedLocus sim;
+	std::stringstream case_ss;
+	case_ss << "d" << depths[d] << "_m" << period << "_x" << expansions[e];
+	sim.chrom = case_ss.str();
+	sim.motif = BENCH_MOTIFS[period - 1];
+	sim.ref_count = (BENCH_REF_REPEAT_LEN + period / 2) / period;
+	sim.allele1 = sim.ref_count;
+	// Normal cases differ from the reference by two units, expanded
+	// ones are the given multiple of the read length
+	if (expansions[e] == 0) {
+	  sim.allele2 = sim.ref_count + 2;
+	} else {
+	  sim.allele2 = (expansions[e] * BENCH_READ_LEN + period - 1) / period;
+	}
+	sim.depth = depths[d];
+	std::string prefix = workdir + "/" + sim.chrom;
+	if (!simulator.WriteLocus(&sim, prefix)) {
+	  PrintMessageDieOnError("Could not write simulated data for " + sim.chrom, M_ERROR);
+	}
+
+	Options options;
+	options.reffa = prefix + ".fa";
+	options.bamfiles.push_back(prefix + ".bam");
+	options.read_len = BENCH_READ_LEN;
+	options.realignment_flanklen = BENCH_READ_LEN;
+	options.dist_mean = BENCH_DIST_MEAN;
+	options.dist_sdev = BENCH_DIST_SDEV;
+	options.dist_max = BENCH_DIST_MEAN + 3 * BENCH_DIST_SDEV;
+	options.coverage = depths[d];
+	options.output_stats = true;
+	options.screen = screen;
+	options.optimizer = optimizer;
+	RefGenome refgenome(options.reffa);
+	BamCramMultiReader bamreader(options.bamfiles, options.reffa,
+				     BamCramMultiReader::ORDER_ALNS_BY_FILE);
+	Genotyper genotyper(refgenome, options);
+
+	Locus best_locus;
+	LocusStats best_stats;
+	bool success = false;
+	double best_wall = -1;
+	for (int32_t r = 0; r < repeats; r++) {
+	  Locus locus;
+	  locus.chrom = sim.chrom;
+	  locus.start = sim.start;
+	  locus.end = sim.end;
+	  locus.period = period;
+	  locus.motif = lowercase(sim.motif);
+	  locus.insert_size_mean = options.dist_mean;
+	  locus.insert_size_stddev = options.dist_sdev;
+	  locus.offtarget_share = 0.0;
+	  double start = LocusStats::Now();
+	  success = genotyper.ProcessLocus(&bamreader, &locus);
+	  double wall = LocusStats::Now() - start;
+	  if (best_wall < 0 || wall < best_wall) {
+	    best_wall = wall;
+	    best_locus = locus;
+	    best_stats = genotyper.stats();
+	  }
+	}
+	total_wall += best_wall;
+
+	const int64_t* counts = best_stats.counts;
+	const double* seconds = best_stats.seconds;
+	// Likelihoods are evaluated by the optimizer, also for each bootstrap replicate
+	double likelihood_sec = seconds[STATS_OPTIMIZE_TIME] + seconds[STATS_BOOTSTRAP_TIME];
+	out << sim.chrom << "\t" << depths[d] << "\t" << sim.motif << "\t" << sim.ref_count
+	    << "\t" << expansions[e] << "\t" << sim.allele1 << "\t" << sim.allele2 << "\t";
+	if (success) {
+	  out << best_locus.allele1 << "\t" << best_locus.allele2 << "\t" << best_locus.screened;
+	} else {
+	  out << ".\t.\t.";
+	}
+	if (success && best_locus.screened) {
+	  Options full_options = options;
+	  full_options.screen = false;
+	  full_options.output_stats = false;
+	  // Calls do not depend on the bootstrap
+	  full_options.num_boot_samp = 0;
+	  Genotyper full_genotyper(refgenome, full_options);
+	  Locus full_locus;
+	  full_locus.chrom = sim.chrom;
+	  full_locus.start = sim.start;
+	  full_locus.end = sim.end;
+	  full_locus.period = period;
+	  full_locus.motif = lowercase(sim.motif);
+	  full_locus.insert_size_mean = options.dist_mean;
+	  full_locus.insert_size_stddev = options.dist_sdev;
+	  full_locus.offtarget_share = 0.0;
+	  num_screened++;
+	  if (full_genotyper.ProcessLocus(&bamreader, &full_locus)) {
+	    out << "\t" << full_locus.allele1 << "\t" << full_locus.allele2;
+	    screen_full += SameGenotype(best_locus.allele1, best_locus.allele2,
+					full_locus.allele1, full_locus.allele2);
+	    full_truth += SameGenotype(full_locus.allele1, full_locus.allele2, sim.allele1, sim.allele2);
+	  } else {
+	    out << "\t.\t.";
+	  }
+	  screen_truth += SameGenotype(best_locus.allele1, best_locus.allele2, sim.allele1, sim.allele2);
+	} else {
+	  out << "\t.\t.";
+	}
+	out << "\t" << counts[STATS_READS_FETCHED] << "\t" << best_wall
+	    << "\t" << (best_wall > 0 ? counts[STATS_READS_FETCHED] / best_wall : 0)
+	    << "\t" << seconds[STATS_REALIGN_TIME] << "\t" << counts[STATS_READS_REALIGNED]
+	    << "\t" << counts[STATS_SSW_CALLS]
+	    << "\t" << seconds[STATS_OPTIMIZE_TIME] << "\t" << counts[STATS_LIKELIHOOD_EVALS]
+	    << "\t" << (counts[STATS_LIKELIHOOD_EVALS] > 0 ? 1e6 * likelihood_sec / counts[STATS_LIKELIHOOD_EVALS] : 0)
+	    << "\t" << counts[STATS_NLOPT_EVALS] << "\t" << counts[STATS_DISCRETE_EVALS]
+	    << "\t" << counts[STATS_DISCRETE_BOUND_EVALS] << "\t" << counts[STATS_DISCRETE_TABLE_ALLELES]
+	    << "\t" << seconds[STATS_BOOTSTRAP_TIME] << endl;
+      }
+    }
+  }
+  std::stringstream ss;
+  ss << "Genotyped " << depths.size() * motif_lens.size() * expansions.size()
+     << " cases in " << total_wall << " seconds";
+  PrintMessageDieOnError(ss.str(), M_PROGRESS);
+  if (screen) {
+    std::stringstream screen_ss;
+    screen_ss << "screened=" << num_screened << "/" << depths.size() * motif_lens.size() * expansions.size()
+	      << " screen_vs_full=" << screen_full << "/" << num_screened
+	      << " screen_vs_truth=" << screen_truth << "/" << num_screened
+	      << " full_vs_truth=" << full_truth << "/" << num_screened;
+    out << "#" << screen_ss.str() << endl;
+    PrintMessageDieOnError("Screen concordance: " + screen_ss.str(), M_PROGRESS);
+  }
+  return 0;
+}
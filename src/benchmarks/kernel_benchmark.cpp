@@ -0,0 +1,516 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Microbenchmarks of the realignment and likelihood kernels.
+
+  Each benchmark calls one function on fixed inputs: reads built from
+  the tests/test.fa locus (chrom 3, CAG repeat at 201-230) and fixed
+  read class data. Calls are repeated until --min-time seconds have
+  passed. Output is a tab separated table with the nanoseconds, heap
+  allocations and allocated bytes per call. Given the table of an
+  earlier build with --baseline, the baseline time and the speedup are
+  added to each row, for before/after comparisons.
+
+  Allocations are counted by replacing malloc/calloc/realloc on glibc,
+  which also covers operator new and the C code of SSW, and by
+  replacing operator new elsewhere.
+
+  Usage: kernel_benchmark [--template tests/test.fa] [--min-time sec]
+                          [--filter substring] [--baseline old.tsv]
+ */
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "src/common.h"
+#include "src/enclosing_class.h"
+#include "src/flanking_class.h"
+#include "src/frr_class.h"
+#include "src/locus.h"
+#include "src/locus_templates.h"
+#include "src/mathops.h"
+#include "src/options.h"
+#include "src/realignment.h"
+#include "src/ref_genome.h"
+#include "src/spanning_class.h"
+#include "src/stats.h"
+#include "src/stringops.h"
+
+using namespace std;
+
+namespace {
+int64_t num_allocs = 0;
+int64_t num_alloc_bytes = 0;
+}  // namespace
+
+#ifdef __GLIBC__
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+  num_allocs++;
+  num_alloc_bytes += size;
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  num_allocs++;
+  num_alloc_bytes += count * size;
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+  num_allocs++;
+  num_alloc_bytes += size;
+  return __libc_realloc(ptr, size);
+}
+}
+#else
+#if __cplusplus >= 201103L
+#define BENCH_NEW_THROW
+#define BENCH_DELETE_THROW noexcept
+#else
+#define BENCH_NEW_THROW throw(std::bad_alloc)
+#define BENCH_DELETE_THROW throw()
+#endif
+
+void* operator new(size_t size) BENCH_NEW_THROW {
+  num_allocs++;
+  num_alloc_bytes += size;
+  void* ptr = malloc(size == 0 ? 1 : size);
+  if (ptr == NULL) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void* operator new[](size_t size) BENCH_NEW_THROW {
+  return operator new(size);
+}
+
+void operator delete(void* ptr) BENCH_DELETE_THROW {
+  free(ptr);
+}
+
+void operator delete[](void* ptr) BENCH_DELETE_THROW {
+  free(ptr);
+}
+#endif
+
+const int32_t BENCH_READ_LEN = 150;
+const int32_t BENCH_MIN_MATCH = 5;
+const int32_t BENCH_REF_COUNT = 10;
+const int32_t BENCH_MOTIF_LEN = 3;
+const double BENCH_COVERAGE = 50;
+// Template locus (tests/test.fa, chrom 3)
+const char BENCH_TEMPLATE_CHROM[] = "3";
+const int32_t BENCH_TEMPLATE_START = 201;
+const int32_t BENCH_TEMPLATE_END = 230;
+// Alleles of the genotypes cycled through by the likelihood benchmarks
+const int32_t BENCH_ALLELES[] = {8, 10, 12, 20, 35, 50, 80, 120, 150};
+const int32_t NUM_BENCH_ALLELES = sizeof(BENCH_ALLELES) / sizeof(BENCH_ALLELES[0]);
+
+// Keeps results alive so calls are not optimized away
+volatile double bench_sink = 0;
+
+/*
+  One microbenchmark. Setup is not timed; RunOnce is one operation
+ */
+class Microbenchmark {
+ public:
+  explicit Microbenchmark(const std::string& name) : name_(name) {}
+  virtual ~Microbenchmark() {}
+  const std::string& name() const { return name_; }
+  virtual void RunOnce() = 0;
+ private:
+  std::string name_;
+};
+
+// Shared inputs: flanks of the template locus and reads built from them
+struct BenchInputs {
+  Locus locus;
+  LocusTemplates templates;
+  std::string qual;
+  std::string enclosing_read;  // 60 flank bases, 10 copies, 60 flank bases
+  std::string flanking_read;   // 75 flank bases, 25 copies
+  std::string irr_read;        // 50 copies
+  Options options;
+};
+
+class RealignBenchmark : public Microbenchmark {
+ public:
+  RealignBenchmark(const std::string& name, const BenchInputs& inputs,
+		   const std::string& read, const bool& use_templates)
+    : Microbenchmark(name), inputs_(inputs), read_(read), use_templates_(use_templates) {}
+  void RunOnce() {
+    int32_t nCopy, start_pos, end_pos, score;
+    FlankMatchState fm_start, fm_end;
+    expansion_aware_realign(read_, inputs_.qual, inputs_.locus.pre_flank, inputs_.locus.post_flank,
+			    inputs_.locus.motif, BENCH_MIN_MATCH, &nCopy, &start_pos, &end_pos,
+			    &score, &fm_start, &fm_end,
+			    use_templates_ ? &inputs_.templates : NULL);
+    bench_sink += score;
+  }
+ private:
+  const BenchInputs& inputs_;
+  std::string read_;
+  bool use_templates_;
+};
+
+// Enclosing read against the template with the reference copy number
+class SSWBenchmark : public Microbenchmark {
+ public:
+  SSWBenchmark(const std::string& name, const BenchInputs& inputs, const bool& translated)
+    : Microbenchmark(name), inputs_(inputs), translated_(translated) {
+    ref_ = inputs.locus.pre_flank;
+    for (int32_t i = 0; i < BENCH_REF_COUNT; i++) {
+      ref_ += inputs.locus.motif;
+    }
+    ref_ += inputs.locus.post_flank;
+  }
+  void RunOnce() {
+    int32_t pos, pos_temp, score, mismatches;
+    if (translated_) {
+      striped_smith_waterman(inputs_.templates.Template(BENCH_REF_COUNT),
+			     inputs_.templates.TemplateLength(BENCH_REF_COUNT),
+			     inputs_.enclosing_read, &pos, &pos_temp, &score, &mismatches);
+    } else {
+      striped_smith_waterman(ref_, inputs_.enclosing_read, inputs_.qual,
+			     &pos, &pos_temp, &score, &mismatches);
+    }
+    bench_sink += score;
+  }
+ private:
+  const BenchInputs& inputs_;
+  bool translated_;
+  std::string ref_;
+};
+
+// Classification of an enclosing read, given its realignment
+class ClassifyBenchmark : public Microbenchmark {
+ public:
+  ClassifyBenchmark(const std::string& name, const BenchInputs& inputs)
+    : Microbenchmark(name), inputs_(inputs) {
+    expansion_aware_realign(inputs.enclosing_read, inputs.qual, inputs.locus.pre_flank,
+			    inputs.locus.post_flank, inputs.locus.motif, BENCH_MIN_MATCH,
+			    &nCopy_, &start_pos_, &end_pos_, &score_, &fm_start_, &fm_end_,
+			    &inputs.templates);
+  }
+  void RunOnce() {
+    SingleReadType srt;
+    classify_realigned_read(inputs_.enclosing_read, inputs_.locus.motif, start_pos_, end_pos_,
+			    nCopy_, score_, (int32_t) inputs_.locus.pre_flank.size(),
+			    BENCH_MIN_MATCH, true, inputs_.locus.pre_flank, inputs_.locus.post_flank,
+			    fm_start_, fm_end_, &srt);
+    bench_sink += srt;
+  }
+ private:
+  const BenchInputs& inputs_;
+  int32_t nCopy_, start_pos_, end_pos_, score_;
+  FlankMatchState fm_start_, fm_end_;
+};
+
+/*
+  Class log likelihood of one genotype, cycling through all genotypes of
+  BENCH_ALLELES. Cold runs clear the per-allele caches before each call,
+  as for the first genotypes of a locus; warm runs hit them, as during
+  the search and bootstrap.
+ */
+template<class ClassType>
+class ClassLikelihoodBenchmark : public Microbenchmark {
+ public:
+  ClassLikelihoodBenchmark(const std::string& name, const Options& options,
+			   const std::vector<int32_t>& data, const bool& cold)
+    : Microbenchmark(name), cold_(cold), index1_(0), index2_(0) {
+    read_class_.SetOptions(options);
+    for (size_t i = 0; i < data.size(); i++) {
+      read_class_.AddData(data[i]);
+    }
+  }
+  void RunOnce() {
+    if (cold_) {
+      read_class_.ClearCache();
+    }
+    double class_ll;
+    read_class_.GetClassLogLikelihood(BENCH_ALLELES[index1_], BENCH_ALLELES[index2_],
+				      BENCH_READ_LEN, BENCH_MOTIF_LEN, BENCH_REF_COUNT, 2, &class_ll);
+    bench_sink += class_ll;
+    NextGenotype();
+  }
+ private:
+  void NextGenotype() {
+    if (++index2_ == NUM_BENCH_ALLELES) {
+      index1_ = (index1_ + 1) % NUM_BENCH_ALLELES;
+      index2_ = index1_;
+    }
+  }
+  ClassType read_class_;
+  bool cold_;
+  int32_t index1_, index2_;
+};
+
+class FRRCountBenchmark : public Microbenchmark {
+ public:
+  FRRCountBenchmark(const std::string& name, const Options& options,
+		    const std::vector<int32_t>& data)
+    : Microbenchmark(name), index_(0) {
+    frr_class_.SetOptions(options);
+    for (size_t i = 0; i < data.size(); i++) {
+      frr_class_.AddData(data[i]);
+    }
+  }
+  void RunOnce() {
+    double count_ll;
+    frr_class_.GetCountLogLikelihood(BENCH_ALLELES[index_], BENCH_ALLELES[NUM_BENCH_ALLELES - 1],
+				     BENCH_READ_LEN, BENCH_MOTIF_LEN, BENCH_COVERAGE, 2, 0, &count_ll);
+    bench_sink += count_ll;
+    index_ = (index_ + 1) % NUM_BENCH_ALLELES;
+  }
+ private:
+  FRRClass frr_class_;
+  int32_t index_;
+};
+
+// Pairs of log values from equal to far apart, the latter cut short by LOG_THRESH
+class LogSumExpBenchmark : public Microbenchmark {
+ public:
+  explicit LogSumExpBenchmark(const std::string& name) : Microbenchmark(name), index_(0) {
+    for (int32_t i = 0; i < 1024; i++) {
+      values1_.push_back(-0.01 * i);
+      values2_.push_back(-0.03 * ((i * 37) % 1024));
+    }
+  }
+  void RunOnce() {
+    bench_sink += fast_log_sum_exp(values1_[index_], values2_[index_]);
+    index_ = (index_ + 1) & 1023;
+  }
+ private:
+  std::vector<double> values1_, values2_;
+  int32_t index_;
+};
+
+struct BenchResult {
+  int64_t iterations;
+  double ns_per_op;
+  double allocs_per_op;
+  double bytes_per_op;
+};
+
+/*
+  Double the number of calls until they take min_time seconds, after one
+  untimed call to fill caches and thread-local buffers
+ */
+BenchResult RunBenchmark(Microbenchmark* bench, const double& min_time) {
+  bench->RunOnce();
+  BenchResult result;
+  int64_t iterations = 1;
+  while (true) {
+    int64_t allocs = num_allocs;
+    int64_t bytes = num_alloc_bytes;
+    double start = LocusStats::Now();
+    for (int64_t i = 0; i < iterations; i++) {
+      bench->RunOnce();
+    }
+    double elapsed = LocusStats::Now() - start;
+    if (elapsed >= min_time || iterations >= ((int64_t) 1 << 40)) {
+      result.iterations = iterations;
+      result.ns_per_op = 1e9 * elapsed / iterations;
+      result.allocs_per_op = (double) (num_allocs - allocs) / iterations;
+      result.bytes_per_op = (double) (num_alloc_bytes - bytes) / iterations;
+      return result;
+    }
+    iterations *= 2;
+  }
+}
+
+// ns/op of each benchmark in an earlier output table
+void ReadBaseline(const std::string& path, std::map<std::string, double>* baseline) {
+  std::ifstream in(path.c_str());
+  if (!in.is_open()) {
+    PrintMessageDieOnError("Could not open baseline " + path, M_ERROR);
+  }
+  std::string line;
+  while (std::getline(in, line)) {
+    std::vector<std::string> items;
+    split_by_delim(line, '\t', items);
+    if (items.size() < 3 || items[0] == "benchmark" || line[0] == '#') {
+      continue;
+    }
+    (*baseline)[items[0]] = atof(items[2].c_str());
+  }
+}
+
+void show_help() {
+  std::stringstream help_msg;
+  help_msg << "\nUsage: kernel_benchmark [OPTIONS]\n\n"
+	   << "\t" << "--template <file.fa>          " << "\t" << "Reference with the test locus. Default: tests/test.fa" << "\n"
+	   << "\t" << "--min-time <float>            " << "\t" << "Seconds to run each benchmark for. Default: 0.5" << "\n"
+	   << "\t" << "--filter   <string>           " << "\t" << "Only run benchmarks whose name contains this" << "\n"
+	   << "\t" << "--baseline <file.tsv>         " << "\t" << "Output of an earlier run to compare against" << "\n"
+	   << "\n";
+  cerr << help_msg.str();
+  exit(1);
+}
+
+int main(int argc, char* argv[]) {
+  std::string template_fa = "tests/test.fa";
+  double min_time = 0.5;
+  std::string filter = "";
+  std::string baseline_file = "";
+
+  enum LONG_OPTIONS {
+    OPT_TEMPLATE,
+    OPT_MIN_TIME,
+    OPT_FILTER,
+    OPT_BASELINE,
+    OPT_HELP,
+  };
+  static struct option long_options[] = {
+    {"template", required_argument, NULL, OPT_TEMPLATE},
+    {"min-time", required_argument, NULL, OPT_MIN_TIME},
+    {"filter",   required_argument, NULL, OPT_FILTER},
+    {"baseline", required_argument, NULL, OPT_BASELINE},
+    {"help",     no_argument,       NULL, OPT_HELP},
+    {NULL,       no_argument,       NULL, 0},
+  };
+  int ch;
+  int option_index = 0;
+  while ((ch = getopt_long(argc, argv, "h", long_options, &option_index)) != -1) {
+    switch (ch) {
+    case OPT_TEMPLATE:
+      template_fa = optarg;
+      break;
+    case OPT_MIN_TIME:
+      min_time = atof(optarg);
+      break;
+    case OPT_FILTER:
+      filter = optarg;
+      break;
+    case OPT_BASELINE:
+      baseline_file = optarg;
+      break;
+    default:
+      show_help();
+    }
+  }
+  std::map<std::string, double> baseline;
+  if (!baseline_file.empty()) {
+    ReadBaseline(baseline_file, &baseline);
+  }
+
+  BenchInputs inputs;
+  inputs.options.read_len = BENCH_READ_LEN;
+  inputs.options.dist_mean = 400;
+  inputs.options.dist_sdev = 50;
+  inputs.options.dist_max = 550;
+  inputs.options.coverage = BENCH_COVERAGE;
+  RefGenome refgenome(template_fa);
+  inputs.locus.chrom = BENCH_TEMPLATE_CHROM;
+  inputs.locus.start = BENCH_TEMPLATE_START;
+  inputs.locus.end = BENCH_TEMPLATE_END;
+  inputs.locus.period = BENCH_MOTIF_LEN;
+  inputs.locus.motif = "cag";
+  refgenome.GetSequence(inputs.locus.chrom, BENCH_TEMPLATE_START - 1 - BENCH_READ_LEN,
+			BENCH_TEMPLATE_START - 2, &inputs.locus.pre_flank);
+  refgenome.GetSequence(inputs.locus.chrom, BENCH_TEMPLATE_END,
+			BENCH_TEMPLATE_END + BENCH_READ_LEN - 1, &inputs.locus.post_flank);
+  if ((int32_t) inputs.locus.pre_flank.size() != BENCH_READ_LEN ||
+      (int32_t) inputs.locus.post_flank.size() != BENCH_READ_LEN) {
+    PrintMessageDieOnError("Template locus of " + template_fa + " is too close to the chromosome ends", M_ERROR);
+  }
+  inputs.templates.Build(inputs.locus, BENCH_READ_LEN);
+  inputs.qual = std::string(BENCH_READ_LEN, 'I');
+  const std::string& motif = inputs.locus.motif;
+  std::string copies;
+  for (int32_t i = 0; i < BENCH_READ_LEN / BENCH_MOTIF_LEN; i++) {
+    copies += motif;
+  }
+  inputs.enclosing_read = inputs.locus.pre_flank.substr(BENCH_READ_LEN - 60)
+    + copies.substr(0, BENCH_REF_COUNT * BENCH_MOTIF_LEN) + inputs.locus.post_flank.substr(0, 60);
+  inputs.flanking_read = inputs.locus.pre_flank.substr(BENCH_READ_LEN - 75) + copies.substr(0, 75);
+  inputs.irr_read = copies;
+
+  // Read class data of a 10/50 genotype
+  std::vector<int32_t> enclosing_data, spanning_data, flanking_data, frr_data;
+  for (int32_t i = 0; i < 20; i++) {
+    enclosing_data.push_back(BENCH_REF_COUNT + (i % 7 == 0 ? 1 : 0));
+    spanning_data.push_back(400 + 5 * ((i * 7) % 21 - 10));
+    spanning_data.push_back(280 + 5 * ((i * 11) % 21 - 10));
+    flanking_data.push_back(1 + (i * 13) % 45);
+    frr_data.push_back((i * 17) % 100);
+  }
+
+  std::vector<Microbenchmark*> benchmarks;
+  benchmarks.push_back(new RealignBenchmark("expansion_aware_realign/enclosing", inputs, inputs.enclosing_read, true));
+  benchmarks.push_back(new RealignBenchmark("expansion_aware_realign/flanking", inputs, inputs.flanking_read, true));
+  benchmarks.push_back(new RealignBenchmark("expansion_aware_realign/irr", inputs, inputs.irr_read, true));
+  benchmarks.push_back(new RealignBenchmark("expansion_aware_realign/enclosing_no_templates", inputs, inputs.enclosing_read, false));
+  benchmarks.push_back(new SSWBenchmark("striped_smith_waterman/string", inputs, false));
+  benchmarks.push_back(new SSWBenchmark("striped_smith_waterman/translated", inputs, true));
+  benchmarks.push_back(new ClassifyBenchmark("classify_realigned_read/enclosing", inputs));
+  for (int cold = 0; cold < 2; cold++) {
+    std::string suffix = (cold ? "/cold" : "/warm");
+    benchmarks.push_back(new ClassLikelihoodBenchmark<EnclosingClass>("EnclosingClass::GetClassLogLikelihood" + suffix, inputs.options, enclosing_data, cold));
+    benchmarks.push_back(new ClassLikelihoodBenchmark<SpanningClass>("SpanningClass::GetClassLogLikelihood" + suffix, inputs.options, spanning_data, cold));
+    benchmarks.push_back(new ClassLikelihoodBenchmark<FlankingClass>("FlankingClass::GetClassLogLikelihood" + suffix, inputs.options, flanking_data, cold));
+    benchmarks.push_back(new ClassLikelihoodBenchmark<FRRClass>("FRRClass::GetClassLogLikelihood" + suffix, inputs.options, frr_data, cold));
+  }
+  benchmarks.push_back(new FRRCountBenchmark("FRRClass::GetCountLogLikelihood", inputs.options, frr_data));
+  benchmarks.push_back(new LogSumExpBenchmark("fast_log_sum_exp"));
+
+  cout << "#kernel_benchmark version=" << _GIT_VERSION << " min_time=" << min_time << endl;
+  cout << "benchmark\titerations\tns_per_op\tallocs_per_op\tbytes_per_op";
+  if (!baseline.empty()) {
+    cout << "\tbaseline_ns_per_op\tspeedup";
+  }
+  cout << endl;
+  for (size_t i = 0; i < benchmarks.size(); i++) {
+    if (benchmarks[i]->name().find(filter) == std::string::npos) {
+      delete benchmarks[i];
+      continue;
+    }
+    BenchResult result = RunBenchmark(benchmarks[i], min_time);
+    cout << benchmarks[i]->name() << "\t" << result.iterations << "\t" << result.ns_per_op
+	 << "\t" << result.allocs_per_op << "\t" << result.bytes_per_op;
+    if (!baseline.empty()) {
+      std::map<std::string, double>::const_iterator it = baseline.find(benchmarks[i]->name());
+      if (it == baseline.end()) {
+	cout << "\t.\t.";
+      } else {
+	cout << "\t" << it->second << "\t" << it->second / result.ns_per_op;
+      }
+    }
+    cout << endl;
+    delete benchmarks[i];
+  }
+  return 0;
+}
@@ -0,0 +1,189 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Compare the NLopt and discrete genotype search engines.
+
+  Read data is simulated for a grid of true genotypes with a fixed seed,
+  and each engine genotypes the same data. Output is a tab separated table
+  on stdout with the called genotype, its negative log likelihood, the
+  number of objective calls and the number of distinct likelihood
+  evaluations (genotype cache misses) for each engine. The discrete
+  engine also evaluates range bounds, each about as costly as a
+  likelihood evaluation, and read log likelihoods of the window alleles,
+  about half as costly per allele. work adds these up in likelihood
+  evaluations, and the last lines give the totals of each engine.
+
+  With num_boot_samp > 0, the bootstrap confidence interval of each call
+  is computed as well and counted with it.
+
+  Usage: optimizer_benchmark [reads_per_allele] [num_boot_samp]
+ */
+
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <iostream>
+#include <vector>
+
+#include "gsl/gsl_randist.h"
+#include "gsl/gsl_rng.h"
+#include "src/likelihood_maximizer.h"
+#include "src/options.h"
+#include "src/stats.h"
+
+using namespace std;
+
+const int32_t BENCH_READ_LEN = 150;
+const int32_t BENCH_MOTIF_LEN = 3;
+const int32_t BENCH_REF_COUNT = 20;
+const int32_t BENCH_MIN_MATCH = 5;
+
+double GetTimeSeconds() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/*
+  Add reads_per_allele simulated reads for each allele of <allele1, allele2>.
+  Reads are enclosing or spanning when the repeat fits in a read, and
+  flanking, spanning or FRR otherwise.
+ */
+void SimulateReads(const Options& options, gsl_rng* r,
+		   const int32_t& allele1, const int32_t& allele2,
+		   const int32_t& reads_per_allele, LikelihoodMaximizer* lm) {
+  int32_t alleles[2] = {allele1, allele2};
+  for (int i = 0; i < 2; i++) {
+    int32_t allele = alleles[i];
+    int32_t str_len = allele * BENCH_MOTIF_LEN;
+    double span_mean = options.dist_mean - BENCH_MOTIF_LEN * (allele - BENCH_REF_COUNT);
+    for (int32_t j = 0; j < reads_per_allele; j++) {
+      double u = gsl_rng_uniform(r);
+      if (str_len + 2 * BENCH_MIN_MATCH <= BENCH_READ_LEN) {
+	if (u < 0.5) {
+	  // Occasional stutter error
+	  double s = gsl_rng_uniform(r);
+	  lm->AddEnclosingData(allele + (s < 0.03 ? 1 : (s < 0.06 ? -1 : 0)));
+	}
+	else {
+	  lm->AddSpanningData(int32_t(span_mean + gsl_ran_gaussian(r, options.dist_sdev)));
+	}
+      }
+      else {
+	int32_t max_flank = BENCH_READ_LEN / BENCH_MOTIF_LEN - 1;
+	if (u < 0.4 || str_len < BENCH_READ_LEN) {
+	  lm->AddFlankingData(1 + gsl_rng_uniform_int(r, max_flank));
+	}
+	else if (u < 0.6 && span_mean > 2 * BENCH_READ_LEN) {
+	  lm->AddSpanningData(int32_t(span_mean + gsl_ran_gaussian(r, options.dist_sdev)));
+	}
+	else {
+	  lm->AddFRRData(gsl_rng_uniform_int(r, str_len - BENCH_READ_LEN + 1));
+	}
+      }
+    }
+  }
+}
+
+// Cost of the counted evaluations, in likelihood evaluations
+double Work(const LocusStats& stats) {
+  return stats.counts[STATS_LIKELIHOOD_EVALS] + stats.counts[STATS_DISCRETE_BOUND_EVALS] +
+    0.5 * stats.counts[STATS_DISCRETE_TABLE_ALLELES];
+}
+
+int main(int argc, char* argv[]) {
+  int32_t reads_per_allele = 20;
+  int32_t num_boot_samp = 0;
+  if (argc > 1) {
+    reads_per_allele = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    num_boot_samp = atoi(argv[2]);
+  }
+  Options options;
+  options.dist_mean = 400;
+  options.dist_sdev = 50;
+  options.read_len = BENCH_READ_LEN;
+  options.coverage = 2.0 * reads_per_allele;
+  options.num_boot_samp = num_boot_samp;
+
+  const char* engines[2] = {"nlopt", "discrete"};
+  int32_t test_alleles[] = {5, 12, 20, 35, 48, 70, 120, 200};
+  int32_t num_test_alleles = sizeof(test_alleles) / sizeof(test_alleles[0]);
+
+  cout << "true_allele1\ttrue_allele2\toptimizer\tallele1\tallele2\tneg_ll"
+       << "\tobjective_calls\tlikelihood_evals\tbound_evals\ttable_alleles\twork\tseconds"
+       << endl;
+  LocusStats totals[2];
+  double total_seconds[2] = {0, 0};
+  for (int32_t i = 0; i < num_test_alleles; i++) {
+    for (int32_t j = i; j < num_test_alleles; j++) {
+      for (int e = 0; e < 2; e++) {
+	options.optimizer = engines[e];
+	LikelihoodMaximizer lm(options);
+	lm.Reset();
+	// Same seed for both engines, so they see the same reads
+	gsl_rng* r = gsl_rng_alloc(gsl_rng_default);
+	gsl_rng_set(r, options.seed + 1000 * i + j);
+	SimulateReads(options, r, test_alleles[i], test_alleles[j], reads_per_allele, &lm);
+	gsl_rng_free(r);
+
+	int32_t allele1, allele2;
+	double min_negLike;
+	LocusStats stats;
+	double start = GetTimeSeconds();
+	{
+	  STATS_SCOPE(&stats);
+	  lm.OptimizeLikelihood(BENCH_READ_LEN, BENCH_MOTIF_LEN, BENCH_REF_COUNT,
+				false, 2, 0, 0.0, &allele1, &allele2, &min_negLike);
+	  if (num_boot_samp > 0) {
+	    Locus locus;
+	    double lob1, hib1, lob2, hib2;
+	    int32_t num_replicates;
+	    lm.GetConfidenceInterval(BENCH_READ_LEN, BENCH_MOTIF_LEN, BENCH_REF_COUNT,
+				     allele1, allele2, locus,
+				     &lob1, &hib1, &lob2, &hib2, &num_replicates);
+	  }
+	}
+	double elapsed = GetTimeSeconds() - start;
+	int64_t hits, misses;
+	lm.GetGenotypeCacheStats(&hits, &misses);
+	totals[e].Add(stats);
+	total_seconds[e] += elapsed;
+	cout << test_alleles[i] << "\t" << test_alleles[j] << "\t" << engines[e] << "\t"
+	     << allele1 << "\t" << allele2 << "\t" << min_negLike << "\t"
+	     << hits + misses << "\t" << misses << "\t"
+	     << stats.counts[STATS_DISCRETE_BOUND_EVALS] << "\t"
+	     << stats.counts[STATS_DISCRETE_TABLE_ALLELES] << "\t"
+	     << Work(stats) << "\t" << elapsed << endl;
+      }
+    }
+  }
+  for (int e = 0; e < 2; e++) {
+    cout << "#" << engines[e]
+	 << " likelihood_evals=" << totals[e].counts[STATS_LIKELIHOOD_EVALS]
+	 << " bound_evals=" << totals[e].counts[STATS_DISCRETE_BOUND_EVALS]
+	 << " table_alleles=" << totals[e].counts[STATS_DISCRETE_TABLE_ALLELES]
+	 << " work=" << Work(totals[e])
+	 << " seconds=" << total_seconds[e] << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,261 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "htslib/faidx.h"
+#include "htslib/sam.h"
+#include "gsl/gsl_randist.h"
+#include "src/benchmarks/read_simulator.h"
+#include "src/stringops.h"
+
+using namespace std;
+
+namespace {
+const char SIM_BASES[] = "ACGT";
+
+// SAM record with its position, for sorting by coordinate
+typedef std::pair<int32_t, std::string> SamRecord;
+
+bool SamRecordLess(const SamRecord& a, const SamRecord& b) {
+  return a.first < b.first;
+}
+
+// FNV-1a hash, to seed each locus independently of the others
+uint32_t HashString(const std::string& s) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < s.size(); i++) {
+    hash ^= (unsigned char) s[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+}  // namespace
+
+ReadSimulator::ReadSimulator(const int32_t& read_len, const double& dist_mean,
+			     const double& dist_sdev, const uint32_t& seed) {
+  read_len_ = read_len;
+  dist_mean_ = dist_mean;
+  dist_sdev_ = dist_sdev;
+  seed_ = seed;
+  // Fixed generator type, so GSL_RNG_TYPE does not change the data
+  rng_ = gsl_rng_alloc(gsl_rng_mt19937);
+  gsl_rng_set(rng_, seed_);
+}
+
+bool ReadSimulator::LoadTemplate(const std::string& template_fa, const std::string& chrom,
+				 const int32_t& rep_start, const int32_t& rep_end) {
+  faidx_t* fai = fai_load(template_fa.c_str());
+  if (fai == NULL) {
+    return false;
+  }
+  int32_t chrom_len = faidx_seq_len(fai, chrom.c_str());
+  if (chrom_len < 0 || rep_start < 2 || rep_end >= chrom_len || rep_end < rep_start) {
+    fai_destroy(fai);
+    return false;
+  }
+  int len;
+  char* left = faidx_fetch_seq(fai, chrom.c_str(), 0, rep_start - 2, &len);
+  std::string left_bases = uppercase(std::string(left, len));
+  free(left);
+  char* right = faidx_fetch_seq(fai, chrom.c_str(), rep_end, chrom_len - 1, &len);
+  std::string right_bases = uppercase(std::string(right, len));
+  free(right);
+  fai_destroy(fai);
+
+  if (left_bases.size() > (size_t) SIM_FLANK_LEN) {
+    left_bases = left_bases.substr(left_bases.size() - SIM_FLANK_LEN);
+  }
+  if (right_bases.size() > (size_t) SIM_FLANK_LEN) {
+    right_bases = right_bases.substr(0, SIM_FLANK_LEN);
+  }
+  gsl_rng_set(rng_, seed_);
+  left_flank_ = RandomBases(SIM_FLANK_LEN - left_bases.size()) + left_bases;
+  right_flank_ = right_bases + RandomBases(SIM_FLANK_LEN - right_bases.size());
+  return true;
+}
+
+std::string ReadSimulator::RandomBases(const int32_t& length) {
+  std::string bases(length, 'N');
+  for (int32_t i = 0; i < length; i++) {
+    bases[i] = SIM_BASES[gsl_rng_uniform_int(rng_, 4)];
+  }
+  return bases;
+}
+
+std::string ReadSimulator::AddErrors(const std::string& seq) {
+  std::string read = seq;
+  for (size_t i = 0; i < read.size(); i++) {
+    if (gsl_rng_uniform(rng_) < SIM_ERROR_RATE) {
+      // Any base but the true one
+      const char* true_base = strchr(SIM_BASES, read[i]);
+      int32_t offset = 1 + gsl_rng_uniform_int(rng_, 3);
+      int32_t index = (true_base == NULL ? 0 : true_base - SIM_BASES);
+      read[i] = SIM_BASES[(index + offset) % 4];
+    }
+  }
+  return read;
+}
+
+int32_t ReadSimulator::MapPosition(const int32_t& hap_pos, const int32_t& hap_rep_len,
+				   const int32_t& ref_rep_len) const {
+  int32_t flank_len = left_flank_.size();
+  if (hap_pos < flank_len) {
+    return hap_pos;
+  }
+  if (hap_pos < flank_len + hap_rep_len) {
+    return flank_len + std::min(hap_pos - flank_len, ref_rep_len);
+  }
+  return hap_pos - hap_rep_len + ref_rep_len;
+}
+
+void ReadSimulator::BuildReference(SimulatedLocus* locus, std::string* refseq) {
+  std::string motif = uppercase(locus->motif);
+  refseq->assign(left_flank_);
+  for (int32_t i = 0; i < locus->ref_count; i++) {
+    refseq->append(motif);
+  }
+  refseq->append(right_flank_);
+  locus->start = left_flank_.size() + 1;
+  locus->end = left_flank_.size() + locus->ref_count * motif.size();
+}
+
+void ReadSimulator::SimulatePairs(const SimulatedLocus& locus, std::vector<SimulatedPair>* pairs) {
+  pairs->clear();
+  std::string motif = uppercase(locus.motif);
+  std::stringstream key;
+  key << motif << ":" << locus.ref_count << ":" << locus.allele1 << ":"
+      << locus.allele2 << ":" << locus.depth;
+  gsl_rng_set(rng_, seed_ ^ HashString(key.str()));
+
+  int32_t ref_rep_len = locus.ref_count * motif.size();
+  int32_t alleles[2] = {locus.allele1, locus.allele2};
+  for (int i = 0; i < 2; i++) {
+    std::string hap = left_flank_;
+    for (int32_t j = 0; j < alleles[i]; j++) {
+      hap.append(motif);
+    }
+    hap.append(right_flank_);
+    int32_t hap_len = hap.size();
+    int32_t hap_rep_len = alleles[i] * motif.size();
+    // Each allele gets half the coverage
+    int64_t num_pairs = (int64_t) (0.5 * locus.depth * hap_len / (2 * read_len_) + 0.5);
+    for (int64_t j = 0; j < num_pairs; j++) {
+      int32_t frag_len = (int32_t) (dist_mean_ + gsl_ran_gaussian(rng_, dist_sdev_) + 0.5);
+      frag_len = std::max(read_len_, std::min(frag_len, hap_len));
+      int32_t frag_start = gsl_rng_uniform_int(rng_, hap_len - frag_len + 1);
+      int32_t mate_start = frag_start + frag_len - read_len_;
+      SimulatedPair pair;
+      std::stringstream name;
+      name << locus.chrom << "_" << i << "_" << j;
+      pair.name = name.str();
+      pair.seq1 = AddErrors(hap.substr(frag_start, read_len_));
+      pair.seq2 = AddErrors(hap.substr(mate_start, read_len_));
+      pair.pos1 = MapPosition(frag_start, hap_rep_len, ref_rep_len);
+      pair.pos2 = MapPosition(mate_start, hap_rep_len, ref_rep_len);
+      pair.reverse1 = (gsl_rng_uniform(rng_) < 0.5);
+      pairs->push_back(pair);
+    }
+  }
+}
+
+bool ReadSimulator::WriteLocus(SimulatedLocus* locus, const std::string& prefix) {
+  std::string refseq;
+  BuildReference(locus, &refseq);
+  std::string fasta = prefix + ".fa";
+  std::ofstream fasta_out(fasta.c_str());
+  fasta_out << ">" << locus->chrom << "\n";
+  for (size_t i = 0; i < refseq.size(); i += 60) {
+    fasta_out << refseq.substr(i, 60) << "\n";
+  }
+  fasta_out.close();
+  if (!fasta_out || fai_build(fasta.c_str()) != 0) {
+    return false;
+  }
+
+  std::vector<SimulatedPair> pairs;
+  SimulatePairs(*locus, &pairs);
+  std::vector<SamRecord> records;
+  std::string qual(read_len_, 'I');
+  for (size_t i = 0; i < pairs.size(); i++) {
+    const SimulatedPair& pair = pairs[i];
+    // The left read is on the forward strand, its mate on the reverse
+    int32_t tlen = pair.pos2 + read_len_ - pair.pos1;
+    int left_flag = (pair.reverse1 ? 163 : 99);
+    int right_flag = (pair.reverse1 ? 83 : 147);
+    std::stringstream left;
+    left << pair.name << "\t" << left_flag << "\t" << locus->chrom << "\t" << pair.pos1 + 1
+	 << "\t60\t" << read_len_ << "M\t=\t" << pair.pos2 + 1 << "\t" << tlen
+	 << "\t" << pair.seq1 << "\t" << qual << "\n";
+    records.push_back(SamRecord(pair.pos1, left.str()));
+    std::stringstream right;
+    right << pair.name << "\t" << right_flag << "\t" << locus->chrom << "\t" << pair.pos2 + 1
+	  << "\t60\t" << read_len_ << "M\t=\t" << pair.pos1 + 1 << "\t" << -tlen
+	  << "\t" << pair.seq2 << "\t" << qual << "\n";
+    records.push_back(SamRecord(pair.pos2, right.str()));
+  }
+  std::stable_sort(records.begin(), records.end(), SamRecordLess);
+
+  // Write SAM text, then let htslib convert it to an indexed BAM
+  std::string sam = prefix + ".sam";
+  std::ofstream sam_out(sam.c_str());
+  sam_out << "@HD\tVN:1.4\tSO:coordinate\n"
+	  << "@SQ\tSN:" << locus->chrom << "\tLN:" << refseq.size() << "\n";
+  for (size_t i = 0; i < records.size(); i++) {
+    sam_out << records[i].second;
+  }
+  sam_out.close();
+  if (!sam_out) {
+    return false;
+  }
+
+  std::string bam = prefix + ".bam";
+  samFile* in = sam_open(sam.c_str(), "r");
+  if (in == NULL) {
+    return false;
+  }
+  bam_hdr_t* header = sam_hdr_read(in);
+  samFile* out = sam_open(bam.c_str(), "wb");
+  bool success = (header != NULL && out != NULL && sam_hdr_write(out, header) == 0);
+  bam1_t* aln = bam_init1();
+  while (success && sam_read1(in, header, aln) >= 0) {
+    success = (sam_write1(out, header, aln) >= 0);
+  }
+  bam_destroy1(aln);
+  if (header != NULL) {
+    bam_hdr_destroy(header);
+  }
+  sam_close(in);
+  if (out != NULL && sam_close(out) != 0) {
+    success = false;
+  }
+  remove(sam.c_str());
+  return success && sam_index_build(bam.c_str(), 0) == 0;
+}
+
+ReadSimulator::~ReadSimulator() {
+  gsl_rng_free(rng_);
+}
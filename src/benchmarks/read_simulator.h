@@ -0,0 +1,111 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SRC_BENCHMARKS_READ_SIMULATOR_H__
+#define SRC_BENCHMARKS_READ_SIMULATOR_H__
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "gsl/gsl_rng.h"
+
+// Flank length on each side of the simulated repeat
+const int32_t SIM_FLANK_LEN = 3000;
+// Per base substitution error rate of simulated reads
+const double SIM_ERROR_RATE = 0.001;
+
+// A simulated diploid sample at one STR
+struct SimulatedLocus {
+  std::string chrom;
+  std::string motif;
+  int32_t ref_count;
+  int32_t allele1;
+  int32_t allele2;
+  double depth;
+  int32_t start;   // 1-based repeat start on chrom, set by BuildReference
+  int32_t end;     // 1-based repeat end on chrom, set by BuildReference
+};
+
+// A simulated read pair. Bases are on the reference forward strand and
+// positions are 0-based on the reference, as they would be in a BAM
+struct SimulatedPair {
+  std::string name;
+  std::string seq1;
+  std::string seq2;
+  int32_t pos1;
+  int32_t pos2;
+  bool reverse1;   // Read 1 on the reverse strand (read 2 on the forward)
+};
+
+/*
+  Deterministic paired-end read simulator for benchmarks.
+
+  Flanks come from a template FASTA with a known repeat: the bases left
+  and right of the template repeat sit next to the simulated repeat, and
+  are padded out to SIM_FLANK_LEN with random bases. Fragments are drawn
+  uniformly from each haplotype with normally distributed lengths, so
+  enclosing, spanning, flanking and fully repetitive reads all occur in
+  their natural proportions. Reads are mapped back to the reference
+  without gaps; reads starting inside an expansion are placed at the
+  reference repeat, as an aligner would. Output only depends on the seed.
+ */
+class ReadSimulator {
+ public:
+  ReadSimulator(const int32_t& read_len, const double& dist_mean,
+		const double& dist_sdev, const uint32_t& seed);
+  virtual ~ReadSimulator();
+
+  // Take flanks from chrom of template_fa, around the repeat
+  // at rep_start..rep_end (1-based, inclusive)
+  bool LoadTemplate(const std::string& template_fa, const std::string& chrom,
+		    const int32_t& rep_start, const int32_t& rep_end);
+  // Reference sequence of the locus. Sets locus->start and locus->end
+  void BuildReference(SimulatedLocus* locus, std::string* refseq);
+  // Read pairs for locus->depth coverage, half from each allele
+  void SimulatePairs(const SimulatedLocus& locus, std::vector<SimulatedPair>* pairs);
+  // Write <prefix>.fa and a coordinate sorted <prefix>.bam with indexes.
+  // Sets locus->start and locus->end
+  bool WriteLocus(SimulatedLocus* locus, const std::string& prefix);
+
+ private:
+  // Private unimplemented copy constructor and assignment operator to prevent operations
+  ReadSimulator(const ReadSimulator& other);
+  ReadSimulator& operator=(const ReadSimulator& other);
+
+  std::string RandomBases(const int32_t& length);
+  // Copy of seq with substitution errors
+  std::string AddErrors(const std::string& seq);
+  // Reference position of haplotype position hap_pos, for a haplotype
+  // whose repeat is hap_rep_len long instead of ref_rep_len
+  int32_t MapPosition(const int32_t& hap_pos, const int32_t& hap_rep_len,
+		      const int32_t& ref_rep_len) const;
+
+  int32_t read_len_;
+  double dist_mean_;
+  double dist_sdev_;
+  std::string left_flank_;
+  std::string right_flank_;
+  uint32_t seed_;
+  gsl_rng* rng_;
+};
+
+#endif  // SRC_BENCHMARKS_READ_SIMULATOR_H__
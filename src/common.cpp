@@ -19,15 +19,54 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include <err.h>
+#include <pthread.h>
 #include <stdlib.h>
 
 #include <iostream>
 #include <sstream>
+#include <utility>
 
 #include "src/common.h"
 
 using namespace std;
 
+namespace {
+pthread_mutex_t error_hooks_mutex = PTHREAD_MUTEX_INITIALIZER;
+std::vector<std::pair<ErrorHook, void*> > error_hooks;
+// Set while a thread runs the hooks, so an error raised by a hook exits
+// at once instead of running them again
+__thread bool in_error_hooks = false;
+
+void RunErrorHooks() {
+  if (in_error_hooks) {
+    return;
+  }
+  in_error_hooks = true;
+  // Held until exit, so hooks run once even if several threads fail
+  pthread_mutex_lock(&error_hooks_mutex);
+  for (size_t i = error_hooks.size(); i > 0; i--) {
+    error_hooks[i-1].first(error_hooks[i-1].second);
+  }
+}
+}  // namespace
+
+void AddErrorHook(ErrorHook hook, void* data) {
+  pthread_mutex_lock(&error_hooks_mutex);
+  error_hooks.push_back(std::make_pair(hook, data));
+  pthread_mutex_unlock(&error_hooks_mutex);
+}
+
+void RemoveErrorHook(ErrorHook hook, void* data) {
+  pthread_mutex_lock(&error_hooks_mutex);
+  for (size_t i = 0; i < error_hooks.size(); i++) {
+    if (error_hooks[i].first == hook && error_hooks[i].second == data) {
+      error_hooks.erase(error_hooks.begin() + i);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&error_hooks_mutex);
+}
+
 void PrintMessageDieOnError(const string& msg, MSGTYPE msgtype) {
   string typestring = "";
   switch (msgtype) {
@@ -52,6 +91,7 @@ void PrintMessageDieOnError(const string& msg, MSGTYPE msgtype) {
   cerr << ss.str();
 
   if (msgtype == M_ERROR) {
+    RunErrorHooks();
     exit(1);
   }
 }
@@ -34,4 +34,10 @@ enum MSGTYPE {
 void PrintMessageDieOnError(const std::string& msg,
                             MSGTYPE msgtype);
 
+// Called by PrintMessageDieOnError on M_ERROR before exiting, so buffered
+// output can be written out. Hooks run in reverse order of registration
+typedef void (*ErrorHook)(void* data);
+void AddErrorHook(ErrorHook hook, void* data);
+void RemoveErrorHook(ErrorHook hook, void* data);
+
 #endif  // SRC_COMMON_H__
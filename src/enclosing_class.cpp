@@ -82,28 +82,17 @@ bool EnclosingClass::GetLogReadProb(const int32_t& allele,
 }
 
 bool EnclosingClass::ExtractEnclosingAlleles(std::vector<int> *alleles){
-    std::map<int32_t, int32_t> allele_repeats;
-
-	for (std::vector<int32_t>::iterator data_it = this->read_class_data_.begin();
-       data_it != this->read_class_data_.end();
-       data_it++) {
-       	if (allele_repeats.find(*data_it) == allele_repeats.end()){
-       		allele_repeats[*data_it] = 1;
-       	}
-       	else{
-       		allele_repeats[*data_it]++;
-       	}
-  	}
-	// Now refill read_class_data_ only with repeated enclosing reads
-	read_class_data_.clear();
-  	for (map<int32_t, int32_t>::iterator it = allele_repeats.begin(); it != allele_repeats.end(); it++){
-  		if (it->second >= 2){
-		    (*alleles).push_back(it->first);
-  		    //cerr << it->first << "\t" << it -> second << endl;
-		    for (int i = 0; i < it->second; i++){
-		      read_class_data_.push_back(it->first);
-		    }
-  		}
-  	}
+	// Keep only repeated enclosing reads
+	std::map<int32_t, int32_t>::iterator it = read_class_data_.begin();
+	while (it != read_class_data_.end()){
+		if (it->second >= 2){
+			(*alleles).push_back(it->first);
+			it++;
+		}
+		else{
+			data_size_ -= it->second;
+			read_class_data_.erase(it++);
+		}
+	}
 	return true;	//TODO add false
 }
@@ -40,7 +40,7 @@ bool FlankingClass::GetAlleleLogLikelihood(const int32_t& allele,
 	int32_t max_nCopy = int32_t(read_len / motif_len);
 	int32_t str_len = allele * motif_len;
 	if (max_nCopy == data) max_nCopy++;
-	if (read_class_data_.size() == 0){
+	if (data_size_ == 0){
 	  *allele_ll = NEG_INF;
 	  return true;
 	}
@@ -56,7 +56,7 @@ bool FlankingClass::GetAlleleLogLikelihood(const int32_t& allele,
 	}
 	    
 	if (allele >= data && data > 0){
-	  //likelihood = 1.0 / (max_nCopy - data) * 1.0 / read_class_data_.size();
+	  //likelihood = 1.0 / (max_nCopy - data) * 1.0 / data_size_;
 	  if (str_len > read_len){
 	    likelihood = double(read_len) / double(2 * flank_len + str_len - 2 * read_len) 
 	      * 1.0 / (allele); // Class prob * read_prob
@@ -79,6 +79,15 @@ bool FlankingClass::GetAlleleLogLikelihood(const int32_t& allele,
 }
 
 
+bool FlankingClass::GetDataLogLikelihood(const int32_t& allele,
+					 const int32_t& data,
+					 const int32_t& read_len,
+					 const int32_t& motif_len,
+					 const int32_t& ref_count,
+					 double* allele_ll){
+  return FlankingClass::GetAlleleLogLikelihood(allele, data, read_len, motif_len, ref_count, allele_ll);
+}
+
 bool FlankingClass::GetClassLogLikelihood(const int32_t& allele1,
 				      const int32_t& allele2,
 				      const int32_t& read_len, const int32_t& motif_len,
@@ -86,20 +95,20 @@ bool FlankingClass::GetClassLogLikelihood(const int32_t& allele1,
 				      double* class_ll) {
   *class_ll = 0;
   double samp_log_likelihood, a1_ll, a2_ll;
-  for (std::vector<int32_t>::iterator data_it = read_class_data_.begin();
+  for (std::map<int32_t, int32_t>::iterator data_it = read_class_data_.begin();
        data_it != read_class_data_.end();
        data_it++) {
-    if (!FlankingClass::GetAlleleLogLikelihood(allele1, *data_it, read_len, motif_len, ref_count, &a1_ll)) {
+    if (!FlankingClass::GetAlleleLogLikelihood(allele1, data_it->first, read_len, motif_len, ref_count, &a1_ll)) {
       return false;
     }
-    if (!FlankingClass::GetAlleleLogLikelihood(allele2, *data_it, read_len, motif_len, ref_count, &a2_ll)) {
+    if (!FlankingClass::GetAlleleLogLikelihood(allele2, data_it->first, read_len, motif_len, ref_count, &a2_ll)) {
       return false;
     }
     if (ploidy == 2){
-      *class_ll += fast_log_sum_exp(log(allele1_weight_)+a1_ll, log(allele2_weight_)+a2_ll);
+      *class_ll += data_it->second * fast_log_sum_exp(log(allele1_weight_)+a1_ll, log(allele2_weight_)+a2_ll);
   	}
     else if (ploidy == 1){
-      *class_ll += log(allele1_weight_) + a1_ll;
+      *class_ll += data_it->second * (log(allele1_weight_) + a1_ll);
     }
   }
   return true;
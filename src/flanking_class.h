@@ -38,6 +38,13 @@ class FlankingClass: public ReadClass {
 				   const int32_t& ref_count,
 				   double* allele_ll);
 
+	bool GetDataLogLikelihood(const int32_t& allele,
+				  const int32_t& data,
+				  const int32_t& read_len,
+				  const int32_t& motif_len,
+				  const int32_t& ref_count,
+				  double* allele_ll);
+
 	bool GetClassLogLikelihood(const int32_t& allele1,
 				      const int32_t& allele2,
 				      const int32_t& read_len, const int32_t& motif_len,
@@ -22,6 +22,7 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 #include "src/frr_class.h"
 
 #include <math.h>
+#include <algorithm>
 #include <gsl/gsl_math.h>
 #include <gsl/gsl_rng.h>
 #include <gsl/gsl_randist.h>
@@ -30,6 +31,32 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 
 using namespace std;
 
+double FRRClass::GetNormConst(const int32_t& allele,
+			      const int32_t& read_len, const int32_t& motif_len) {
+	if (norm_const_cache_.empty() ||
+	    read_len != norm_read_len_ || motif_len != norm_motif_len_){
+		norm_const_cache_.clear();
+		norm_read_len_ = read_len;
+		norm_motif_len_ = motif_len;
+	}
+	std::map<int32_t, double>::iterator it = norm_const_cache_.find(allele);
+	if (it != norm_const_cache_.end()){
+		return it->second;
+	}
+	int str_len = allele * motif_len;
+	double norm_const = gsl_cdf_gaussian_P(2 * flank_len + str_len - dist_mean, dist_sdev) -
+						gsl_cdf_gaussian_P(2 * read_len - dist_mean, dist_sdev); 
+	norm_const_cache_[allele] = norm_const;
+	return norm_const;
+}
+
+void FRRClass::ClearCache() {
+	ReadClass::ClearCache();
+	norm_const_cache_.clear();
+	norm_read_len_ = -1;
+	norm_motif_len_ = -1;
+}
+
 bool FRRClass::GetLogClassProb(const int32_t& allele,
 			       const int32_t& read_len, const int32_t& motif_len,
 			       double* log_class_prob) {
@@ -40,8 +67,7 @@ bool FRRClass::GetLogClassProb(const int32_t& allele,
 		return true;
 	}
 	// Compute normalization constant norm_const
-	double norm_const = gsl_cdf_gaussian_P(2 * flank_len + str_len - dist_mean, dist_sdev) -
-						gsl_cdf_gaussian_P(2 * read_len - dist_mean, dist_sdev); 
+	double norm_const = GetNormConst(allele, read_len, motif_len);
 	if (norm_const == 0 or
 	    (2.0 * flank_len + str_len - 2.0 * read_len) == 0){
 	  cerr << "FRRClassProb::Divide by Zero prevented!" << endl;
@@ -90,8 +116,7 @@ bool FRRClass::GetLogReadProb(const int32_t& allele,
 	}
 
 	// Compute normalization constant norm_const
-	double norm_const = gsl_cdf_gaussian_P(2 * flank_len + str_len - dist_mean, dist_sdev) -
-						gsl_cdf_gaussian_P(2 * read_len - dist_mean, dist_sdev); 
+	double norm_const = GetNormConst(allele, read_len, motif_len);
 
 	double term1 = gsl_cdf_gaussian_P(read_len + data + str_len - dist_mean, dist_sdev) - 
 			gsl_cdf_gaussian_P(2 * read_len + data - dist_mean, dist_sdev);
@@ -112,6 +137,31 @@ bool FRRClass::GetLogReadProb(const int32_t& allele,
 		return false;
 }
 
+double FRRClass::GetExpectedCount(const int32_t& allele, const int32_t& read_len,
+				  const int32_t& motif_len, const double& coverage) {
+  double frr_thresh = double(read_len) / double(motif_len);
+  if (allele < frr_thresh) {
+    return 0;
+  }
+  return coverage / 2.0 / double(read_len) * double(allele * motif_len - read_len);
+}
+
+double FRRClass::GetPoissonLogLikelihood(const int32_t& frr_count, const double& lambda) {
+  //    *count_ll = log(pow(lambda, frr_count) * exp(-lambda) / tgamma(frr_count + 1));
+  if (frr_count < 10){
+    return frr_count * log(lambda) - lambda - log(tgamma(frr_count + 1));
+  }
+  // Approx for log of factorial by Srinivasa Ramanujan
+  double n = frr_count;
+  //double log_fact = n * log(n) - n + 
+  //log(n * (1 + 4 * n * (1 + 2 * n))) / 6 + 
+  //  log(3.141593) / 2;
+
+  // Approx for log of factorial: Stirling method      
+  double log_fact = (n + 0.5) * log(n) - n + 0.5 * log(2 * 3.141593);
+  return frr_count * log(lambda) - lambda - log_fact;
+}
+
 bool FRRClass::GetCountLogLikelihood(const int32_t& allele1,
 				     const int32_t& allele2,
 				     const int32_t& read_len,
@@ -122,47 +172,55 @@ bool FRRClass::GetCountLogLikelihood(const int32_t& allele1,
 				     double* count_ll){
   
   int32_t frr_count = GetDataSize() + offtarget_count;
-  double frr_thresh = double(read_len) / double(motif_len);
   if (read_len == 0){
     cerr<< allele1 * motif_len << endl;
     cerr << "FRRCountProb::Divide by Zero prevented!" << endl;
     *count_ll = 0;
     return true;
   }
-  double exp_count1 = coverage / 2.0 / double(read_len) * double(allele1 * motif_len - read_len);
-  double exp_count2 = coverage / 2.0 / double(read_len) * double(allele2 * motif_len - read_len); 
-  double lambda = (allele1 >= frr_thresh ? exp_count1 : 0) + 
-    (allele2 >= frr_thresh ? exp_count2: 0);// Poisson parameter: Total expected number of FRRs
+  // Poisson parameter: Total expected number of FRRs
+  double lambda = GetExpectedCount(allele1, read_len, motif_len, coverage) +
+    GetExpectedCount(allele2, read_len, motif_len, coverage);
   
-    
-  double prob = 0;
   if (lambda <= 0 || allele1 <= 0 || allele2 <= 0 || frr_count <= 0){
     *count_ll = NEG_INF;
     return true;
   }
-  else{
-    //    *count_ll = log(pow(lambda, frr_count) * exp(-lambda) / tgamma(frr_count + 1));
-    if (frr_count < 10){
-      *count_ll = frr_count * log(lambda) - lambda - log(tgamma(frr_count + 1));
-    }
-    else{
-      // Approx for log of factorial by Srinivasa Ramanujan
-      double n = frr_count;
-      //double log_fact = n * log(n) - n + 
-      //log(n * (1 + 4 * n * (1 + 2 * n))) / 6 + 
-      //  log(3.141593) / 2;
-
-      // Approx for log of factorial: Stirling method      
-      double log_fact = (n + 0.5) * log(n) - n + 0.5 * log(2 * 3.141593);
-      *count_ll = frr_count * log(lambda) - lambda - log_fact;
-      //std::cerr<<endl;
-      //std::cerr<< ">> "<<allele1<< ": "<< exp_count1<<", "<<allele2<<": "<< exp_count2<<endl;
-      //std::cerr<< ">> "<<allele1<<", "<<allele2<<"\texp:"<<lambda<<"\treal:"<<frr_count << "\tll:" << log_fact<<endl;
-
-    }
-    
+  *count_ll = GetPoissonLogLikelihood(frr_count, lambda);
+  return true;
+}
+
+/*
+  The expected count only grows with each allele, so lambda ranges over
+  [lambda(lo, lo), lambda(hi, hi)]. The Poisson log likelihood is concave
+  in lambda with its maximum at lambda = frr_count, which gives the bound.
+  Genotypes with no expected FRRs get NEG_INF, which may be larger.
+ */
+bool FRRClass::GetMaxCountLogLikelihood(const int32_t& allele1_lo, const int32_t& allele1_hi,
+					const int32_t& allele2_lo, const int32_t& allele2_hi,
+					const int32_t& read_len,
+					const int32_t& motif_len,
+					const double& coverage,
+					const int32_t& ploidy,
+					const int32_t& offtarget_count,
+					double* count_ll) {
+  int32_t frr_count = GetDataSize() + offtarget_count;
+  if (read_len == 0){
+    *count_ll = 0;
+    return true;
+  }
+  double lambda_lo = GetExpectedCount(allele1_lo, read_len, motif_len, coverage) +
+    GetExpectedCount(allele2_lo, read_len, motif_len, coverage);
+  double lambda_hi = GetExpectedCount(allele1_hi, read_len, motif_len, coverage) +
+    GetExpectedCount(allele2_hi, read_len, motif_len, coverage);
+  if (lambda_hi <= 0 || allele1_hi <= 0 || allele2_hi <= 0 || frr_count <= 0){
+    *count_ll = NEG_INF;
     return true;
   }
-  
+  double lambda = std::min(std::max((double) frr_count, lambda_lo), lambda_hi);
+  *count_ll = GetPoissonLogLikelihood(frr_count, lambda);
+  if (lambda_lo <= 0 || allele1_lo <= 0 || allele2_lo <= 0){
+    *count_ll = std::max(*count_ll, (double) NEG_INF);
+  }
   return true;
 }
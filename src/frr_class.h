@@ -23,6 +23,8 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "src/read_class.h"
 
+#include <map>
+
 /*
   Type of ReadClass
 
@@ -46,7 +48,30 @@ class FRRClass: public ReadClass {
 			     const int32_t& ploidy,
 			     const int32_t& offtarget_count,
 			     double* count_ll);
+  // Upper bound of GetCountLogLikelihood over allele1 in
+  // [allele1_lo, allele1_hi] and allele2 in [allele2_lo, allele2_hi]
+  bool GetMaxCountLogLikelihood(const int32_t& allele1_lo, const int32_t& allele1_hi,
+				const int32_t& allele2_lo, const int32_t& allele2_hi,
+				const int32_t& read_len,
+				const int32_t& motif_len,
+				const double& coverage,
+				const int32_t& ploidy,
+				const int32_t& offtarget_count,
+				double* count_ll);
+  void ClearCache();
 
+ private:
+  // Expected number of FRRs from one allele
+  double GetExpectedCount(const int32_t& allele, const int32_t& read_len,
+			  const int32_t& motif_len, const double& coverage);
+  // Poisson log probability of frr_count FRRs given lambda expected ones
+  double GetPoissonLogLikelihood(const int32_t& frr_count, const double& lambda);
+  // Normalization constant shared by class and read probabilities (cached by allele)
+  double GetNormConst(const int32_t& allele,
+		      const int32_t& read_len, const int32_t& motif_len);
+  std::map<int32_t, double> norm_const_cache_;
+  int32_t norm_read_len_;
+  int32_t norm_motif_len_;
 };
 
 #endif  // SRC_FRR_CLASS_H__
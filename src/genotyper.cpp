@@ -18,6 +18,7 @@ You should have received a copy of the GNU General Public License
 along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <iostream>
 
 #include "src/genotyper.h"
@@ -26,14 +27,37 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 using namespace std;
 
 Genotyper::Genotyper(RefGenome& _refgenome,
-		    Options& _options) {
+		     Options& _options,
+		     std::ostream* readinfo_out,
+		     std::ostream* bootstrap_out) {
   refgenome = &_refgenome;
   options = &_options;
-  read_extractor = new ReadExtractor(_options);
-  likelihood_maximizer = new LikelihoodMaximizer(_options);
+  read_extractor = new ReadExtractor(_options, readinfo_out);
+  likelihood_maximizer = new LikelihoodMaximizer(_options, bootstrap_out);
+  screen_tested_ = 0;
+  screen_passed_ = 0;
+  screen_concordant_ = 0;
+}
+
+void Genotyper::GetScreenCounts(int64_t* tested, int64_t* passed, int64_t* concordant) const {
+  *tested = screen_tested_;
+  *passed = screen_passed_;
+  *concordant = screen_concordant_;
 }
 
 bool Genotyper::SetFlanks(Locus* locus) {
+  const int32_t flanklen = options->realignment_flanklen;
+  // Flanks from a locus catalog can be longer than needed
+  if (locus->flank_len >= flanklen) {
+    if ((int32_t)locus->pre_flank.size() > flanklen) {
+      locus->pre_flank.erase(0, locus->pre_flank.size() - flanklen);
+    }
+    if ((int32_t)locus->post_flank.size() > flanklen) {
+      locus->post_flank.resize(flanklen);
+    }
+    locus->flank_len = flanklen;
+    return true;
+  }
   if (!refgenome->GetSequence(locus->chrom,
 			      locus->start-options->realignment_flanklen-1,
 			      locus->start-2,
@@ -46,18 +70,28 @@ bool Genotyper::SetFlanks(Locus* locus) {
 			      &locus->post_flank)) {
     return false;
   }
+  locus->flank_len = flanklen;
   return true;
 }
 
 bool Genotyper::ProcessLocus(BamCramMultiReader* bamreader, Locus* locus) {
   int32_t read_len = options->read_len;
+  if (options->output_stats) {
+    stats_.Reset();
+  }
+  STATS_SCOPE(options->output_stats ? &stats_ : NULL);
+  STATS_TIMER(STATS_TOTAL_TIME);
 
   // Load preflank and postflank to locus
   if (options->verbose) {
     PrintMessageDieOnError("\tSetting flanking regions", M_PROGRESS);
   }
-  if (!SetFlanks(locus)) {
-    return false;
+  {
+    STATS_TIMER(STATS_FLANKS_TIME);
+    if (!SetFlanks(locus)) {
+      return false;
+    }
+    locus_templates.Build(*locus, read_len);
   }
 
   likelihood_maximizer->Reset();
@@ -66,8 +100,22 @@ bool Genotyper::ProcessLocus(BamCramMultiReader* bamreader, Locus* locus) {
   if (options->verbose) {
     PrintMessageDieOnError("\tLoading read data", M_PROGRESS);
   }
-  if (!read_extractor->ExtractReads(bamreader, *locus, likelihood_maximizer->options->regionsize,
-				    likelihood_maximizer->options->min_match, likelihood_maximizer)) {
+  int64_t decompressed_bytes = bamreader->decompressed_bytes();
+  bool extracted;
+  {
+    STATS_TIMER(STATS_EXTRACT_TIME);
+    extracted = read_extractor->ExtractReads(bamreader, *locus, likelihood_maximizer->options->regionsize,
+					     likelihood_maximizer->options->min_match, likelihood_maximizer,
+					     &locus_templates);
+  }
+  STATS_COUNT(STATS_BYTES_DECOMPRESSED, bamreader->decompressed_bytes() - decompressed_bytes);
+  if (options->verbose) {
+    stringstream msg;
+    msg << "\tDecompressed " << bamreader->decompressed_bytes() - decompressed_bytes
+	<< " bytes of alignments";
+    PrintMessageDieOnError(msg.str(), M_PROGRESS);
+  }
+  if (!extracted) {
     return false;
   }
 
@@ -89,25 +137,61 @@ bool Genotyper::ProcessLocus(BamCramMultiReader* bamreader, Locus* locus) {
     return false;
   }
 
+  int32_t allele1, allele2;
+  int32_t ref_count = (int32_t)((locus->end-locus->start+1)/locus->motif.size());
+
+  // Reference-like loci are called from their enclosing reads alone
+  int32_t screen_allele1 = -1, screen_allele2 = -1;
+  if (options->screen) {
+    screen_tested_++;
+    if (likelihood_maximizer->ScreenGenotype((int32_t)(locus->motif.size()), ref_count,
+					     options->ploidy, &screen_allele1, &screen_allele2)) {
+      screen_passed_++;
+      locus->screened = true;
+      if (options->verbose) {
+	stringstream msg;
+	msg<<"\tScreened genotype: "<<screen_allele1<<", "<<screen_allele2;
+	PrintMessageDieOnError(msg.str(), M_PROGRESS);
+      }
+      if (!options->screen_check) {
+	double neg_lik;
+	if (!likelihood_maximizer->GetGenotypeNegLogLikelihood(screen_allele1, screen_allele2, read_len,
+								(int32_t)(locus->motif.size()), ref_count,
+								false, &neg_lik)) {
+	  return false;
+	}
+	// No bootstrap, so the VCF writer outputs no confidence interval
+	locus->allele1 = screen_allele1;
+	locus->allele2 = screen_allele2;
+	locus->min_neg_lik = neg_lik;
+	locus->depth = likelihood_maximizer->GetReadPoolSize();
+	return true;
+      }
+    }
+  }
+
   // Maximize the likelihood
   if (options->verbose) {
     PrintMessageDieOnError("\tMaximizing likelihood", M_PROGRESS);
   }
-  int32_t allele1, allele2;
-  int32_t ref_count = (int32_t)((locus->end-locus->start+1)/locus->motif.size());
   double min_negLike, lob1, lob2, hib1, hib2;
   bool resampled = false;
   try {
-    if (!likelihood_maximizer->OptimizeLikelihood(read_len, 
-						(int32_t)(locus->motif.size()),
-						ref_count, 
-						resampled, 
-						options->ploidy, 
-						0,
-						locus->offtarget_share,
-						&allele1, 
-						&allele2, 
-						&min_negLike)) {
+    bool optimized;
+    {
+      STATS_TIMER(STATS_OPTIMIZE_TIME);
+      optimized = likelihood_maximizer->OptimizeLikelihood(read_len,
+							   (int32_t)(locus->motif.size()),
+							   ref_count,
+							   resampled,
+							   options->ploidy,
+							   0,
+							   locus->offtarget_share,
+							   &allele1,
+							   &allele2,
+							   &min_negLike);
+    }
+    if (!optimized) {
       return false;
     }
     locus->allele1 = allele1;
@@ -118,15 +202,32 @@ bool Genotyper::ProcessLocus(BamCramMultiReader* bamreader, Locus* locus) {
     locus->frr_reads = likelihood_maximizer->GetFRRDataSize();
     locus->flanking_reads = likelihood_maximizer->GetFlankingDataSize();
     locus->depth = likelihood_maximizer->GetReadPoolSize();
+    if (locus->screened) {
+      // --screen-check: compare with the screen call
+      if (std::min(allele1, allele2) == screen_allele1 && std::max(allele1, allele2) == screen_allele2) {
+	screen_concordant_++;
+      } else {
+	stringstream msg;
+	msg<<"\tScreen call "<<screen_allele1<<", "<<screen_allele2<<" differs from full model call "
+	   <<allele1<<", "<<allele2<<" at "<<locus->chrom<<":"<<locus->start;
+	PrintMessageDieOnError(msg.str(), M_WARNING);
+      }
+    }
     
     if (options->num_boot_samp > 0){
       if (options->verbose) {
 	PrintMessageDieOnError("\tGetting confidence intervals", M_PROGRESS);
       }
       try{
-	if (!likelihood_maximizer->GetConfidenceInterval(read_len, (int32_t)(locus->motif.size()),
-							 ref_count, allele1, allele2, *locus,
-							 &lob1, &hib1, &lob2, &hib2)) {
+	bool bootstrapped;
+	{
+	  STATS_TIMER(STATS_BOOTSTRAP_TIME);
+	  bootstrapped = likelihood_maximizer->GetConfidenceInterval(read_len, (int32_t)(locus->motif.size()),
+								     ref_count, allele1, allele2, *locus,
+								     &lob1, &hib1, &lob2, &hib2,
+								     &locus->num_bootstraps);
+	}
+	if (!bootstrapped) {
 	  return false;
 	}
 	locus->lob1 = lob1;
@@ -158,6 +259,16 @@ bool Genotyper::ProcessLocus(BamCramMultiReader* bamreader, Locus* locus) {
 	return false;
       }
     }
+    if (options->very_verbose) {
+      int64_t cache_hits, cache_misses;
+      likelihood_maximizer->GetGenotypeCacheStats(&cache_hits, &cache_misses);
+      stringstream msg;
+      msg<<"\tGenotype likelihood cache: "<<cache_hits<<" hits, "<<cache_misses<<" misses";
+      if (cache_hits + cache_misses > 0) {
+	msg<<" ("<<100.0*cache_hits/(cache_hits + cache_misses)<<"% hit rate)";
+      }
+      PrintMessageDieOnError(msg.str(), M_PROGRESS);
+    }
   }
   catch (std::exception &exc){
     if (options->verbose) {
@@ -21,24 +21,37 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef SRC_GENOTYPER_H__
 #define SRC_GENOTYPER_H__
 
+#include <iostream>
 #include <string>
 
 //#include "src/bam_reader.h"
 #include "src/bam_io.h"
 #include "src/likelihood_maximizer.h"
 #include "src/locus.h"
+#include "src/locus_templates.h"
 #include "src/options.h"
 #include "src/read_extractor.h"
 #include "src/ref_genome.h"
+#include "src/stats.h"
 
 class Genotyper {
   friend class GenotyperTest;
  public:
+  // Optional streams redirect per-locus read info and bootstrap output
   Genotyper(RefGenome& _refgenome,
-	    Options& _options);
+	    Options& _options,
+	    std::ostream* readinfo_out = NULL,
+	    std::ostream* bootstrap_out = NULL);
   virtual ~Genotyper();
 
   bool ProcessLocus(BamCramMultiReader* bamreader, Locus* locus);
+  // Also look up IRRs of each locus in catalog (may be NULL)
+  void SetIRRCatalog(const IRRCatalog* catalog) { read_extractor->SetIRRCatalog(catalog); }
+  // Stage timers and counters of the last locus (with --stats)
+  const LocusStats& stats() const { return stats_; }
+  // Loci given to the --screen first pass, called by it, and of those the
+  // ones the full model agreed with (--screen-check), over all loci so far
+  void GetScreenCounts(int64_t* tested, int64_t* passed, int64_t* concordant) const;
 
   void Debug(BamCramMultiReader* bamreader); // For testing member classes. can remove later
  protected:
@@ -49,6 +62,12 @@ class Genotyper {
   Options* options;
   LikelihoodMaximizer* likelihood_maximizer;
   ReadExtractor* read_extractor;
+  // Realignment templates of the current locus, rebuilt after SetFlanks
+  LocusTemplates locus_templates;
+  LocusStats stats_;
+  int64_t screen_tested_;
+  int64_t screen_passed_;
+  int64_t screen_concordant_;
 };
 
 #endif  // SRC_GENOTYPER_H__
@@ -0,0 +1,215 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "src/common.h"
+#include "src/genotyper_pool.h"
+
+using namespace std;
+
+GenotyperPool::GenotyperPool(Options& _options, VCFWriter* _vcfwriter,
+			     const IRRCatalog* irr_catalog,
+			     htsThreadPool* io_pool,
+			     const PackedReference* packed_ref,
+			     StatsWriter* stats_writer) {
+  options = &_options;
+  vcfwriter = _vcfwriter;
+  stats_writer_ = stats_writer;
+  next_index_ = 0;
+  next_write_ = 0;
+  // Enough queued loci to keep all workers busy while a slow locus
+  // holds up writing
+  max_unwritten_ = 4 * options->num_threads;
+  done_ = false;
+  finished_run_ = false;
+
+  if (options->output_readinfo) {
+    readfile_.open((options->outprefix + ".readinfo.tab").c_str());
+  }
+  if (options->output_bootstrap) {
+    bsfile_.open((options->outprefix + ".bootstrap.tab").c_str());
+  }
+
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&job_ready_, NULL);
+  pthread_cond_init(&job_done_, NULL);
+
+  // Set up all workers before starting any thread
+  int merge_type = BamCramMultiReader::ORDER_ALNS_BY_FILE;
+  for (int32_t i = 0; i < options->num_threads; i++) {
+    Worker* worker = new Worker;
+    worker->pool = this;
+    worker->refgenome = new RefGenome(options->reffa, packed_ref);
+    worker->bamreader = new BamCramMultiReader(options->bamfiles, options->reffa, merge_type, io_pool);
+    worker->genotyper = new Genotyper(*worker->refgenome, *options,
+				      &worker->readinfo_ss, &worker->bootstrap_ss);
+    worker->genotyper->SetIRRCatalog(irr_catalog);
+    workers_.push_back(worker);
+  }
+  threads_.resize(workers_.size());
+  for (size_t i = 0; i < workers_.size(); i++) {
+    if (pthread_create(&threads_[i], NULL, WorkerMain, workers_[i]) != 0) {
+      PrintMessageDieOnError("Failed to create worker thread", M_ERROR);
+    }
+  }
+}
+
+void* GenotyperPool::WorkerMain(void* arg) {
+  Worker* worker = (Worker*) arg;
+  worker->pool->RunWorker(worker);
+  return NULL;
+}
+
+void GenotyperPool::RunWorker(Worker* worker) {
+  while (true) {
+    pthread_mutex_lock(&mutex_);
+    while (pending_.empty() && !done_) {
+      pthread_cond_wait(&job_ready_, &mutex_);
+    }
+    if (pending_.empty()) {
+      pthread_mutex_unlock(&mutex_);
+      return;
+    }
+    LocusJob* job = pending_.front();
+    pending_.pop_front();
+    pthread_mutex_unlock(&mutex_);
+
+    stringstream ss;
+    ss << "Processing " << job->locus.chrom << ":" << job->locus.start;
+    PrintMessageDieOnError(ss.str(), M_PROGRESS);
+    job->success = worker->genotyper->ProcessLocus(worker->bamreader, &job->locus);
+    job->readinfo = worker->readinfo_ss.str();
+    job->bootstrap = worker->bootstrap_ss.str();
+    job->stats = worker->genotyper->stats();
+    worker->readinfo_ss.str("");
+    worker->readinfo_ss.clear();
+    worker->bootstrap_ss.str("");
+    worker->bootstrap_ss.clear();
+
+    pthread_mutex_lock(&mutex_);
+    finished_[job->index] = job;
+    pthread_cond_signal(&job_done_);
+    pthread_mutex_unlock(&mutex_);
+  }
+}
+
+void GenotyperPool::AddLocus(const Locus& locus) {
+  LocusJob* job = new LocusJob;
+  job->index = next_index_++;
+  job->locus = locus;
+  job->success = false;
+
+  pthread_mutex_lock(&mutex_);
+  pending_.push_back(job);
+  pthread_cond_signal(&job_ready_);
+  pthread_mutex_unlock(&mutex_);
+
+  WriteFinishedLoci(max_unwritten_);
+}
+
+void GenotyperPool::WriteFinishedLoci(const int64_t& max_unwritten) {
+  while (true) {
+    std::vector<LocusJob*> ready;
+    pthread_mutex_lock(&mutex_);
+    while (next_index_ - next_write_ > max_unwritten &&
+	   finished_.find(next_write_) == finished_.end()) {
+      pthread_cond_wait(&job_done_, &mutex_);
+    }
+    std::map<int64_t, LocusJob*>::iterator it = finished_.find(next_write_);
+    while (it != finished_.end()) {
+      ready.push_back(it->second);
+      finished_.erase(it);
+      next_write_++;
+      it = finished_.find(next_write_);
+    }
+    bool keep_waiting = (next_index_ - next_write_ > max_unwritten);
+    pthread_mutex_unlock(&mutex_);
+
+    // Only this thread writes, so output can happen outside the lock
+    for (std::vector<LocusJob*>::iterator job_it = ready.begin();
+	 job_it != ready.end(); job_it++) {
+      WriteLocus(*job_it);
+      delete *job_it;
+    }
+    if (!keep_waiting) {
+      return;
+    }
+  }
+}
+
+void GenotyperPool::WriteLocus(LocusJob* job) {
+  if (options->output_readinfo) {
+    readfile_ << job->readinfo;
+  }
+  if (options->output_bootstrap) {
+    bsfile_ << job->bootstrap;
+  }
+  if (job->success) {
+    vcfwriter->WriteRecord(job->locus);
+  }
+  if (stats_writer_ != NULL) {
+    stats_writer_->WriteLocus(job->locus, job->success, job->stats);
+  }
+}
+
+void GenotyperPool::Finish() {
+  if (finished_run_) {
+    return;
+  }
+  WriteFinishedLoci(0);
+
+  pthread_mutex_lock(&mutex_);
+  done_ = true;
+  pthread_cond_broadcast(&job_ready_);
+  pthread_mutex_unlock(&mutex_);
+  for (size_t i = 0; i < threads_.size(); i++) {
+    pthread_join(threads_[i], NULL);
+  }
+  finished_run_ = true;
+}
+
+void GenotyperPool::GetScreenCounts(int64_t* tested, int64_t* passed, int64_t* concordant) const {
+  *tested = *passed = *concordant = 0;
+  for (size_t i = 0; i < workers_.size(); i++) {
+    int64_t worker_tested, worker_passed, worker_concordant;
+    workers_[i]->genotyper->GetScreenCounts(&worker_tested, &worker_passed, &worker_concordant);
+    *tested += worker_tested;
+    *passed += worker_passed;
+    *concordant += worker_concordant;
+  }
+}
+
+GenotyperPool::~GenotyperPool() {
+  Finish();
+  for (size_t i = 0; i < workers_.size(); i++) {
+    delete workers_[i]->genotyper;
+    delete workers_[i]->bamreader;
+    delete workers_[i]->refgenome;
+    delete workers_[i];
+  }
+  pthread_mutex_destroy(&mutex_);
+  pthread_cond_destroy(&job_ready_);
+  pthread_cond_destroy(&job_done_);
+  if (options->output_readinfo) {
+    readfile_.close();
+  }
+  if (options->output_bootstrap) {
+    bsfile_.close();
+  }
+}
@@ -0,0 +1,120 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SRC_GENOTYPER_POOL_H__
+#define SRC_GENOTYPER_POOL_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <deque>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "src/bam_io.h"
+#include "src/genotyper.h"
+#include "src/irr_catalog.h"
+#include "src/locus.h"
+#include "src/options.h"
+#include "src/ref_genome.h"
+#include "src/stats.h"
+#include "src/vcf_writer.h"
+
+// A locus waiting for (or done with) processing by a worker
+struct LocusJob {
+  int64_t index;          // Position of the locus in the regions file
+  Locus locus;
+  bool success;           // Return value of Genotyper::ProcessLocus
+  std::string readinfo;   // Buffered --output-readinfo lines
+  std::string bootstrap;  // Buffered --output-bootstraps lines
+  LocusStats stats;       // --stats timers and counters
+};
+
+/*
+  Pool of worker threads for --threads mode.
+
+  Each worker owns its own RefGenome, BamCramMultiReader and Genotyper
+  (and with it a ReadExtractor and LikelihoodMaximizer), so nothing is
+  shared while a locus is processed, apart from the read-only IRR catalog
+  and packed reference. Finished loci go to a reorder buffer and are
+  written by the calling thread in regions file order, so the output
+  matches a single-threaded run.
+ */
+class GenotyperPool {
+ public:
+  GenotyperPool(Options& _options, VCFWriter* _vcfwriter,
+		const IRRCatalog* irr_catalog = NULL,
+		htsThreadPool* io_pool = NULL,
+		const PackedReference* packed_ref = NULL,
+		StatsWriter* stats_writer = NULL);
+  virtual ~GenotyperPool();
+
+  // Queue a locus. Blocks while too many loci are waiting to be written
+  void AddLocus(const Locus& locus);
+  // Wait for all queued loci, write them and stop the workers
+  void Finish();
+  // Genotyper::GetScreenCounts summed over the workers, after Finish
+  void GetScreenCounts(int64_t* tested, int64_t* passed, int64_t* concordant) const;
+
+ private:
+  struct Worker {
+    GenotyperPool* pool;
+    RefGenome* refgenome;
+    BamCramMultiReader* bamreader;
+    Genotyper* genotyper;
+    std::stringstream readinfo_ss;
+    std::stringstream bootstrap_ss;
+  };
+
+  // Private unimplemented copy constructor and assignment operator to prevent operations
+  GenotyperPool(const GenotyperPool& other);
+  GenotyperPool& operator=(const GenotyperPool& other);
+
+  static void* WorkerMain(void* arg);
+  void RunWorker(Worker* worker);
+  // Write finished loci in order until at most max_unwritten remain
+  void WriteFinishedLoci(const int64_t& max_unwritten);
+  void WriteLocus(LocusJob* job);
+
+  Options* options;
+  VCFWriter* vcfwriter;
+  StatsWriter* stats_writer_;
+  std::ofstream readfile_;
+  std::ofstream bsfile_;
+
+  std::vector<Worker*> workers_;
+  std::vector<pthread_t> threads_;
+  std::deque<LocusJob*> pending_;            // Loci not yet picked up by a worker
+  std::map<int64_t, LocusJob*> finished_;    // Reorder buffer
+  int64_t next_index_;   // Index given to the next queued locus
+  int64_t next_write_;   // Index of the next locus to write
+  int64_t max_unwritten_;
+  bool done_;
+  bool finished_run_;
+
+  pthread_mutex_t mutex_;
+  pthread_cond_t job_ready_;
+  pthread_cond_t job_done_;
+};
+
+#endif  // SRC_GENOTYPER_POOL_H__
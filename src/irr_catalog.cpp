@@ -0,0 +1,545 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "src/bam_io.h"
+#include "src/common.h"
+#include "src/irr_catalog.h"
+#include "src/locus.h"
+#include "src/realignment.h"
+#include "src/region_reader.h"
+#include "src/stringops.h"
+
+using namespace std;
+
+std::string canonical_motif(const std::string& motif) {
+  std::string forward = uppercase(motif);
+  std::string reverse = uppercase(reverse_complement(forward));
+  std::string best = forward;
+  for (size_t i = 0; i < forward.size(); i++) {
+    std::string rotation = forward.substr(i) + forward.substr(0, i);
+    if (rotation < best) {
+      best = rotation;
+    }
+    rotation = reverse.substr(i) + reverse.substr(0, i);
+    if (rotation < best) {
+      best = rotation;
+    }
+  }
+  return best;
+}
+
+bool find_read_motif(const std::string& seq, const int32_t& max_period,
+		     std::string* motif) {
+  const int32_t length = (int32_t)seq.size();
+  for (int32_t period = 1; period <= max_period && 2 * period <= length; period++) {
+    // Count bases equal to the base one period later
+    int32_t matches = 0;
+    for (int32_t i = 0; i + period < length; i++) {
+      if (toupper(seq[i]) == toupper(seq[i+period]) && toupper(seq[i]) != 'N') {
+	matches++;
+      }
+    }
+    if (matches < IRR_MIN_PERIODICITY * (length - period)) {
+      continue;
+    }
+    // The smallest period found is the motif. Take the most common base
+    // at each of its positions
+    std::string consensus(period, 'N');
+    for (int32_t phase = 0; phase < period; phase++) {
+      int32_t counts[4] = {0, 0, 0, 0};
+      for (int32_t i = phase; i < length; i += period) {
+	switch (toupper(seq[i])) {
+	case 'A': counts[0]++; break;
+	case 'C': counts[1]++; break;
+	case 'G': counts[2]++; break;
+	case 'T': counts[3]++; break;
+	default: break;
+	}
+      }
+      int32_t best = 0;
+      for (int32_t base = 1; base < 4; base++) {
+	if (counts[base] > counts[best]) {
+	  best = base;
+	}
+      }
+      if (counts[best] == 0) {
+	return false;
+      }
+      consensus[phase] = "ACGT"[best];
+    }
+    *motif = canonical_motif(consensus);
+    return true;
+  }
+  return false;
+}
+
+IRRCatalogWriter::IRRCatalogWriter(const std::string& path, const size_t& chunk_size)
+  : path_(path), chunk_size_(std::max(chunk_size, (size_t)1)), num_records_(0) {}
+
+IRRCatalogWriter::~IRRCatalogWriter() {
+  RemoveTemporaryFiles();
+}
+
+int32_t IRRCatalogWriter::Number(const std::string& str, std::map<std::string, int32_t>* numbers,
+				 std::vector<std::string>* strings) {
+  std::map<std::string, int32_t>::const_iterator it = numbers->find(str);
+  if (it != numbers->end()) {
+    return it->second;
+  }
+  int32_t number = (int32_t)strings->size();
+  (*numbers)[str] = number;
+  strings->push_back(str);
+  return number;
+}
+
+void IRRCatalogWriter::Add(const IRRRecord& record) {
+  PendingRecord pending;
+  memset(&pending.record, 0, sizeof(pending.record));
+  pending.motif = Number(record.motif, &motif_numbers_, &motifs_);
+  pending.record.mate_chrom = Number(record.mate_chrom, &chrom_numbers_, &chroms_);
+  pending.record.mate_position = record.mate_position;
+  pending.record.chrom = (record.chrom == "*" ? -1 : Number(record.chrom, &chrom_numbers_, &chroms_));
+  pending.record.position = record.position;
+  pending.record.file_index = record.file_index;
+  pending.record.read_length = record.read_length;
+  pending.record.name_length = record.name.size();
+  pending.name = record.name;
+  chunk_.push_back(pending);
+  num_records_++;
+  if (chunk_.size() >= chunk_size_) {
+    SpillChunk();
+  }
+}
+
+bool IRRCatalogWriter::PendingLess::operator()(const PendingRecord& a,
+						const PendingRecord& b) const {
+  if (a.motif != b.motif) {
+    return writer->motifs_[a.motif] < writer->motifs_[b.motif];
+  }
+  if (a.record.mate_chrom != b.record.mate_chrom) {
+    return a.record.mate_chrom < b.record.mate_chrom;
+  }
+  if (a.record.mate_position != b.record.mate_position) {
+    return a.record.mate_position < b.record.mate_position;
+  }
+  if (a.record.file_index != b.record.file_index) {
+    return a.record.file_index < b.record.file_index;
+  }
+  return a.name < b.name;
+}
+
+bool IRRCatalogWriter::RunGreater::operator()(const size_t& a, const size_t& b) const {
+  PendingLess less;
+  less.writer = writer;
+  return less((*runs)[b].current, (*runs)[a].current);
+}
+
+bool IRRCatalogWriter::RunReader::Next() {
+  uint32_t name_length;
+  if (!in->read((char*)&current.motif, sizeof(current.motif)) ||
+      !in->read((char*)&current.record, sizeof(current.record)) ||
+      !in->read((char*)&name_length, sizeof(name_length))) {
+    return false;
+  }
+  current.name.resize(name_length);
+  return (name_length == 0 || in->read(&current.name[0], name_length));
+}
+
+std::string IRRCatalogWriter::RunPath(const size_t& run) const {
+  std::stringstream ss;
+  ss << path_ << ".run" << run << ".tmp";
+  return ss.str();
+}
+
+std::string IRRCatalogWriter::NamesPath() const {
+  return path_ + ".names.tmp";
+}
+
+/*
+  Sort the records collected so far and write them to a new run file
+ */
+bool IRRCatalogWriter::SpillChunk() {
+  PendingLess less;
+  less.writer = this;
+  std::sort(chunk_.begin(), chunk_.end(), less);
+  runs_.push_back(RunPath(runs_.size()));
+  std::ofstream out(runs_.back().c_str(), std::ios::binary);
+  for (std::vector<PendingRecord>::const_iterator it = chunk_.begin();
+       it != chunk_.end(); it++) {
+    uint32_t name_length = it->name.size();
+    out.write((const char*)&it->motif, sizeof(it->motif));
+    out.write((const char*)&it->record, sizeof(it->record));
+    out.write((const char*)&name_length, sizeof(name_length));
+    out.write(it->name.data(), name_length);
+  }
+  chunk_.clear();
+  out.close();
+  if (out.fail()) {
+    PrintMessageDieOnError("Could not write IRR catalog run " + runs_.back(), M_ERROR);
+  }
+  return true;
+}
+
+void IRRCatalogWriter::WriteRecord(const PendingRecord& pending, std::ofstream* out,
+				   std::ofstream* names, std::vector<IRRCatalogMotif>* motifs) {
+  const std::string& motif = motifs_[pending.motif];
+  if (motifs->empty() || motif != motifs->back().motif) {
+    IRRCatalogMotif entry;
+    memset(&entry, 0, sizeof(entry));
+    strncpy(entry.motif, motif.c_str(), IRR_MAX_PERIOD);
+    entry.first_record = (motifs->empty() ? 0 :
+			  motifs->back().first_record + motifs->back().num_records);
+    motifs->push_back(entry);
+  }
+  motifs->back().num_records++;
+  IRRCatalogRecord record = pending.record;
+  record.name_offset = names->tellp();
+  out->write((const char*)&record, sizeof(record));
+  names->write(pending.name.data(), pending.name.size());
+}
+
+/*
+  Merge the sorted runs (or sort the only chunk in memory) into the
+  records section. Read names go to a temporary file that becomes the
+  names section, after the motif index and chromosome records.
+ */
+bool IRRCatalogWriter::Finish() {
+  std::ofstream out(path_.c_str(), std::ios::binary);
+  if (!out.is_open()) {
+    PrintMessageDieOnError("Could not open IRR catalog " + path_ + " for writing", M_ERROR);
+  }
+  std::ofstream names(NamesPath().c_str(), std::ios::binary);
+  IRRCatalogHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, IRR_CATALOG_MAGIC, sizeof(header.magic));
+  header.version = IRR_CATALOG_VERSION;
+  header.num_records = num_records_;
+  header.records_offset = sizeof(header);
+  out.write((const char*)&header, sizeof(header));
+
+  std::vector<IRRCatalogMotif> motifs;
+  if (runs_.empty()) {
+    PendingLess less;
+    less.writer = this;
+    std::sort(chunk_.begin(), chunk_.end(), less);
+    for (std::vector<PendingRecord>::const_iterator it = chunk_.begin();
+	 it != chunk_.end(); it++) {
+      WriteRecord(*it, &out, &names, &motifs);
+    }
+    chunk_.clear();
+  } else {
+    if (!chunk_.empty()) {
+      SpillChunk();
+    }
+    std::vector<RunReader> readers(runs_.size());
+    std::vector<size_t> heap;
+    for (size_t i = 0; i < runs_.size(); i++) {
+      readers[i].in = new std::ifstream(runs_[i].c_str(), std::ios::binary);
+      if (readers[i].Next()) {
+	heap.push_back(i);
+      }
+    }
+    RunGreater greater;
+    greater.writer = this;
+    greater.runs = &readers;
+    std::make_heap(heap.begin(), heap.end(), greater);
+    while (!heap.empty()) {
+      std::pop_heap(heap.begin(), heap.end(), greater);
+      size_t run = heap.back();
+      WriteRecord(readers[run].current, &out, &names, &motifs);
+      if (readers[run].Next()) {
+	std::push_heap(heap.begin(), heap.end(), greater);
+      } else {
+	heap.pop_back();
+      }
+    }
+    for (size_t i = 0; i < readers.size(); i++) {
+      delete readers[i].in;
+    }
+  }
+
+  // Chromosome names follow the read names
+  std::vector<IRRCatalogChrom> chroms(chroms_.size());
+  for (size_t i = 0; i < chroms_.size(); i++) {
+    memset(&chroms[i], 0, sizeof(chroms[i]));
+    chroms[i].name_offset = names.tellp();
+    chroms[i].name_length = chroms_[i].size();
+    names.write(chroms_[i].data(), chroms_[i].size());
+  }
+  header.names_size = names.tellp();
+  names.close();
+
+  header.num_motifs = motifs.size();
+  header.num_chroms = chroms.size();
+  header.motifs_offset = out.tellp();
+  if (!motifs.empty()) {
+    out.write((const char*)&motifs[0], motifs.size() * sizeof(motifs[0]));
+  }
+  header.chroms_offset = out.tellp();
+  if (!chroms.empty()) {
+    out.write((const char*)&chroms[0], chroms.size() * sizeof(chroms[0]));
+  }
+  header.names_offset = out.tellp();
+  std::ifstream names_in(NamesPath().c_str(), std::ios::binary);
+  if (header.names_size > 0) {
+    out << names_in.rdbuf();
+  }
+  names_in.close();
+  out.seekp(0);
+  out.write((const char*)&header, sizeof(header));
+  out.close();
+  RemoveTemporaryFiles();
+  return !out.fail();
+}
+
+void IRRCatalogWriter::RemoveTemporaryFiles() {
+  for (size_t i = 0; i < runs_.size(); i++) {
+    remove(runs_[i].c_str());
+  }
+  runs_.clear();
+  remove(NamesPath().c_str());
+}
+
+IRRCatalog::IRRCatalog()
+  : data_(NULL), data_size_(0), header_(NULL), records_(NULL), motifs_(NULL),
+    chroms_(NULL), names_(NULL) {}
+
+IRRCatalog::~IRRCatalog() {
+  Close();
+}
+
+/*
+  Stream each BAM file once, from the first record to the unmapped reads
+  at the end, and keep primary reads whose mate is mapped and that are
+  fully repetitive reads of a motif of the regions file: made up of the
+  motif (find_read_motif) and aligning to its copies like the FRR check
+  of read extraction (is_frr_sequence), on either strand.
+ */
+bool IRRCatalog::Build(const std::vector<std::string>& bamfiles, const std::string& fasta_path,
+		       const std::string& regionsfile, const std::string& path,
+		       htsThreadPool* thread_pool) {
+  std::set<std::string> motifs;
+  int32_t max_period = 0;
+  RegionReader region_reader(regionsfile);
+  Locus locus;
+  while (region_reader.GetNextRegion(&locus)) {
+    if (!locus.motif.empty() && (int32_t)locus.motif.size() <= IRR_MAX_PERIOD) {
+      motifs.insert(canonical_motif(locus.motif));
+      max_period = std::max(max_period, (int32_t)locus.motif.size());
+    }
+    locus.Reset();
+  }
+  IRRCatalogWriter writer(path);
+  IRRRecord record;
+  std::string motif;
+  for (size_t file_index = 0; file_index < bamfiles.size(); file_index++) {
+    PrintMessageDieOnError("\tBuilding IRR catalog from " + bamfiles[file_index], M_PROGRESS);
+    BamCramReader reader(bamfiles[file_index], fasta_path, thread_pool);
+    const BamHeader* bam_header = reader.bam_header();
+    if (!reader.SetWholeFile()) {
+      return false;
+    }
+    BamAlignment alignment;
+    int64_t num_reads = 0, num_irrs = 0;
+    while (reader.GetNextAlignment(alignment)) {
+      num_reads++;
+      if (alignment.IsSecondary() || alignment.IsSupplementary() ||
+	  !alignment.IsMateMapped()) {
+	continue;
+      }
+      const std::string& bases = alignment.QueryBases();
+      if (!find_read_motif(bases, max_period, &motif) || motifs.count(motif) == 0) {
+	continue;
+      }
+      std::string seq = lowercase(bases);
+      std::string motif_seq = lowercase(motif);
+      if (!is_frr_sequence(seq, alignment.Qualities(), motif_seq) &&
+	  !is_frr_sequence(reverse_complement(seq), alignment.Qualities(), motif_seq)) {
+	continue;
+      }
+      record.motif = motif;
+      record.mate_chrom = bam_header->ref_name(alignment.MateRefID());
+      record.mate_position = alignment.MatePosition();
+      record.file_index = (int32_t)file_index;
+      record.name = alignment.Name();
+      if (record.name.size() > 2 && record.name[record.name.size()-2] == '/') {
+	record.name.resize(record.name.size()-2);
+      }
+      record.chrom = bam_header->ref_name(alignment.RefID());
+      record.position = alignment.Position();
+      record.read_length = (int32_t)bases.size();
+      writer.Add(record);
+      num_irrs++;
+    }
+    std::stringstream ss;
+    ss << "\tScanned " << num_reads << " reads, found " << num_irrs << " IRRs";
+    PrintMessageDieOnError(ss.str(), M_PROGRESS);
+  }
+  return writer.Finish();
+}
+
+bool IRRCatalog::Load(const std::string& path) {
+  Close();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(IRRCatalogHeader)) {
+    close(fd);
+    return false;
+  }
+  data_size_ = file_stat.st_size;
+  data_ = mmap(NULL, data_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data_ == MAP_FAILED) {
+    data_ = NULL;
+    return false;
+  }
+  header_ = (const IRRCatalogHeader*)data_;
+  const char* base = (const char*)data_;
+  bool valid = (memcmp(header_->magic, IRR_CATALOG_MAGIC, sizeof(header_->magic)) == 0 &&
+		header_->version == IRR_CATALOG_VERSION &&
+		header_->records_offset % sizeof(uint64_t) == 0 &&
+		header_->motifs_offset % sizeof(uint64_t) == 0 &&
+		header_->chroms_offset % sizeof(uint64_t) == 0 &&
+		header_->num_records <= data_size_ / sizeof(IRRCatalogRecord) &&
+		header_->num_motifs <= data_size_ / sizeof(IRRCatalogMotif) &&
+		header_->num_chroms <= data_size_ / sizeof(IRRCatalogChrom) &&
+		header_->records_offset + header_->num_records * sizeof(IRRCatalogRecord) <= data_size_ &&
+		header_->motifs_offset + header_->num_motifs * sizeof(IRRCatalogMotif) <= data_size_ &&
+		header_->chroms_offset + header_->num_chroms * sizeof(IRRCatalogChrom) <= data_size_ &&
+		header_->names_offset <= data_size_ &&
+		header_->names_size <= data_size_ - header_->names_offset);
+  if (valid) {
+    records_ = (const IRRCatalogRecord*)(base + header_->records_offset);
+    motifs_ = (const IRRCatalogMotif*)(base + header_->motifs_offset);
+    chroms_ = (const IRRCatalogChrom*)(base + header_->chroms_offset);
+    names_ = base + header_->names_offset;
+  }
+  // Only the small motif index and chromosome table are checked up front.
+  // Records are checked when Find reads them
+  for (uint64_t i = 0; valid && i < header_->num_motifs; i++) {
+    valid = (motifs_[i].motif[IRR_MAX_PERIOD] == '\0' &&
+	     motifs_[i].first_record <= header_->num_records &&
+	     motifs_[i].num_records <= header_->num_records - motifs_[i].first_record);
+  }
+  for (uint32_t i = 0; valid && i < header_->num_chroms; i++) {
+    valid = ValidString(chroms_[i].name_offset, chroms_[i].name_length);
+    if (valid) {
+      chrom_numbers_[GetString(chroms_[i].name_offset, chroms_[i].name_length)] = (int32_t)i;
+    }
+  }
+  if (!valid) {
+    Close();
+  }
+  return valid;
+}
+
+void IRRCatalog::Find(const std::string& motif, const std::string& chrom,
+		      const int32_t& start, const int32_t& end,
+		      std::vector<IRRRecord>* records) const {
+  records->clear();
+  if (header_ == NULL) {
+    return;
+  }
+  std::map<std::string, int32_t>::const_iterator chrom_it = chrom_numbers_.find(chrom);
+  if (chrom_it == chrom_numbers_.end()) {
+    return;
+  }
+  // Motifs are sorted, so binary search the index
+  uint64_t low = 0, high = header_->num_motifs;
+  while (low < high) {
+    uint64_t mid = low + (high - low) / 2;
+    if (strcmp(motifs_[mid].motif, motif.c_str()) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low == header_->num_motifs || motif != motifs_[low].motif) {
+    return;
+  }
+  // Then the records of the motif, by mate location
+  const IRRCatalogRecord* first = records_ + motifs_[low].first_record;
+  const IRRCatalogRecord* last = first + motifs_[low].num_records;
+  int32_t mate_chrom = chrom_it->second;
+  while (first < last) {
+    const IRRCatalogRecord* mid = first + (last - first) / 2;
+    if (mid->mate_chrom < mate_chrom ||
+	(mid->mate_chrom == mate_chrom && mid->mate_position < start)) {
+      first = mid + 1;
+    } else {
+      last = mid;
+    }
+  }
+  last = records_ + motifs_[low].first_record + motifs_[low].num_records;
+  IRRRecord record;
+  record.motif = motif;
+  record.mate_chrom = chrom;
+  for (; first < last && first->mate_chrom == mate_chrom && first->mate_position <= end; first++) {
+    if (!ValidString(first->name_offset, first->name_length) ||
+	first->chrom < -1 || first->chrom >= (int32_t)header_->num_chroms) {
+      PrintMessageDieOnError("IRR catalog not formatted correctly", M_ERROR);
+    }
+    record.mate_position = first->mate_position;
+    record.file_index = first->file_index;
+    record.name = GetString(first->name_offset, first->name_length);
+    record.chrom = (first->chrom < 0 ? "*" :
+		    GetString(chroms_[first->chrom].name_offset, chroms_[first->chrom].name_length));
+    record.position = first->position;
+    record.read_length = first->read_length;
+    records->push_back(record);
+  }
+}
+
+void IRRCatalog::Close() {
+  if (data_ != NULL) {
+    munmap(data_, data_size_);
+  }
+  data_ = NULL;
+  data_size_ = 0;
+  header_ = NULL;
+  records_ = NULL;
+  motifs_ = NULL;
+  chroms_ = NULL;
+  names_ = NULL;
+  chrom_numbers_.clear();
+}
+
+std::string IRRCatalog::GetString(const uint64_t& offset, const uint32_t& length) const {
+  return std::string(names_ + offset, length);
+}
+
+bool IRRCatalog::ValidString(const uint64_t& offset, const uint32_t& length) const {
+  return offset <= header_->names_size && length <= header_->names_size - offset;
+}
@@ -0,0 +1,226 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SRC_IRR_CATALOG_H__
+#define SRC_IRR_CATALOG_H__
+
+#include <stdint.h>
+
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "htslib/thread_pool.h"
+
+// Longest motif looked for in reads
+const int32_t IRR_MAX_PERIOD = 20;
+// Minimum fraction of bases equal to the base one period later
+const double IRR_MIN_PERIODICITY = 0.8;
+// First bytes of an IRR catalog
+const char IRR_CATALOG_MAGIC[8] = {'G', 'S', 'T', 'R', 'I', 'R', 'R', '\0'};
+const uint32_t IRR_CATALOG_VERSION = 1;
+// Records sorted in memory at once by IRRCatalogWriter. Larger catalogs
+// are sorted in runs of this many records, which are then merged
+const size_t IRR_SORT_CHUNK = 1 << 20;
+
+// A read made up of one short motif, and where its mate is
+struct IRRRecord {
+  std::string motif;       // Canonical motif (see canonical_motif)
+  std::string mate_chrom;
+  int32_t mate_position;
+  int32_t file_index;      // Index of the BAM file in --bam
+  std::string name;        // Read name without /1 or /2
+  std::string chrom;       // Where the read itself is, * if unplaced
+  int32_t position;
+  int32_t read_length;
+};
+
+/*
+  Layout of the catalog file, in host byte order: header, num_records
+  read records sorted by motif, mate chromosome and mate position, the
+  index of num_motifs motifs into the records, num_chroms chromosome
+  records, then a blob of read and chromosome names referenced by
+  (offset, length) pairs.
+ */
+struct IRRCatalogHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_chroms;
+  uint64_t num_motifs;
+  uint64_t num_records;
+  uint64_t records_offset;   // File offsets of each section
+  uint64_t motifs_offset;
+  uint64_t chroms_offset;
+  uint64_t names_offset;
+  uint64_t names_size;
+};
+
+struct IRRCatalogRecord {
+  int32_t mate_chrom;        // Index into the chromosome records
+  int32_t mate_position;
+  int32_t chrom;             // -1 if unplaced
+  int32_t position;
+  int32_t file_index;
+  int32_t read_length;
+  uint64_t name_offset;
+  uint32_t name_length;
+  uint32_t unused;
+};
+
+struct IRRCatalogMotif {
+  char motif[IRR_MAX_PERIOD + 4];  // Canonical motif, zero padded
+  uint64_t first_record;
+  uint64_t num_records;
+};
+
+struct IRRCatalogChrom {
+  uint64_t name_offset;
+  uint32_t name_length;
+  uint32_t unused;
+};
+
+/*
+  Canonical form of a motif: the smallest of all rotations of the motif
+  and of its reverse complement. Upper case
+ */
+std::string canonical_motif(const std::string& motif);
+
+/*
+  Motif periodicity scan. Return true if seq is dominated by a motif of
+  period at most max_period, and set motif to its canonical form
+ */
+bool find_read_motif(const std::string& seq, const int32_t& max_period,
+		     std::string* motif);
+
+/*
+  Writes an IRR catalog without holding all of its records in memory.
+  Records are sorted in chunks of chunk_size, each spilled to a temporary
+  run file next to the catalog, and the runs are merged into the catalog
+  by Finish.
+ */
+class IRRCatalogWriter {
+ public:
+  IRRCatalogWriter(const std::string& path, const size_t& chunk_size = IRR_SORT_CHUNK);
+  virtual ~IRRCatalogWriter();
+
+  void Add(const IRRRecord& record);
+  // Write the catalog and remove the temporary files
+  bool Finish();
+  // Run files written so far
+  size_t num_runs() const { return runs_.size(); }
+
+ private:
+  // A record being sorted. Motifs and chromosomes are numbered in the
+  // order they are first seen
+  struct PendingRecord {
+    int32_t motif;
+    IRRCatalogRecord record;
+    std::string name;
+  };
+  struct PendingLess {
+    const IRRCatalogWriter* writer;
+    bool operator()(const PendingRecord& a, const PendingRecord& b) const;
+  };
+  // Reads a run file back one record at a time
+  struct RunReader {
+    std::ifstream* in;
+    PendingRecord current;
+    bool Next();
+  };
+  struct RunGreater {
+    const IRRCatalogWriter* writer;
+    const std::vector<RunReader>* runs;
+    bool operator()(const size_t& a, const size_t& b) const;
+  };
+
+  // Private unimplemented copy constructor and assignment operator to prevent operations
+  IRRCatalogWriter(const IRRCatalogWriter& other);
+  IRRCatalogWriter& operator=(const IRRCatalogWriter& other);
+
+  int32_t Number(const std::string& str, std::map<std::string, int32_t>* numbers,
+		 std::vector<std::string>* strings);
+  bool SpillChunk();
+  // Append a record of the sorted stream to the catalog
+  void WriteRecord(const PendingRecord& pending, std::ofstream* out, std::ofstream* names,
+		   std::vector<IRRCatalogMotif>* motifs);
+  std::string RunPath(const size_t& run) const;
+  std::string NamesPath() const;
+  void RemoveTemporaryFiles();
+
+  std::string path_;
+  size_t chunk_size_;
+  std::vector<PendingRecord> chunk_;
+  std::vector<std::string> runs_;       // Paths of the run files
+  std::map<std::string, int32_t> motif_numbers_;
+  std::vector<std::string> motifs_;
+  std::map<std::string, int32_t> chrom_numbers_;
+  std::vector<std::string> chroms_;
+  uint64_t num_records_;
+};
+
+/*
+  Genome-wide catalog of fully repetitive reads (IRRs), indexed by motif
+  and sorted by mate location. It is built by streaming the BAM files
+  once, unmapped reads included, and keeps only reads of the motifs of a
+  regions file. Each locus then picks up IRRs of its motif that were
+  mapped far away from it or left unmapped. The file is memory mapped
+  and records are read in place.
+ */
+class IRRCatalog {
+ public:
+  IRRCatalog();
+  virtual ~IRRCatalog();
+
+  // Stream all BAM files and write the catalog of IRRs of the motifs in
+  // regionsfile (BED file or locus catalog) to path
+  static bool Build(const std::vector<std::string>& bamfiles, const std::string& fasta_path,
+		    const std::string& regionsfile, const std::string& path,
+		    htsThreadPool* thread_pool = NULL);
+  // Map a catalog written by Build. Return false if it is not valid
+  bool Load(const std::string& path);
+
+  // Records for motif with the mate on chrom in [start, end], in catalog order
+  void Find(const std::string& motif, const std::string& chrom,
+	    const int32_t& start, const int32_t& end,
+	    std::vector<IRRRecord>* records) const;
+  uint64_t size() const { return (header_ == NULL ? 0 : header_->num_records); }
+
+ private:
+  // Private unimplemented copy constructor and assignment operator to prevent operations
+  IRRCatalog(const IRRCatalog& other);
+  IRRCatalog& operator=(const IRRCatalog& other);
+
+  void Close();
+  std::string GetString(const uint64_t& offset, const uint32_t& length) const;
+  bool ValidString(const uint64_t& offset, const uint32_t& length) const;
+
+  void* data_;
+  size_t data_size_;
+  const IRRCatalogHeader* header_;
+  const IRRCatalogRecord* records_;
+  const IRRCatalogMotif* motifs_;
+  const IRRCatalogChrom* chroms_;
+  const char* names_;
+  std::map<std::string, int32_t> chrom_numbers_;
+};
+
+#endif  // SRC_IRR_CATALOG_H__
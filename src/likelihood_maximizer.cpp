@@ -18,6 +18,8 @@ You should have received a copy of the GNU General Public License
 along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <nlopt.hpp>
+#include <pthread.h>
+#include <stdlib.h>
 // #include <nlopt.h>
 
 #include <gsl/gsl_multimin.h>
@@ -27,10 +29,11 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 #include "src/realignment.h" // for MARGIN
 #include <iostream>
 #include <algorithm>
+#include <queue>
 using namespace std;
 
 
-LikelihoodMaximizer::LikelihoodMaximizer(Options& _options) {
+LikelihoodMaximizer::LikelihoodMaximizer(Options& _options, std::ostream* bootstrap_out) {
   options = &_options;
 
   enclosing_class_.SetOptions(*options);
@@ -43,8 +46,12 @@ LikelihoodMaximizer::LikelihoodMaximizer(Options& _options) {
   resampled_flanking_class_.SetOptions(*options);
 
   // Set up output file
-  if (options->output_bootstrap) {
-    bsfile_.open((options->outprefix + ".bootstrap.tab").c_str());
+  bsout_ = bootstrap_out;
+  if (bsout_ == NULL) {
+    if (options->output_bootstrap) {
+      bsfile_.open((options->outprefix + ".bootstrap.tab").c_str());
+    }
+    bsout_ = &bsfile_;
   }
   //plotfile_.open((options->outprefix + ".plot.tab").c_str());
 
@@ -56,6 +63,11 @@ LikelihoodMaximizer::LikelihoodMaximizer(Options& _options) {
   r = gsl_rng_alloc (T);
 
   gsl_rng_set(r, options->seed);
+  read_pool_size_ = 0;
+  offtarget_share = 0.0;
+  gt_cache_hits_ = 0;
+  gt_cache_misses_ = 0;
+  parent_discrete_bounds_ = NULL;
   
   //offtarget_share = 0.0;
 }
@@ -81,43 +93,67 @@ void LikelihoodMaximizer::Reset() {
   spanning_class_.Reset();
   flanking_class_.Reset();
   offtarget_class_.Reset();
+  // Cached class probabilities depend on the locus
+  enclosing_class_.ClearCache();
+  frr_class_.ClearCache();
+  spanning_class_.ClearCache();
+  flanking_class_.ClearCache();
+  offtarget_class_.ClearCache();
+  resampled_enclosing_class_.ClearCache();
+  resampled_frr_class_.ClearCache();
+  resampled_spanning_class_.ClearCache();
+  resampled_flanking_class_.ClearCache();
   read_pool.clear();
+  read_pool_index_.clear();
+  read_pool_size_ = 0;
+  gt_ll_cache_[0].clear();
+  gt_ll_cache_[1].clear();
+  gt_cache_hits_ = 0;
+  gt_cache_misses_ = 0;
+  discrete_bounds_.built = false;
+  parent_discrete_bounds_ = NULL;
+  // Bootstrap helpers keep resampled classes and caches of the last locus
+  for (size_t i = 0; i < boot_helpers_.size(); i++) {
+    boot_helpers_[i]->Reset();
+  }
+}
+
+void LikelihoodMaximizer::AddToReadPool(const ReadType& read_type, const int32_t& data) {
+  std::pair<int32_t, int32_t> key((int32_t)read_type, data);
+  std::map<std::pair<int32_t, int32_t>, std::size_t>::iterator it = read_pool_index_.find(key);
+  if (it == read_pool_index_.end()) {
+    ReadRecord rec;
+    rec.read_type = read_type;
+    rec.data = data;
+    rec.count = 1;
+    read_pool_index_[key] = read_pool.size();
+    read_pool.push_back(rec);
+  }
+  else {
+    read_pool[it->second].count++;
+  }
+  read_pool_size_++;
 }
 
 void LikelihoodMaximizer::AddEnclosingData(const int32_t& data) {
   enclosing_class_.AddData(data);
-  ReadRecord rec;
-  rec.read_type = RC_ENCL;
-  rec.data = data;
-  read_pool.push_back(rec);
+  AddToReadPool(RC_ENCL, data);
 }
 void LikelihoodMaximizer::AddSpanningData(const int32_t& data) {
   spanning_class_.AddData(data);
-  ReadRecord rec;
-  rec.read_type = RC_SPAN;
-  rec.data = data;
-  read_pool.push_back(rec);
+  AddToReadPool(RC_SPAN, data);
 }
 void LikelihoodMaximizer::AddFRRData(const int32_t& data) {
   frr_class_.AddData(data);
-  ReadRecord rec;
-  rec.read_type = RC_FRR;
-  rec.data = data;
-  read_pool.push_back(rec);
+  AddToReadPool(RC_FRR, data);
 }
 void LikelihoodMaximizer::AddFlankingData(const int32_t& data) {
   flanking_class_.AddData(data);
-  ReadRecord rec;
-  rec.read_type = RC_BOUND;
-  rec.data = data;
-  read_pool.push_back(rec);
+  AddToReadPool(RC_BOUND, data);
 }
 void LikelihoodMaximizer::AddOffTargetData(const int32_t& data) {
   offtarget_class_.AddData(data);
-  ReadRecord rec;
-  rec.read_type = RC_OFFT;
-  rec.data = data;
-  read_pool.push_back(rec);
+  AddToReadPool(RC_OFFT, data);
 }
 
 void LikelihoodMaximizer::PlotLikelihood(int32_t fix_allele,
@@ -129,87 +165,82 @@ void LikelihoodMaximizer::PlotLikelihood(int32_t fix_allele,
                                           int32_t ref_count){
   double gt_ll;
   for (int32_t var_allele = start; var_allele <= end; var_allele+=step){
-    GetGenotypeNegLogLikelihood(fix_allele, var_allele, read_len, motif_len, ref_count, false, &gt_ll);
+    GetCachedGenotypeNegLogLikelihood(fix_allele, var_allele, read_len, motif_len, ref_count, false, &gt_ll);
     //    plotfile_ << fix_allele << "\t" << var_allele << "\t"
     //    << gt_ll << endl;
   }
 }
 
 void LikelihoodMaximizer::PrintReadPool(){
-  if (resampled_pool.size() == read_pool.size()){
-    vector<ReadRecord>::iterator resamp_rec = resampled_pool.begin();
-    for (vector<ReadRecord>::iterator rec = read_pool.begin();
-          rec != read_pool.end(); rec++){
-      cerr<<rec->read_type<<"\t"<<rec->data<<"\t|\t"
-          <<resamp_rec->read_type<<"\t"<<resamp_rec->data<<endl;
-      resamp_rec++;
+  bool print_resampled = (resampled_counts_.size() == read_pool.size());
+  for (std::size_t i = 0; i < read_pool.size(); i++){
+    cerr<<read_pool[i].read_type<<"\t"<<read_pool[i].data<<"\t"<<read_pool[i].count;
+    if (print_resampled){
+      cerr<<"\t|\t"<<resampled_counts_[i];
     }
-  }
-  else{
-    for (vector<ReadRecord>::iterator rec = read_pool.begin();
-          rec != read_pool.end(); rec++){
-      cerr<<rec->read_type<<"\t"<<rec->data<<endl;
-    } 
+    cerr<<endl;
   }
 }
 
+/*
+  Resample read pool with replacement.
+
+  Drawing read_pool_size_ reads with replacement is the same as drawing
+  multinomial counts for each distinct record, so resampled classes are
+  filled with new counts instead of copies of each read.
+ */
 void LikelihoodMaximizer::ResampleReadPool(){
   //gsl_rng_set(r, options->seed);   // Seed reset! ~~
-  int32_t pool_size = read_pool.size();
-  if (!resampled_pool.empty()){
-    resampled_pool.clear();
+  std::size_t num_records = read_pool.size();
+  resampled_counts_.resize(num_records);
+  pool_weights_.resize(num_records);
+  for (std::size_t i = 0; i < num_records; i++){
+    pool_weights_[i] = read_pool[i].count;
+  }
+  if (num_records > 0){
+    gsl_ran_multinomial(r, num_records, read_pool_size_, &pool_weights_[0], &resampled_counts_[0]);
   }
-  resampled_pool.resize(pool_size);
 
-  gsl_ran_sample(r, &resampled_pool[0], pool_size, &read_pool[0], pool_size, sizeof(ReadRecord));
-  
   resampled_enclosing_class_.Reset();
   resampled_frr_class_.Reset();
   resampled_spanning_class_.Reset();
   resampled_flanking_class_.Reset();
-  for (vector<ReadRecord>::iterator rec = resampled_pool.begin();
-        rec != resampled_pool.end(); rec ++){
-    if (rec->read_type == RC_ENCL){
-      resampled_enclosing_class_.AddData(rec->data);
+  gt_ll_cache_[1].clear();
+  for (std::size_t i = 0; i < num_records; i++){
+    const ReadRecord& rec = read_pool[i];
+    int32_t count = resampled_counts_[i];
+    if (rec.read_type == RC_ENCL){
+      resampled_enclosing_class_.AddData(rec.data, count);
     }
-    else if (rec->read_type == RC_FRR){
-      resampled_frr_class_.AddData(rec->data);
+    else if (rec.read_type == RC_FRR){
+      resampled_frr_class_.AddData(rec.data, count);
     }
-    else if (rec->read_type == RC_SPAN){
-      resampled_spanning_class_.AddData(rec->data);
+    else if (rec.read_type == RC_SPAN){
+      resampled_spanning_class_.AddData(rec.data, count);
     }
-    else if (rec->read_type == RC_BOUND){
-      resampled_flanking_class_.AddData(rec->data);
+    else if (rec.read_type == RC_BOUND){
+      resampled_flanking_class_.AddData(rec.data, count);
     }
   }
 
   //PrintReadPool();
 }
 
-bool LikelihoodMaximizer::GetConfidenceInterval(const int32_t& read_len, 
-						const int32_t& motif_len,
-						const int32_t& ref_count,
-						const int32_t& all1,
-						const int32_t& all2,
-						const Locus& locus,
-						double* lob1, double* hib1, double* lob2, double* hib2){
-  int32_t allele1, allele2;
-  // TODO allow change of alpha
-  double alpha = 0.05;   // Tail error on each end
-  if (all1 > all2){
-    allele2 = all1;
-    allele1 = all2;
-  }
-  else{
-    allele1 = all1;
-    allele2 = all2;
-  }
-  int32_t num_boot_samp = options->num_boot_samp;
+bool LikelihoodMaximizer::RunBootstrapReplicates(const int32_t& first, const int32_t& step,
+						 const int32_t& num_samples,
+						 const int32_t& read_len, const int32_t& motif_len,
+						 const int32_t& ref_count,
+						 const int32_t& allele1, const int32_t& allele2,
+						 std::vector<int32_t>* small_alleles,
+						 std::vector<int32_t>* large_alleles) {
   int32_t boot_al1_1, boot_al1_2, boot_al2_1, boot_al2_2;
   int32_t boot_al1, boot_al2;
   double min_negLike;
-  std::vector<int32_t> small_alleles, large_alleles;
-  for (int i = 0; i < num_boot_samp + 1; i++){
+  for (int32_t i = first; i < num_samples; i += step){
+    STATS_COUNT(STATS_BOOTSTRAP_REPLICATES, 1);
+    // Every replicate has its own random stream, so results do not
+    // depend on how replicates are split between threads
+    gsl_rng_set(r, bootstrapSeed(options->seed, i));
     ResampleReadPool();
     if (options->ploidy == 2){
       OptimizeLikelihood(read_len, motif_len, ref_count, 
@@ -218,9 +249,6 @@ bool LikelihoodMaximizer::GetConfidenceInterval(const int32_t& read_len,
       OptimizeLikelihood(read_len, motif_len, ref_count, 
 			 true, 1, allele2, offtarget_share, 
 			 &boot_al1_1, &boot_al1_2, &min_negLike);
-      
-      //cerr << allele1 << ":\t" << boot_al2_1 << "\t" << boot_al2_2 << "\n"
-      //	   << allele2 << ":\t" << boot_al1_1 << "\t" << boot_al1_2 << "\n";
       if (boot_al1_1 == allele2)
 	boot_al1 = boot_al1_2;
       else if (boot_al1_2 == allele2)
@@ -234,39 +262,240 @@ bool LikelihoodMaximizer::GetConfidenceInterval(const int32_t& read_len,
 	boot_al2 = boot_al2_1;
       else
 	cerr<< "Hell Na\n";
-      double gt_ll1, gt_ll2;
-      // PrintReadPool();
-      //GetGenotypeNegLogLikelihood(allele1, boot_al1, read_len, motif_len, ref_count, true, &gt_ll1);
-      //GetGenotypeNegLogLikelihood(allele2, boot_al1, read_len, motif_len, ref_count, true, &gt_ll2);
-      //cerr << allele1 << ", "<< boot_al2 << "\t" << gt_ll1  << "\n";
-      //cerr << allele2 << ", "<< boot_al1 << "\t" << gt_ll2  << "\n";
-      // cerr << allele1 << "\t" << boot_al1 << endl;
-      // cerr << allele2 << "\t" << boot_al2 << endl;
     }
     else{ // haploid
       OptimizeLikelihood(read_len, motif_len, ref_count, 
 			 true, 1, 0, offtarget_share, 
 			 &boot_al1, &boot_al2, &min_negLike);
     }
-    // cerr<<min(boot_al1, boot_al2)<<"\t"<<max(boot_al1, boot_al2)<<endl;
-    // small_alleles.push_back(min(boot_al1, boot_al2) - allele1);
-    // large_alleles.push_back(max(boot_al1, boot_al2) - allele2);
-    
-    small_alleles.push_back(boot_al1);
-    large_alleles.push_back(boot_al2);
-    if (options->output_bootstrap) {
-      bsfile_ << locus.chrom << "\t" << locus.start << "\t" << locus.end << "\t"
-	      << min(boot_al1, boot_al2) << "\t" << max(boot_al1, boot_al2) << endl;
+    (*small_alleles)[i] = boot_al1;
+    (*large_alleles)[i] = boot_al2;
+  }
+  return true;
+}
+
+/*
+  First pass of --screen. A locus is reference-like if its reads are
+  explained by at most ploidy alleles short enough to be enclosed:
+  - no FRR or off-target reads, which only come from alleles longer
+    than a read
+  - at least SCREEN_MIN_ENCLOSING enclosing reads, at least
+    SCREEN_MIN_CONSENSUS of them at a called copy number and the rest
+    one unit away from one (stutter)
+  - no flanking read with more copies than the longest called allele
+  - a mean spanning insert size consistent with the call
+  The calls are the most common enclosing copy numbers. A second allele
+  needs SCREEN_MIN_ALLELE_SHARE of the enclosing reads.
+ */
+bool LikelihoodMaximizer::ScreenGenotype(const int32_t& motif_len, const int32_t& ref_count,
+					 const int32_t& ploidy, int32_t* allele1, int32_t* allele2) {
+  if (frr_class_.GetDataSize() > 0 || offtarget_class_.GetDataSize() > 0) {
+    return false;
+  }
+  std::size_t num_enclosing = enclosing_class_.GetDataSize();
+  if (num_enclosing < SCREEN_MIN_ENCLOSING) {
+    return false;
+  }
+
+  // Two most common enclosing copy numbers, ties going to the shorter
+  int32_t best = -1, second = -1;
+  int32_t best_count = 0, second_count = 0;
+  for (std::vector<ReadRecord>::const_iterator it = read_pool.begin();
+       it != read_pool.end(); it++) {
+    if (it->read_type != RC_ENCL) {
+      continue;
+    }
+    if (it->count > best_count || (it->count == best_count && it->data < best)) {
+      second = best;
+      second_count = best_count;
+      best = it->data;
+      best_count = it->count;
+    } else if (it->count > second_count || (it->count == second_count && it->data < second)) {
+      second = it->data;
+      second_count = it->count;
     }
   }
-  std::sort(small_alleles.begin(), small_alleles.end());
-  std::sort(large_alleles.begin(), large_alleles.end());
+  *allele1 = best;
+  *allele2 = best;
+  if (ploidy == 2 && second_count >= SCREEN_MIN_ALLELE_SHARE * num_enclosing) {
+    *allele1 = std::min(best, second);
+    *allele2 = std::max(best, second);
+  }
 
-  // Bootstrapping method from Davison and Hinkley 1997
-  *lob1 = small_alleles.at(int((alpha / 2.0)  * (num_boot_samp + 1)));
-  *hib1 = small_alleles.at(int((1.0 - alpha / 2.0) * (num_boot_samp + 1)));
-  *lob2 = large_alleles.at(int((alpha / 2.0) * (num_boot_samp + 1)));
-  *hib2 = large_alleles.at(int((1.0 - alpha / 2.0) * (num_boot_samp + 1)));
+  std::size_t num_called = 0;
+  std::size_t num_spanning = 0;
+  double insert_sum = 0;
+  for (std::vector<ReadRecord>::const_iterator it = read_pool.begin();
+       it != read_pool.end(); it++) {
+    if (it->read_type == RC_ENCL) {
+      if (it->data == *allele1 || it->data == *allele2) {
+	num_called += it->count;
+      } else if (abs(it->data - *allele1) > 1 && abs(it->data - *allele2) > 1) {
+	return false;
+      }
+    } else if (it->read_type == RC_BOUND && it->data > *allele2) {
+      return false;
+    } else if (it->read_type == RC_SPAN) {
+      insert_sum += (double) it->data * it->count;
+      num_spanning += it->count;
+    }
+  }
+  if (num_called < SCREEN_MIN_CONSENSUS * num_enclosing) {
+    return false;
+  }
+  if (num_spanning > 0) {
+    double called_count = (ploidy == 2 ? 0.5 * (*allele1 + *allele2) : *allele1);
+    double expected = options->dist_mean - motif_len * (called_count - ref_count);
+    double std_err = options->dist_sdev / sqrt((double) num_spanning);
+    if (fabs(insert_sum / num_spanning - expected) > SCREEN_MAX_SPANNING_Z * std_err) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void LikelihoodMaximizer::RunBootstrapBatch(const int32_t& begin, const int32_t& end,
+					    const int32_t& read_len, const int32_t& motif_len,
+					    const int32_t& ref_count,
+					    const int32_t& allele1, const int32_t& allele2,
+					    std::vector<int32_t>* small_alleles,
+					    std::vector<int32_t>* large_alleles) {
+  int32_t num_boot_threads = options->num_boot_threads;
+  if (num_boot_threads > end - begin) {
+    num_boot_threads = end - begin;
+  }
+  if (num_boot_threads <= 1) {
+    RunBootstrapReplicates(begin, 1, end, read_len, motif_len, ref_count,
+			   allele1, allele2, small_alleles, large_alleles);
+    return;
+  }
+  // Each extra thread works on its own copy of the read data so that
+  // resampled classes are never shared
+  while ((int32_t)boot_helpers_.size() < num_boot_threads - 1) {
+    boot_helpers_.push_back(new LikelihoodMaximizer(*options, bsout_));
+  }
+  // Helpers only copy the read pool and enclosing reads, so the
+  // --optimizer discrete table is built here and shared
+  const discrete_bounds* bounds = NULL;
+  if (options->optimizer == "discrete") {
+    int32_t lower, upper;
+    GetDiscreteSearchWindow(read_len, motif_len, ref_count, 1, OPTIMIZER_UPPER_BOUND,
+			    &lower, &upper);
+    bounds = GetDiscreteBounds(read_len, motif_len, ref_count, lower, upper);
+  }
+  std::vector<bootstrap_data> thread_data(num_boot_threads);
+  std::vector<pthread_t> threads(num_boot_threads);
+  for (int32_t t = 0; t < num_boot_threads; t++) {
+    LikelihoodMaximizer* lm_ptr = this;
+    if (t > 0) {
+      lm_ptr = boot_helpers_[t - 1];
+      lm_ptr->parent_discrete_bounds_ = bounds;
+      lm_ptr->enclosing_class_ = enclosing_class_;
+      lm_ptr->offtarget_class_ = offtarget_class_;
+      lm_ptr->read_pool = read_pool;
+      lm_ptr->read_pool_index_ = read_pool_index_;
+      lm_ptr->read_pool_size_ = read_pool_size_;
+      lm_ptr->gt_ll_cache_[0].clear();
+      lm_ptr->offtarget_share = offtarget_share;
+    }
+    thread_data[t].lm_ptr = lm_ptr;
+    thread_data[t].first = begin + t;
+    thread_data[t].step = num_boot_threads;
+    thread_data[t].num_samples = end;
+    thread_data[t].read_len = read_len;
+    thread_data[t].motif_len = motif_len;
+    thread_data[t].ref_count = ref_count;
+    thread_data[t].allele1 = allele1;
+    thread_data[t].allele2 = allele2;
+    thread_data[t].small_alleles = small_alleles;
+    thread_data[t].large_alleles = large_alleles;
+    thread_data[t].collect_stats = (t > 0 && LocusStats::Current() != NULL);
+  }
+  for (int32_t t = 1; t < num_boot_threads; t++) {
+    if (pthread_create(&threads[t], NULL, bootstrapThread, &thread_data[t]) != 0) {
+      PrintMessageDieOnError("Failed to create bootstrap thread", M_ERROR);
+    }
+  }
+  bootstrapThread(&thread_data[0]);
+  for (int32_t t = 1; t < num_boot_threads; t++) {
+    pthread_join(threads[t], NULL);
+    STATS_ADD(thread_data[t].stats);
+  }
+}
+
+/*
+  Percentile bootstrap confidence intervals for both alleles.
+
+  By default num_boot_samp + 1 replicates are run. With
+  --bootstrap-adaptive they are run in batches of --bootstrap-batch, up to
+  the same maximum, and the run stops once the interval bounds computed
+  after each of BOOT_STABLE_BATCHES batches in a row have moved by at most
+  --bootstrap-tol copies. Replicate i always uses the same random stream,
+  so the interval from n adaptive replicates is the one a fixed run of n
+  replicates gives. num_replicates is set to the number of replicates used.
+ */
+bool LikelihoodMaximizer::GetConfidenceInterval(const int32_t& read_len, 
+						const int32_t& motif_len,
+						const int32_t& ref_count,
+						const int32_t& all1,
+						const int32_t& all2,
+						const Locus& locus,
+						double* lob1, double* hib1, double* lob2, double* hib2,
+						int32_t* num_replicates){
+  int32_t allele1, allele2;
+  // TODO allow change of alpha
+  double alpha = 0.05;   // Tail error on each end
+  if (all1 > all2){
+    allele2 = all1;
+    allele1 = all2;
+  }
+  else{
+    allele1 = all1;
+    allele2 = all2;
+  }
+  int32_t max_samples = options->num_boot_samp + 1;
+  std::vector<int32_t> small_alleles(max_samples), large_alleles(max_samples);
+  int32_t num_samples = 0;
+  if (!options->adaptive_boot) {
+    RunBootstrapBatch(0, max_samples, read_len, motif_len, ref_count,
+		      allele1, allele2, &small_alleles, &large_alleles);
+    num_samples = max_samples;
+  }
+  else {
+    double prev_bounds[4] = {0, 0, 0, 0};
+    int32_t stable_batches = 0;
+    while (num_samples < max_samples && stable_batches < BOOT_STABLE_BATCHES) {
+      int32_t batch_end = min(num_samples + options->boot_batch, max_samples);
+      RunBootstrapBatch(num_samples, batch_end, read_len, motif_len, ref_count,
+			allele1, allele2, &small_alleles, &large_alleles);
+      double bounds[4];
+      GetBootstrapQuantiles(small_alleles, large_alleles, batch_end, alpha,
+			    &bounds[0], &bounds[1], &bounds[2], &bounds[3]);
+      if (num_samples > 0) {
+	bool stable = true;
+	for (int k = 0; k < 4; k++) {
+	  if (fabs(bounds[k] - prev_bounds[k]) > options->boot_tol) {
+	    stable = false;
+	  }
+	}
+	stable_batches = (stable ? stable_batches + 1 : 0);
+      }
+      for (int k = 0; k < 4; k++) {
+	prev_bounds[k] = bounds[k];
+      }
+      num_samples = batch_end;
+    }
+  }
+  if (options->output_bootstrap) {
+    for (int32_t i = 0; i < num_samples; i++) {
+      (*bsout_) << locus.chrom << "\t" << locus.start << "\t" << locus.end << "\t"
+		<< min(small_alleles[i], large_alleles[i]) << "\t"
+		<< max(small_alleles[i], large_alleles[i]) << endl;
+    }
+  }
+  GetBootstrapQuantiles(small_alleles, large_alleles, num_samples, alpha,
+			lob1, hib1, lob2, hib2);
+  *num_replicates = num_samples;
 
   // TODO 0.9 or 0.1? allele1 -/+ lob1?
   // TODO allow change of 0.9 and 0.1
@@ -295,7 +524,7 @@ std::size_t LikelihoodMaximizer::GetOffTargetDataSize() {
   return offtarget_class_.GetDataSize();
 }
 std::size_t LikelihoodMaximizer::GetReadPoolSize() {
-  return read_pool.size();
+  return read_pool_size_;
 }
 
 bool LikelihoodMaximizer::GetGenotypeNegLogLikelihood(const int32_t& allele1,
@@ -305,6 +534,7 @@ bool LikelihoodMaximizer::GetGenotypeNegLogLikelihood(const int32_t& allele1,
 						      const int32_t& ref_count,
 						      const bool& resampled,
 						      double* gt_ll) {
+  STATS_COUNT(STATS_LIKELIHOOD_EVALS, 1);
   double frr_count_ll = 0.0, frr_ll, span_ll, encl_ll, flank_ll = 0.0;
   double count_weight = .01 * options->coverage;
   double cov = options -> coverage;
@@ -395,6 +625,312 @@ bool LikelihoodMaximizer::GetGenotypeNegLogLikelihood(const int32_t& allele1,
   return true;
 }
 
+/*
+  Same as GetGenotypeNegLogLikelihood, but looks up the genotype in the
+  per-locus cache first. The optimizers evaluate the same integer
+  genotypes many times.
+ */
+bool LikelihoodMaximizer::GetCachedGenotypeNegLogLikelihood(const int32_t& allele1,
+							    const int32_t& allele2,
+							    const int32_t& read_len,
+							    const int32_t& motif_len,
+							    const int32_t& ref_count,
+							    const bool& resampled,
+							    double* gt_ll) {
+  std::pair<int32_t, int32_t> key(allele1, allele2);
+  // Diploid likelihood is symmetric in the two alleles
+  if (options->ploidy == 2 && allele1 > allele2) {
+    key = std::pair<int32_t, int32_t>(allele2, allele1);
+  }
+  std::map<std::pair<int32_t, int32_t>, double>& cache = gt_ll_cache_[resampled ? 1 : 0];
+  std::map<std::pair<int32_t, int32_t>, double>::iterator it = cache.find(key);
+  if (it != cache.end()) {
+    gt_cache_hits_++;
+    *gt_ll = it->second;
+    return true;
+  }
+  gt_cache_misses_++;
+  if (!GetGenotypeNegLogLikelihood(allele1, allele2, read_len, motif_len, ref_count,
+				   resampled, gt_ll)) {
+    return false;
+  }
+  cache[key] = *gt_ll;
+  return true;
+}
+
+void LikelihoodMaximizer::GetGenotypeCacheStats(int64_t* hits, int64_t* misses) {
+  *hits = gt_cache_hits_;
+  *misses = gt_cache_misses_;
+  for (size_t i = 0; i < boot_helpers_.size(); i++) {
+    *hits += boot_helpers_[i]->gt_cache_hits_;
+    *misses += boot_helpers_[i]->gt_cache_misses_;
+  }
+}
+
+/*
+  Copy numbers the reads of the locus can support, searched by
+  --optimizer discrete. The window is taken from the original reads,
+  so bootstrap replicates search the same window:
+  - lower: DISCRETE_MARGIN below the shortest enclosing read. Without
+    enclosing reads a short allele is only seen through spanning reads,
+    so the window starts at lower_bound
+  - upper: the largest of
+    * DISCRETE_MARGIN above the longest enclosing or flanking read
+    * the allele that puts the shortest spanning insert DISCRETE_SPAN_Z
+      standard deviations above its expected size
+    * with FRR reads, DISCRETE_MARGIN above the shortest allele that
+      gives FRR reads and, if the FRR count is modelled, the allele that
+      alone expects DISCRETE_FRR_Z standard deviations more FRR reads
+      than observed. Without coverage it is upper_bound
+  Both are clipped to [lower_bound, upper_bound].
+ */
+void LikelihoodMaximizer::GetDiscreteSearchWindow(const int32_t& read_len,
+						  const int32_t& motif_len,
+						  const int32_t& ref_count,
+						  const int32_t& lower_bound,
+						  const int32_t& upper_bound,
+						  int32_t* lower, int32_t* upper) {
+  int32_t min_enclosing = -1, max_repeat = -1, min_insert = -1;
+  for (std::vector<ReadRecord>::const_iterator it = read_pool.begin();
+       it != read_pool.end(); it++) {
+    if (it->read_type == RC_ENCL) {
+      if (min_enclosing < 0 || it->data < min_enclosing) {
+	min_enclosing = it->data;
+      }
+      max_repeat = max(max_repeat, it->data);
+    } else if (it->read_type == RC_BOUND) {
+      max_repeat = max(max_repeat, it->data);
+    } else if (it->read_type == RC_SPAN) {
+      if (min_insert < 0 || it->data < min_insert) {
+	min_insert = it->data;
+      }
+    }
+  }
+  *lower = (min_enclosing < 0 ? lower_bound : min_enclosing - DISCRETE_MARGIN);
+  *upper = max_repeat + DISCRETE_MARGIN;
+  if (min_insert >= 0) {
+    double span_allele = ref_count + (options->dist_mean + DISCRETE_SPAN_Z * options->dist_sdev
+				      - min_insert) / motif_len;
+    *upper = max(*upper, (int32_t) ceil(span_allele));
+  }
+  // Counted from the read pool, which bootstrap helpers share
+  double frr_count = 0;
+  for (std::vector<ReadRecord>::const_iterator it = read_pool.begin();
+       it != read_pool.end(); it++) {
+    if (it->read_type == RC_FRR || it->read_type == RC_OFFT) {
+      frr_count += it->count;
+    }
+  }
+  if (frr_count > 0) {
+    *upper = max(*upper, (int32_t) ceil(double(read_len) / motif_len) + DISCRETE_MARGIN);
+    if (options->use_cov && options->coverage > 0) {
+      double max_count = frr_count + DISCRETE_FRR_Z * sqrt(frr_count) + DISCRETE_FRR_Z * DISCRETE_FRR_Z;
+      double frr_allele = (max_count * 2.0 * read_len / options->coverage + read_len) / motif_len;
+      *upper = max(*upper, (int32_t) ceil(frr_allele));
+    }
+    else {
+      *upper = upper_bound;
+    }
+  }
+  *lower = max(*lower, lower_bound);
+  *upper = min(*upper, upper_bound);
+  if (*upper < *lower) {
+    *upper = *lower;
+  }
+}
+
+/*
+  Builds the --optimizer discrete table of the window [lower, upper], or
+  returns the one already built for it. Rows are the data values of the
+  read pool, so the table also serves the resampled read pools of the
+  locus. Log likelihoods come from the classes of the original reads
+  (FlankingClass has none without flanking reads).
+ */
+const discrete_bounds* LikelihoodMaximizer::GetDiscreteBounds(const int32_t& read_len,
+							      const int32_t& motif_len,
+							      const int32_t& ref_count,
+							      const int32_t& lower,
+							      const int32_t& upper) {
+  const discrete_bounds* tables[2] = {parent_discrete_bounds_, &discrete_bounds_};
+  for (int i = 0; i < 2; i++) {
+    const discrete_bounds* table = tables[i];
+    if (table != NULL && table->built && table->read_len == read_len &&
+	table->motif_len == motif_len && table->ref_count == ref_count &&
+	table->lower == lower && table->upper == upper &&
+	table->num_records == read_pool.size()) {
+      return table;
+    }
+  }
+  STATS_COUNT(STATS_DISCRETE_TABLE_ALLELES, upper - lower + 1);
+  const ReadType types[4] = {RC_FRR, RC_SPAN, RC_ENCL, RC_BOUND};
+  ReadClass* classes[4] = {&frr_class_, &spanning_class_, &enclosing_class_, &flanking_class_};
+  discrete_bounds& table = discrete_bounds_;
+  table.built = true;
+  table.read_len = read_len;
+  table.motif_len = motif_len;
+  table.ref_count = ref_count;
+  table.lower = lower;
+  table.upper = upper;
+  table.num_records = read_pool.size();
+  table.num_rows = 0;
+  for (int c = 0; c < 4; c++) {
+    table.values[c].clear();
+    for (std::vector<ReadRecord>::const_iterator it = read_pool.begin();
+	 it != read_pool.end(); it++) {
+      if (it->read_type == types[c]) {
+	table.values[c].push_back(it->data);
+      }
+    }
+    std::sort(table.values[c].begin(), table.values[c].end());
+    table.first_row[c] = table.num_rows;
+    table.num_rows += table.values[c].size();
+  }
+  table.num_leaves = 1;
+  while (table.num_leaves < upper - lower + 1) {
+    table.num_leaves *= 2;
+  }
+  std::size_t num_nodes = 2 * table.num_leaves;
+  table.node_lo.assign(num_nodes, 0);
+  table.node_hi.assign(num_nodes, 0);
+  table.max_ll.assign(num_nodes * table.num_rows, -HUGE_VAL);
+  table.failed.assign(num_nodes, 0);
+  for (int32_t i = 0; i < table.num_leaves; i++) {
+    int32_t leaf = table.num_leaves + i;
+    int32_t allele = lower + i;
+    table.node_lo[leaf] = table.node_hi[leaf] = allele;
+    if (allele > upper) {
+      continue;
+    }
+    for (int c = 0; c < 4; c++) {
+      for (std::size_t j = 0; j < table.values[c].size(); j++) {
+	double* ll = &table.max_ll[leaf * table.num_rows + table.first_row[c] + j];
+	if (!classes[c]->GetDataLogLikelihood(allele, table.values[c][j], read_len,
+					      motif_len, ref_count, ll)) {
+	  table.failed[leaf] = 1;
+	}
+      }
+    }
+  }
+  for (int32_t node = table.num_leaves - 1; node >= 1; node--) {
+    table.node_lo[node] = table.node_lo[2 * node];
+    table.node_hi[node] = min(table.node_hi[2 * node + 1], upper);
+    table.failed[node] = table.failed[2 * node] || table.failed[2 * node + 1];
+    for (std::size_t row = 0; row < table.num_rows; row++) {
+      table.max_ll[node * table.num_rows + row] =
+	max(table.max_ll[2 * node * table.num_rows + row],
+	    table.max_ll[(2 * node + 1) * table.num_rows + row]);
+    }
+  }
+  return &table;
+}
+
+bool LikelihoodMaximizer::GetDiscreteAlleleColumn(const discrete_bounds& bounds,
+						  const int32_t& allele,
+						  const bool& resampled,
+						  std::vector<double>* column) {
+  STATS_COUNT(STATS_DISCRETE_TABLE_ALLELES, 1);
+  ReadClass* classes[4] = {&frr_class_, &spanning_class_, &enclosing_class_, &flanking_class_};
+  if (resampled) {
+    classes[0] = &resampled_frr_class_;
+    classes[1] = &resampled_spanning_class_;
+    classes[2] = &resampled_enclosing_class_;
+    classes[3] = &resampled_flanking_class_;
+  }
+  column->assign(bounds.num_rows, -HUGE_VAL);
+  for (int c = 0; c < 4; c++) {
+    for (std::size_t j = 0; j < bounds.values[c].size(); j++) {
+      if (!classes[c]->GetDataLogLikelihood(allele, bounds.values[c][j], bounds.read_len,
+					    bounds.motif_len, bounds.ref_count,
+					    &(*column)[bounds.first_row[c] + j])) {
+	return false;
+      }
+    }
+  }
+  return true;
+}
+
+/*
+  Lower bound of GetGenotypeNegLogLikelihood over a range of genotypes.
+  Each read term of GetClassLogLikelihood grows with the log likelihoods
+  of both alleles, so it is at most the term of the row maxima ll1 and
+  ll2, plus DISCRETE_LSE_SLACK for the error of fast_log_sum_exp. The FRR
+  count term is at most the Poisson log likelihood at the expected count
+  of the range closest to the observed count. Returns false if some read
+  has no row in bounds.
+ */
+bool LikelihoodMaximizer::GetGenotypeNegLogLikelihoodBound(const discrete_bounds& bounds,
+							   const double* ll1, const int32_t& lo1,
+							   const int32_t& hi1,
+							   const double* ll2, const int32_t& lo2,
+							   const int32_t& hi2,
+							   const bool& resampled, double* bound) {
+  STATS_COUNT(STATS_DISCRETE_BOUND_EVALS, 1);
+  if (lo1 < 0 || lo2 < 0) {
+    // Genotypes with a negative allele are not scored by the classes
+    *bound = -HUGE_VAL;
+    return true;
+  }
+  ReadClass* classes[4] = {&frr_class_, &spanning_class_, &enclosing_class_, &flanking_class_};
+  FRRClass* frr_class = &frr_class_;
+  if (resampled) {
+    classes[0] = frr_class = &resampled_frr_class_;
+    classes[1] = &resampled_spanning_class_;
+    classes[2] = &resampled_enclosing_class_;
+    classes[3] = &resampled_flanking_class_;
+  }
+  const double weights[4] = {options->frr_weight, options->spanning_weight,
+			     options->enclosing_weight, options->flanking_weight};
+  int offtarget_count = offtarget_class_.GetDataSize();
+  int frr_count = frr_class->GetDataSize();
+  int read_count = frr_count + 2 * offtarget_count;
+  for (int c = 1; c < 4; c++) {
+    read_count += classes[c]->GetDataSize();
+  }
+  if (read_count == 0) {
+    *bound = frr_class_.NEG_INF;
+    return true;
+  }
+  double log_weight = log(0.5);  // Allele weights of ReadClass
+  double ll = 0;
+  for (int c = 0; c < 4; c++) {
+    if (weights[c] < 0) {
+      // Larger read likelihoods lower the class term
+      *bound = -HUGE_VAL;
+      return true;
+    }
+    const std::map<int32_t, int32_t>& data = classes[c]->GetData();
+    const std::vector<int32_t>& values = bounds.values[c];
+    std::size_t j = 0;
+    double class_ll = 0;
+    for (std::map<int32_t, int32_t>::const_iterator it = data.begin(); it != data.end(); it++) {
+      while (j < values.size() && values[j] < it->first) {
+	j++;
+      }
+      if (j == values.size() || values[j] != it->first) {
+	return false;
+      }
+      std::size_t row = bounds.first_row[c] + j;
+      if (options->ploidy == 2) {
+	double hi = max(ll1[row], ll2[row]), lo = min(ll1[row], ll2[row]);
+	double term = (hi == -HUGE_VAL ? hi : log_weight + hi + log1p(exp(lo - hi)));
+	class_ll += it->second * (term + DISCRETE_LSE_SLACK);
+      }
+      else if (options->ploidy == 1) {
+	class_ll += it->second * (log_weight + ll1[row]);
+      }
+    }
+    ll += weights[c] * class_ll;
+  }
+  double count_ll = 0.0;
+  if (options->use_cov && options->coverage > 0 && frr_count > 0) {
+    frr_class->GetMaxCountLogLikelihood(lo1, hi1, lo2, hi2, bounds.read_len, bounds.motif_len,
+					options->coverage, options->ploidy,
+					2 * offtarget_count * offtarget_share, &count_ll);
+  }
+  *bound = -1 * (1.0 / read_count * ll + .01 * options->coverage * count_ll) - DISCRETE_BOUND_TOL;
+  return true;
+}
+
 bool LikelihoodMaximizer::OptimizeLikelihood(const int32_t& read_len, 
 					     const int32_t& motif_len,
 					     const int32_t& ref_count, 
@@ -412,6 +948,11 @@ bool LikelihoodMaximizer::OptimizeLikelihood(const int32_t& read_len,
     }
    }
 
+  if (off_share != offtarget_share) {
+    // Cached likelihoods were computed with a different off-target share
+    gt_ll_cache_[0].clear();
+    gt_ll_cache_[1].clear();
+  }
   offtarget_share = off_share;
   int32_t a1, a2, result, temp;
   double minf;
@@ -420,12 +961,17 @@ bool LikelihoodMaximizer::OptimizeLikelihood(const int32_t& read_len,
   if (options->very_verbose) {
     PrintMessageDieOnError("\t\tExtracting enclosing alleles", M_PROGRESS);
   }
+  std::size_t enclosing_size = enclosing_class_.GetDataSize();
   this->enclosing_class_.ExtractEnclosingAlleles(&allele_list);
+  if (enclosing_class_.GetDataSize() != enclosing_size) {
+    // Dropped unrepeated enclosing reads change the likelihood
+    gt_ll_cache_[0].clear();
+  }
   if (options->very_verbose) {
     PrintMessageDieOnError("\t\tResample read pool", M_PROGRESS);
   }
   //ResampleReadPool();
-  int32_t upper_bound = 600; // TODO Change 200 for number depending the parameters
+  int32_t upper_bound = OPTIMIZER_UPPER_BOUND; // TODO Change 200 for number depending the parameters
   int32_t lower_bound_1d, lower_bound_2d;
   
   /*
@@ -441,6 +987,34 @@ bool LikelihoodMaximizer::OptimizeLikelihood(const int32_t& read_len,
 
   lower_bound_1d = 1;
   lower_bound_2d = 1;
+  bool use_discrete = (options->optimizer == "discrete");
+
+  if (use_discrete) {
+    // The search is exact over the window, which covers the 1D
+    // searches from each enclosing allele and the final allele list
+    int32_t lower, upper;
+    GetDiscreteSearchWindow(read_len, motif_len, ref_count, 1, upper_bound, &lower, &upper);
+    if (options->very_verbose) {
+      stringstream msg;
+      msg<<"\t\tDiscrete search over ["<<lower<<", "<<upper<<"]";
+      PrintMessageDieOnError(msg.str(), M_PROGRESS);
+    }
+    if (ploidy == 2) {
+      discrete_2D_optimize(read_len, motif_len, ref_count, lower, upper, resampled,
+			   this, allele1, allele2, min_negLike);
+    }
+    else {
+      discrete_1D_optimize(read_len, motif_len, ref_count, lower, upper, resampled,
+			   this, fix_allele, allele1, min_negLike);
+      *allele2 = fix_allele;
+    }
+    if (*allele1 > *allele2){
+      temp = *allele1;
+      *allele1 = *allele2;
+      *allele2 = temp;
+    }
+    return true;
+  }
 
   if (ploidy == 2){
     for (std::vector<int32_t>::iterator allele_it = allele_list.begin();
@@ -541,7 +1115,7 @@ bool LikelihoodMaximizer::findBestAlleleListTuple(std::vector<int32_t> allele_li
       for (std::vector<int32_t>::iterator a2_it = allele_list.begin();
             a2_it != allele_list.end();
             a2_it++){
-        GetGenotypeNegLogLikelihood(*a1_it, *a2_it, read_len, motif_len, ref_count, resampled, &gt_ll);
+        GetCachedGenotypeNegLogLikelihood(*a1_it, *a2_it, read_len, motif_len, ref_count, resampled, &gt_ll);
         // if (!resampled)
         //   cerr<<endl<<*a1_it<<"\t"<<*a2_it<<"\t"<<gt_ll<<endl;
           if (gt_ll < *min_negLike){
@@ -557,7 +1131,7 @@ bool LikelihoodMaximizer::findBestAlleleListTuple(std::vector<int32_t> allele_li
     for (std::vector<int32_t>::iterator a1_it = allele_list.begin();
             a1_it != allele_list.end();
             a1_it++){
-      GetGenotypeNegLogLikelihood(*a1_it, fix_allele, read_len, motif_len, ref_count, resampled, &gt_ll);
+      GetCachedGenotypeNegLogLikelihood(*a1_it, fix_allele, read_len, motif_len, ref_count, resampled, &gt_ll);
       // cerr<<">> "<<fix_allele<<"\t"<<*a1_it<<"\t"<<gt_ll<<endl;
       if (gt_ll < *min_negLike){
         *min_negLike = gt_ll;
@@ -575,15 +1149,55 @@ LikelihoodMaximizer::~LikelihoodMaximizer() {
   if (options->output_bootstrap) {
     bsfile_.close();
   }
+  for (size_t i = 0; i < boot_helpers_.size(); i++) {
+    delete boot_helpers_[i];
+  }
   gsl_rng_free(r);
 }
 
+void* bootstrapThread(void* data) {
+  bootstrap_data* d = (bootstrap_data*) data;
+  STATS_SCOPE(d->collect_stats ? &d->stats : LocusStats::Current());
+  d->lm_ptr->RunBootstrapReplicates(d->first, d->step, d->num_samples,
+				    d->read_len, d->motif_len, d->ref_count,
+				    d->allele1, d->allele2,
+				    d->small_alleles, d->large_alleles);
+  return NULL;
+}
+
+void GetBootstrapQuantiles(const std::vector<int32_t>& small_alleles,
+			   const std::vector<int32_t>& large_alleles,
+			   const int32_t& num_samples, const double& alpha,
+			   double* lob1, double* hib1, double* lob2, double* hib2) {
+  std::vector<int32_t> small_sorted(small_alleles.begin(), small_alleles.begin() + num_samples);
+  std::vector<int32_t> large_sorted(large_alleles.begin(), large_alleles.begin() + num_samples);
+  std::sort(small_sorted.begin(), small_sorted.end());
+  std::sort(large_sorted.begin(), large_sorted.end());
+
+  // Bootstrapping method from Davison and Hinkley 1997
+  *lob1 = small_sorted.at(int((alpha / 2.0) * num_samples));
+  *hib1 = small_sorted.at(int((1.0 - alpha / 2.0) * num_samples));
+  *lob2 = large_sorted.at(int((alpha / 2.0) * num_samples));
+  *hib2 = large_sorted.at(int((1.0 - alpha / 2.0) * num_samples));
+}
+
+unsigned long bootstrapSeed(const int32_t& seed, const int32_t& replicate) {
+  // splitmix64 finalizer, so that neighbouring replicates get unrelated streams
+  uint64_t z = ((uint64_t)(uint32_t)seed << 32) + (uint64_t)replicate + 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z = z ^ (z >> 31);
+  // gsl_rng_set treats 0 as the generator's default seed
+  return (unsigned long)(z & 0xFFFFFFFFUL) + 1;
+}
+
 double nloptNegLikelihood(unsigned n, const double *x, double *grad, void *data)
 {
   if (grad) {
         cerr<< "No grad!"<<endl;
         return 0.0;
   }
+  STATS_COUNT(STATS_NLOPT_EVALS, 1);
   nlopt_data *d = (nlopt_data *) data;
   int read_len  = d -> read_len;
   int motif_len = d -> motif_len;
@@ -594,7 +1208,7 @@ double nloptNegLikelihood(unsigned n, const double *x, double *grad, void *data)
   double gt_ll;
   if (n == 2){
     double A = x[0], B = x[1];
-    if(!lm_ptr->GetGenotypeNegLogLikelihood(A, B, read_len, motif_len, ref_count, resampled, &gt_ll))
+    if(!lm_ptr->GetCachedGenotypeNegLogLikelihood(A, B, read_len, motif_len, ref_count, resampled, &gt_ll))
       return -100.0;
     else{
       return gt_ll;
@@ -602,7 +1216,7 @@ double nloptNegLikelihood(unsigned n, const double *x, double *grad, void *data)
   }
   else{
     double A = x[0], B = fix_allele;
-    if(!lm_ptr->GetGenotypeNegLogLikelihood(A, B, read_len, motif_len, ref_count, resampled, &gt_ll))
+    if(!lm_ptr->GetCachedGenotypeNegLogLikelihood(A, B, read_len, motif_len, ref_count, resampled, &gt_ll))
       return -100.0;
     else{
       return gt_ll;
@@ -695,6 +1309,197 @@ return true;  // TODO add false
 }
 
 
+// Objective of the discrete search. Returns false if the likelihood
+// could not be computed
+static bool discreteNegLikelihood(LikelihoodMaximizer* lm_ptr,
+				  const int32_t& allele1, const int32_t& allele2,
+				  const int32_t& read_len, const int32_t& motif_len,
+				  const int32_t& ref_count, const bool& resampled,
+				  double* gt_ll) {
+  STATS_COUNT(STATS_DISCRETE_EVALS, 1);
+  return lm_ptr->GetCachedGenotypeNegLogLikelihood(allele1, allele2, read_len, motif_len,
+						   ref_count, resampled, gt_ll);
+}
+
+// Range of genotypes waiting in the discrete search: node1 x node2 of
+// the bounds tree (node2 < 0 for the fixed allele of the 1D search)
+struct discrete_range{
+  double bound;
+  int32_t node1, node2;
+  // std::priority_queue pops the largest element, here the lowest bound
+  bool operator<(const discrete_range& other) const {
+    return bound > other.bound;
+  }
+};
+
+// Row log likelihoods of a node of bounds
+static const double* discreteNodeLL(const discrete_bounds& bounds, const int32_t& node) {
+  return bounds.num_rows == 0 ? NULL : &bounds.max_ll[node * bounds.num_rows];
+}
+
+// Depth of a node of the bounds tree (0 for the root)
+static int32_t discreteNodeDepth(int32_t node) {
+  int32_t depth = 0;
+  while (node > 1) {
+    node /= 2;
+    depth++;
+  }
+  return depth;
+}
+
+// Bound node1 x (ll2, lo2, hi2) and queue it unless it cannot beat best.
+// Ranges without a bound are always searched
+static void discreteQueueRange(LikelihoodMaximizer* lm_ptr, const discrete_bounds& bounds,
+			       const int32_t& node1, const int32_t& node2,
+			       const double* ll2, const int32_t& lo2, const int32_t& hi2,
+			       const bool& failed2, const bool& resampled, const double& best,
+			       std::priority_queue<discrete_range>* queue) {
+  if (bounds.node_lo[node1] > bounds.upper ||
+      (node2 >= 0 && bounds.node_lo[node2] > bounds.upper)) {
+    return;  // Padding beyond the window
+  }
+  discrete_range range;
+  range.node1 = node1;
+  range.node2 = node2;
+  if (failed2 || bounds.failed[node1] ||
+      !lm_ptr->GetGenotypeNegLogLikelihoodBound(bounds, discreteNodeLL(bounds, node1),
+						bounds.node_lo[node1], bounds.node_hi[node1],
+						ll2, lo2, hi2, resampled, &range.bound) ||
+      range.bound != range.bound) {
+    range.bound = -HUGE_VAL;
+  }
+  if (!(range.bound > best)) {
+    queue->push(range);
+  }
+}
+
+/*
+  Branch and bound over the alleles of the window: ranges of alleles are
+  popped lowest bound first and split in halves, and the search stops
+  once no range left can reach the best likelihood found. Bounds are at
+  most the likelihood of any genotype of the range (see
+  GetGenotypeNegLogLikelihoodBound), so the result is the one of a full
+  scan of the window.
+ */
+bool discrete_1D_optimize(const int32_t& read_len, const int32_t& motif_len,
+			  const int32_t& ref_count, const int32_t& lower_bound,
+			  const int32_t& upper_bound, const bool& resampled,
+			  LikelihoodMaximizer* lm_ptr,
+			  const int32_t& fix_allele, int32_t* allele1,
+			  double* minf_ret) {
+  bool found = false;
+  double f;
+  *allele1 = lower_bound;
+  *minf_ret = 1000000;
+  const discrete_bounds& bounds = *lm_ptr->GetDiscreteBounds(read_len, motif_len, ref_count,
+							     lower_bound, upper_bound);
+  // Row log likelihoods of the fixed allele
+  std::vector<double> fix_column;
+  const double* fix_ll;
+  bool fix_failed;
+  if (fix_allele >= bounds.lower && fix_allele <= bounds.upper) {
+    int32_t leaf = bounds.num_leaves + fix_allele - bounds.lower;
+    fix_ll = discreteNodeLL(bounds, leaf);
+    fix_failed = bounds.failed[leaf];
+  }
+  else {
+    fix_failed = !lm_ptr->GetDiscreteAlleleColumn(bounds, fix_allele, resampled, &fix_column);
+    fix_ll = fix_column.empty() ? NULL : &fix_column[0];
+  }
+  double best = HUGE_VAL;
+  std::priority_queue<discrete_range> queue;
+  discreteQueueRange(lm_ptr, bounds, 1, -1, fix_ll, fix_allele, fix_allele, fix_failed,
+		     resampled, best, &queue);
+  while (!queue.empty() && !(queue.top().bound > best)) {
+    int32_t node = queue.top().node1;
+    queue.pop();
+    if (node >= bounds.num_leaves) {
+      int32_t a = bounds.node_lo[node];
+      if (!discreteNegLikelihood(lm_ptr, a, fix_allele, read_len, motif_len, ref_count,
+				 resampled, &f)) {
+	continue;
+      }
+      if (!found || f < *minf_ret || (f == *minf_ret && a < *allele1)) {
+	found = true;
+	*minf_ret = f;
+	*allele1 = a;
+	best = f;
+      }
+      continue;
+    }
+    for (int32_t child = 2 * node; child <= 2 * node + 1; child++) {
+      discreteQueueRange(lm_ptr, bounds, child, -1, fix_ll, fix_allele, fix_allele,
+			 fix_failed, resampled, best, &queue);
+    }
+  }
+  return found;
+}
+
+/*
+  Same branch and bound as discrete_1D_optimize over pairs of nodes
+  node1 <= node2. A pair of equal nodes is split into its two halves
+  with each other and with themselves, any other pair at the wider node.
+ */
+bool discrete_2D_optimize(const int32_t& read_len, const int32_t& motif_len,
+			  const int32_t& ref_count, const int32_t& lower_bound,
+			  const int32_t& upper_bound, const bool& resampled,
+			  LikelihoodMaximizer* lm_ptr,
+			  int32_t* allele1, int32_t* allele2, double* minf_ret) {
+  // The diploid likelihood is symmetric, so allele1 <= allele2 covers
+  // every genotype
+  bool found = false;
+  double f;
+  *allele1 = *allele2 = lower_bound;
+  *minf_ret = 1000000;
+  const discrete_bounds& bounds = *lm_ptr->GetDiscreteBounds(read_len, motif_len, ref_count,
+							     lower_bound, upper_bound);
+  double best = HUGE_VAL;
+  std::priority_queue<discrete_range> queue;
+  discreteQueueRange(lm_ptr, bounds, 1, 1, discreteNodeLL(bounds, 1), bounds.node_lo[1],
+		     bounds.node_hi[1], bounds.failed[1], resampled, best, &queue);
+  while (!queue.empty() && !(queue.top().bound > best)) {
+    int32_t node1 = queue.top().node1, node2 = queue.top().node2;
+    queue.pop();
+    std::vector<std::pair<int32_t, int32_t> > children;
+    if (node1 >= bounds.num_leaves && node2 >= bounds.num_leaves) {
+      int32_t a = bounds.node_lo[node1], b = bounds.node_lo[node2];
+      if (!discreteNegLikelihood(lm_ptr, a, b, read_len, motif_len, ref_count,
+				 resampled, &f)) {
+	continue;
+      }
+      if (!found || f < *minf_ret ||
+	  (f == *minf_ret && (a < *allele1 || (a == *allele1 && b < *allele2)))) {
+	found = true;
+	*minf_ret = f;
+	*allele1 = a;
+	*allele2 = b;
+	best = f;
+      }
+      continue;
+    }
+    if (node1 == node2) {
+      children.push_back(std::pair<int32_t, int32_t>(2 * node1, 2 * node1));
+      children.push_back(std::pair<int32_t, int32_t>(2 * node1, 2 * node1 + 1));
+      children.push_back(std::pair<int32_t, int32_t>(2 * node1 + 1, 2 * node1 + 1));
+    }
+    else if (discreteNodeDepth(node1) <= discreteNodeDepth(node2)) {
+      children.push_back(std::pair<int32_t, int32_t>(2 * node1, node2));
+      children.push_back(std::pair<int32_t, int32_t>(2 * node1 + 1, node2));
+    }
+    else {
+      children.push_back(std::pair<int32_t, int32_t>(node1, 2 * node2));
+      children.push_back(std::pair<int32_t, int32_t>(node1, 2 * node2 + 1));
+    }
+    for (std::size_t i = 0; i < children.size(); i++) {
+      int32_t child1 = children[i].first, child2 = children[i].second;
+      discreteQueueRange(lm_ptr, bounds, child1, child2, discreteNodeLL(bounds, child2),
+			 bounds.node_lo[child2], bounds.node_hi[child2], bounds.failed[child2],
+			 resampled, best, &queue);
+    }
+  }
+  return found;
+}
+
 // /// GSL siman helper functions (not complete)
 // double simanEnergy(void *xp){
 //   siman_data *d = (siman_data *) xp;
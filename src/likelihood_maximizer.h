@@ -29,26 +29,90 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 #include "src/spanning_class.h"
 #include "src/read_pair.h"
 #include "src/locus.h"
+#include "src/stats.h"
 #include "gsl/gsl_vector.h"
 #include "gsl/gsl_rng.h"
 #include "gsl/gsl_randist.h"
 
 #include <iostream>
 #include <fstream>
+#include <map>
 #include <string>
+#include <utility>
+#include <vector>
 
 using namespace std;
 
+// --screen: least enclosing reads to call a locus without the full model
+const std::size_t SCREEN_MIN_ENCLOSING = 10;
+// --screen: least share of enclosing reads supporting a second allele
+const double SCREEN_MIN_ALLELE_SHARE = 0.2;
+// --screen: least share of enclosing reads exactly at the called alleles
+const double SCREEN_MIN_CONSENSUS = 0.8;
+// --screen: largest deviation of the mean spanning insert size from the
+// call, in standard errors
+const double SCREEN_MAX_SPANNING_Z = 3.0;
+// --bootstrap-adaptive: number of batches in a row after which the
+// confidence interval must not have moved to stop early
+const int32_t BOOT_STABLE_BATCHES = 2;
+// Largest allele searched by the optimizers
+const int32_t OPTIMIZER_UPPER_BOUND = 600;
+// --optimizer discrete: copies searched beyond the longest and below the
+// shortest enclosing or flanking read (stutter and partial flanks)
+const int32_t DISCRETE_MARGIN = 5;
+// --optimizer discrete: standard deviations of the insert size a
+// spanning read may be off from the searched alleles
+const double DISCRETE_SPAN_Z = 3.0;
+// --optimizer discrete: standard deviations of the FRR count above the
+// observed count that the searched alleles may expect
+const double DISCRETE_FRR_Z = 5.0;
+// --optimizer discrete: most by which fast_log_sum_exp of two read log
+// likelihoods exceeds the exact value (measured below 1e-5)
+const double DISCRETE_LSE_SLACK = 1e-4;
+// --optimizer discrete: margin subtracted from bounds for rounding
+const double DISCRETE_BOUND_TOL = 1e-9;
+
+/*
+  --optimizer discrete: log likelihood of each read data value under each
+  allele of the search window [lower, upper], kept as the maximum over
+  allele ranges. Ranges are the nodes of a binary tree: node 1 covers
+  [lower, lower + num_leaves), node k has children 2k and 2k + 1, and
+  allele lower + i is the leaf num_leaves + i. Rows are the data values
+  of the FRR, spanning, enclosing and flanking classes, in this order.
+ */
+struct discrete_bounds{
+  bool built;
+  // Locus and window the table was built for
+  int32_t read_len, motif_len, ref_count, lower, upper;
+  std::size_t num_records;
+  int32_t num_leaves;
+  // Sorted data values of each class, and the row of the first one
+  std::vector<int32_t> values[4];
+  std::size_t first_row[4];
+  std::size_t num_rows;
+  // Allele range of each node, clipped to upper (empty if lo > upper)
+  std::vector<int32_t> node_lo, node_hi;
+  // num_rows values per node: largest log likelihood of the row over
+  // the alleles of the node
+  std::vector<double> max_ll;
+  // Whether some allele of the node has no likelihood
+  std::vector<char> failed;
+  discrete_bounds() : built(false) {}
+};
+
 // Struct for storing reads from all classes in a unified vector
+// (one record per distinct class and data value)
 struct ReadRecord{
   int32_t data;
   ReadType read_type;
+  int32_t count;
 };
 
 class LikelihoodMaximizer {
  friend class Genotyper;
  public:
-  LikelihoodMaximizer(Options& _options);
+  // If bootstrap_out is given, bootstrap samples are written there instead of <outprefix>.bootstrap.tab
+  LikelihoodMaximizer(Options& _options, std::ostream* bootstrap_out = NULL);
   // LikelihoodMaximizer(const LikelihoodMaximizer& lm_obj); // copy constructor
   virtual ~LikelihoodMaximizer();
 
@@ -82,6 +146,13 @@ class LikelihoodMaximizer {
 				   const int32_t& read_len, const int32_t& motif_len,
 				   const int32_t& ref_count, const bool& resampled,
 				   double* gt_ll);
+  // Main likelihood function, using the per-locus cache of integer genotypes
+  bool GetCachedGenotypeNegLogLikelihood(const int32_t& allele1, const int32_t& allele2,
+					 const int32_t& read_len, const int32_t& motif_len,
+					 const int32_t& ref_count, const bool& resampled,
+					 double* gt_ll);
+  // Genotype likelihood cache hits and misses since the last Reset
+  void GetGenotypeCacheStats(int64_t* hits, int64_t* misses);
   // Main optimization function - TODO also return other data
   bool OptimizeLikelihood(const int32_t& read_len, 
 			  const int32_t& motif_len,
@@ -97,6 +168,35 @@ class LikelihoodMaximizer {
 			  int32_t ploidy, int32_t fix_allele,
                           int32_t* allele1, int32_t* allele2, double* min_negLike);
 
+  // Window [lower, upper] of copy numbers supported by the reads, searched
+  // by --optimizer discrete
+  void GetDiscreteSearchWindow(const int32_t& read_len, const int32_t& motif_len,
+			       const int32_t& ref_count,
+			       const int32_t& lower_bound, const int32_t& upper_bound,
+			       int32_t* lower, int32_t* upper);
+
+  // --optimizer discrete: read log likelihood table over the window
+  // [lower, upper], built once per locus and shared with the bootstrap
+  // helpers
+  const discrete_bounds* GetDiscreteBounds(const int32_t& read_len, const int32_t& motif_len,
+					   const int32_t& ref_count,
+					   const int32_t& lower, const int32_t& upper);
+  // Log likelihoods of one allele for the rows of bounds
+  bool GetDiscreteAlleleColumn(const discrete_bounds& bounds, const int32_t& allele,
+			       const bool& resampled, std::vector<double>* column);
+  // Lower bound of GetGenotypeNegLogLikelihood over allele1 in
+  // [lo1, hi1] and allele2 in [lo2, hi2], where ll1 and ll2 are the
+  // largest log likelihoods of each row of bounds over these ranges
+  bool GetGenotypeNegLogLikelihoodBound(const discrete_bounds& bounds,
+					const double* ll1, const int32_t& lo1, const int32_t& hi1,
+					const double* ll2, const int32_t& lo2, const int32_t& hi2,
+					const bool& resampled, double* bound);
+
+  // Call a reference-like locus directly from its enclosing reads
+  // (--screen). Returns false if the locus needs the full model
+  bool ScreenGenotype(const int32_t& motif_len, const int32_t& ref_count,
+		      const int32_t& ploidy, int32_t* allele1, int32_t* allele2);
+
   // Compute and return confidence interval with bootstrapping
   bool GetConfidenceInterval(const int32_t& read_len, 
 			     const int32_t& motif_len,
@@ -104,7 +204,8 @@ class LikelihoodMaximizer {
 			     const int32_t& allele1,
 			     const int32_t& allele2,
 			     const Locus& locus,
-			     double* lob1, double* hib1, double* lob2, double* hib2);
+			     double* lob1, double* hib1, double* lob2, double* hib2,
+			     int32_t* num_replicates);
 
   // // Not needed. since options are updated before creating likelihood maximizer object
   // // TODO delete
@@ -117,18 +218,45 @@ class LikelihoodMaximizer {
   // Resample read pool with replacement
   void ResampleReadPool();
 
+  // Run bootstrap replicates first, first+step, ... < num_samples and store
+  // the resulting alleles at the replicate index
+  bool RunBootstrapReplicates(const int32_t& first, const int32_t& step,
+			      const int32_t& num_samples,
+			      const int32_t& read_len, const int32_t& motif_len,
+			      const int32_t& ref_count,
+			      const int32_t& allele1, const int32_t& allele2,
+			      std::vector<int32_t>* small_alleles,
+			      std::vector<int32_t>* large_alleles);
+  // Run bootstrap replicates begin, ..., end - 1, split between
+  // --bootstrap-threads threads
+  void RunBootstrapBatch(const int32_t& begin, const int32_t& end,
+			 const int32_t& read_len, const int32_t& motif_len,
+			 const int32_t& ref_count,
+			 const int32_t& allele1, const int32_t& allele2,
+			 std::vector<int32_t>* small_alleles,
+			 std::vector<int32_t>* large_alleles);
+
  protected:
   // Other params -> Made public for gslNegLikelihood to have access
   Options* options;
 
  private:
+  // Add one read to the unified read pool
+  void AddToReadPool(const ReadType& read_type, const int32_t& data);
+
   EnclosingClass enclosing_class_;
   FRRClass frr_class_;
   SpanningClass spanning_class_;
   FlankingClass flanking_class_;
   FRRClass offtarget_class_;
   std::vector<ReadRecord> read_pool;
-  std::vector<ReadRecord> resampled_pool;
+  // (read type, data) -> index in read_pool
+  std::map<std::pair<int32_t, int32_t>, std::size_t> read_pool_index_;
+  // Total number of reads in read_pool
+  std::size_t read_pool_size_;
+  // Number of times each read_pool record was drawn by ResampleReadPool
+  std::vector<unsigned int> resampled_counts_;
+  std::vector<double> pool_weights_;
   EnclosingClass resampled_enclosing_class_;
   FRRClass resampled_frr_class_;
   SpanningClass resampled_spanning_class_;
@@ -136,9 +264,21 @@ class LikelihoodMaximizer {
 
   // Write bootstrap samples to file
   ofstream bsfile_;
+  std::ostream* bsout_;
   //  ofstream plotfile_;
   // Random number generator
   gsl_rng * r;
+  // Negative log likelihood per integer genotype, for the
+  // original [0] and resampled [1] read pools
+  std::map<std::pair<int32_t, int32_t>, double> gt_ll_cache_[2];
+  int64_t gt_cache_hits_;
+  int64_t gt_cache_misses_;
+  // Copies of this object used by extra bootstrap threads
+  std::vector<LikelihoodMaximizer*> boot_helpers_;
+  // --optimizer discrete table of this object, and for bootstrap helpers
+  // the one of the locus thread
+  discrete_bounds discrete_bounds_;
+  const discrete_bounds* parent_discrete_bounds_;
   // percentage of off-target reads
   double offtarget_share;
 };
@@ -169,6 +309,43 @@ bool nlopt_2D_optimize(const int32_t& read_len, const int32_t& motif_len,
                int32_t* allele1, int32_t* allele2, int32_t* ret_result, double* minf_ret);
 // Helper function for NLOPT gradient optimizer
 double nloptNegLikelihood(unsigned n, const double *x, double *grad, void *data);
+// 1D integer search: branch and bound over [lower_bound, upper_bound],
+// exact within it, ties going to the smaller allele
+bool discrete_1D_optimize(const int32_t& read_len, const int32_t& motif_len,
+			  const int32_t& ref_count, const int32_t& lower_bound,
+			  const int32_t& upper_bound, const bool& resampled,
+			  LikelihoodMaximizer* lm_ptr,
+			  const int32_t& fix_allele, int32_t* allele1,
+			  double* minf_ret);
+// 2D integer search: branch and bound over genotypes allele1 <= allele2
+// in [lower_bound, upper_bound], exact within it, ties going to the
+// smaller allele1, then allele2
+bool discrete_2D_optimize(const int32_t& read_len, const int32_t& motif_len,
+			  const int32_t& ref_count, const int32_t& lower_bound,
+			  const int32_t& upper_bound, const bool& resampled,
+			  LikelihoodMaximizer* lm_ptr,
+			  int32_t* allele1, int32_t* allele2, double* minf_ret);
+
+// Helper struct for running bootstrap replicates in a thread
+struct bootstrap_data{
+  LikelihoodMaximizer* lm_ptr;
+  int32_t first, step, num_samples;
+  int32_t read_len, motif_len, ref_count, allele1, allele2;
+  std::vector<int32_t>* small_alleles;
+  std::vector<int32_t>* large_alleles;
+  bool collect_stats;     // Whether the locus thread collects stats
+  LocusStats stats;       // Counted by this thread, added up after join
+};
+// Thread entry point for bootstrap replicates
+void* bootstrapThread(void* data);
+// Percentile confidence interval bounds from the first num_samples
+// bootstrap replicates, with tail error alpha / 2 on each end
+void GetBootstrapQuantiles(const std::vector<int32_t>& small_alleles,
+			   const std::vector<int32_t>& large_alleles,
+			   const int32_t& num_samples, const double& alpha,
+			   double* lob1, double* hib1, double* lob2, double* hib2);
+// Seed of the random number stream for one bootstrap replicate
+unsigned long bootstrapSeed(const int32_t& seed, const int32_t& replicate);
 
 
 
@@ -27,6 +27,7 @@ Locus::Locus() {
   start = -1;
   end = -1;
   period = -1;
+  flank_len = -1;
 
   insert_size_mean = -1.0;
   insert_size_stddev = -1.0;
@@ -42,6 +43,8 @@ Locus::Locus() {
   frr_reads = 0;
   flanking_reads = 0;
   depth = 0;
+  screened = false;
+  num_bootstraps = 0;
 
   offtarget_set = false;
   offtarget_share = 0.0;
@@ -52,6 +55,7 @@ void Locus::Reset(){
   start = -1;
   end = -1;
   period = -1;
+  flank_len = -1;
 
   insert_size_mean = -1.0;
   insert_size_stddev = -1.0;
@@ -67,6 +71,8 @@ void Locus::Reset(){
   frr_reads = 0;
   flanking_reads = 0;
   depth = 0;
+  screened = false;
+  num_bootstraps = 0;
 
   offtarget_set = false;
   offtarget_regions.clear();
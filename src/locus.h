@@ -43,6 +43,8 @@ class Locus {
   std::string motif;
   std::string pre_flank;
   std::string post_flank;
+  // Flank length pre_flank and post_flank were fetched with (-1 if not set)
+  int flank_len;
 
   // Fill in these fields
   double insert_size_mean;
@@ -59,6 +61,10 @@ class Locus {
   size_t frr_reads;
   size_t flanking_reads;
   size_t depth;
+  // Genotype called by the --screen first pass
+  bool screened;
+  // Number of bootstrap replicates behind the confidence intervals
+  int num_bootstraps;
 
   // Off target loci
   bool offtarget_set;
@@ -0,0 +1,293 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <vector>
+
+#include "src/common.h"
+#include "src/locus_catalog.h"
+#include "src/ref_genome.h"
+#include "src/region_reader.h"
+
+using namespace std;
+
+namespace {
+// Append str to the string blob and return its offset
+uint64_t AddString(const std::string& str, std::string* strings) {
+  uint64_t offset = strings->size();
+  strings->append(str);
+  return offset;
+}
+
+// Same as AddString, but chromosome and motif strings are stored once
+uint64_t AddSharedString(const std::string& str, std::string* strings,
+			 std::map<std::string, uint64_t>* offsets) {
+  std::map<std::string, uint64_t>::const_iterator it = offsets->find(str);
+  if (it != offsets->end()) {
+    return it->second;
+  }
+  uint64_t offset = AddString(str, strings);
+  (*offsets)[str] = offset;
+  return offset;
+}
+}  // namespace
+
+LocusCatalog::LocusCatalog() {
+  data_ = NULL;
+  data_size_ = 0;
+  header_ = NULL;
+  loci_ = NULL;
+  regions_ = NULL;
+  strings_ = NULL;
+}
+
+/*
+  Read every region, fetch its flanks and write the catalog. As when
+  genotyping, a chromosome missing from the reference is an error
+ */
+bool LocusCatalog::Build(const std::string& regionsfile, const std::string& reffa,
+			 const int32_t& flank_len, const std::string& path) {
+  RegionReader region_reader(regionsfile);
+  RefGenome refgenome(reffa);
+  std::vector<CatalogLocusRecord> loci;
+  std::vector<CatalogRegionRecord> regions;
+  std::string strings;
+  std::map<std::string, uint64_t> shared_offsets;
+  Locus locus;
+  std::string pre_flank, post_flank;
+  while (region_reader.GetNextRegion(&locus)) {
+    CatalogLocusRecord record;
+    memset(&record, 0, sizeof(record));
+    record.start = locus.start;
+    record.end = locus.end;
+    record.period = locus.period;
+    record.ref_count = (locus.period > 0 ? (locus.end - locus.start + 1) / locus.period : 0);
+    record.chrom_len = locus.chrom.size();
+    record.chrom_offset = AddSharedString(locus.chrom, &strings, &shared_offsets);
+    record.motif_len = locus.motif.size();
+    record.motif_offset = AddSharedString(locus.motif, &strings, &shared_offsets);
+    // Same coordinates as Genotyper::SetFlanks. Shorter flanks are cut
+    // from these, which only holds if faidx did not clamp the end of the
+    // pre flank; other loci get their flanks from the reference
+    refgenome.GetSequence(locus.chrom, locus.start - flank_len - 1, locus.start - 2, &pre_flank);
+    refgenome.GetSequence(locus.chrom, locus.end, locus.end + flank_len - 1, &post_flank);
+    int32_t pre_flank_len = locus.start - 1 - max(locus.start - flank_len - 1, 0);
+    if ((int32_t)pre_flank.size() == pre_flank_len && locus.end >= 0) {
+      record.flank_len = flank_len;
+      record.pre_flank_len = pre_flank.size();
+      record.pre_flank_offset = AddString(pre_flank, &strings);
+      record.post_flank_len = post_flank.size();
+      record.post_flank_offset = AddString(post_flank, &strings);
+    } else {
+      record.flank_len = -1;
+    }
+    // Reads are extracted around the locus and each off-target region
+    record.cost = LOCUS_CATALOG_BASE_COST + (locus.end - locus.start + 1);
+    record.first_region = regions.size();
+    record.num_regions = locus.offtarget_regions.size();
+    for (std::vector<GenomeRegion>::const_iterator it = locus.offtarget_regions.begin();
+	 it != locus.offtarget_regions.end(); it++) {
+      CatalogRegionRecord region;
+      memset(&region, 0, sizeof(region));
+      region.chrom_len = it->chrom.size();
+      region.chrom_offset = AddSharedString(it->chrom, &strings, &shared_offsets);
+      region.start = it->start;
+      region.end = it->end;
+      regions.push_back(region);
+      record.cost += (it->end - it->start + 1);
+    }
+    loci.push_back(record);
+    locus.Reset();
+  }
+
+  CatalogHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, LOCUS_CATALOG_MAGIC, sizeof(header.magic));
+  header.version = LOCUS_CATALOG_VERSION;
+  header.flank_len = flank_len;
+  header.num_loci = loci.size();
+  header.num_regions = regions.size();
+  header.loci_offset = sizeof(CatalogHeader);
+  header.regions_offset = header.loci_offset + loci.size() * sizeof(CatalogLocusRecord);
+  header.strings_offset = header.regions_offset + regions.size() * sizeof(CatalogRegionRecord);
+  header.strings_size = strings.size();
+
+  std::ofstream out(path.c_str(), std::ios::out | std::ios::binary);
+  if (!out.is_open()) {
+    return false;
+  }
+  out.write((const char*)&header, sizeof(header));
+  if (!loci.empty()) {
+    out.write((const char*)&loci[0], loci.size() * sizeof(CatalogLocusRecord));
+  }
+  if (!regions.empty()) {
+    out.write((const char*)&regions[0], regions.size() * sizeof(CatalogRegionRecord));
+  }
+  out.write(strings.data(), strings.size());
+  out.close();
+  return !out.fail();
+}
+
+bool LocusCatalog::IsCatalog(const std::string& path) {
+  std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+  char magic[sizeof(LOCUS_CATALOG_MAGIC)];
+  if (!in.read(magic, sizeof(magic))) {
+    return false;
+  }
+  return memcmp(magic, LOCUS_CATALOG_MAGIC, sizeof(magic)) == 0;
+}
+
+/*
+  Map the file and check that every section and string lies inside it,
+  so GetLocus needs no checks
+ */
+bool LocusCatalog::Open(const std::string& path) {
+  Close();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(CatalogHeader)) {
+    close(fd);
+    return false;
+  }
+  data_size_ = file_stat.st_size;
+  data_ = mmap(NULL, data_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data_ == MAP_FAILED) {
+    data_ = NULL;
+    return false;
+  }
+  header_ = (const CatalogHeader*)data_;
+  const char* base = (const char*)data_;
+  bool valid = (memcmp(header_->magic, LOCUS_CATALOG_MAGIC, sizeof(header_->magic)) == 0 &&
+		header_->version == LOCUS_CATALOG_VERSION &&
+		header_->loci_offset % sizeof(uint64_t) == 0 &&
+		header_->regions_offset % sizeof(uint64_t) == 0 &&
+		header_->num_loci <= data_size_ / sizeof(CatalogLocusRecord) &&
+		header_->num_regions <= data_size_ / sizeof(CatalogRegionRecord) &&
+		header_->loci_offset + header_->num_loci * sizeof(CatalogLocusRecord) <= data_size_ &&
+		header_->regions_offset + header_->num_regions * sizeof(CatalogRegionRecord) <= data_size_ &&
+		header_->strings_offset <= data_size_ &&
+		header_->strings_size <= data_size_ - header_->strings_offset);
+  if (valid) {
+    loci_ = (const CatalogLocusRecord*)(base + header_->loci_offset);
+    regions_ = (const CatalogRegionRecord*)(base + header_->regions_offset);
+    strings_ = base + header_->strings_offset;
+  }
+  for (uint64_t i = 0; valid && i < header_->num_loci; i++) {
+    const CatalogLocusRecord& record = loci_[i];
+    valid = (ValidString(record.chrom_offset, record.chrom_len) &&
+	     ValidString(record.motif_offset, record.motif_len) &&
+	     ValidString(record.pre_flank_offset, record.pre_flank_len) &&
+	     ValidString(record.post_flank_offset, record.post_flank_len) &&
+	     record.first_region <= header_->num_regions &&
+	     record.num_regions <= header_->num_regions - record.first_region);
+  }
+  for (uint64_t i = 0; valid && i < header_->num_regions; i++) {
+    valid = ValidString(regions_[i].chrom_offset, regions_[i].chrom_len);
+  }
+  if (!valid) {
+    Close();
+  }
+  return valid;
+}
+
+void LocusCatalog::GetLocus(const uint64_t& index, Locus* locus) const {
+  const CatalogLocusRecord& record = loci_[index];
+  locus->chrom = GetString(record.chrom_offset, record.chrom_len);
+  locus->start = record.start;
+  locus->end = record.end;
+  locus->period = record.period;
+  locus->motif = GetString(record.motif_offset, record.motif_len);
+  if (record.flank_len >= 0) {
+    locus->pre_flank = GetString(record.pre_flank_offset, record.pre_flank_len);
+    locus->post_flank = GetString(record.post_flank_offset, record.post_flank_len);
+  }
+  locus->flank_len = record.flank_len;
+  for (uint32_t i = 0; i < record.num_regions; i++) {
+    const CatalogRegionRecord& region = regions_[record.first_region + i];
+    GenomeRegion offtarget;
+    offtarget.chrom = GetString(region.chrom_offset, region.chrom_len);
+    offtarget.start = region.start;
+    offtarget.end = region.end;
+    locus->offtarget_regions.push_back(offtarget);
+    locus->offtarget_set = true;
+  }
+}
+
+/*
+  Locus i belongs to the shard that contains the total cost of the loci
+  before it, so shards are contiguous and about equally expensive
+ */
+void LocusCatalog::ShardRange(const int32_t& shard, const int32_t& num_shards,
+			      uint64_t* first, uint64_t* last) const {
+  double total_cost = 0;
+  for (uint64_t i = 0; i < size(); i++) {
+    total_cost += loci_[i].cost;
+  }
+  *first = size();
+  *last = size();
+  double cost = 0;
+  for (uint64_t i = 0; i < size(); i++) {
+    int32_t owner = (int32_t)(cost * num_shards / total_cost);
+    if (owner >= shard && *first == size()) {
+      *first = i;
+    }
+    if (owner > shard) {
+      *last = i;
+      return;
+    }
+    cost += loci_[i].cost;
+  }
+}
+
+void LocusCatalog::Close() {
+  if (data_ != NULL) {
+    munmap(data_, data_size_);
+  }
+  data_ = NULL;
+  data_size_ = 0;
+  header_ = NULL;
+  loci_ = NULL;
+  regions_ = NULL;
+  strings_ = NULL;
+}
+
+std::string LocusCatalog::GetString(const uint64_t& offset, const uint32_t& length) const {
+  return std::string(strings_ + offset, length);
+}
+
+bool LocusCatalog::ValidString(const uint64_t& offset, const uint32_t& length) const {
+  return offset <= header_->strings_size && length <= header_->strings_size - offset;
+}
+
+LocusCatalog::~LocusCatalog() {
+  Close();
+}
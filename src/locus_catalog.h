@@ -0,0 +1,128 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SRC_LOCUS_CATALOG_H__
+#define SRC_LOCUS_CATALOG_H__
+
+#include <stdint.h>
+
+#include <string>
+
+#include "src/locus.h"
+
+// First bytes of a binary locus catalog
+const char LOCUS_CATALOG_MAGIC[8] = {'G', 'S', 'T', 'R', 'C', 'A', 'T', '\0'};
+const uint32_t LOCUS_CATALOG_VERSION = 1;
+// Flank length stored by catalog-build unless set with --flanklen
+const int32_t LOCUS_CATALOG_FLANKLEN = 150;
+// Fixed part of the cost estimate, for the extraction window of each locus
+const float LOCUS_CATALOG_BASE_COST = 1000;
+
+/*
+  Layout of the catalog file, in host byte order:
+  header, num_loci locus records, num_regions off-target region records,
+  then a blob of strings referenced by (offset, length) pairs.
+ */
+struct CatalogHeader {
+  char magic[8];
+  uint32_t version;
+  int32_t flank_len;         // Flank length used by catalog-build
+  uint64_t num_loci;
+  uint64_t num_regions;
+  uint64_t loci_offset;      // File offsets of each section
+  uint64_t regions_offset;
+  uint64_t strings_offset;
+  uint64_t strings_size;
+};
+
+struct CatalogLocusRecord {
+  int32_t start;
+  int32_t end;
+  int32_t period;
+  int32_t ref_count;         // Reference copies of the motif
+  int32_t flank_len;         // -1 if flanks could not be extracted
+  float cost;                // Relative cost estimate, for sharding
+  uint32_t chrom_len;
+  uint32_t motif_len;        // Lower case
+  uint32_t pre_flank_len;
+  uint32_t post_flank_len;
+  uint32_t num_regions;      // Off-target regions
+  uint32_t unused;
+  uint64_t chrom_offset;
+  uint64_t motif_offset;
+  uint64_t pre_flank_offset;
+  uint64_t post_flank_offset;
+  uint64_t first_region;     // Index of the first off-target region
+};
+
+struct CatalogRegionRecord {
+  uint64_t chrom_offset;
+  uint32_t chrom_len;
+  int32_t start;
+  int32_t end;
+  uint32_t unused;
+};
+
+/*
+  Binary locus catalog compiled by "GangSTR catalog-build" from a regions
+  file and the reference. The file is memory mapped and records are read
+  in place, so opening a catalog costs nothing per locus, and any locus
+  can be read by its index.
+ */
+class LocusCatalog {
+ public:
+  LocusCatalog();
+  virtual ~LocusCatalog();
+
+  // Compile regionsfile into a catalog at path, with flanks of flank_len
+  static bool Build(const std::string& regionsfile, const std::string& reffa,
+		    const int32_t& flank_len, const std::string& path);
+  // Whether path starts with the catalog magic
+  static bool IsCatalog(const std::string& path);
+
+  // Map a catalog written by Build. Return false if it is not valid
+  bool Open(const std::string& path);
+  // Fill in the locus at index, flanks included
+  void GetLocus(const uint64_t& index, Locus* locus) const;
+  const CatalogLocusRecord& record(const uint64_t& index) const { return loci_[index]; }
+  uint64_t size() const { return (header_ == NULL ? 0 : header_->num_loci); }
+  // Contiguous range [first, last) of loci in shard (0-based) of
+  // num_shards, balanced by estimated cost
+  void ShardRange(const int32_t& shard, const int32_t& num_shards,
+		  uint64_t* first, uint64_t* last) const;
+
+ private:
+  // Private unimplemented copy constructor and assignment operator to prevent operations
+  LocusCatalog(const LocusCatalog& other);
+  LocusCatalog& operator=(const LocusCatalog& other);
+
+  void Close();
+  std::string GetString(const uint64_t& offset, const uint32_t& length) const;
+  bool ValidString(const uint64_t& offset, const uint32_t& length) const;
+
+  void* data_;
+  size_t data_size_;
+  const CatalogHeader* header_;
+  const CatalogLocusRecord* loci_;
+  const CatalogRegionRecord* regions_;
+  const char* strings_;
+};
+
+#endif  // SRC_LOCUS_CATALOG_H__
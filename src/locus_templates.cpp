@@ -0,0 +1,82 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "src/locus_templates.h"
+
+using namespace std;
+
+LocusTemplates::LocusTemplates() {
+  Clear();
+}
+
+void LocusTemplates::Clear() {
+  max_read_len_ = 0;
+  max_copies_ = 0;
+  period_ = 0;
+  template_codes_.clear();
+  template_offsets_.clear();
+  frr_codes_.clear();
+  forward_codes_.clear();
+  reverse_codes_.clear();
+}
+
+void LocusTemplates::Build(const Locus& locus, const int32_t& max_read_len) {
+  Clear();
+  period_ = (int32_t)locus.motif.size();
+  if (period_ == 0 || max_read_len <= 0) {
+    return;
+  }
+  max_copies_ = max_read_len / period_ + 1;
+
+  vector<int8_t> pre, motif, post;
+  for (size_t i = 0; i < locus.pre_flank.size(); i++) {
+    pre.push_back(nt_code(locus.pre_flank[i]));
+  }
+  for (size_t i = 0; i < locus.motif.size(); i++) {
+    motif.push_back(nt_code(locus.motif[i]));
+  }
+  for (size_t i = 0; i < locus.post_flank.size(); i++) {
+    post.push_back(nt_code(locus.post_flank[i]));
+  }
+
+  template_offsets_.push_back(0);
+  for (int32_t n = 0; n <= max_copies_; n++) {
+    template_codes_.insert(template_codes_.end(), pre.begin(), pre.end());
+    for (int32_t i = 0; i < n; i++) {
+      template_codes_.insert(template_codes_.end(), motif.begin(), motif.end());
+    }
+    template_codes_.insert(template_codes_.end(), post.begin(), post.end());
+    template_offsets_.push_back((int32_t)template_codes_.size());
+  }
+
+  forward_codes_ = pre;
+  for (int32_t i = 0; i < max_copies_; i++) {
+    frr_codes_.insert(frr_codes_.end(), motif.begin(), motif.end());
+    forward_codes_.insert(forward_codes_.end(), motif.begin(), motif.end());
+  }
+  reverse_codes_.assign(forward_codes_.size() - pre.size() + post.size(), 0);
+  for (size_t i = 0; i < post.size(); i++) {
+    reverse_codes_[i] = post[post.size() - 1 - i];
+  }
+  for (size_t i = 0; i < frr_codes_.size(); i++) {
+    reverse_codes_[post.size() + i] = frr_codes_[frr_codes_.size() - 1 - i];
+  }
+  max_read_len_ = max_read_len;
+}
@@ -0,0 +1,96 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SRC_LOCUS_TEMPLATES_H__
+#define SRC_LOCUS_TEMPLATES_H__
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "src/locus.h"
+
+// Numeric alphabet used by SSW: A/C/G/T -> 0..3, anything else -> 4
+inline int8_t nt_code(const char& base) {
+  switch (base) {
+  case 'A': case 'a': return 0;
+  case 'C': case 'c': return 1;
+  case 'G': case 'g': return 2;
+  case 'T': case 't': return 3;
+  default: return 4;
+  }
+}
+
+/*
+  Realignment references of one locus, translated once after
+  Genotyper::SetFlanks and then shared read-only by every read.
+
+  Holds pre_flank + motif*n + post_flank for each copy number n a read
+  of up to max_read_len bases is aligned against, the pure motif
+  reference used to confirm FRRs, and the two repeat graph sequences
+  swept by repeat_graph_align.
+ */
+class LocusTemplates {
+ public:
+  LocusTemplates();
+
+  // Translate all templates of locus for reads up to max_read_len long
+  void Build(const Locus& locus, const int32_t& max_read_len);
+  void Clear();
+
+  // True if the templates are set up for a read of this length
+  bool Covers(const int32_t& read_len) const {
+    return max_read_len_ > 0 && read_len > 0 && read_len <= max_read_len_;
+  }
+  int32_t MaxCopies() const { return max_copies_; }
+
+  // pre_flank + motif*nCopy + post_flank, for nCopy in [0, MaxCopies()]
+  const int8_t* Template(const int32_t& nCopy) const {
+    return &template_codes_[template_offsets_[nCopy]];
+  }
+  int32_t TemplateLength(const int32_t& nCopy) const {
+    return template_offsets_[nCopy+1] - template_offsets_[nCopy];
+  }
+
+  // Motif copies an FRR of read_len bases is aligned against
+  const int8_t* FRRReference() const { return &frr_codes_[0]; }
+  int32_t FRRLength(const int32_t& read_len) const {
+    return (read_len / period_ + 1) * period_;
+  }
+
+  // pre_flank followed by MaxCopies() motif copies
+  const std::vector<int8_t>& Forward() const { return forward_codes_; }
+  // Reversed post_flank followed by MaxCopies() reversed motif copies
+  const std::vector<int8_t>& Reverse() const { return reverse_codes_; }
+
+ private:
+  int32_t max_read_len_;
+  int32_t max_copies_;
+  int32_t period_;
+  // All per-copy-number templates back to back
+  std::vector<int8_t> template_codes_;
+  std::vector<int32_t> template_offsets_;
+  std::vector<int8_t> frr_codes_;
+  std::vector<int8_t> forward_codes_;
+  std::vector<int8_t> reverse_codes_;
+};
+
+#endif  // SRC_LOCUS_TEMPLATES_H__
@@ -19,9 +19,11 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include <getopt.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include <iostream>
+#include <set>
 #include <sstream>
 
 //#include "src/bam_reader.h"
@@ -29,9 +31,13 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 #include "src/bam_io.h"
 #include "src/common.h"
 #include "src/genotyper.h"
+#include "src/genotyper_pool.h"
+#include "src/irr_catalog.h"
+#include "src/locus_catalog.h"
 #include "src/options.h"
 #include "src/ref_genome.h"
 #include "src/region_reader.h"
+#include "src/stats.h"
 #include "src/stringops.h"
 #include "src/vcf_writer.h"
 
@@ -46,11 +52,12 @@ void show_help() {
 	   << "--regions <regions.bed> "
 	   << "--out <outprefix> "
 	   << "\n\n Required options:\n"
-	   << "\t" << "--bam         <file.bam>      " << "\t" << "BAM input file" << "\n"
+	   << "\t" << "--bam         <file.bam>      " << "\t" << "BAM or CRAM input file" << "\n"
 	   << "\t" << "--ref         <genome.fa>     " << "\t" << "FASTA file for the reference genome" << "\n"
-	   << "\t" << "--regions     <regions.bed>   " << "\t" << "BED file containing TR coordinates" << "\n"
+	   << "\t" << "--regions     <regions.bed>   " << "\t" << "BED file containing TR coordinates, or a catalog from GangSTR catalog-build" << "\n"
 	   << "\t" << "--out         <outprefix>     " << "\t" << "Prefix to name output files" << "\n"
 	   << "\n Additional general options:\n"
+	   << "\t" << "--out-format  <vcf|vcf.gz|bcf>" << "\t" << "Output format. Compressed output is indexed. Default: " << options.out_format << "\n"
 	   << "\t" << "--genomewide                  " << "\t" << "Genome-wide mode" << "\n"
 	   << "\n Options for different sequencing settings\n"
 	   << "\t" << "--readlength  <int>           " << "\t" << "Read length. Default: " << options.read_len << "\n"
@@ -68,6 +75,13 @@ void show_help() {
 	   << "\t" << "--insertmax   <float>         " << "\t" << "Maximum insert size. Default " << options.dist_max << "\n"
 	   << "\t" << "--read-prob-mode              " << "\t" << "Use only read probability (ignore class probability)" << "\n"
 	   << "\t" << "--numbstrap   <int>           " << "\t" << "Number of bootstrap samples. Default: " << options.num_boot_samp << "\n"
+	   << "\t" << "--optimizer   <nlopt|discrete>" << "\t" << "Genotype search engine. Default: " << options.optimizer << "\n"
+	   << "\t" << "--bootstrap-threads <int>     " << "\t" << "Number of threads for bootstrap samples at each locus. Default: " << options.num_boot_threads << "\n"
+	   << "\t" << "--bootstrap-adaptive          " << "\t" << "Run bootstrap samples in batches and stop once the confidence intervals are stable (--numbstrap is the maximum)" << "\n"
+	   << "\t" << "--bootstrap-batch <int>       " << "\t" << "Bootstrap samples per batch with --bootstrap-adaptive. Default: " << options.boot_batch << "\n"
+	   << "\t" << "--bootstrap-tol <float>       " << "\t" << "Largest change of a confidence interval bound between batches that counts as stable. Default: " << options.boot_tol << "\n"
+	   << "\t" << "--screen                      " << "\t" << "Call reference-like loci from enclosing reads, without the full model and bootstrap" << "\n"
+	   << "\t" << "--screen-check                " << "\t" << "Like --screen, but also run the full model on screened loci, output its calls and report concordance" << "\n"
 	   << "\n Parameters for local realignment:\n"
 	   << "\t" << "--minscore    <int>           " << "\t" << "Minimum alignment score (out of 100). Default: " << options.min_score << "\n"
 	   << "\t" << "--minmatch    <int>           " << "\t" << "Minimum number of matching basepairs on each end of enclosing reads. Default:L " << options.min_match<< "\n"
@@ -78,9 +92,17 @@ void show_help() {
 	   << "\n Parameters for more detailed info about each locus:\n"
 	   << "\t" << "--output-bootstraps           " << "\t" << "Output file with bootstrap samples" << "\n"
 	   << "\t" << "--output-readinfo             " << "\t" << "Output read class info (for debugging)" << "\n"
+	   << "\t" << "--stats                       " << "\t" << "Output time spent in each stage and counters for each locus" << "\n"
 	   << "\n Additional optional paramters:\n"
 	   << "\t" << "-h,--help                     " << "\t" << "display this help screen" << "\n"
 	   << "\t" << "--seed                        " << "\t" << "Random number generator initial seed" << "\n"
+	   << "\t" << "--threads     <int>           " << "\t" << "Number of threads used to process loci. Default: " << options.num_threads << "\n"
+	   << "\t" << "--stream-regions              " << "\t" << "Decode each BAM record once for neighbouring loci. Best with a sorted regions file" << "\n"
+	   << "\t" << "--io-threads  <int>           " << "\t" << "Number of threads for BAM decompression. Default: " << options.io_threads << "\n"
+	   << "\t" << "--ref-cache                   " << "\t" << "Keep the reference of the genotyped chromosomes packed in memory" << "\n"
+	   << "\t" << "--shard       <i>/<n>         " << "\t" << "Only genotype part i (1 to n) of a locus catalog, split by estimated cost" << "\n"
+	   << "\t" << "--irr-catalog <file>          " << "\t" << "Genome-wide catalog of fully repetitive reads, used to find FRRs mapped away from each locus" << "\n"
+	   << "\t" << "--build-irr-catalog           " << "\t" << "Build the --irr-catalog file from the BAM files before genotyping" << "\n"
 	   << "\t" << "-v,--verbose                  " << "\t" << "Print out useful progress messages" << "\n"
 	   << "\t" << "--very                        " << "\t" << "Print out more detailed progress messages for debugging" << "\n"
 	   << "\t" << "--version                     " << "\t" << "Print out the version of this software.\n"
@@ -96,6 +118,7 @@ void parse_commandline_options(int argc, char* argv[], Options* options) {
     OPT_REFFA,
     OPT_REGIONS,
     OPT_OUT,
+    OPT_OUTFORMAT,
     OPT_HELP,
     OPT_WFRR,
     OPT_WENCLOSE,
@@ -116,10 +139,25 @@ void parse_commandline_options(int argc, char* argv[], Options* options) {
     OPT_STUTDW,
     OPT_STUTPR,
     OPT_NBSTRAP,
+    OPT_BSTHREADS,
+    OPT_BSADAPTIVE,
+    OPT_BSBATCH,
+    OPT_BSTOL,
+    OPT_OPTIMIZER,
     OPT_RDPROB,
     OPT_OUTBS,
     OPT_OUTREADINFO,
+    OPT_STATS,
     OPT_SEED,
+    OPT_THREADS,
+    OPT_STREAM,
+    OPT_IOTHREADS,
+    OPT_REFCACHE,
+    OPT_SHARD,
+    OPT_IRRCATALOG,
+    OPT_BUILDIRR,
+    OPT_SCREEN,
+    OPT_SCREENCHECK,
     OPT_VERBOSE,
     OPT_VERYVERBOSE,
     OPT_VERSION,
@@ -129,6 +167,7 @@ void parse_commandline_options(int argc, char* argv[], Options* options) {
     {"ref",         required_argument,  NULL, OPT_REFFA},
     {"regions",     required_argument,  NULL, OPT_REGIONS},
     {"out",         required_argument,  NULL, OPT_OUT},
+    {"out-format",  required_argument,  NULL, OPT_OUTFORMAT},
     {"help",        no_argument,        NULL, OPT_HELP},
     {"frrweight",   required_argument,  NULL, OPT_WFRR},      // TODO tried using optional_argument, but it causes segmentation faults
     {"enclweight",  required_argument,  NULL, OPT_WENCLOSE},
@@ -149,10 +188,25 @@ void parse_commandline_options(int argc, char* argv[], Options* options) {
     {"stutterdown", required_argument,  NULL, OPT_STUTDW},
     {"stutterprob", required_argument,  NULL, OPT_STUTPR},
     {"numbstrap",   required_argument,  NULL, OPT_NBSTRAP},
+    {"bootstrap-threads", required_argument, NULL, OPT_BSTHREADS},
+    {"bootstrap-adaptive", no_argument, NULL, OPT_BSADAPTIVE},
+    {"bootstrap-batch", required_argument, NULL, OPT_BSBATCH},
+    {"bootstrap-tol", required_argument, NULL, OPT_BSTOL},
+    {"optimizer",   required_argument,  NULL, OPT_OPTIMIZER},
     {"read-prob-mode",   no_argument,  NULL, OPT_RDPROB},
     {"output-bootstraps", no_argument,      NULL, OPT_OUTBS},
     {"output-readinfo", no_argument,        NULL, OPT_OUTREADINFO},
+    {"stats",       no_argument,        NULL, OPT_STATS},
     {"seed",        required_argument,  NULL, OPT_SEED},
+    {"threads",     required_argument,  NULL, OPT_THREADS},
+    {"stream-regions", no_argument,     NULL, OPT_STREAM},
+    {"io-threads",  required_argument,  NULL, OPT_IOTHREADS},
+    {"ref-cache",   no_argument,        NULL, OPT_REFCACHE},
+    {"shard",       required_argument,  NULL, OPT_SHARD},
+    {"irr-catalog", required_argument,  NULL, OPT_IRRCATALOG},
+    {"build-irr-catalog", no_argument,  NULL, OPT_BUILDIRR},
+    {"screen",      no_argument,        NULL, OPT_SCREEN},
+    {"screen-check", no_argument,       NULL, OPT_SCREENCHECK},
     {"verbose",     no_argument,        NULL, OPT_VERBOSE},
     {"very",  no_argument, NULL, OPT_VERYVERBOSE},
     {"version",     no_argument,        NULL, OPT_VERSION},
@@ -177,6 +231,9 @@ void parse_commandline_options(int argc, char* argv[], Options* options) {
     case OPT_OUT:
       options->outprefix = optarg;
       break;
+    case OPT_OUTFORMAT:
+      options->out_format = optarg;
+      break;
     case OPT_HELP:
     case 'h':
       show_help();
@@ -239,6 +296,21 @@ void parse_commandline_options(int argc, char* argv[], Options* options) {
     case OPT_NBSTRAP:
       options->num_boot_samp = atoi(optarg);
       break;
+    case OPT_BSTHREADS:
+      options->num_boot_threads = atoi(optarg);
+      break;
+    case OPT_BSADAPTIVE:
+      options->adaptive_boot = true;
+      break;
+    case OPT_BSBATCH:
+      options->boot_batch = atoi(optarg);
+      break;
+    case OPT_BSTOL:
+      options->boot_tol = atof(optarg);
+      break;
+    case OPT_OPTIMIZER:
+      options->optimizer = optarg;
+      break;
     case OPT_OUTBS:
       options->output_bootstrap++;
       break;
@@ -248,9 +320,46 @@ void parse_commandline_options(int argc, char* argv[], Options* options) {
     case OPT_OUTREADINFO:
       options->output_readinfo++;
       break;
+    case OPT_STATS:
+#ifdef GANGSTR_NO_STATS
+      PrintMessageDieOnError("--stats is not available, GangSTR was configured with --disable-stats", M_ERROR);
+#endif
+      options->output_stats = true;
+      break;
     case OPT_SEED:
       options->seed = atoi(optarg);
       break;
+    case OPT_THREADS:
+      options->num_threads = atoi(optarg);
+      break;
+    case OPT_STREAM:
+      options->stream_regions = true;
+      break;
+    case OPT_IOTHREADS:
+      options->io_threads = atoi(optarg);
+      break;
+    case OPT_REFCACHE:
+      options->ref_cache = true;
+      break;
+    case OPT_SHARD:
+      if (sscanf(optarg, "%d/%d", &options->shard, &options->num_shards) != 2) {
+	PrintMessageDieOnError("--shard must be given as <i>/<n>", M_ERROR);
+      }
+      options->shard--;
+      break;
+    case OPT_IRRCATALOG:
+      options->irr_catalog = optarg;
+      break;
+    case OPT_BUILDIRR:
+      options->build_irr_catalog = true;
+      break;
+    case OPT_SCREEN:
+      options->screen = true;
+      break;
+    case OPT_SCREENCHECK:
+      options->screen = true;
+      options->screen_check = true;
+      break;
     case OPT_VERBOSE:
     case 'v':
       options->verbose++;
@@ -292,10 +401,133 @@ void parse_commandline_options(int argc, char* argv[], Options* options) {
   if (options->min_score < 0 and options->min_score > 100){
     PrintMessageDieOnError("--min_score parameter must be in (0, 100) range", M_ERROR);
   }
+  if (options->num_threads < 1) {
+    PrintMessageDieOnError("--threads must be at least 1", M_ERROR);
+  }
+  if (options->io_threads < 0) {
+    PrintMessageDieOnError("--io-threads must be at least 0", M_ERROR);
+  }
+  if (options->num_shards < 1 or options->shard < 0 or options->shard >= options->num_shards) {
+    PrintMessageDieOnError("--shard <i>/<n> needs 1 <= i <= n", M_ERROR);
+  }
+  if (options->num_boot_threads < 1) {
+    PrintMessageDieOnError("--bootstrap-threads must be at least 1", M_ERROR);
+  }
+  if (options->boot_batch < 1) {
+    PrintMessageDieOnError("--bootstrap-batch must be at least 1", M_ERROR);
+  }
+  if (options->boot_tol < 0) {
+    PrintMessageDieOnError("--bootstrap-tol must be at least 0", M_ERROR);
+  }
+  if (options->out_format != "vcf" and options->out_format != "vcf.gz" and options->out_format != "bcf") {
+    PrintMessageDieOnError("--out-format must be vcf, vcf.gz or bcf", M_ERROR);
+  }
+  if (options->optimizer != "nlopt" and options->optimizer != "discrete") {
+    PrintMessageDieOnError("--optimizer must be nlopt or discrete", M_ERROR);
+  }
+  if (options->build_irr_catalog and options->irr_catalog.empty()) {
+    PrintMessageDieOnError("--build-irr-catalog requires --irr-catalog", M_ERROR);
+  }
   
 }
 
+void show_catalog_build_help() {
+  Options options;
+  std::stringstream help_msg;
+  help_msg << "\nUsage: GangSTR catalog-build "
+	   << "--regions <regions.bed> "
+	   << "--ref <reference.fa> "
+	   << "--out <catalog> "
+	   << "\n\n Compile a regions file into a binary locus catalog, which can be given to --regions\n"
+	   << "\n Required options:\n"
+	   << "\t" << "--regions     <regions.bed>   " << "\t" << "BED file containing TR coordinates" << "\n"
+	   << "\t" << "--ref         <genome.fa>     " << "\t" << "FASTA file for the reference genome" << "\n"
+	   << "\t" << "--out         <catalog>       " << "\t" << "Catalog file to write" << "\n"
+	   << "\n Additional optional paramters:\n"
+	   << "\t" << "--flanklen    <int>           " << "\t" << "Length of the stored flanks. Should be at least the read length. Default: " << LOCUS_CATALOG_FLANKLEN << "\n"
+	   << "\t" << "-h,--help                     " << "\t" << "display this help screen" << "\n"
+	   << "\n";
+  cerr << help_msg.str();
+  exit(1);
+}
+
+/*
+  GangSTR catalog-build: compile a regions file and the reference into a
+  binary locus catalog
+ */
+int catalog_build_main(int argc, char* argv[]) {
+  enum LONG_OPTIONS {
+    OPT_REGIONS,
+    OPT_REFFA,
+    OPT_OUT,
+    OPT_FLANKLEN,
+    OPT_HELP,
+  };
+  static struct option long_options[] = {
+    {"regions",     required_argument,  NULL, OPT_REGIONS},
+    {"ref",         required_argument,  NULL, OPT_REFFA},
+    {"out",         required_argument,  NULL, OPT_OUT},
+    {"flanklen",    required_argument,  NULL, OPT_FLANKLEN},
+    {"help",        no_argument,        NULL, OPT_HELP},
+    {NULL,          no_argument,        NULL, 0},
+  };
+  std::string regionsfile, reffa, outfile;
+  int32_t flank_len = LOCUS_CATALOG_FLANKLEN;
+  int ch;
+  int option_index = 0;
+  while ((ch = getopt_long(argc, argv, "h?", long_options, &option_index)) != -1) {
+    switch (ch) {
+    case OPT_REGIONS:
+      regionsfile = optarg;
+      break;
+    case OPT_REFFA:
+      reffa = optarg;
+      break;
+    case OPT_OUT:
+      outfile = optarg;
+      break;
+    case OPT_FLANKLEN:
+      flank_len = atoi(optarg);
+      break;
+    default:
+      show_catalog_build_help();
+    };
+  }
+  if (optind < argc) {
+    PrintMessageDieOnError("Unnecessary leftover arguments", M_ERROR);
+  }
+  if (regionsfile.empty() or reffa.empty() or outfile.empty()) {
+    show_catalog_build_help();
+  }
+  if (flank_len < 1) {
+    PrintMessageDieOnError("--flanklen must be at least 1", M_ERROR);
+  }
+  PrintMessageDieOnError("\tBuilding locus catalog " + outfile, M_PROGRESS);
+  if (!LocusCatalog::Build(regionsfile, reffa, flank_len, outfile)) {
+    PrintMessageDieOnError("Failed to write locus catalog " + outfile, M_ERROR);
+  }
+  return 0;
+}
+
+/*
+  Print how many loci --screen called and, with --screen-check, how many
+  of those got the same genotype from the full model
+ */
+void print_screen_summary(const Options& options, const int64_t& tested,
+			  const int64_t& passed, const int64_t& concordant) {
+  std::stringstream ss;
+  ss << "Screen called " << passed << " of " << tested << " loci";
+  if (options.screen_check && passed > 0) {
+    ss << ", full model agreed on " << concordant
+       << " (" << 100.0 * concordant / passed << "% concordance)";
+  }
+  PrintMessageDieOnError(ss.str(), M_PROGRESS);
+}
+
 int main(int argc, char* argv[]) {
+  if (argc > 1 && std::string(argv[1]) == "catalog-build") {
+    return catalog_build_main(argc - 1, argv + 1);
+  }
   // Set up
   Options options;
   parse_commandline_options(argc, argv, &options);
@@ -306,14 +538,22 @@ int main(int argc, char* argv[]) {
   }
   std::string full_command = full_command_ss.str();
   RegionReader region_reader(options.regionsfile);
+  if (options.num_shards > 1 && !region_reader.SetShard(options.shard, options.num_shards)) {
+    PrintMessageDieOnError("--shard requires a locus catalog (see GangSTR catalog-build)", M_ERROR);
+  }
   Locus locus;
   int merge_type = BamCramMultiReader::ORDER_ALNS_BY_FILE;
-  BamCramMultiReader bamreader(options.bamfiles, options.reffa, merge_type);
+  // Shared by all BAM readers, so it is declared before them
+  IOThreadPool io_pool(options.io_threads);
+  BamCramMultiReader bamreader(options.bamfiles, options.reffa, merge_type, io_pool.get());
 
 
   // Extract information from bam file (read length, insert size distribution, ..)
   int32_t read_len;
-  double mean, std_dev, coverage;
+  double mean, coverage;
+  // Fragment length sd used for all loci. Kept from the command line
+  // unless it is estimated from the BAM below
+  double std_dev = options.dist_sdev;
   BamInfoExtract bam_info(&options, &bamreader, &region_reader);
   if (options.genome_wide == true){
     PrintMessageDieOnError("\tRunning in whole genome mode", M_PROGRESS);
@@ -371,11 +611,95 @@ int main(int argc, char* argv[]) {
     options.dist_max = options.dist_mean + options.dist_sdev * 3;
   }
 
+  // Genome-wide IRR catalog, shared by all loci
+  IRRCatalog irr_catalog;
+  if (options.build_irr_catalog) {
+    PrintMessageDieOnError("\tBuilding IRR catalog " + options.irr_catalog, M_PROGRESS);
+    if (!IRRCatalog::Build(options.bamfiles, options.reffa, options.regionsfile,
+			   options.irr_catalog, io_pool.get())) {
+      PrintMessageDieOnError("Failed to build IRR catalog", M_ERROR);
+    }
+  }
+  if (!options.irr_catalog.empty()) {
+    if (!irr_catalog.Load(options.irr_catalog)) {
+      PrintMessageDieOnError("Could not open IRR catalog " + options.irr_catalog, M_ERROR);
+    }
+    if (options.verbose) {
+      stringstream ss;
+      ss << "\tLoaded " << irr_catalog.size() << " IRRs from catalog";
+      PrintMessageDieOnError(ss.str(), M_PROGRESS);
+    }
+  }
+  const IRRCatalog* irr_catalog_ptr = (options.irr_catalog.empty() ? NULL : &irr_catalog);
+
+  // Decompression threads only run ahead within a stream, so follow
+  // sorted regions with one stream instead of seeking for each locus
+  if (region_reader.AutoStreamRegions(options)) {
+    if (options.verbose) {
+      PrintMessageDieOnError("\tRegions are sorted, reading ahead with --stream-regions", M_PROGRESS);
+    }
+    options.stream_regions = true;
+  }
+
+  // Flanks of all loci are decoded from memory instead of read through faidx
+  PackedReference packed_ref;
+  if (options.ref_cache) {
+    std::set<std::string> chroms;
+    region_reader.Reset();
+    while (region_reader.GetNextRegion(&locus)) {
+      chroms.insert(locus.chrom);
+      locus.Reset();
+    }
+    if (!packed_ref.Load(options.reffa, chroms)) {
+      PrintMessageDieOnError("Could not load reference " + options.reffa, M_ERROR);
+    }
+    if (options.verbose) {
+      stringstream ss;
+      ss << "\tPacked " << chroms.size() << " chromosomes into " << packed_ref.packed_bytes() << " bytes";
+      PrintMessageDieOnError(ss.str(), M_PROGRESS);
+    }
+  }
+  const PackedReference* packed_ref_ptr = (options.ref_cache ? &packed_ref : NULL);
+
   // Process each region
   region_reader.Reset();
-  RefGenome refgenome(options.reffa);
-  VCFWriter vcfwriter(options.outprefix + ".vcf", full_command);
+  VCFWriter vcfwriter(options.outprefix + "." + options.out_format, full_command,
+		      options.out_format, options.reffa);
+  // Rows are written in regions file order, like the VCF
+  StatsWriter* stats_writer = NULL;
+  if (options.output_stats) {
+    stats_writer = new StatsWriter(options.outprefix + ".stats.tsv");
+  }
+  if (options.num_threads > 1) {
+    // Workers read options while running, so set it before they start
+    options.dist_sdev = std_dev;
+    // Workers set up their own reference and BAM readers
+    GenotyperPool pool(options, &vcfwriter, irr_catalog_ptr, io_pool.get(), packed_ref_ptr,
+		       stats_writer);
+    while (region_reader.GetNextRegion(&locus)) {
+      if (options.use_off == true){
+	locus.offtarget_share = 1.0;
+      }
+      else{
+	locus.offtarget_share = 0.0;
+      }
+      locus.insert_size_mean = options.dist_mean;
+      locus.insert_size_stddev = options.dist_sdev;
+      pool.AddLocus(locus);
+      locus.Reset();
+    }
+    pool.Finish();
+    if (options.screen) {
+      int64_t tested, passed, concordant;
+      pool.GetScreenCounts(&tested, &passed, &concordant);
+      print_screen_summary(options, tested, passed, concordant);
+    }
+    delete stats_writer;
+    return 0;
+  }
+  RefGenome refgenome(options.reffa, packed_ref_ptr);
   Genotyper genotyper(refgenome, options);
+  genotyper.SetIRRCatalog(irr_catalog_ptr);
   stringstream ss;
   while (region_reader.GetNextRegion(&locus)) {
     ss.str("");
@@ -398,9 +722,19 @@ int main(int argc, char* argv[]) {
     locus.insert_size_mean = options.dist_mean;
     locus.insert_size_stddev = options.dist_sdev = std_dev;
 
-    if (genotyper.ProcessLocus(&bamreader, &locus)) {
+    bool genotyped = genotyper.ProcessLocus(&bamreader, &locus);
+    if (genotyped) {
       vcfwriter.WriteRecord(locus);
     }
+    if (stats_writer != NULL) {
+      stats_writer->WriteLocus(locus, genotyped, genotyper.stats());
+    }
     locus.Reset();
   };
+  if (options.screen) {
+    int64_t tested, passed, concordant;
+    genotyper.GetScreenCounts(&tested, &passed, &concordant);
+    print_screen_summary(options, tested, passed, concordant);
+  }
+  delete stats_writer;
 }
@@ -68,12 +68,29 @@ Options::Options() {
   read_prob_mode = false;
   output_bootstrap = false;
   output_readinfo = false;
+  output_stats = false;
   //seed = time(NULL);
   // Fixed seed
   seed = 123;
   min_match = 5;
   use_cov = true;
   use_off = false;
+  num_threads = 1;
+  num_boot_threads = 1;
+  adaptive_boot = false;
+  boot_batch = 10;
+  boot_tol = 1.0;
+  optimizer = "nlopt";
+  stream_regions = false;
+  io_threads = 0;
+  ref_cache = false;
+  shard = 0;
+  num_shards = 1;
+  out_format = "vcf";
+  irr_catalog = "";
+  build_irr_catalog = false;
+  screen = false;
+  screen_check = false;
 }
 
 Options::~Options() {}
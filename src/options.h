@@ -76,12 +76,46 @@ class Options {
   bool output_bootstrap;
   // Output debug info for reads
   bool output_readinfo;
+  // Output per-locus stage timers and counters
+  bool output_stats;
   // Use coverage (set to 0 for whole exome)
   bool use_cov;
   // Use off target regions if specified in bam file
   bool use_off;
   // Random number generator seed
   int32_t seed;
+  // Number of threads for processing loci
+  int32_t num_threads;
+  // Number of threads for bootstrap replicates at each locus
+  int32_t num_boot_threads;
+  // Stop bootstrapping once the confidence intervals are stable
+  bool adaptive_boot;
+  // Replicates per batch with adaptive_boot
+  int32_t boot_batch;
+  // Largest change of a confidence interval bound (in copies) between
+  // batches that counts as stable with adaptive_boot
+  double boot_tol;
+  // Genotype search engine ("nlopt" or "discrete")
+  std::string optimizer;
+  // Share decoded reads between neighbouring loci
+  bool stream_regions;
+  // Number of threads for BAM decompression (0 for none)
+  int32_t io_threads;
+  // Keep the reference of the genotyped chromosomes 2-bit packed in memory
+  bool ref_cache;
+  // Process shard (0-based) of num_shards of a locus catalog
+  int32_t shard;
+  int32_t num_shards;
+  // Output format ("vcf", "vcf.gz" or "bcf")
+  std::string out_format;
+  // Genome-wide IRR catalog file ("" to not use one)
+  std::string irr_catalog;
+  // Build the IRR catalog before genotyping
+  bool build_irr_catalog;
+  // Call reference-like loci from enclosing reads, skipping the full model
+  bool screen;
+  // Also run the full model on screened loci and report concordance
+  bool screen_check;
 };
 
 #endif  // SRC_OPTIONS_H__
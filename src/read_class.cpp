@@ -28,6 +28,9 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 using namespace std;
 
 ReadClass::ReadClass() {
+  data_size_ = 0;
+  cache_read_len_ = -1;
+  cache_motif_len_ = -1;
   // Set default options
   Options default_options;
   SetOptions(default_options);
@@ -41,10 +44,15 @@ void ReadClass::SetOptions(const Options& options) {
   stutter_down = options.stutter_down;
   stutter_p = options.stutter_p;
   read_prob_mode = options.read_prob_mode;
+  ClearCache();
 }
 
-void ReadClass::AddData(const int32_t& data) {
-  read_class_data_.push_back(data);
+void ReadClass::AddData(const int32_t& data, const int32_t& count) {
+  if (count <= 0) {
+    return;
+  }
+  read_class_data_[data] += count;
+  data_size_ += count;
 }
 
 /*
@@ -53,6 +61,8 @@ void ReadClass::AddData(const int32_t& data) {
   log P(data|<allelele1, allele2>) = sum_i log P(data_i | <allele1, allele2>)
   P(data_i | <allele1, allele2> = allele1_weight*P(data_i|allele1) + allele2_weight*P(data_i|allele2)
 
+  Each distinct data value is evaluated once and weighted by its read count.
+
   Return false if something goes wrong.
  */
 bool ReadClass::GetClassLogLikelihood(const int32_t& allele1,
@@ -62,23 +72,23 @@ bool ReadClass::GetClassLogLikelihood(const int32_t& allele1,
 				      double* class_ll) {
   *class_ll = 0;
   double samp_log_likelihood, a1_ll, a2_ll;
-  for (std::vector<int32_t>::iterator data_it = read_class_data_.begin();
+  for (std::map<int32_t, int32_t>::iterator data_it = read_class_data_.begin();
        data_it != read_class_data_.end();
        data_it++) {
-    if (!GetAlleleLogLikelihood(allele1, *data_it, read_len, motif_len, ref_count, &a1_ll)) {
+    if (!GetAlleleLogLikelihood(allele1, data_it->first, read_len, motif_len, ref_count, &a1_ll)) {
       return false;
     }
-    if (!GetAlleleLogLikelihood(allele2, *data_it, read_len, motif_len, ref_count, &a2_ll)) {
+    if (!GetAlleleLogLikelihood(allele2, data_it->first, read_len, motif_len, ref_count, &a2_ll)) {
       return false;
     }
     // TODO delete
     // cerr<<typeid(*this).name()<<"\t";
-    // cerr<<*data_it<<"\t"<<fast_log_sum_exp(log(allele1_weight_)+a1_ll, log(allele2_weight_)+a2_ll)<<endl;
+    // cerr<<data_it->first<<"\t"<<fast_log_sum_exp(log(allele1_weight_)+a1_ll, log(allele2_weight_)+a2_ll)<<endl;
     if (ploidy == 2){
-      *class_ll += fast_log_sum_exp(log(allele1_weight_)+a1_ll, log(allele2_weight_)+a2_ll);
+      *class_ll += data_it->second * fast_log_sum_exp(log(allele1_weight_)+a1_ll, log(allele2_weight_)+a2_ll);
     }
     else if (ploidy == 1){
-      *class_ll += log(allele1_weight_) + a1_ll;
+      *class_ll += data_it->second * (log(allele1_weight_) + a1_ll);
     }
   }
   return true;
@@ -95,7 +105,7 @@ bool ReadClass::GetAlleleLogLikelihood(const int32_t& allele,
 				       const int32_t& ref_count,
 				       double* allele_ll) {
   double log_class_prob, log_read_prob;
-  if (!GetLogClassProb(allele, read_len, motif_len, &log_class_prob)) {
+  if (!GetCachedLogClassProb(allele, read_len, motif_len, &log_class_prob)) {
     return false;
   }
   if (!GetLogReadProb(allele, data, read_len, motif_len, ref_count, &log_read_prob)) {
@@ -111,6 +121,30 @@ bool ReadClass::GetAlleleLogLikelihood(const int32_t& allele,
   return true;
 }
 
+/*
+  Returns GetLogClassProb from the per-locus cache, computing it on
+  the first request for each allele.
+ */
+bool ReadClass::GetCachedLogClassProb(const int32_t& allele,
+				      const int32_t& read_len, const int32_t& motif_len,
+				      double* log_class_prob) {
+  if (read_len != cache_read_len_ || motif_len != cache_motif_len_) {
+    ClearCache();
+    cache_read_len_ = read_len;
+    cache_motif_len_ = motif_len;
+  }
+  std::map<int32_t, double>::iterator it = class_prob_cache_.find(allele);
+  if (it != class_prob_cache_.end()) {
+    *log_class_prob = it->second;
+    return true;
+  }
+  if (!GetLogClassProb(allele, read_len, motif_len, log_class_prob)) {
+    return false;
+  }
+  class_prob_cache_[allele] = *log_class_prob;
+  return true;
+}
+
 bool ReadClass::GetLogClassProb(const int32_t& allele,
 				const int32_t& read_len, const int32_t& motif_len,
 				double* log_class_prob) {
@@ -127,11 +161,29 @@ bool ReadClass::GetLogReadProb(const int32_t& allele,
 
 void ReadClass::Reset() {
   read_class_data_.clear();
+  data_size_ = 0;
+}
+
+void ReadClass::ClearCache() {
+  class_prob_cache_.clear();
+  cache_read_len_ = -1;
+  cache_motif_len_ = -1;
 }
 
 
 std::size_t ReadClass::GetDataSize() {
-  return read_class_data_.size();
+  return data_size_;
+}
+
+const std::map<int32_t, int32_t>& ReadClass::GetData() {
+  return read_class_data_;
+}
+
+bool ReadClass::GetDataLogLikelihood(const int32_t& allele, const int32_t& data,
+				     const int32_t& read_len, const int32_t& motif_len,
+				     const int32_t& ref_count,
+				     double* allele_ll) {
+  return GetAlleleLogLikelihood(allele, data, read_len, motif_len, ref_count, allele_ll);
 }
 
 ReadClass::~ReadClass() {}
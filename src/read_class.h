@@ -25,6 +25,7 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdint.h>
 
+#include <map>
 #include <vector>
 
 /*
@@ -34,7 +35,7 @@ Individual read classes (FRR, enclosing, spanning) inherit
 from this and implement their own read and class probability functions
 
 A read class consists of:
-- data (a vector of relevant values, e.g. copy number, insert size)
+- data (a histogram of relevant values, e.g. copy number, insert size)
 - a method to calculate the class log likelihood for a diploid genotype
  */
 class ReadClass {
@@ -46,8 +47,8 @@ class ReadClass {
   ReadClass();
   virtual ~ReadClass();
 
-  // Add a data point to the class data vector
-  void AddData(const int32_t& data);
+  // Add count data points with the same value to the class data
+  void AddData(const int32_t& data, const int32_t& count = 1);
   // Set options (e.g. insert sizes, stutter params)
   void SetOptions(const Options& options);
   // Calculate class log likelihood for diploid genotype P(data|<A,B>)
@@ -57,8 +58,18 @@ class ReadClass {
 			     double* class_ll);
   // Clear all data from the class
   void Reset();
+  // Clear cached per-locus values (class probabilities etc.)
+  virtual void ClearCache();
   // Check how many data points
   std::size_t GetDataSize();
+  // Class data (value -> number of reads)
+  const std::map<int32_t, int32_t>& GetData();
+  // log P(one read with this data value | allele), the per-allele term
+  // that GetClassLogLikelihood combines for the two alleles
+  virtual bool GetDataLogLikelihood(const int32_t& allele, const int32_t& data,
+				    const int32_t& read_len, const int32_t& motif_len,
+				    const int32_t& ref_count,
+				    double* allele_ll);
 
  protected:
   // Calculate log probability P(datapoint | allele)
@@ -75,8 +86,19 @@ class ReadClass {
   double stutter_down;
   double stutter_p;
   bool read_prob_mode;
-  // Store vector of data for this class
-  std::vector<int32_t> read_class_data_;
+  // Store data for this class as value -> number of reads
+  std::map<int32_t, int32_t> read_class_data_;
+  // Total number of reads in read_class_data_
+  std::size_t data_size_;
+
+  // Class probabilities only depend on the allele within a locus,
+  // so they are computed once per allele and cached here
+  bool GetCachedLogClassProb(const int32_t& allele,
+			     const int32_t& read_len, const int32_t& motif_len,
+			     double* log_class_prob);
+  std::map<int32_t, double> class_prob_cache_;
+  int32_t cache_read_len_;
+  int32_t cache_motif_len_;
   
 
   // Allele weights. TODO: change if phasing available, would need per-read weights
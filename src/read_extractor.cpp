@@ -18,18 +18,30 @@ You should have received a copy of the GNU General Public License
 along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <string.h>
+
 #include <map>
 #include "src/stringops.h"
 #include "src/read_extractor.h"
 #include "src/realignment.h"
+#include "src/stats.h"
 #include "gsl/gsl_statistics_int.h"
 #include <iostream>
 
 using namespace std;
 
-ReadExtractor::ReadExtractor(const Options& options_) : options(options_) {
-  if (options.output_readinfo) {
-    readfile_.open((options.outprefix + ".readinfo.tab").c_str());
+ReadExtractor::ReadExtractor(const Options& options_,
+			     std::ostream* readinfo_out)
+  : options(options_), mate_cache_(MATE_CACHE_SIZE) {
+  readinfo_out_ = readinfo_out;
+  templates_ = NULL;
+  irr_catalog_ = NULL;
+  if (readinfo_out_ == NULL) {
+    if (options.output_readinfo) {
+      readfile_.open((options.outprefix + ".readinfo.tab").c_str());
+    }
+    readinfo_out_ = &readfile_;
   }
 }
 
@@ -41,9 +53,12 @@ bool ReadExtractor::ExtractReads(BamCramMultiReader* bamreader,
          const Locus& locus,
          const int32_t& regionsize,
          const int32_t& min_match, 
-         LikelihoodMaximizer* likelihood_maximizer) {
+         LikelihoodMaximizer* likelihood_maximizer,
+         const LocusTemplates* templates) {
+  templates_ = templates;
   // This will keep track of information for each read pair
-  std::map<std::string, ReadPair> read_pairs;
+  ReadPairTable& read_pairs = read_pairs_;
+  read_pairs.Clear();
   
   if (!ProcessReadPairs(bamreader, locus, regionsize, min_match, &read_pairs)) {
     return false;
@@ -59,23 +74,26 @@ bool ReadExtractor::ExtractReads(BamCramMultiReader* bamreader,
   int32_t max_bound = 0, median_bound = 0, bound_thresh = 0;
   int32_t max_enclose = 0;
   std::vector<int32_t> bound_vals;
-  for (std::map<std::string, ReadPair>::const_iterator iter = read_pairs.begin();
-       iter != read_pairs.end(); iter++) {
-    if (iter->second.read_type == RC_SPAN){
-      if (iter->second.max_nCopy - 1 > 0){
-	bound_vals.push_back(iter->second.max_nCopy - 1);
+  std::vector<size_t> order;
+  read_pairs.SortedOrder(&order);
+  for (std::vector<size_t>::const_iterator iter = order.begin();
+       iter != order.end(); iter++) {
+    const ReadPair& read_pair = read_pairs.at(*iter);
+    if (read_pair.read_type == RC_SPAN){
+      if (read_pair.max_nCopy - 1 > 0){
+	bound_vals.push_back(read_pair.max_nCopy - 1);
       }
-	//if (iter->second.max_nCopy - 1 > max_bound){
-	//max_bound = iter->second.max_nCopy - 1;
+	//if (read_pair.max_nCopy - 1 > max_bound){
+	//max_bound = read_pair.max_nCopy - 1;
 	//}
-    } else if (iter->second.read_type == RC_BOUND){
-      bound_vals.push_back(iter->second.data_value - 1);
-      //if (iter->second.data_value - 1 > max_bound){
-      //max_bound = iter->second.data_value -1;
+    } else if (read_pair.read_type == RC_BOUND){
+      bound_vals.push_back(read_pair.data_value - 1);
+      //if (read_pair.data_value - 1 > max_bound){
+      //max_bound = read_pair.data_value -1;
       //}
-    } else if (iter->second.read_type == RC_ENCL){
-      if (iter->second.data_value > max_enclose){
-	max_enclose = iter->second.data_value;
+    } else if (read_pair.read_type == RC_ENCL){
+      if (read_pair.data_value > max_enclose){
+	max_enclose = read_pair.data_value;
       }
     }
   }
@@ -129,93 +147,92 @@ bool ReadExtractor::ExtractReads(BamCramMultiReader* bamreader,
   */
 
   /* Load data into likelihood maximizer */
-  for (std::map<std::string, ReadPair>::const_iterator iter = read_pairs.begin();
-       iter != read_pairs.end(); iter++) {
+  for (std::vector<size_t>::const_iterator iter = order.begin();
+       iter != order.end(); iter++) {
+    const ReadPair& read_pair = read_pairs.at(*iter);
     /*
-    if (iter->second.read_type != RC_DISCARD and iter->second.read_type != RC_UNKNOWN)
+    if (read_pair.read_type != RC_DISCARD and read_pair.read_type != RC_UNKNOWN)
     {
-      cout<<iter->first<<"\t"<<iter->second.read_type<<"\t"<<iter->second.data_value<<endl;
-      cout<<((BamAlignment)iter->second.read1).QueryBases()<<endl;
-      cout<<((BamAlignment)iter->second.read2).QueryBases()<<endl;
+      cout<<read_pairs.Key(*iter)<<"\t"<<read_pair.read_type<<"\t"<<read_pair.data_value<<endl;
     }
     */
-    if (iter->second.read_type == RC_SPAN) {
-      if (iter->second.data_value < options.dist_max){
+    if (read_pair.read_type == RC_SPAN) {
+      if (read_pair.data_value < options.dist_max){
         if (options.output_readinfo) {
-	  readfile_ << locus.chrom << "\t" 
+	  (*readinfo_out_) << locus.chrom << "\t" 
 		    << locus.start << "\t" 
 		    << locus.end << "\t"
-		    << iter->first << "\t" 
+		    << read_pairs.Key(*iter) << "\t" 
 		    << "SPAN" << "\t" 
-		    << iter->second.data_value << "\t" 
-		    << iter->second.found_pair << std::endl;
+		    << read_pair.data_value << "\t" 
+		    << read_pair.found_pair << std::endl;
         }
-        likelihood_maximizer->AddSpanningData(iter->second.data_value);
+        likelihood_maximizer->AddSpanningData(read_pair.data_value);
         span++;
       }
       // In spanning case, we can also have flanking reads:
-      if (iter->second.max_nCopy > 0 and iter->second.max_nCopy < bound_thresh) {
+      if (read_pair.max_nCopy > 0 and read_pair.max_nCopy < bound_thresh) {
 	if (options.output_readinfo) {
-	  readfile_ << locus.chrom << "\t" 
+	  (*readinfo_out_) << locus.chrom << "\t" 
 		    << locus.start << "\t" 
 		    << locus.end << "\t"
-		    << iter->first << "\t" 
+		    << read_pairs.Key(*iter) << "\t" 
 		    << "SPFLNK" << "\t" 
-		    << iter->second.max_nCopy - 1 << "\t" 
-		    << iter->second.found_pair << std::endl;
+		    << read_pair.max_nCopy - 1 << "\t" 
+		    << read_pair.found_pair << std::endl;
   }
-        likelihood_maximizer->AddFlankingData(iter->second.max_nCopy-1); //-1 because flanking is always picked up +1
+        likelihood_maximizer->AddFlankingData(read_pair.max_nCopy-1); //-1 because flanking is always picked up +1
         flank++;
       }
-    } else if (iter->second.read_type == RC_ENCL) {
+    } else if (read_pair.read_type == RC_ENCL) {
       if (options.output_readinfo) {
-	readfile_ << locus.chrom << "\t" 
+	(*readinfo_out_) << locus.chrom << "\t" 
 		  << locus.start << "\t" 
 		  << locus.end << "\t"
-		  << iter->first << "\t" 
+		  << read_pairs.Key(*iter) << "\t" 
 		  << "ENCLOSE" << "\t" 
-		  << iter->second.data_value << "\t" 
-		  << iter->second.found_pair << std::endl;
+		  << read_pair.data_value << "\t" 
+		  << read_pair.found_pair << std::endl;
       }
-      likelihood_maximizer->AddEnclosingData(iter->second.data_value);
+      likelihood_maximizer->AddEnclosingData(read_pair.data_value);
       encl++;
-    } else if (iter->second.read_type == RC_FRR) {
-      if (accept_FRR && iter->second.data_value < options.dist_max - options.read_len){
+    } else if (read_pair.read_type == RC_FRR) {
+      if (accept_FRR && read_pair.data_value < options.dist_max - options.read_len){
 	if (options.output_readinfo) {
-	  readfile_ << locus.chrom << "\t" 
+	  (*readinfo_out_) << locus.chrom << "\t" 
 		    << locus.start << "\t" 
 		    << locus.end << "\t"
-		    << iter->first << "\t" 
+		    << read_pairs.Key(*iter) << "\t" 
 		    << "FRR" << "\t" 
-		    << iter->second.data_value << "\t" 
-		    << iter->second.found_pair << std::endl;
+		    << read_pair.data_value << "\t" 
+		    << read_pair.found_pair << std::endl;
 	}
-	likelihood_maximizer->AddFRRData(iter->second.data_value);
+	likelihood_maximizer->AddFRRData(read_pair.data_value);
 	frr++;
       }
-    } else if (iter->second.read_type == RC_BOUND and iter->second.data_value < bound_thresh) {
+    } else if (read_pair.read_type == RC_BOUND and read_pair.data_value < bound_thresh) {
       if (options.output_readinfo) {
-	readfile_ << locus.chrom << "\t" 
+	(*readinfo_out_) << locus.chrom << "\t" 
 		  << locus.start << "\t" 
 		  << locus.end << "\t"
-		  << iter->first << "\t" 
+		  << read_pairs.Key(*iter) << "\t" 
 		  << "BOUND" << "\t" 
-		  << iter->second.data_value - 1 << "\t" 
-		  << iter->second.found_pair << std::endl;
+		  << read_pair.data_value - 1 << "\t" 
+		  << read_pair.found_pair << std::endl;
       }
-      likelihood_maximizer->AddFlankingData(iter->second.data_value - 1); // -1 because flanking is always picked up +1
+      likelihood_maximizer->AddFlankingData(read_pair.data_value - 1); // -1 because flanking is always picked up +1
       flank++;
-    } else if (iter->second.read_type == RC_OFFT){
+    } else if (read_pair.read_type == RC_OFFT){
       if (options.output_readinfo) {
-	readfile_ << locus.chrom << "\t" 
+	(*readinfo_out_) << locus.chrom << "\t" 
 		  << locus.start << "\t" 
 		  << locus.end << "\t"
-		  << iter->first << "\t" 
+		  << read_pairs.Key(*iter) << "\t" 
 		  << "OFFT" << "\t" 
-		  << iter->second.data_value << "\t" 
-		  << iter->second.found_pair << std::endl;
+		  << read_pair.data_value << "\t" 
+		  << read_pair.found_pair << std::endl;
       }
-      likelihood_maximizer->AddOffTargetData(iter->second.data_value);
+      likelihood_maximizer->AddOffTargetData(read_pair.data_value);
       offt++;
     } else {
       continue;
@@ -231,30 +248,41 @@ bool ReadExtractor::ExtractReads(BamCramMultiReader* bamreader,
  */
 bool ReadExtractor::ProcessReadPairs(BamCramMultiReader* bamreader,
              const Locus& locus, const int32_t& regionsize, const int32_t& min_match,
-             std::map<std::string, ReadPair>* read_pairs) {
+             ReadPairTable* read_pairs) {
   if (locus.end < locus.start){
     // TODO print error "Not enough extracted reads"
     PrintMessageDieOnError("\tLocus end preceeds locus start. Aborting..", M_PROGRESS);
     return false;
   }
   // Get bam alignments from the relevant region
-  bamreader->SetRegion(locus.chrom, 
-		       locus.start-regionsize, 
-		       locus.end+regionsize);
+  if (options.stream_regions) {
+    bamreader->SetWindowRegion(locus.chrom,
+			       locus.start-regionsize,
+			       locus.end+regionsize);
+  } else {
+    bamreader->SetRegion(locus.chrom, 
+			 locus.start-regionsize, 
+			 locus.end+regionsize);
+  }
 
   // Keep track of which file we're processing
   int32_t file_index = 0;
-  std::string file_label = "0_";
   std::string prev_file = "";
+  std::vector<std::string> files;
 
   // Header has info about chromosome names
   const BamHeader* bam_header = bamreader->bam_header();
   const int32_t chrom_ref_id = bam_header->ref_id(locus.chrom);
 
-  // Go through each alignment in the region
-  BamAlignment alignment;
+  // Go through each alignment in the region. Alignments are viewed in
+  // place, so reads that are skipped or discarded are never copied
+  BamAlignmentView alignment;
+  // The mate rescue pass below classifies rescued reads by the position
+  // of the last alignment in the region
+  int32_t last_position = 0;
 
-  while (bamreader->GetNextAlignment(alignment)) {
+  while (bamreader->GetNextAlignment(&alignment)) {
+    last_position = alignment.Position();
     if (debug) {
       std::cerr << "Processing " << alignment.Name() << std::endl;
     }
@@ -268,29 +296,29 @@ bool ReadExtractor::ProcessReadPairs(BamCramMultiReader* bamreader,
     // Check if we've moved to a different file
     if (prev_file.compare(alignment.Filename()) != 0) {
       prev_file = alignment.Filename();
-      std::stringstream ss;
-      ss << ++file_index << "_";
-      file_label = ss.str();
+      file_index++;
+      files.push_back(prev_file);
     }
 
     // Set key to keep track of this mate pair
-    std::string aln_key = file_label + trim_alignment_name(alignment);
+    const char* aln_name = alignment.NameData();
+    size_t aln_name_length = trimmed_name_length(alignment);
 
     /*  Check if read's mate already processed */
-    std::map<std::string, ReadPair>::iterator rp_iter = read_pairs->find(aln_key);
-    if (rp_iter != read_pairs->end()) {
+    ReadPair* rp = read_pairs->Find(file_index, aln_name, aln_name_length);
+    if (rp != NULL) {
       if (debug) {
         std::cerr << "Already found mate  " << alignment.Name()
-            << " " << rp_iter->second.read_type
+            << " " << rp->read_type
             << std::endl;
       }
 
-      rp_iter->second.found_pair = true;
-      rp_iter->second.read2 = alignment;
+      rp->found_pair = true;
+      rp->read2.Set(alignment);
       // We will check the mate in any case (not just UNKONWN) 
       // (to find longer flanking reads or potential FRRs)
-      if (rp_iter->second.read_type != RC_FRR && rp_iter->second.read_type != RC_ENCL){ 
-      // if (rp_iter->second.read_type == RC_UNKNOWN) {
+      if (rp->read_type != RC_FRR && rp->read_type != RC_ENCL){ 
+      // if (rp->read_type == RC_UNKNOWN) {
         if (debug) {
           std::cerr << "Checking mate " << alignment.Name() 
 		    << " " << alignment.QueryBases() << std:: endl;
@@ -298,10 +326,10 @@ bool ReadExtractor::ProcessReadPairs(BamCramMultiReader* bamreader,
 
         int32_t insert_size;
         // This check is probably redundant (SPAN will be found in first round)
-        if (rp_iter->second.read_type != RC_SPAN){
+        if (rp->read_type != RC_SPAN){
           if (FindSpanningRead(alignment, chrom_ref_id, locus, &insert_size)) {
-            rp_iter->second.read_type = RC_SPAN;
-            rp_iter->second.data_value = insert_size;
+            rp->read_type = RC_SPAN;
+            rp->data_value = insert_size;
             continue;
           }
         }
@@ -317,39 +345,39 @@ bool ReadExtractor::ProcessReadPairs(BamCramMultiReader* bamreader,
           std::cerr << "Mate found to be   " << read_type << std:: endl;
         }
         if (read_type == RC_FRR || srt == SR_IRR){ // if new guess is FRR
-          rp_iter->second.read_type = RC_FRR;
-          rp_iter->second.data_value = data_value;
+          rp->read_type = RC_FRR;
+          rp->data_value = data_value;
 
-          if (rp_iter->second.max_nCopy < nCopy_value){
-            rp_iter->second.max_nCopy = nCopy_value;
+          if (rp->max_nCopy < nCopy_value){
+            rp->max_nCopy = nCopy_value;
           }
         }
-        else if ((rp_iter->second.read_type == RC_BOUND) && (read_type == RC_BOUND || 
+        else if ((rp->read_type == RC_BOUND) && (read_type == RC_BOUND || 
                   srt == SR_PREFLANK ||
                   srt == SR_POSTFLANK)){  // if new guess is BOUND, just check to update ncopy
-          if (rp_iter->second.max_nCopy < nCopy_value){
-            rp_iter->second.max_nCopy = nCopy_value;
-            rp_iter->second.data_value = nCopy_value;
+          if (rp->max_nCopy < nCopy_value){
+            rp->max_nCopy = nCopy_value;
+            rp->data_value = nCopy_value;
           }
         }
         else if (read_type == RC_ENCL ||  // If new guess is ENCL, update to ENCL
                    srt == SR_ENCLOSING){
-          rp_iter->second.read_type = RC_ENCL;
-          rp_iter->second.data_value = data_value;
+          rp->read_type = RC_ENCL;
+          rp->data_value = data_value;
         }
-        else if (rp_iter->second.read_type != RC_UNKNOWN &&
+        else if (rp->read_type != RC_UNKNOWN &&
                     read_type == RC_UNKNOWN) // If new guess is UNK and old guess is not, do nothing
         {
 
         }
         else if (read_type == RC_SPAN) { // If new guess is SPAN
-          rp_iter->second.read_type = RC_SPAN;
-          rp_iter->second.data_value = data_value;
+          rp->read_type = RC_SPAN;
+          rp->data_value = data_value;
         }
 
         // For all cases, update nCopy
-        if (rp_iter->second.max_nCopy < nCopy_value){
-            rp_iter->second.max_nCopy = nCopy_value;
+        if (rp->max_nCopy < nCopy_value){
+            rp->max_nCopy = nCopy_value;
         }
 
       }
@@ -365,8 +393,8 @@ bool ReadExtractor::ProcessReadPairs(BamCramMultiReader* bamreader,
     if (FindDiscardedRead(alignment, chrom_ref_id, locus)) {
       ReadPair read_pair;
       read_pair.read_type = RC_DISCARD;
-      read_pair.read1 = alignment;
-      read_pairs->insert(std::pair<std::string, ReadPair>(aln_key, read_pair));
+      read_pair.read1.Set(alignment);
+      read_pairs->Insert(file_index, aln_name, aln_name_length, read_pair);
       continue;
     }
 
@@ -380,9 +408,9 @@ bool ReadExtractor::ProcessReadPairs(BamCramMultiReader* bamreader,
     if (FindSpanningRead(alignment, chrom_ref_id, locus, &insert_size)) {
       ReadPair read_pair;
       read_pair.read_type = RC_SPAN;
-      read_pair.read1 = alignment;
+      read_pair.read1.Set(alignment);
       read_pair.data_value = insert_size;
-      read_pairs->insert(std::pair<std::string, ReadPair>(aln_key, read_pair));
+      read_pairs->Insert(file_index, aln_name, aln_name_length, read_pair);
       continue;
     }
 
@@ -402,39 +430,64 @@ bool ReadExtractor::ProcessReadPairs(BamCramMultiReader* bamreader,
           &data_value, &nCopy_value, &score_value, &read_type, &srt);
 
     read_pair.read_type = read_type;
-    read_pair.read1 = alignment;
+    read_pair.read1.Set(alignment);
     read_pair.data_value = data_value;
     read_pair.max_nCopy = nCopy_value;
-    read_pairs->insert(std::pair<std::string, ReadPair>(aln_key, read_pair));
+    read_pairs->Insert(file_index, aln_name, aln_name_length, read_pair);
+  }
+  /* IRRs placed away from the locus */
+  if (irr_catalog_ != NULL) {
+    AddCatalogIRRs(bam_header, locus, files, read_pairs);
   }
+
   /*  Second pass through reads where only one end processed */
+  // Collect all mates to rescue first, so they are looked up in one sweep
   int32_t num_rescue = 0;
-  for (std::map<std::string, ReadPair>::iterator iter = read_pairs->begin();
-       iter != read_pairs->end(); iter++) {
-    if (iter->second.found_pair || iter->second.read_type == RC_FRR || 
-	iter->second.read_type == RC_ENCL || 
-	iter->second.read_type == RC_DISCARD) {  
+  std::vector<size_t> order;
+  read_pairs->SortedOrder(&order);
+  std::vector<MateRequest> requests;
+  for (std::vector<size_t>::const_iterator order_it = order.begin();
+       order_it != order.end(); order_it++) {
+    const ReadPair& read_pair = read_pairs->at(*order_it);
+    if (read_pair.found_pair || read_pair.read_type == RC_FRR || 
+	read_pair.read_type == RC_ENCL || 
+	read_pair.read_type == RC_DISCARD) {  
       continue;
     }
     num_rescue++;
-    if (num_rescue > 200){
-      continue;
+    if (num_rescue > MAX_RESCUE_PER_LOCUS){
+      break;
     }
-
     if (debug) {
-      std::cerr << "Attempting to rescue mate " << iter->first << std::endl;
+      std::cerr << "Attempting to rescue mate " << read_pairs->Key(*order_it) << std::endl;
     }
-    BamAlignment matepair;
-    if (!RescueMate(bamreader, iter->second.read1, &matepair)) {
+    requests.push_back(MateRequest());
+    requests.back().pair_index = *order_it;
+    requests.back().name = read_pairs->Name(*order_it);
+    requests.back().file = files[read_pairs->FileIndex(*order_it) - 1];
+    requests.back().read = read_pair.read1;
+  }
+  {
+    STATS_TIMER(STATS_RESCUE_TIME);
+    RescueMates(bamreader, &requests);
+  }
+  STATS_COUNT(STATS_RESCUES_ATTEMPTED, requests.size());
+
+  for (std::vector<MateRequest>::const_iterator request = requests.begin();
+       request != requests.end(); request++) {
+    if (!request->found) {
       continue;
     }
+    STATS_COUNT(STATS_RESCUES_FOUND, 1);
+    ReadPair* read_pair = &read_pairs->at(request->pair_index);
     if (debug) {
-      std::cerr << "Found mate for " << iter->first << std::endl;
+      std::cerr << "Found mate for " << read_pairs->Key(request->pair_index) << std::endl;
     }
+    BamAlignmentView matepair(request->mate);
 
-    iter->second.read2 = matepair;
+    read_pair->read2.Set(matepair);
 
-    iter->second.found_pair = true;
+    read_pair->found_pair = true;
     int32_t data_value, score_value;
     int32_t nCopy_value = 0;
     ReadType read_type;
@@ -452,51 +505,51 @@ bool ReadExtractor::ProcessReadPairs(BamCramMultiReader* bamreader,
             && nCopy_value >= read_length / locus.period - 1  // and there are enough copies present
             && score_value >= 0.8 * MATCH_SCORE * read_length){ // and the score is high enough TODO set threshold
      
-      iter->second.read_type = RC_FRR;
+      read_pair->read_type = RC_FRR;
       int32_t data;
-      if (iter->second.read1.Position() < locus.start) {
-        data = locus.start - (iter->second.read1.Position()+read_length);
+      if (read_pair->read1.position < locus.start) {
+        data = locus.start - (read_pair->read1.position+read_length);
       } else {
-        data = iter->second.read1.Position() - locus.end;
+        data = read_pair->read1.position - locus.end;
       }
 
-      iter->second.data_value = data;
-      if (iter->second.max_nCopy < nCopy_value){
-        iter->second.max_nCopy = nCopy_value;
+      read_pair->data_value = data;
+      if (read_pair->max_nCopy < nCopy_value){
+        read_pair->max_nCopy = nCopy_value;
       }
     }
     else if (read_type == RC_BOUND      // if new guess is BOUND, just check to update ncopy
       || srt == SR_PREFLANK || srt == SR_POSTFLANK
       && nCopy_value >= 1  // and there are enough copies present
             && score_value >= 0.8 * MATCH_SCORE * read_length){ // and the score is high enough TODO set threshold  
-      if (iter->second.read_type == RC_UNKNOWN){
-        iter->second.read_type = RC_BOUND;
+      if (read_pair->read_type == RC_UNKNOWN){
+        read_pair->read_type = RC_BOUND;
       }
-      if (iter->second.max_nCopy < nCopy_value){
-        iter->second.max_nCopy = nCopy_value;
-        iter->second.data_value = nCopy_value;
+      if (read_pair->max_nCopy < nCopy_value){
+        read_pair->max_nCopy = nCopy_value;
+        read_pair->data_value = nCopy_value;
       }
     }
     else if (read_type == RC_SPAN ||
-          (srt == SR_PREFLANK && alignment.Position() >= max(locus.end - read_length, locus.start)) || 
-          (srt == SR_POSTFLANK && alignment.Position() <= max(locus.end - read_length, locus.start))){
-      iter->second.read_type = RC_SPAN;
+          (srt == SR_PREFLANK && last_position >= max(locus.end - read_length, locus.start)) || 
+          (srt == SR_POSTFLANK && last_position <= max(locus.end - read_length, locus.start))){
+      read_pair->read_type = RC_SPAN;
       if (srt == SR_PREFLANK){
-        iter->second.data_value = abs(locus.start + nCopy_value*(int32_t)locus.motif.size() - read_length
-              - (alignment.Position() + read_length));
+        read_pair->data_value = abs(locus.start + nCopy_value*(int32_t)locus.motif.size() - read_length
+              - (last_position + read_length));
       } else if (srt == SR_POSTFLANK){
-        iter->second.data_value = abs(locus.end - nCopy_value*(int32_t)locus.motif.size()
-              - alignment.Position() + read_length);
+        read_pair->data_value = abs(locus.end - nCopy_value*(int32_t)locus.motif.size()
+              - last_position + read_length);
       }
-      if (iter->second.max_nCopy < nCopy_value){
-        iter->second.max_nCopy = nCopy_value;
+      if (read_pair->max_nCopy < nCopy_value){
+        read_pair->max_nCopy = nCopy_value;
       }
     }
     else{
-      iter->second.read_type = read_type;
-      iter->second.data_value = data_value;
-      if (iter->second.max_nCopy < nCopy_value){
-        iter->second.max_nCopy = nCopy_value;
+      read_pair->read_type = read_type;
+      read_pair->data_value = data_value;
+      if (read_pair->max_nCopy < nCopy_value){
+        read_pair->max_nCopy = nCopy_value;
       }
     }
 
@@ -518,11 +571,12 @@ bool ReadExtractor::ProcessReadPairs(BamCramMultiReader* bamreader,
       const int32_t offchrom_ref_id = bam_header->ref_id(reg_it->chrom);
 
       // Go through each alignment in the region
-      while (bamreader->GetNextAlignment(alignment)) {
+      while (bamreader->GetNextAlignment(&alignment)) {
 	if (alignment.IsSecondary() or alignment.IsSupplementary())
 	  continue;
 	// Set key to keep track of this mate pair
-	std::string aln_key = file_label + trim_alignment_name(alignment);
+	const char* aln_name = alignment.NameData();
+	size_t aln_name_length = trimmed_name_length(alignment);
 	int32_t read_length = (int32_t)alignment.QueryBases().size();
 	int32_t data_value, score_value;
 	int32_t nCopy_value = 0;
@@ -533,28 +587,28 @@ bool ReadExtractor::ProcessReadPairs(BamCramMultiReader* bamreader,
 			  &data_value, &nCopy_value, &score_value, &read_type, &srt);
        
 	//  Check if read's mate already processed
-	std::map<std::string, ReadPair>::iterator rp_iter = read_pairs->find(aln_key);
-	if (rp_iter->second.found_pair){
+	ReadPair* rp = read_pairs->Find(file_index, aln_name, aln_name_length);
+	if (rp != NULL && rp->found_pair){
 	  continue;
 	}
-	if (rp_iter != read_pairs->end()) {
+	if (rp != NULL) {
 	  // do another round of rescue maybe?! Currently, naive rescue:
-	  rp_iter->second.read2 = alignment;
+	  rp->read2.Set(alignment);
 	  if (read_type == RC_FRR or srt == SR_UM_POT_IRR or srt == SR_IRR){
-	    if (rp_iter->second.read_type == RC_POT_OFFT){
+	    if (rp->read_type == RC_POT_OFFT){
 	      //cerr << "2\t" << locus.chrom << " " << alignment.QueryBases() << endl;
-	      rp_iter->second.read_type = RC_OFFT;
-	      rp_iter->second.data_value = -read_length;
+	      rp->read_type = RC_OFFT;
+	      rp->data_value = -read_length;
 	    }
 	    else{
-	      rp_iter->second.read_type = RC_FRR;
-	      rp_iter->second.data_value = data_value;
+	      rp->read_type = RC_FRR;
+	      rp->data_value = data_value;
 	    }
 	  }
 	  else{
-	    if (rp_iter->second.read_type == RC_UNKNOWN){
-	      rp_iter->second.read_type = read_type;
-	      rp_iter->second.data_value = data_value;
+	    if (rp->read_type == RC_UNKNOWN){
+	      rp->read_type = read_type;
+	      rp->data_value = data_value;
 	    }
 	  }
 	}
@@ -562,9 +616,9 @@ bool ReadExtractor::ProcessReadPairs(BamCramMultiReader* bamreader,
 	  if (read_type == RC_FRR or srt == SR_UM_POT_IRR){
 	    //cerr << "1\t" << locus.chrom << " " << alignment.Name() << endl;
 	    read_pair.read_type = RC_POT_OFFT;
-	    read_pair.read1 = alignment;
+	    read_pair.read1.Set(alignment);
 	    read_pair.data_value = -read_length;
-	    read_pairs->insert(std::pair<std::string, ReadPair>(aln_key, read_pair));
+	    read_pairs->Insert(file_index, aln_name, aln_name_length, read_pair);
 	  }
 	}
     }
@@ -581,7 +635,7 @@ bool ReadExtractor::ProcessReadPairs(BamCramMultiReader* bamreader,
   See 5.2_filter_spanning_only_core.py second case
   Return true if yes
 */
-bool ReadExtractor::FindDiscardedRead(BamAlignment alignment,
+bool ReadExtractor::FindDiscardedRead(const BamAlignmentView& alignment,
               const int32_t& chrom_ref_id,
               const Locus& locus) {
   // Get read length
@@ -602,7 +656,7 @@ bool ReadExtractor::FindDiscardedRead(BamAlignment alignment,
    See 5.2_filter_spanning_only_core.py
    Return true if yes
 */
-bool ReadExtractor::FindSpanningRead(BamAlignment alignment,
+bool ReadExtractor::FindSpanningRead(const BamAlignmentView& alignment,
              const int32_t& chrom_ref_id,
              const Locus& locus,
              int32_t* insert_size) {
@@ -634,7 +688,7 @@ bool ReadExtractor::FindSpanningRead(BamAlignment alignment,
   
   Return false if something goes wrong
  */
-bool ReadExtractor::ProcessSingleRead(BamAlignment alignment,
+bool ReadExtractor::ProcessSingleRead(const BamAlignmentView& alignment,
               const int32_t& chrom_ref_id,
               const Locus& locus,
               const int32_t &min_match,
@@ -654,8 +708,28 @@ bool ReadExtractor::ProcessSingleRead(BamAlignment alignment,
     *score_value = 0;
     return true;
   }
-  
-  int32_t start_pos, start_pos_rev, pos_frr, end_frr, score_frr, mismatches_frr;
+
+  /* Without enough motif copies in either orientation, realignment scores
+     the read 0 and it ends up unknown below. Count the copies on the packed
+     read so most reads are dropped before building any string. Unmapped
+     reads may still be reported by --output-readinfo, so they take the
+     full path then */
+  int32_t nCopy_stretch, nCopy_total, nCopy_stretch_rev, nCopy_total_rev;
+  if (options.min_score > 0 && options.read_len > 0 &&
+      !(options.output_readinfo && !alignment.IsMapped()) &&
+      packed_motif_copies(alignment.PackedBases(), alignment.Length(), locus.motif,
+			  &nCopy_stretch, &nCopy_total, &nCopy_stretch_rev, &nCopy_total_rev) &&
+      !enough_motif_copies(nCopy_stretch, nCopy_total) &&
+      !enough_motif_copies(nCopy_stretch_rev, nCopy_total_rev)) {
+    *nCopy_value = 0;
+    *data_value = 0;
+    *score_value = 0;
+    *srt = SR_UNKNOWN;
+    *read_type = RC_UNKNOWN;
+    return true;
+  }
+
+  int32_t start_pos, start_pos_rev;
   int32_t end_pos, end_pos_rev;
   int32_t score, score_rev;
   int32_t nCopy, nCopy_rev;
@@ -670,13 +744,18 @@ bool ReadExtractor::ProcessSingleRead(BamAlignment alignment,
   //     << "\n" << alignment.QueryBases() << "\n";
 
   /* Perform realignment and classification */
-  if (!expansion_aware_realign(seq, qual, locus.pre_flank, locus.post_flank, locus.motif, min_match,
-			       &nCopy, &start_pos, &end_pos, &score, &fm_start, &fm_end)) {
-    return false;
-  }
-  if (!expansion_aware_realign(seq_rev, qual, locus.pre_flank, locus.post_flank, locus.motif, min_match,
-			       &nCopy_rev, &start_pos_rev, &end_pos_rev, &score_rev, &fm_start_rev, &fm_end_rev)) {
-    return false;
+  {
+    STATS_TIMER(STATS_REALIGN_TIME);
+    STATS_COUNT(STATS_READS_REALIGNED, 1);
+    if (!expansion_aware_realign(seq, qual, locus.pre_flank, locus.post_flank, locus.motif, min_match,
+				 &nCopy, &start_pos, &end_pos, &score, &fm_start, &fm_end, templates_)) {
+      return false;
+    }
+    if (!expansion_aware_realign(seq_rev, qual, locus.pre_flank, locus.post_flank, locus.motif, min_match,
+				 &nCopy_rev, &start_pos_rev, &end_pos_rev, &score_rev, &fm_start_rev, &fm_end_rev,
+				 templates_)) {
+      return false;
+    }
   }
 
   if (score_rev > score) {
@@ -715,21 +794,7 @@ bool ReadExtractor::ProcessSingleRead(BamAlignment alignment,
       alignment.IsMateMapped() &&
       alignment.MatePosition() < locus.end + (options.dist_mean - options.read_len) && 
       alignment.MatePosition() > locus.start - (options.dist_mean - options.read_len)){
-    std::stringstream var_realign_frr;
-    for (int i = 0; i<(seq.size() / locus.motif.size() + 1); i++) {
-      var_realign_frr << locus.motif;
-    }
-    std::string frr_ref = var_realign_frr.str();
-    striped_smith_waterman(frr_ref, seq, qual, &pos_frr, &end_frr, &score_frr, &mismatches_frr);
-    int gaps_frr = abs(int(end_frr - pos_frr - seq.size()));
-    // cerr << mismatches_frr << "\t" << seq << endl;
-    
-    // Tune 0.75 for false positive rate
-    if (score_frr > 0.75 * seq.size() * SSW_MATCH_SCORE && 
-	mismatches_frr < int(.05 * seq.size()) && 
-	gaps_frr < int(.05 * seq.size())){
-      // cerr << seq << endl;
-      // cerr << mismatches_frr << "\t" << score_frr << endl;
+    if (IsFRRSequence(seq, qual, locus)){
       *srt = SR_IRR;
     }
     else{
@@ -737,8 +802,9 @@ bool ReadExtractor::ProcessSingleRead(BamAlignment alignment,
     }
   }
 
-  if (alignment.IsMapped() == false && alignment.MatePosition() < locus.end + options.dist_mean && alignment.MatePosition() > locus.start - options.dist_mean){
-    readfile_ << locus.chrom << "\t" << alignment.Position() << "\t" << alignment.MatePosition() << "\t"
+  if (options.output_readinfo &&
+      alignment.IsMapped() == false && alignment.MatePosition() < locus.end + options.dist_mean && alignment.MatePosition() > locus.start - options.dist_mean){
+    (*readinfo_out_) << locus.chrom << "\t" << alignment.Position() << "\t" << alignment.MatePosition() << "\t"
         << alignment.Name() << "\t" << "UNMAPPED" << std::endl << alignment.QueryBases()<<std::endl;
   }
 
@@ -838,43 +904,218 @@ bool ReadExtractor::ProcessSingleRead(BamAlignment alignment,
   TODO: this doesn't handle if the mate is unaligned?
  */
 
-bool ReadExtractor::RescueMate(BamCramMultiReader* bamreader,
-             BamAlignment alignment, BamAlignment* matepair) {
+/*
+  Check if seq aligns to copies of the locus motif well enough to be an
+  IRR. seq must be in the orientation of the locus
+ */
+bool ReadExtractor::IsFRRSequence(const std::string& seq, const std::string& qual,
+				  const Locus& locus) const {
+  int32_t read_length = (int32_t)seq.size();
+  if (templates_ != NULL && templates_->Covers(read_length)) {
+    int32_t pos_frr, end_frr, score_frr, mismatches_frr;
+    striped_smith_waterman(templates_->FRRReference(), templates_->FRRLength(read_length),
+			   seq, &pos_frr, &end_frr, &score_frr, &mismatches_frr);
+    return is_frr_alignment(read_length, pos_frr, end_frr, score_frr, mismatches_frr);
+  }
+  return is_frr_sequence(seq, qual, locus.motif);
+}
+
+/*
+  Add IRRs from the --irr-catalog whose mate is close enough to the locus
+  for them to be FRRs. files holds the BAM file of each file index used
+  in read_pairs. Reads already extracted from the region are skipped; an
+  IRR whose mate was extracted completes that pair. Catalog reads passed
+  the FRR check for their motif when the catalog was built.
+ */
+void ReadExtractor::AddCatalogIRRs(const BamHeader* bam_header, const Locus& locus,
+				   const std::vector<std::string>& files,
+				   ReadPairTable* read_pairs) {
+  // Same window as the mate check in ProcessSingleRead
+  int32_t margin = (int32_t)(options.dist_mean - options.read_len);
+  std::vector<IRRRecord> records;
+  irr_catalog_->Find(canonical_motif(locus.motif), locus.chrom,
+		     locus.start - margin + 1, locus.end + margin - 1, &records);
+  for (std::vector<IRRRecord>::const_iterator it = records.begin();
+       it != records.end(); it++) {
+    const IRRRecord& record = *it;
+    if (record.file_index < 0 || record.file_index >= (int32_t)options.bamfiles.size()) {
+      continue;
+    }
+    // Files without reads in the region get indices after the others
+    const std::string& filename = options.bamfiles[record.file_index];
+    int32_t file_index = (int32_t)(files.size() + 1 + record.file_index);
+    for (size_t i = 0; i < files.size(); i++) {
+      if (files[i] == filename) {
+	file_index = (int32_t)i + 1;
+	break;
+      }
+    }
+    ReadPair* rp = read_pairs->Find(file_index, record.name);
+    if (rp != NULL &&
+	(rp->found_pair || (bam_header->ref_name(rp->read1.ref_id) == record.chrom &&
+			    rp->read1.position == record.position))) {
+      continue;
+    }
+    if (debug) {
+      std::cerr << "Found IRR in catalog " << record.name << std::endl;
+    }
+    const int32_t& read_length = record.read_length;
+    int32_t data_value;
+    if (record.mate_position < locus.start) {
+      data_value = locus.start - (record.mate_position + read_length);
+    } else {
+      data_value = record.mate_position - locus.end;
+    }
+    int32_t nCopy_value = read_length / (int32_t)locus.motif.size();
+
+    ReadSummary read;
+    read.ref_id = bam_header->ref_id(record.chrom);
+    read.position = record.position;
+    read.mate_ref_id = bam_header->ref_id(record.mate_chrom);
+    read.mate_position = record.mate_position;
+    if (rp != NULL) {
+      rp->found_pair = true;
+      rp->read2 = read;
+      if (rp->read_type != RC_FRR && rp->read_type != RC_ENCL) {
+	rp->read_type = RC_FRR;
+	rp->data_value = data_value;
+      }
+      if (rp->max_nCopy < nCopy_value) {
+	rp->max_nCopy = nCopy_value;
+      }
+    } else {
+      ReadPair read_pair;
+      read_pair.read_type = RC_FRR;
+      read_pair.read1 = read;
+      read_pair.data_value = data_value;
+      read_pair.max_nCopy = nCopy_value;
+      read_pairs->Insert(file_index, record.name, read_pair);
+    }
+  }
+}
+
+bool ReadExtractor::RescueMate(BamCramMultiReader* bamreader, const std::string& file,
+             const std::string& read_name, const ReadSummary& read,
+             BamAlignmentView* matepair) {
   const BamHeader* bam_header = bamreader->bam_header();
-  std::string aln_key1 = trim_alignment_name(alignment);
   if (debug) {
-    std::cerr << "Looking for mate in " << bam_header->ref_name(alignment.MateRefID()) <<
-      " " << alignment.MatePosition() << std::endl;
+    std::cerr << "Looking for mate in " << bam_header->ref_name(read.mate_ref_id) <<
+      " " << read.mate_position << std::endl;
   }
 
-  bamreader->SetRegion(bam_header->ref_name(alignment.MateRefID()),
-           alignment.MatePosition()-1, alignment.MatePosition()+1);
-  BamAlignment aln;
+  bamreader->SetRegion(bam_header->ref_name(read.mate_ref_id),
+           read.mate_position-1, read.mate_position+1);
   int32_t count = 0;
-  while (bamreader->GetNextAlignment(aln)) {
-    std::string aln_key2 = trim_alignment_name(aln);
+  while (bamreader->GetNextAlignment(matepair)) {
     count++;
-    if (count > 50){ // Skip this region if mate was not found in the first 50 alignments
+    if (count > MAX_MATE_ALIGNMENTS){ // Skip this region if mate was not found in the first 50 alignments
       return false;
     }
+    size_t name_length = trimmed_name_length(*matepair);
     if (debug) {
-      std::cerr << "Looking for " << aln_key1 << " found " << aln_key2 << std::endl;
+      std::cerr << "Looking for " << read_name << " found "
+		<< std::string(matepair->NameData(), name_length) << std::endl;
     }
-    if (aln_key1 == aln_key2) {
-      *matepair = aln;
+    if (name_length == read_name.size() &&
+	read_name.compare(0, name_length, matepair->NameData(), name_length) == 0 &&
+	matepair->Filename() == file) {
       return true;
     }
   }
   return false;
 }
 
-std::string ReadExtractor::trim_alignment_name(const BamAlignment& aln) const {
-  std::string aln_name = aln.Name();
-  if (aln_name.size() > 2){
-    if (aln_name[aln_name.size()-2] == '/')
-      aln_name.resize(aln_name.size()-2);
+bool ReadExtractor::RescueMates(BamCramMultiReader* bamreader,
+				std::vector<MateRequest>* requests) {
+  const BamHeader* bam_header = bamreader->bam_header();
+  // ((mate ref id, mate position), request index) of mates not in the cache
+  std::vector<std::pair<std::pair<int32_t, int32_t>, size_t> > pending;
+  for (size_t i = 0; i < requests->size(); i++) {
+    MateRequest& request = requests->at(i);
+    if (request.read.mate_ref_id < 0) {
+      continue;
+    }
+    if (mate_cache_.Get(request.file, request.name, request.read.mate_ref_id,
+			request.read.mate_position, &request.mate)) {
+      request.found = true;
+      continue;
+    }
+    pending.push_back(std::pair<std::pair<int32_t, int32_t>, size_t>
+		      (std::pair<int32_t, int32_t>(request.read.mate_ref_id,
+						   request.read.mate_position), i));
+  }
+  std::sort(pending.begin(), pending.end());
+
+  BamAlignment mate;
+  BamAlignmentView mate_view;
+  size_t group_start = 0;
+  while (group_start < pending.size()) {
+    // Group mates on the same chromosome that are close to each other
+    int32_t ref_id = pending[group_start].first.first;
+    std::vector<int32_t> positions(1, pending[group_start].first.second);
+    size_t group_end = group_start + 1;
+    while (group_end < pending.size() && pending[group_end].first.first == ref_id &&
+	   pending[group_end].first.second - positions.back() <= MATE_RESCUE_MAX_GAP) {
+      positions.push_back(pending[group_end].first.second);
+      group_end++;
+    }
+    if (debug) {
+      std::cerr << "Looking for " << positions.size() << " mates in "
+		<< bam_header->ref_name(ref_id) << " " << positions.front()
+		<< "-" << positions.back() << std::endl;
+    }
+    if (!bamreader->SetRegion(bam_header->ref_name(ref_id),
+			      positions.front()-1, positions.back()+1)) {
+      group_start = group_end;
+      continue;
+    }
+    // Alignments seen so far at each request's position, like RescueMate
+    std::vector<int32_t> counts(positions.size(), 0);
+    size_t unresolved = positions.size();
+    while (unresolved > 0 && bamreader->GetNextAlignment(mate)) {
+      // Requests whose single-position query would have returned this alignment
+      size_t first = std::lower_bound(positions.begin(), positions.end(),
+				      mate.Position()) - positions.begin();
+      size_t last = std::upper_bound(positions.begin(), positions.end(),
+				     mate.GetEndPosition()) - positions.begin();
+      if (first >= last) {
+	continue;
+      }
+      mate_view.Reset(mate);
+      size_t name_length = trimmed_name_length(mate_view);
+      for (size_t j = first; j < last; j++) {
+	MateRequest& request = requests->at(pending[group_start + j].second);
+	if (request.found || counts[j] > MAX_MATE_ALIGNMENTS) {
+	  continue;
+	}
+	counts[j]++;
+	if (counts[j] > MAX_MATE_ALIGNMENTS) {
+	  unresolved--;
+	  continue;
+	}
+	if (name_length == request.name.size() &&
+	    request.name.compare(0, name_length, mate_view.NameData(), name_length) == 0 &&
+	    mate.Filename() == request.file) {
+	  request.found = true;
+	  request.mate = mate;
+	  mate_cache_.Put(request.file, request.name, ref_id, positions[j], mate);
+	  unresolved--;
+	}
+      }
+    }
+    group_start = group_end;
+  }
+  return true;
+}
+
+size_t ReadExtractor::trimmed_name_length(const BamAlignmentView& aln) const {
+  const char* aln_name = aln.NameData();
+  size_t length = strlen(aln_name);
+  if (length > 2){
+    if (aln_name[length-2] == '/')
+      length -= 2;
   }
-  return aln_name;
+  return length;
 }
 
 // Implemented in BamInfoExtract. TODO delete
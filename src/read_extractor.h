@@ -22,7 +22,9 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 #define SRC_READ_EXTRACTOR_H__
 
 #include "src/bam_io.h"
+#include "src/irr_catalog.h"
 #include "src/locus.h"
+#include "src/locus_templates.h"
 #include "src/likelihood_maximizer.h"
 #include "src/options.h"
 #include "src/read_pair.h"
@@ -32,33 +34,48 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <math.h>
 
+// At most this many mates are rescued per locus
+const int32_t MAX_RESCUE_PER_LOCUS = 200;
+// Give up on a mate after this many alignments at its position
+const int32_t MAX_MATE_ALIGNMENTS = 50;
+// Mates closer than this are looked up with a single region query
+const int32_t MATE_RESCUE_MAX_GAP = 1000;
+// Number of rescued mates kept for neighbouring loci
+const size_t MATE_CACHE_SIZE = 4096;
+
 class ReadExtractor {
   friend class ReadExtractorTest;
   friend class Genotyper;
  public:
-  ReadExtractor(const Options& options_);
+  // If readinfo_out is given, read info is written there instead of <outprefix>.readinfo.tab
+  ReadExtractor(const Options& options_, std::ostream* readinfo_out = NULL);
   virtual ~ReadExtractor();
+
+  // Also look up IRRs of each locus in catalog (may be NULL)
+  void SetIRRCatalog(const IRRCatalog* catalog) { irr_catalog_ = catalog; }
     
   bool debug = false;
 // bool print_read_data = false;
 
-  // Main function to extract reads of each class
+  // Main function to extract reads of each class.
+  // If given, templates must be built for the same locus.
   bool ExtractReads(BamCramMultiReader* bamreader,
 		    const Locus& locus,
 		    const int32_t& regionsize,
 		    const int32_t& min_match, 
-		    LikelihoodMaximizer* likelihood_maximizer);
+		    LikelihoodMaximizer* likelihood_maximizer,
+		    const LocusTemplates* templates = NULL);
 
  protected:
-  // Trim alignment read names
-  std::string trim_alignment_name(const BamAlignment& aln) const;
+  // Length of the read name without a trailing /1 or /2
+  size_t trimmed_name_length(const BamAlignmentView& aln) const;
   
   // Process all read pairs
   bool ProcessReadPairs(BamCramMultiReader* bamreader,
 			const Locus& locus, 
 			const int32_t& regionsize,
 			const int32_t& min_match, 
-			std::map<std::string, ReadPair>* read_pairs);
+			ReadPairTable* read_pairs);
 
   // Implemented in BamInfoExtract. TODO delete
   // // Find insert size distribution
@@ -67,16 +84,16 @@ class ReadExtractor {
   //      double* mean, double* std_dev, int32_t* read_len);
 
   // Check if read should be discarded
-  bool FindDiscardedRead(BamAlignment alignment,
+  bool FindDiscardedRead(const BamAlignmentView& alignment,
 			 const int32_t& chrom_ref_id,
 			 const Locus& locus);
   // Check if read is spanning class
-  bool FindSpanningRead(BamAlignment alignment,
+  bool FindSpanningRead(const BamAlignmentView& alignment,
 			const int32_t& chrom_ref_id,
 			const Locus& locus,
 			int32_t* insert_size);
   // Check single read overlapping repeat area
-  bool ProcessSingleRead(BamAlignment alignment,
+  bool ProcessSingleRead(const BamAlignmentView& alignment,
 			 const int32_t& chrom_ref_id,
 			 const Locus& locus,
 			 const int32_t &min_match,
@@ -85,13 +102,36 @@ class ReadExtractor {
 			 int32_t* score_value,
 			 ReadType* read_type,
 			 SingleReadType* srt);
-  // Rescue mate pairs aligned elsewhere
-  bool RescueMate(BamCramMultiReader* bamreader,
-		  BamAlignment alignment, BamAlignment* matepair);
+  // Rescue mate pairs aligned elsewhere. read_name is the trimmed name and
+  // file the file of the read, which the mate must come from too.
+  // matepair is valid until bamreader reads another alignment
+  bool RescueMate(BamCramMultiReader* bamreader, const std::string& file,
+		  const std::string& read_name, const ReadSummary& read,
+		  BamAlignmentView* matepair);
+  // Whether seq is a fully repetitive read of the locus motif
+  bool IsFRRSequence(const std::string& seq, const std::string& qual,
+		     const Locus& locus) const;
+  void AddCatalogIRRs(const BamHeader* bam_header, const Locus& locus,
+		      const std::vector<std::string>& files,
+		      ReadPairTable* read_pairs);
+  // Rescue many mates at once. Requests are looked up in the cache, then
+  // sorted by mate position and nearby mates fetched with one region query.
+  // Gives the same mates as calling RescueMate for each request
+  bool RescueMates(BamCramMultiReader* bamreader,
+		   std::vector<MateRequest>* requests);
 
 private:
 const Options options;
 ofstream readfile_;
+std::ostream* readinfo_out_;
+// Realignment templates of the locus being extracted (may be NULL)
+const LocusTemplates* templates_;
+// Read pairs of the current locus, kept to reuse its memory
+ReadPairTable read_pairs_;
+// Genome-wide IRR catalog (may be NULL)
+const IRRCatalog* irr_catalog_;
+// Recently rescued mates. Loci close to each other often share them
+MateCache mate_cache_;
 };
 
 #endif  // SRC_READ_EXTRACTOR_H__
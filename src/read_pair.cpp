@@ -18,10 +18,32 @@ You should have received a copy of the GNU General Public License
 along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <string.h>
+
+#include <algorithm>
+#include <sstream>
+
 #include "src/read_pair.h"
 
 using namespace std;
 
+// Table size when the first pair is added. Always a power of 2.
+const static size_t MIN_SLOTS = 1024;
+
+ReadSummary::ReadSummary() {
+  ref_id = -1;
+  position = -1;
+  mate_ref_id = -1;
+  mate_position = -1;
+}
+
+void ReadSummary::Set(const BamAlignmentView& alignment) {
+  ref_id = alignment.RefID();
+  position = alignment.Position();
+  mate_ref_id = alignment.MateRefID();
+  mate_position = alignment.MatePosition();
+}
+
 ReadPair::ReadPair() {
   read_type = RC_UNKNOWN;
   found_pair = false;
@@ -29,3 +51,187 @@ ReadPair::ReadPair() {
 }
 
 ReadPair::~ReadPair() {}
+
+ReadPairTable::ReadPairTable() {}
+
+ReadPairTable::~ReadPairTable() {}
+
+void ReadPairTable::Clear() {
+  pairs_.clear();
+  entries_.clear();
+  names_.clear();
+  std::fill(slots_.begin(), slots_.end(), -1);
+}
+
+/*
+  FNV-1a over the file index and the name
+ */
+uint64_t ReadPairTable::Hash(const int32_t& file_index, const char* name, const size_t& length) {
+  uint64_t hash = 14695981039346656037ULL;
+  const uint64_t prime = 1099511628211ULL;
+  for (int i = 0; i < 4; i++) {
+    hash = (hash ^ ((file_index >> (8*i)) & 0xff)) * prime;
+  }
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (unsigned char)name[i]) * prime;
+  }
+  return hash;
+}
+
+bool ReadPairTable::Matches(const Entry& entry, const uint64_t& hash, const int32_t& file_index,
+			    const char* name, const size_t& length) const {
+  return entry.hash == hash && entry.file_index == file_index &&
+    entry.name_length == length &&
+    (length == 0 || memcmp(&names_[entry.name_offset], name, length) == 0);
+}
+
+ReadPair* ReadPairTable::Find(const int32_t& file_index, const char* name, const size_t& length) {
+  if (slots_.empty()) {
+    return NULL;
+  }
+  uint64_t hash = Hash(file_index, name, length);
+  size_t mask = slots_.size() - 1;
+  for (size_t slot = hash & mask; slots_[slot] != -1; slot = (slot + 1) & mask) {
+    if (Matches(entries_[slots_[slot]], hash, file_index, name, length)) {
+      return &pairs_[slots_[slot]];
+    }
+  }
+  return NULL;
+}
+
+ReadPair* ReadPairTable::Insert(const int32_t& file_index, const char* name, const size_t& length,
+				const ReadPair& read_pair) {
+  // Keep the load factor at most 1/2
+  if (2 * (entries_.size() + 1) > slots_.size()) {
+    Grow();
+  }
+  Entry entry;
+  entry.hash = Hash(file_index, name, length);
+  entry.file_index = file_index;
+  entry.name_offset = names_.size();
+  entry.name_length = length;
+  names_.insert(names_.end(), name, name + length);
+
+  size_t mask = slots_.size() - 1;
+  size_t slot = entry.hash & mask;
+  while (slots_[slot] != -1) {
+    slot = (slot + 1) & mask;
+  }
+  slots_[slot] = (int32_t)entries_.size();
+  entries_.push_back(entry);
+  pairs_.push_back(read_pair);
+  return &pairs_.back();
+}
+
+void ReadPairTable::Grow() {
+  size_t num_slots = slots_.empty() ? MIN_SLOTS : 2 * slots_.size();
+  slots_.assign(num_slots, -1);
+  size_t mask = num_slots - 1;
+  for (size_t i = 0; i < entries_.size(); i++) {
+    size_t slot = entries_[i].hash & mask;
+    while (slots_[slot] != -1) {
+      slot = (slot + 1) & mask;
+    }
+    slots_[slot] = (int32_t)i;
+  }
+}
+
+std::string ReadPairTable::Name(const size_t& i) const {
+  if (entries_[i].name_length == 0) {
+    return "";
+  }
+  return std::string(&names_[entries_[i].name_offset], entries_[i].name_length);
+}
+
+std::string ReadPairTable::Key(const size_t& i) const {
+  std::stringstream ss;
+  ss << entries_[i].file_index << "_" << Name(i);
+  return ss.str();
+}
+
+bool ReadPairTable::KeyLess::operator()(const size_t& a, const size_t& b) const {
+  const Entry& entry_a = table->entries_[a];
+  const Entry& entry_b = table->entries_[b];
+  if (entry_a.file_index != entry_b.file_index) {
+    // Labels are digits followed by '_', so neither is a prefix of the
+    // other and they alone decide the order of the keys
+    std::stringstream label_a, label_b;
+    label_a << entry_a.file_index << "_";
+    label_b << entry_b.file_index << "_";
+    return label_a.str() < label_b.str();
+  }
+  size_t length = std::min(entry_a.name_length, entry_b.name_length);
+  int cmp = length == 0 ? 0 :
+    memcmp(&table->names_[entry_a.name_offset], &table->names_[entry_b.name_offset], length);
+  if (cmp != 0) {
+    return cmp < 0;
+  }
+  return entry_a.name_length < entry_b.name_length;
+}
+
+void ReadPairTable::SortedOrder(std::vector<size_t>* order) const {
+  order->resize(entries_.size());
+  for (size_t i = 0; i < order->size(); i++) {
+    (*order)[i] = i;
+  }
+  KeyLess less;
+  less.table = this;
+  std::sort(order->begin(), order->end(), less);
+}
+
+bool MateCache::Key::operator<(const Key& other) const {
+  if (ref_id != other.ref_id) {
+    return ref_id < other.ref_id;
+  }
+  if (position != other.position) {
+    return position < other.position;
+  }
+  if (name != other.name) {
+    return name < other.name;
+  }
+  return file < other.file;
+}
+
+MateCache::MateCache(const size_t& capacity) {
+  capacity_ = capacity;
+}
+
+bool MateCache::Get(const std::string& file, const std::string& name,
+		    const int32_t& ref_id, const int32_t& position, BamAlignment* mate) {
+  Key key;
+  key.file = file;
+  key.name = name;
+  key.ref_id = ref_id;
+  key.position = position;
+  std::map<Key, EntryList::iterator>::iterator it = index_.find(key);
+  if (it == index_.end()) {
+    return false;
+  }
+  entries_.splice(entries_.begin(), entries_, it->second);
+  *mate = it->second->second;
+  return true;
+}
+
+void MateCache::Put(const std::string& file, const std::string& name,
+		    const int32_t& ref_id, const int32_t& position, const BamAlignment& mate) {
+  if (capacity_ == 0) {
+    return;
+  }
+  Key key;
+  key.file = file;
+  key.name = name;
+  key.ref_id = ref_id;
+  key.position = position;
+  std::map<Key, EntryList::iterator>::iterator it = index_.find(key);
+  if (it != index_.end()) {
+    entries_.splice(entries_.begin(), entries_, it->second);
+    it->second->second = mate;
+    return;
+  }
+  if (index_.size() >= capacity_) {
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+  entries_.push_front(std::pair<Key, BamAlignment>(key, mate));
+  index_[key] = entries_.begin();
+}
@@ -21,6 +21,14 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef SRC_READ_PAIR_H__
 #define SRC_READ_PAIR_H__
 
+#include <stdint.h>
+
+#include <deque>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
 #include "src/bam_io.h"
 #include "src/realignment.h"
 
@@ -35,17 +43,141 @@ enum ReadType {
   RC_POT_OFFT = 7
 };
 
+// Alignment fields still needed once a read has been processed
+struct ReadSummary {
+  int32_t ref_id;
+  int32_t position;
+  int32_t mate_ref_id;
+  int32_t mate_position;
+
+  ReadSummary();
+  void Set(const BamAlignmentView& alignment);
+};
+
 class ReadPair {
  public:
   ReadPair();
   virtual ~ReadPair();
 
-  BamAlignment read1;
-  BamAlignment read2;
+  ReadSummary read1;
+  ReadSummary read2;
   ReadType read_type;
   int32_t data_value;
   int32_t max_nCopy;    // maximum nCopy among two reads (used for flanking heuristic)
   bool found_pair;
 };
 
+/*
+  Read pairs of one locus, keyed by (file index, read name).
+
+  Open addressing hash table over a 64-bit hash of the key. Names are
+  copied once into an arena and compared on hash matches, so collisions
+  are resolved exactly. Clear() drops all pairs and names at once but
+  keeps the memory for the next locus.
+ */
+class ReadPairTable {
+ public:
+  ReadPairTable();
+  virtual ~ReadPairTable();
+
+  void Clear();
+  size_t size() const { return pairs_.size(); }
+
+  // Pair with this key, or NULL if there is none
+  ReadPair* Find(const int32_t& file_index, const char* name, const size_t& length);
+  ReadPair* Find(const int32_t& file_index, const std::string& name) {
+    return Find(file_index, name.data(), name.size());
+  }
+  // Add a pair whose key is not in the table yet
+  ReadPair* Insert(const int32_t& file_index, const char* name, const size_t& length,
+		   const ReadPair& read_pair);
+  ReadPair* Insert(const int32_t& file_index, const std::string& name,
+		   const ReadPair& read_pair) {
+    return Insert(file_index, name.data(), name.size(), read_pair);
+  }
+
+  // Pairs are numbered in insertion order
+  ReadPair& at(const size_t& i) { return pairs_[i]; }
+  const ReadPair& at(const size_t& i) const { return pairs_[i]; }
+  std::string Name(const size_t& i) const;
+  int32_t FileIndex(const size_t& i) const { return entries_[i].file_index; }
+  // "<file index>_<read name>", as printed in --output-readinfo
+  std::string Key(const size_t& i) const;
+
+  // Pair numbers sorted by Key, which is the order loci were processed
+  // in when pairs were kept in a std::map<std::string, ReadPair>
+  void SortedOrder(std::vector<size_t>* order) const;
+
+ private:
+  struct Entry {
+    uint64_t hash;
+    int32_t file_index;
+    size_t name_offset;
+    size_t name_length;
+  };
+  struct KeyLess {
+    const ReadPairTable* table;
+    bool operator()(const size_t& a, const size_t& b) const;
+  };
+
+  // Private unimplemented copy constructor and assignment operator to prevent operations
+  ReadPairTable(const ReadPairTable& other);
+  ReadPairTable& operator=(const ReadPairTable& other);
+
+  static uint64_t Hash(const int32_t& file_index, const char* name, const size_t& length);
+  bool Matches(const Entry& entry, const uint64_t& hash, const int32_t& file_index,
+	       const char* name, const size_t& length) const;
+  void Grow();
+
+  std::deque<ReadPair> pairs_;     // deque, so returned pointers stay valid
+  std::vector<Entry> entries_;     // Key of each pair
+  std::vector<int32_t> slots_;     // Pair number, or -1 if empty
+  std::vector<char> names_;        // Name arena
+};
+
+// A read whose mate is looked up by ReadExtractor::RescueMates
+struct MateRequest {
+  size_t pair_index;    // Number of the pair in its ReadPairTable
+  std::string name;     // Trimmed read name
+  std::string file;     // File the read came from, which must hold its mate
+  ReadSummary read;
+  bool found;
+  BamAlignment mate;
+
+  MateRequest() : pair_index(0), found(false) {}
+};
+
+/*
+  Bounded least recently used cache of rescued mates, kept across loci
+  since neighbouring loci share many reads. Keyed by the file and name of
+  the read and the mate position the rescue looked at, which decide the
+  rescue outcome. Files are keyed by path: the file indices of
+  ReadPairTable only number the files with reads at one locus.
+ */
+class MateCache {
+ public:
+  explicit MateCache(const size_t& capacity);
+
+  // Copy the cached mate to mate, if there is one
+  bool Get(const std::string& file, const std::string& name,
+	   const int32_t& ref_id, const int32_t& position, BamAlignment* mate);
+  void Put(const std::string& file, const std::string& name,
+	   const int32_t& ref_id, const int32_t& position, const BamAlignment& mate);
+  size_t size() const { return index_.size(); }
+
+ private:
+  struct Key {
+    std::string file;
+    std::string name;
+    int32_t ref_id;
+    int32_t position;
+    bool operator<(const Key& other) const;
+  };
+  typedef std::list<std::pair<Key, BamAlignment> > EntryList;
+
+  EntryList entries_;                         // Most recently used first
+  std::map<Key, EntryList::iterator> index_;
+  size_t capacity_;
+};
+
 #endif  // SRC_READ_PAIR_H__
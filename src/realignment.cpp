@@ -19,12 +19,47 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "src/realignment.h"
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#else
+#include <emmintrin.h>
+#endif
+#include <pthread.h>
 #include <algorithm>
 #include <sstream>
 #include <iostream>
 
+#include "src/stats.h"
+
 using namespace std;
 
+// One SSW aligner per thread, reused across all realignments.
+// Deleted by the key destructor when a worker thread exits.
+static pthread_key_t aligner_key;
+static pthread_once_t aligner_key_once = PTHREAD_ONCE_INIT;
+
+static void delete_aligner(void* aligner) {
+  delete (StripedSmithWaterman::Aligner*) aligner;
+}
+
+static void make_aligner_key() {
+  pthread_key_create(&aligner_key, delete_aligner);
+}
+
+static StripedSmithWaterman::Aligner* get_thread_aligner() {
+  pthread_once(&aligner_key_once, make_aligner_key);
+  StripedSmithWaterman::Aligner* aligner =
+    (StripedSmithWaterman::Aligner*) pthread_getspecific(aligner_key);
+  if (aligner == NULL) {
+    aligner = new StripedSmithWaterman::Aligner(SSW_MATCH_SCORE,
+						 SSW_MISMATCH_SCORE,
+						 SSW_GAP_OPEN,
+						 SSW_GAP_EXTEND);
+    pthread_setspecific(aligner_key, aligner);
+  }
+  return aligner;
+}
+
 bool find_longest_stretch(const std::string& seq,
 			  const std::string& motif,
 			  int32_t* nCopy_stretch,
@@ -60,8 +95,445 @@ bool find_longest_stretch(const std::string& seq,
   }
   *nCopy_stretch = longest_stretch;
   *nCopy_total = total;
+  return true;
+}
+
+
+// Bit i of the result is bit i+shift of bits (words past the end read as 0)
+static inline uint64_t shifted_word(const uint64_t* bits, const int32_t& num_words,
+				    const int32_t& word, const int32_t& shift) {
+  int32_t src = word + shift / 64;
+  int32_t offset = shift % 64;
+  uint64_t low = (src < num_words ? bits[src] : 0);
+  if (offset == 0) {
+    return low;
+  }
+  uint64_t high = (src + 1 < num_words ? bits[src + 1] : 0);
+  return (low >> offset) | (high << (64 - offset));
+}
+
+// First set bit at or after from and before limit, or -1
+static inline int32_t next_set_bit(const uint64_t* bits, const int32_t& from,
+				   const int32_t& limit) {
+  if (from >= limit) {
+    return -1;
+  }
+  int32_t word = from / 64;
+  uint64_t current = bits[word] & (~(uint64_t)0 << (from % 64));
+  while (true) {
+    if (current != 0) {
+      int32_t pos = word * 64 + __builtin_ctzll(current);
+      return (pos < limit ? pos : -1);
+    }
+    word++;
+    if (word * 64 >= limit) {
+      return -1;
+    }
+    current = bits[word];
+  }
+}
+
+/*
+  Greedy left to right scan of find_longest_stretch over the positions of
+  motif copies in base_masks (one bit mask per base, acgt)
+ */
+static void count_masked_copies(const uint64_t base_masks[4][PACKED_MAX_READ_LEN / 64],
+				const int32_t& read_len, const int8_t* motif_codes,
+				const int32_t& period,
+				int32_t* nCopy_stretch, int32_t* nCopy_total) {
+  int32_t num_words = (read_len + 63) / 64;
+  uint64_t copies[PACKED_MAX_READ_LEN / 64];
+  for (int32_t w = 0; w < num_words; w++) {
+    copies[w] = ~(uint64_t)0;
+    for (int32_t j = 0; j < period; j++) {
+      copies[w] &= shifted_word(base_masks[motif_codes[j]], num_words, w, j);
+    }
+  }
+  // find_longest_stretch never looks at the last possible start
+  int32_t limit = read_len - period;
+  int32_t longest = 0, current = 0, total = 0, expected = -1;
+  int32_t i = next_set_bit(copies, 0, limit);
+  while (i >= 0) {
+    total++;
+    current = (i == expected ? current + 1 : 1);
+    if (current > longest) {
+      longest = current;
+    }
+    expected = i + period;
+    i = next_set_bit(copies, expected, limit);
+  }
+  *nCopy_stretch = longest;
+  *nCopy_total = total;
+}
+
+bool packed_motif_copies(const uint8_t* packed_seq,
+			 const int32_t& read_len,
+			 const std::string& motif,
+			 int32_t* nCopy_stretch, int32_t* nCopy_total,
+			 int32_t* nCopy_stretch_rev, int32_t* nCopy_total_rev) {
+  int32_t period = (int32_t)motif.size();
+  if (period == 0 || read_len > PACKED_MAX_READ_LEN) {
+    return false;
+  }
+  if (period > read_len) {
+    *nCopy_stretch = *nCopy_total = *nCopy_stretch_rev = *nCopy_total_rev = 0;
+    return true;
+  }
+  int8_t motif_codes[PACKED_MAX_READ_LEN];
+  for (int32_t j = 0; j < period; j++) {
+    // Only lower case bases match the lower cased read
+    switch (motif[j]) {
+    case 'a': motif_codes[j] = 0; break;
+    case 'c': motif_codes[j] = 1; break;
+    case 'g': motif_codes[j] = 2; break;
+    case 't': motif_codes[j] = 3; break;
+    default: return false;
+    }
+  }
+
+  // Base masks of the read and of its reverse complement. 4-bit codes
+  // 1, 2, 4 and 8 are A, C, G and T; anything else matches no motif base
+  uint64_t forward[4][PACKED_MAX_READ_LEN / 64];
+  uint64_t reverse[4][PACKED_MAX_READ_LEN / 64];
+  int32_t num_words = (read_len + 63) / 64;
+  for (int32_t b = 0; b < 4; b++) {
+    for (int32_t w = 0; w < num_words; w++) {
+      forward[b][w] = 0;
+      reverse[b][w] = 0;
+    }
+  }
+  for (int32_t i = 0; i < read_len; i++) {
+    int32_t base;
+    switch ((packed_seq[i >> 1] >> ((~i & 1) << 2)) & 0xf) {
+    case 1: base = 0; break;
+    case 2: base = 1; break;
+    case 4: base = 2; break;
+    case 8: base = 3; break;
+    default: continue;
+    }
+    int32_t rev_i = read_len - 1 - i;
+    forward[base][i / 64] |= (uint64_t)1 << (i % 64);
+    reverse[3 - base][rev_i / 64] |= (uint64_t)1 << (rev_i % 64);
+  }
+  count_masked_copies(forward, read_len, motif_codes, period, nCopy_stretch, nCopy_total);
+  count_masked_copies(reverse, read_len, motif_codes, period, nCopy_stretch_rev, nCopy_total_rev);
+  return true;
+}
+
+// Lane-wise max of 32-bit integers (SSE2 has no pmaxsd)
+static inline __m128i max_epi32(const __m128i& a, const __m128i& b) {
+#ifdef __SSE4_1__
+  return _mm_max_epi32(a, b);
+#else
+  __m128i mask = _mm_cmpgt_epi32(a, b);
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+#endif
 }
 
+/*
+  One column-at-a-time local alignment of a read against a template,
+  with affine gaps scored like SSW (a gap of length L costs
+  SSW_GAP_OPEN + (L-1)*SSW_GAP_EXTEND). Row i+1 holds read base i.
+
+  Every cell holds a key packing its score with the template column
+  where its alignment starts (score * 2^16 + start), so one comparison
+  picks the best score and, among ties, the latest start (the shortest
+  alignment, as SSW reports). H is the best cell of the current column
+  and E the best cell ending in a deletion. Rows are padded to a
+  multiple of 4 after the read, for SSE2. Padding rows only ever hold
+  cells worse than a read row, and no read row depends on them.
+ */
+class LocalAlignmentSweep {
+ public:
+  LocalAlignmentSweep(const std::vector<int8_t>& read, const bool& reversed)
+    : reversed_(reversed), rows_(1 + ((read.size() + 3) / 4) * 4),
+      H(rows_, 0), E(rows_, Key(-SSW_GAP_OPEN, 0)), best(0), best_end(0) {
+    prev_H_.assign(rows_, 0);
+    for (int8_t code = 0; code < 5; code++) {
+      profile_[code].assign(rows_, Key(-SSW_MISMATCH_SCORE, 0));
+      for (size_t i = 1; i <= read.size(); i++) {
+	if (read[i-1] == code && code < 4) {
+	  profile_[code][i] = Key(SSW_MATCH_SCORE, 0);
+	}
+      }
+    }
+  }
+
+  // Largest template length and read length the keys can hold
+  static const int32_t MAX_COLUMNS = 65535;
+  static const int32_t MAX_READ_LEN = 4000;
+
+  static int32_t Key(const int32_t& score, const int32_t& start) {
+    return score * 65536 + start;
+  }
+  static int32_t Score(const int32_t& key) {
+    return key >> 16;
+  }
+  static int32_t Start(const int32_t& key) {
+    return key & 0xffff;
+  }
+
+  // Add template column col holding base ref_code
+  void Step(const int8_t& ref_code, const int32_t& col) {
+    const __m128i gap_open = _mm_set1_epi32(Key(SSW_GAP_OPEN, 0));
+    const __m128i gap_extend = _mm_set1_epi32(Key(SSW_GAP_EXTEND, 0));
+    // An empty alignment before this column continues at this column
+    const __m128i fresh = _mm_set1_epi32(Key(0, col + 1));
+    const int32_t* profile = &profile_[ref_code][0];
+    H.swap(prev_H_);
+    int32_t* h_col = &H[0];
+    const int32_t* h_prev = &prev_H_[0];
+    int32_t* e_col = &E[0];
+    h_col[0] = Key(0, col + 1);
+
+    // Cells without insertions. Rows only depend on the last column.
+    for (int32_t i = 1; i < rows_; i += 4) {
+      // Deletion of this template base after row i of the last column
+      __m128i h_left = _mm_loadu_si128((const __m128i*)(h_prev + i));
+      __m128i e = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(e_col + i)), gap_extend);
+      e = max_epi32(e, _mm_sub_epi32(h_left, gap_open));
+      __m128i diag = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(h_prev + i - 1)),
+				   _mm_loadu_si128((const __m128i*)(profile + i)));
+      _mm_storeu_si128((__m128i*)(e_col + i), e);
+      _mm_storeu_si128((__m128i*)(h_col + i), max_epi32(max_epi32(diag, fresh), e));
+    }
+
+    // Insertions (read base i-1 after the cell above). Opening from a
+    // cell that itself ends in an insertion never beats extending, so
+    //   f[i] = max over k < i of h[k] - gap_open - (i-1-k) * gap_extend
+    // Adding gap_open + i * gap_extend turns this into a running maximum
+    // of h[i-1] + i * gap_extend, which is never negative (h >= 0), so
+    // zeros shifted into the lanes do not change it.
+    __m128i shift = _mm_set_epi32(Key(4 * SSW_GAP_EXTEND, 0), Key(3 * SSW_GAP_EXTEND, 0),
+				  Key(2 * SSW_GAP_EXTEND, 0), Key(SSW_GAP_EXTEND, 0));
+    const __m128i shift_step = _mm_set1_epi32(Key(4 * SSW_GAP_EXTEND, 0));
+    __m128i carry = _mm_setzero_si128();
+    __m128i col_best = _mm_setzero_si128();
+    __m128i last_block = fresh;
+    for (int32_t i = 1; i < rows_; i += 4) {
+      // Cells above: last row of the previous block, then this block
+      // shifted by one row. Cells without insertions will do, so the
+      // blocks only depend on each other through carry.
+      __m128i h_block = _mm_loadu_si128((const __m128i*)(h_col + i));
+      __m128i up = _mm_or_si128(_mm_slli_si128(h_block, 4), _mm_srli_si128(last_block, 12));
+      last_block = h_block;
+      __m128i f = _mm_add_epi32(up, shift);
+      f = max_epi32(f, _mm_slli_si128(f, 4));
+      f = max_epi32(f, _mm_slli_si128(f, 8));
+      f = max_epi32(f, carry);
+      carry = _mm_shuffle_epi32(f, 0xff);
+      __m128i h = max_epi32(h_block, _mm_sub_epi32(f, _mm_add_epi32(shift, gap_open)));
+      _mm_storeu_si128((__m128i*)(h_col + i), h);
+      col_best = max_epi32(col_best, h);
+      shift = _mm_add_epi32(shift, shift_step);
+    }
+    col_best = max_epi32(col_best, _mm_shuffle_epi32(col_best, 0x4e));
+    col_best = max_epi32(col_best, _mm_shuffle_epi32(col_best, 0xb1));
+    int32_t column_best = _mm_cvtsi128_si32(col_best);
+
+    // Like SSW, keep the leftmost end on ties. On a reversed template
+    // that is the alignment with the largest start column.
+    if (reversed_ ? column_best > best : Score(column_best) > Score(best)) {
+      best = column_best;
+      best_end = col;
+    }
+  }
+
+ private:
+  bool reversed_;
+  int32_t rows_;
+  std::vector<int32_t> prev_H_;
+  // Match or mismatch key of every row, for each template base code
+  std::vector<int32_t> profile_[5];
+
+ public:
+  std::vector<int32_t> H, E;
+  int32_t best;
+  int32_t best_end;
+};
+
+/*
+  Check that seq[seq_pos, seq_pos+length) equals the same stretch of
+  pre_flank + motif*nCopy + post_flank, without building the template.
+ */
+static bool template_matches(const std::string& seq, const int32_t& seq_pos,
+			     const std::string& pre_flank, const std::string& post_flank,
+			     const std::string& motif, const int32_t& nCopy,
+			     const int32_t& template_pos, const int32_t& length) {
+  int32_t pre_len = (int32_t)pre_flank.size();
+  int32_t str_len = nCopy * (int32_t)motif.size();
+  int32_t template_len = pre_len + str_len + (int32_t)post_flank.size();
+  if (seq_pos < 0 || seq_pos + length > (int32_t)seq.size() ||
+      template_pos < 0 || template_pos + length > template_len) {
+    return false;
+  }
+  for (int32_t k = 0; k < length; k++) {
+    int32_t t = template_pos + k;
+    char base;
+    if (t < pre_len) {
+      base = pre_flank[t];
+    } else if (t < pre_len + str_len) {
+      base = motif[(t - pre_len) % motif.size()];
+    } else {
+      base = post_flank[t - pre_len - str_len];
+    }
+    if (seq[seq_pos + k] != base) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+  Flank match states of an alignment against pre_flank + motif*nCopy +
+  post_flank starting at hit->start_pos, assuming no indels between the
+  alignment start and the flank boundaries.
+ */
+static void set_flank_match(const std::string& seq,
+			    const std::string& pre_flank,
+			    const std::string& post_flank,
+			    const std::string& motif,
+			    const int32_t& min_match,
+			    const int32_t& nCopy,
+			    RepeatGraphHit* hit) {
+  int32_t read_len = (int32_t)seq.size();
+  int32_t str_len = nCopy * (int32_t)motif.size();
+  hit->fm_start = template_matches(seq, read_len - hit->start_pos - min_match,
+				   pre_flank, post_flank, motif, nCopy,
+				   read_len - min_match, 2 * min_match) ?
+    FM_COMPLETE : FM_NOMATCH;
+  hit->fm_end = template_matches(seq, read_len - hit->start_pos + str_len - min_match,
+				 pre_flank, post_flank, motif, nCopy,
+				 read_len + str_len - min_match, 2 * min_match) ?
+    FM_COMPLETE : FM_NOMATCH;
+}
+
+bool repeat_graph_align(const std::string& seq,
+			const std::string& pre_flank,
+			const std::string& post_flank,
+			const std::string& motif,
+			const int32_t& min_match,
+			const int32_t& max_nCopy,
+			std::vector<RepeatGraphHit>* hits,
+			const LocusTemplates* templates) {
+  int32_t read_len = (int32_t)seq.size();
+  int32_t period = (int32_t)motif.size();
+  int32_t pre_len = (int32_t)pre_flank.size();
+  int32_t post_len = (int32_t)post_flank.size();
+  if (read_len == 0 || period == 0 || max_nCopy < 0 ||
+      read_len > LocalAlignmentSweep::MAX_READ_LEN ||
+      pre_len + post_len + max_nCopy * period > LocalAlignmentSweep::MAX_COLUMNS) {
+    return false;
+  }
+  hits->assign(max_nCopy + 1, RepeatGraphHit());
+
+  std::vector<int8_t> read(read_len), read_rev(read_len);
+  for (int32_t i = 0; i < read_len; i++) {
+    read[i] = nt_code(seq[i]);
+    read_rev[read_len - 1 - i] = read[i];
+  }
+
+  // Graph sequences, translated once per locus when templates are given
+  std::vector<int8_t> local_forward, local_reverse;
+  const std::vector<int8_t>* forward = &local_forward;
+  const std::vector<int8_t>* reverse = &local_reverse;
+  if (templates != NULL && templates->Covers(read_len) && max_nCopy <= templates->MaxCopies()) {
+    forward = &templates->Forward();
+    reverse = &templates->Reverse();
+  } else {
+    for (int32_t col = 0; col < pre_len + max_nCopy * period; col++) {
+      local_forward.push_back(col < pre_len ? nt_code(pre_flank[col]) :
+			      nt_code(motif[(col - pre_len) % period]));
+    }
+    for (int32_t col = 0; col < post_len + max_nCopy * period; col++) {
+      local_reverse.push_back(col < post_len ? nt_code(post_flank[post_len - 1 - col]) :
+			      nt_code(motif[period - 1 - (col - post_len) % period]));
+    }
+  }
+
+  // Forward: pre_flank followed by max_nCopy motif copies.
+  // left[n] is the best alignment within pre_flank + motif*n.
+  std::vector<RepeatGraphHit> left(max_nCopy + 1);
+  LocalAlignmentSweep fwd(read, false);
+  std::vector<int32_t> cut_H, cut_E;
+  for (int32_t col = 0; col < pre_len + max_nCopy * period; col++) {
+    fwd.Step((*forward)[col], col);
+    if (col == pre_len - 1) {
+      // Alignments ending on the last pre_flank base, to be joined
+      // with alignments starting on the base after it
+      cut_H = fwd.H;
+      cut_E = fwd.E;
+    }
+    if (col >= pre_len - 1 && (col - pre_len + 1) % period == 0) {
+      RepeatGraphHit& hit = left[(col - pre_len + 1) / period];
+      hit.score = LocalAlignmentSweep::Score(fwd.best);
+      hit.start_pos = hit.score > 0 ? LocalAlignmentSweep::Start(fwd.best) : 0;
+      hit.end_pos = hit.score > 0 ? fwd.best_end : 0;
+    }
+  }
+
+  // Reverse: reversed read against reversed post_flank followed by
+  // max_nCopy reversed motif copies. Each prefix of this is the reverse
+  // of motif*n + post_flank, and its columns map back to template
+  // pre_flank + motif*n + post_flank as col -> template_len-1-col.
+  LocalAlignmentSweep rev(read_rev, true);
+  int32_t nCopy = 0;
+  int32_t rev_len = post_len + max_nCopy * period;
+  for (int32_t col = -1; col < rev_len; col++) {
+    if (col >= 0) {
+      rev.Step((*reverse)[col], col);
+    }
+    if (col != post_len + nCopy * period - 1) {
+      continue;
+    }
+    int32_t template_len = pre_len + nCopy * period + post_len;
+    RepeatGraphHit& hit = hits->at(nCopy);
+    hit = left[nCopy];
+    // Alignments within motif*n + post_flank
+    int32_t rev_score = LocalAlignmentSweep::Score(rev.best);
+    if (rev_score > hit.score ||
+	(rev_score == hit.score && rev_score > 0 &&
+	 template_len - 1 - LocalAlignmentSweep::Start(rev.best) < hit.end_pos)) {
+      hit.score = rev_score;
+      hit.start_pos = template_len - 1 - rev.best_end;
+      hit.end_pos = template_len - 1 - LocalAlignmentSweep::Start(rev.best);
+    }
+    // Alignments crossing out of pre_flank: read bases [0, i] end on
+    // the last pre_flank base and [i+1, read_len) start on the next one.
+    for (int32_t i = 0; pre_len > 0 && col >= 0 && i < read_len - 1; i++) {
+      int32_t r = read_len - 1 - i;
+      int32_t joined = 0, start = 0, end = 0;
+      int32_t left_score = LocalAlignmentSweep::Score(cut_H[i+1]);
+      int32_t right_score = LocalAlignmentSweep::Score(rev.H[r]);
+      if (left_score > 0 && right_score > 0) {
+	joined = left_score + right_score;
+	start = LocalAlignmentSweep::Start(cut_H[i+1]);
+	end = template_len - 1 - LocalAlignmentSweep::Start(rev.H[r]);
+      }
+      // One deletion spanning the cut only pays one gap open
+      left_score = LocalAlignmentSweep::Score(cut_E[i+1]);
+      right_score = LocalAlignmentSweep::Score(rev.E[r]);
+      if (left_score > 0 && right_score > 0 &&
+	  left_score + right_score + SSW_GAP_OPEN - SSW_GAP_EXTEND > joined) {
+	joined = left_score + right_score + SSW_GAP_OPEN - SSW_GAP_EXTEND;
+	start = LocalAlignmentSweep::Start(cut_E[i+1]);
+	end = template_len - 1 - LocalAlignmentSweep::Start(rev.E[r]);
+      }
+      if (joined > hit.score || (joined == hit.score && joined > 0 && end < hit.end_pos)) {
+	hit.score = joined;
+	hit.start_pos = start;
+	hit.end_pos = end;
+      }
+    }
+
+    set_flank_match(seq, pre_flank, post_flank, motif, min_match, nCopy, &hit);
+    nCopy++;
+    if (nCopy > max_nCopy) {
+      break;
+    }
+  }
+  return true;
+}
 
 bool expansion_aware_realign(const std::string& seq,
 			     const std::string& qual,
@@ -74,7 +546,8 @@ bool expansion_aware_realign(const std::string& seq,
 			     int32_t* end_pos, 
 			     int32_t* score,
 			     FlankMatchState* fm_start,
-			     FlankMatchState* fm_end) {
+			     FlankMatchState* fm_end,
+			     const LocusTemplates* templates) {
 
   *fm_start = FM_NOMATCH;
   *fm_end = FM_NOMATCH;
@@ -83,7 +556,7 @@ bool expansion_aware_realign(const std::string& seq,
   int32_t min_nCopy = 0, total_nCopy = 0;
   // Find longest stretch of motif as starting point of our search.
   find_longest_stretch(seq, motif, &min_nCopy, &total_nCopy);
-  if (min_nCopy < 2 and total_nCopy < 10){
+  if (!enough_motif_copies(min_nCopy, total_nCopy)){
       *nCopy = 0;
       *score = 0;
       *start_pos = 0;
@@ -98,59 +571,79 @@ bool expansion_aware_realign(const std::string& seq,
   int32_t max_end_pos = 0;
   int32_t current_score = 0;
   int32_t current_start_pos = 0, current_end_pos = 0;
-  int32_t current_nCopy, current_num_mismatch;
+  int32_t current_nCopy;
   int32_t prev_score = 0;
-  std::string template_sub, sequence_sub;
   MARGIN = 1 * period - 1;
-  
-  //cerr << min_nCopy << " ";
-  for (current_nCopy=min_nCopy; current_nCopy<(int32_t)(read_len/period)+2; current_nCopy++) {
-    std::stringstream var_realign_ss;
-    var_realign_ss << pre_flank;
-    for (int i = 0; i<current_nCopy; i++) {
-      var_realign_ss << motif;
-    }
-    var_realign_ss << post_flank;
-    std::string var_realign_string = var_realign_ss.str();
-    
 
-    if (!striped_smith_waterman(var_realign_string, seq, qual, &current_start_pos, &current_end_pos, &current_score, &current_num_mismatch)) {
-      return false;
+  // Start with one SSW alignment per copy number, which is cheapest when
+  // the search stops after a few. If it runs on, score all remaining
+  // copy numbers in a single pass over the repeat graph instead.
+  int32_t max_copies = (int32_t)(read_len/period) + 1;
+  bool use_graph = false;
+  std::vector<RepeatGraphHit> hits;
+  // The read is the query for every template, so build its profile once.
+  // Only positions and score are needed here, so skip the cigar.
+  StripedSmithWaterman::Aligner* aligner = get_thread_aligner();
+  if (!aligner->SetQuery(seq.c_str(), read_len)) {
+    return false;
+  }
+  StripedSmithWaterman::Filter filter(true, false, 0, 32767);
+  StripedSmithWaterman::Alignment alignment;
+  const int32_t maskLen = 15;
+
+  // Use the locus templates if they are long enough for this read.
+  // Otherwise the template grows by one motif copy per iteration.
+  bool use_templates = (templates != NULL && templates->Covers(read_len));
+  std::string var_realign_string;
+  if (!use_templates) {
+    var_realign_string = pre_flank;
+    for (int i = 0; i<min_nCopy; i++) {
+      var_realign_string += motif;
     }
-    
+    var_realign_string += post_flank;
+  }
 
-    // Flank match check
-    // Preflank
-    if (read_len - current_start_pos - min_match >= 0 &&
-	read_len - current_start_pos + min_match <= read_len){ //Full match is possible
-      sequence_sub = seq.substr(read_len - current_start_pos - min_match, 2 * min_match);
-      template_sub = var_realign_string.substr(read_len - min_match, 2 * min_match);
-      if (sequence_sub == template_sub){
-	*fm_start = FM_COMPLETE;
-      }
-      else{
-	*fm_start = FM_NOMATCH;
+  //cerr << min_nCopy << " ";
+  for (current_nCopy=min_nCopy; current_nCopy<(int32_t)(read_len/period)+2; current_nCopy++) {
+    if (!use_graph && current_nCopy - min_nCopy == REPEAT_GRAPH_MIN_COPIES) {
+      if (!repeat_graph_align(seq, pre_flank, post_flank, motif, min_match,
+			      max_copies, &hits, templates)) {
+	return false;
       }
+      use_graph = true;
     }
-    else{
-      *fm_start = FM_NOMATCH;
-    }
-    // Postflank
-    if (read_len - current_start_pos + current_nCopy * period + min_match <= read_len &&
-	read_len - current_start_pos + current_nCopy * period - min_match >= 0){ //Full match is possible
-      sequence_sub = seq.substr(read_len - current_start_pos + current_nCopy * period - min_match, 2 * min_match);
-      template_sub = var_realign_string.substr(read_len + current_nCopy * period - min_match, 2 * min_match);
-      
-      if (sequence_sub == template_sub){
-	*fm_end = FM_COMPLETE;
+    RepeatGraphHit hit;
+    if (use_graph) {
+      hit = hits[current_nCopy];
+    } else if (use_templates) {
+      STATS_COUNT(STATS_SSW_CALLS, 1);
+      if (!aligner->AlignQueryTranslated(templates->Template(current_nCopy),
+					 templates->TemplateLength(current_nCopy),
+					 filter, &alignment, maskLen)) {
+	return false;
       }
-      else{
-	*fm_end = FM_NOMATCH;
+    } else {
+      if (current_nCopy > min_nCopy) {
+	var_realign_string.insert(pre_flank.size(), motif);
+      }
+      STATS_COUNT(STATS_SSW_CALLS, 1);
+      if (!aligner->AlignQuery(var_realign_string.c_str(), (int32_t)var_realign_string.size(),
+			       filter, &alignment, maskLen)) {
+	return false;
       }
     }
-    else{
-      *fm_end = FM_NOMATCH;
+    if (!use_graph) {
+      hit.score = alignment.sw_score;
+      hit.start_pos = alignment.ref_begin;
+      hit.end_pos = alignment.ref_end;
+      set_flank_match(seq, pre_flank, post_flank, motif, min_match, current_nCopy, &hit);
     }
+    current_start_pos = hit.start_pos;
+    current_end_pos = hit.end_pos;
+    current_score = hit.score;
+    *fm_start = hit.fm_start;
+    *fm_end = hit.fm_end;
+
     if (current_score >= max_score) {
       second_best_score = max_score;
       second_best_nCopy = max_nCopy;
@@ -245,38 +738,66 @@ bool striped_smith_waterman(const std::string& ref,
         const std::string& qual,
         int32_t* pos, int32_t* end, int32_t* score, int32_t* mismatches) {
 
-  // SSW Objects
-  StripedSmithWaterman::Aligner* aligner;
-  StripedSmithWaterman::Filter* filter;
-  StripedSmithWaterman::Alignment* alignment;
-
-  aligner = new StripedSmithWaterman::Aligner(SSW_MATCH_SCORE, 
-                              SSW_MISMATCH_SCORE, 
-                              SSW_GAP_OPEN, 
-                              SSW_GAP_EXTEND);
-  filter = new StripedSmithWaterman::Filter;
-  alignment = new StripedSmithWaterman::Alignment;
-  int32_t maskLen = seq.size() / 2;
-  maskLen = maskLen < 15 ? 15 : maskLen;
-  maskLen = 15;
-  aligner->Align(seq.c_str(), ref.c_str(), (int32_t)ref.size(), *filter, alignment, maskLen);
-
-  // if (seq == "ggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggcggggcgcggcgcggccgccgcccgcggcggggcggcgggccgccg"){
-  //   cerr << ref.size() << endl;
-  //   ssw_PrintAlignment(*alignment);
-  // }
-  // ssw_PrintAlignment(*alignment);
-  *pos = alignment->ref_begin;
-  *end = alignment->ref_end;
-  *score = alignment->sw_score;
-  *mismatches = alignment->mismatches;
-  // cerr<<ref.substr(alignment->ref_begin, alignment->ref_end)<<endl;
-  delete aligner;
-  delete filter;
-  delete alignment;
+  StripedSmithWaterman::Aligner* aligner = get_thread_aligner();
+  StripedSmithWaterman::Filter filter;
+  StripedSmithWaterman::Alignment alignment;
+  int32_t maskLen = 15;
+  if (!aligner->SetQuery(seq.c_str(), (int32_t)seq.size())) {
+    return false;
+  }
+  STATS_COUNT(STATS_SSW_CALLS, 1);
+  if (!aligner->AlignQuery(ref.c_str(), (int32_t)ref.size(), filter, &alignment, maskLen)) {
+    return false;
+  }
+  *pos = alignment.ref_begin;
+  *end = alignment.ref_end;
+  *score = alignment.sw_score;
+  *mismatches = alignment.mismatches;
+  return true;
+}
+
+bool striped_smith_waterman(const int8_t* ref, const int32_t& ref_len,
+        const std::string& seq,
+        int32_t* pos, int32_t* end, int32_t* score, int32_t* mismatches) {
+
+  StripedSmithWaterman::Aligner* aligner = get_thread_aligner();
+  StripedSmithWaterman::Filter filter;
+  StripedSmithWaterman::Alignment alignment;
+  int32_t maskLen = 15;
+  if (!aligner->SetQuery(seq.c_str(), (int32_t)seq.size())) {
+    return false;
+  }
+  STATS_COUNT(STATS_SSW_CALLS, 1);
+  if (!aligner->AlignQueryTranslated(ref, ref_len, filter, &alignment, maskLen)) {
+    return false;
+  }
+  *pos = alignment.ref_begin;
+  *end = alignment.ref_end;
+  *score = alignment.sw_score;
+  *mismatches = alignment.mismatches;
   return true;
 }
 
+bool is_frr_alignment(const int32_t& read_length, const int32_t& pos, const int32_t& end,
+		      const int32_t& score, const int32_t& mismatches) {
+  int32_t gaps = abs(end - pos - read_length);
+  // Tune 0.75 for false positive rate
+  return (score > 0.75 * read_length * SSW_MATCH_SCORE &&
+	  mismatches < int(.05 * read_length) &&
+	  gaps < int(.05 * read_length));
+}
+
+bool is_frr_sequence(const std::string& seq, const std::string& qual,
+		     const std::string& motif) {
+  std::string frr_ref;
+  for (size_t i = 0; i < seq.size() / motif.size() + 1; i++) {
+    frr_ref += motif;
+  }
+  int32_t pos, end, score, mismatches;
+  striped_smith_waterman(frr_ref, seq, qual, &pos, &end, &score, &mismatches);
+  return is_frr_alignment((int32_t)seq.size(), pos, end, score, mismatches);
+}
+
 static void ssw_PrintAlignment(const StripedSmithWaterman::Alignment& alignment){
   cerr << "===== SSW result =====" << endl;
   cerr << "Best Smith-Waterman score:\t" << alignment.sw_score << endl
@@ -25,6 +25,7 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 #include <vector>
 
 #include <stdint.h>
+#include "src/locus_templates.h"
 #include "src/ssw_cpp.h"
 
 // Set NW params
@@ -42,8 +43,15 @@ const static int32_t SSW_MISMATCH_SCORE = 5;
 const static int32_t SSW_GAP_OPEN = 4;
 const static int32_t SSW_GAP_EXTEND = 2;
 
+// expansion_aware_realign tries this many copy numbers with one SSW alignment
+// each, then scores the rest with a single repeat_graph_align pass. Most
+// reads stop within a few copies, where the SSW calls cost about half of
+// a graph pass over all max_nCopy copies.
+const static int32_t REPEAT_GRAPH_MIN_COPIES = 4;
+
 // amount of slip we allow between alignment position and STR start and end
-static int32_t MARGIN = 5;		// This value is reset in expansion_aware_realign
+// This value is reset in expansion_aware_realign (thread-local for --threads)
+static __thread int32_t MARGIN = 5;
 // Threshold to discard alignment as non-overlapping
 const static double MATCH_PERC_THRESHOLD = 0.9;
 
@@ -64,6 +72,17 @@ enum FlankMatchState{
   FM_COMPLETE = 2
 };
 
+// Best local alignment of a read against pre_flank + motif*n + post_flank
+struct RepeatGraphHit {
+  int32_t score;
+  int32_t start_pos;   // Template position where the alignment starts
+  int32_t end_pos;     // Template position where the alignment ends
+  FlankMatchState fm_start;
+  FlankMatchState fm_end;
+  RepeatGraphHit()
+    : score(0), start_pos(0), end_pos(0), fm_start(FM_NOMATCH), fm_end(FM_NOMATCH) {}
+};
+
 enum sw_move{
 	SW_END = 0,
 	SW_DIAG = 1,
@@ -83,6 +102,37 @@ bool next_move(std::vector<std::vector<int32_t> > score_matrix,
             const int32_t& y, 
             sw_move* move);
 
+// Longest reads counted by packed_motif_copies
+const static int32_t PACKED_MAX_READ_LEN = 1024;
+
+/*
+  Count copies of motif in seq, scanning left to right: the longest run of
+  adjacent copies and the total number of non-overlapping copies
+ */
+bool find_longest_stretch(const std::string& seq,
+			  const std::string& motif,
+			  int32_t* nCopy_stretch,
+			  int32_t* nCopy_total);
+
+/*
+  Same counts as find_longest_stretch on the lower case read and on its
+  reverse complement, straight from the 4-bit BAM encoding of the read
+  (bam_get_seq) and without building any string. Copies are found with
+  one bitwise AND of shifted base masks per motif position, 64 read
+  positions at a time. Returns false if the motif has other bases than
+  acgt or the read is longer than PACKED_MAX_READ_LEN
+ */
+bool packed_motif_copies(const uint8_t* packed_seq,
+			 const int32_t& read_len,
+			 const std::string& motif,
+			 int32_t* nCopy_stretch, int32_t* nCopy_total,
+			 int32_t* nCopy_stretch_rev, int32_t* nCopy_total_rev);
+
+// Whether expansion_aware_realign goes on to realign a read with these counts
+inline bool enough_motif_copies(const int32_t& nCopy_stretch, const int32_t& nCopy_total) {
+  return !(nCopy_stretch < 2 and nCopy_total < 10);
+}
+
 bool expansion_aware_realign(const std::string& seq,
 			     const std::string& qual,
 			     const std::string& pre_flank,
@@ -94,7 +144,26 @@ bool expansion_aware_realign(const std::string& seq,
 			     int32_t* end_pos, 
 			     int32_t* score,
 			     FlankMatchState* fm_start,
-			     FlankMatchState* fm_end);		      
+			     FlankMatchState* fm_end,
+			     const LocusTemplates* templates = NULL);
+
+/*
+  Align seq once against the graph pre_flank -> (motif)* -> post_flank.
+  hits[n] gets the same score as a local alignment against the template
+  with n motif copies, for every n in [0, max_nCopy], plus the flank
+  match states used by classify_realigned_read. Costs two dynamic
+  programming passes of about read_len x (flank + read_len) cells,
+  instead of one full alignment per copy number. If templates covers
+  the read, its pre-translated graph sequences are used.
+ */
+bool repeat_graph_align(const std::string& seq,
+			const std::string& pre_flank,
+			const std::string& post_flank,
+			const std::string& motif,
+			const int32_t& min_match,
+			const int32_t& max_nCopy,
+			std::vector<RepeatGraphHit>* hits,
+			const LocusTemplates* templates = NULL);
 
 bool smith_waterman(const std::string& seq1,
 		    const std::string& seq2,
@@ -105,7 +174,21 @@ bool striped_smith_waterman(const std::string& ref,
         const std::string& seq,
         const std::string& qual,
         int32_t* pos, int32_t* pos_temp, int32_t* score, int32_t* mismatches);
+// Same, against a reference already translated by nt_code
+bool striped_smith_waterman(const int8_t* ref, const int32_t& ref_len,
+        const std::string& seq,
+        int32_t* pos, int32_t* pos_temp, int32_t* score, int32_t* mismatches);
 //static void ssw_PrintAlignment(const StripedSmithWaterman::Alignment& alignment);
+
+// Whether an alignment of a read of read_length bases against copies of
+// its motif makes it a fully repetitive read: high score, few mismatches
+// and gaps
+bool is_frr_alignment(const int32_t& read_length, const int32_t& pos, const int32_t& end,
+		      const int32_t& score, const int32_t& mismatches);
+// Align seq against enough copies of motif to cover it and check the
+// alignment with is_frr_alignment
+bool is_frr_sequence(const std::string& seq, const std::string& qual,
+		     const std::string& motif);
 bool create_score_matrix(const int32_t& rows, const int32_t& cols,
 			 const std::string& seq1,
 			 const std::string& seq2,
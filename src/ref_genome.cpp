@@ -29,7 +29,124 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 
 using namespace std;
 
-RefGenome::RefGenome(const std::string& _reffa) {
+// Bases read from the FASTA file at a time while packing
+const static int32_t PACK_CHUNK_SIZE = 1 << 20;
+
+PackedReference::PackedReference() {}
+
+bool PackedReference::Load(const std::string& reffa, const std::set<std::string>& chroms) {
+  faidx_t* fai = fai_load(reffa.c_str());
+  if (fai == NULL) {
+    return false;
+  }
+  for (int i = 0; i < faidx_nseq(fai); i++) {
+    std::string name = faidx_iseq(fai, i);
+    if (!chroms.empty() && chroms.find(name) == chroms.end()) {
+      continue;
+    }
+    Chrom& chrom = chroms_[name];
+    chrom.length = faidx_seq_len(fai, name.c_str());
+    chrom.bases.assign((chrom.length + 3) / 4, 0);
+    for (int32_t chunk_start = 0; chunk_start < chrom.length; chunk_start += PACK_CHUNK_SIZE) {
+      int32_t chunk_end = std::min(chunk_start + PACK_CHUNK_SIZE, chrom.length);
+      int length;
+      char* chunk = faidx_fetch_seq(fai, name.c_str(), chunk_start, chunk_end - 1, &length);
+      if (chunk == NULL || length != chunk_end - chunk_start) {
+	free((void *)chunk);
+	fai_destroy(fai);
+	return false;
+      }
+      for (int32_t i = 0; i < length; i++) {
+	int32_t pos = chunk_start + i;
+	uint8_t code = 0;
+	char base = (char)tolower(chunk[i]);
+	switch (base) {
+	case 'a': code = 0; break;
+	case 'c': code = 1; break;
+	case 'g': code = 2; break;
+	case 't': code = 3; break;
+	case 'n':
+	  if (!chrom.n_blocks.empty() && chrom.n_blocks.back().second == pos) {
+	    chrom.n_blocks.back().second++;
+	  } else {
+	    chrom.n_blocks.push_back(std::pair<int32_t, int32_t>(pos, pos + 1));
+	  }
+	  break;
+	default:
+	  chrom.others.push_back(std::pair<int32_t, char>(pos, base));
+	  break;
+	}
+	chrom.bases[pos >> 2] |= code << ((3 - (pos & 3)) << 1);
+      }
+      free((void *)chunk);
+    }
+  }
+  fai_destroy(fai);
+  return true;
+}
+
+bool PackedReference::HasChrom(const std::string& chrom) const {
+  return chroms_.find(chrom) != chroms_.end();
+}
+
+int64_t PackedReference::packed_bytes() const {
+  int64_t total = 0;
+  for (std::map<std::string, Chrom>::const_iterator it = chroms_.begin();
+       it != chroms_.end(); it++) {
+    total += it->second.bases.size();
+  }
+  return total;
+}
+
+bool PackedReference::GetSequence(const std::string& chrom_name,
+				  const int32_t& start,
+				  const int32_t& end,
+				  std::string* seq) const {
+  std::map<std::string, Chrom>::const_iterator chrom_it = chroms_.find(chrom_name);
+  if (chrom_it == chroms_.end() || chrom_it->second.length == 0) {
+    return false;
+  }
+  const Chrom& chrom = chrom_it->second;
+  // Same clamping as faidx_fetch_seq
+  int32_t first = (end < start ? end : start);
+  int32_t last = end;
+  if (first < 0) {
+    first = 0;
+  } else if (first >= chrom.length) {
+    first = chrom.length - 1;
+  }
+  if (last < 0) {
+    last = 0;
+  } else if (last >= chrom.length) {
+    last = chrom.length - 1;
+  }
+  seq->resize(last - first + 1);
+  for (int32_t pos = first; pos <= last; pos++) {
+    (*seq)[pos - first] = "acgt"[(chrom.bases[pos >> 2] >> ((3 - (pos & 3)) << 1)) & 3];
+  }
+  // Put back Ns and other bases in the slice
+  std::vector<std::pair<int32_t, int32_t> >::const_iterator block =
+    std::upper_bound(chrom.n_blocks.begin(), chrom.n_blocks.end(),
+		     std::pair<int32_t, int32_t>(first, chrom.length + 1));
+  if (block != chrom.n_blocks.begin()) {
+    block--;
+  }
+  for (; block != chrom.n_blocks.end() && block->first <= last; block++) {
+    for (int32_t pos = std::max(block->first, first); pos < std::min(block->second, last + 1); pos++) {
+      (*seq)[pos - first] = 'n';
+    }
+  }
+  std::vector<std::pair<int32_t, char> >::const_iterator other =
+    std::lower_bound(chrom.others.begin(), chrom.others.end(),
+		     std::pair<int32_t, char>(first, (char)0));
+  for (; other != chrom.others.end() && other->first <= last; other++) {
+    (*seq)[other->first - first] = other->second;
+  }
+  return true;
+}
+
+RefGenome::RefGenome(const std::string& _reffa, const PackedReference* packed_ref) {
+  packed_ref_ = packed_ref;
   // Check if file exists
   if (!file_exists(_reffa)) {
     PrintMessageDieOnError("FASTA file " + _reffa + " does not exist", M_ERROR);
@@ -51,6 +168,9 @@ bool RefGenome::GetSequence(const std::string& _chrom,
 			    const int32_t& _start,
 			    const int32_t& _end,
 			    std::string* seq) {
+  if (packed_ref_ != NULL && packed_ref_->GetSequence(_chrom, _start, _end, seq)) {
+    return true;
+  }
   int length;
   char* result = faidx_fetch_seq(refindex, _chrom.c_str(), _start, _end, &length);
   if (result == NULL) {
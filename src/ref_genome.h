@@ -26,11 +26,54 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdint.h>
 #include <unistd.h>
 
+#include <map>
+#include <set>
 #include <string>
+#include <utility>
+#include <vector>
+
+/*
+  Reference chromosomes held in memory with 2 bits per base (--ref-cache).
+  Runs of N and the rare other IUPAC codes are kept on the side, so
+  sequences come back exactly as RefGenome would fetch them. Read-only
+  after Load, so one instance can be shared by all threads. It only
+  replaces the FASTA reads of flank extraction: the realignment kernels
+  and the read prefilters still take the decoded flank strings.
+ */
+class PackedReference {
+ public:
+  PackedReference();
+
+  // Pack the given chromosomes of reffa, or all of them if chroms is empty
+  bool Load(const std::string& reffa, const std::set<std::string>& chroms);
+  bool HasChrom(const std::string& chrom) const;
+  // Same as RefGenome::GetSequence, decoded from memory
+  bool GetSequence(const std::string& chrom,
+		   const int32_t& start,
+		   const int32_t& end,
+		   std::string* seq) const;
+  // Memory used by the packed bases
+  int64_t packed_bytes() const;
+
+ private:
+  struct Chrom {
+    int32_t length;
+    std::vector<uint8_t> bases;  // 4 bases per byte, first in the high bits. a,c,g,t = 0..3
+    std::vector<std::pair<int32_t, int32_t> > n_blocks;  // [start, end) runs of n
+    std::vector<std::pair<int32_t, char> > others;       // Other bases, lower case
+  };
+
+  // Private unimplemented copy constructor and assignment operator to prevent operations
+  PackedReference(const PackedReference& other);
+  PackedReference& operator=(const PackedReference& other);
+
+  std::map<std::string, Chrom> chroms_;
+};
 
 class RefGenome {
  public:
-  RefGenome(const std::string& _reffa);
+  // Chromosomes in packed_ref (may be NULL) are read from it instead of the file
+  RefGenome(const std::string& _reffa, const PackedReference* packed_ref = NULL);
   virtual ~RefGenome();
 
   bool GetSequence(const std::string& _chrom,
@@ -43,6 +86,7 @@ class RefGenome {
   }
 
   faidx_t* refindex;
+  const PackedReference* packed_ref_;
 };
 
 #endif  // SRC_REF_GENOME_H__
@@ -20,6 +20,7 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdlib.h>
 #include <algorithm>
+#include <set>
 #include <string>
 
 #include "src/common.h"
@@ -30,6 +31,17 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 using namespace std;
 
 RegionReader::RegionReader(const std::string& filename) {
+  freader = NULL;
+  catalog_ = NULL;
+  first_locus_ = last_locus_ = next_locus_ = 0;
+  if (LocusCatalog::IsCatalog(filename)) {
+    catalog_ = new LocusCatalog;
+    if (!catalog_->Open(filename)) {
+      PrintMessageDieOnError("Invalid locus catalog " + filename, M_ERROR);
+    }
+    last_locus_ = catalog_->size();
+    return;
+  }
   freader = new std::ifstream(filename.c_str());
   if (!freader->is_open()) {
     PrintMessageDieOnError("Could not open regions file", M_ERROR);
@@ -45,6 +57,13 @@ bool RegionReader::GetNextRegion(Locus* locus) {
   std::vector<std::string> items, offtarget_regions;
   std::string offtarget_str;
   bool stat;
+  if (catalog_ != NULL) {
+    if (next_locus_ >= last_locus_) {
+      return false;
+    }
+    catalog_->GetLocus(next_locus_++, locus);
+    return true;
+  }
   if (!std::getline(*freader, line)) {
     return false;
   }
@@ -87,10 +106,63 @@ bool RegionReader::GetNextRegion(Locus* locus) {
   Reset region reader to the top of the regions file
 */
 void RegionReader::Reset(){
+  if (catalog_ != NULL) {
+    next_locus_ = first_locus_;
+    return;
+  }
   freader->clear();
   freader->seekg(0, ios::beg);
 }
+
+/*
+  Restrict a catalog to one shard, balanced by the catalog's cost
+  estimates. Resets the reader
+*/
+bool RegionReader::SetShard(const int32_t& shard, const int32_t& num_shards){
+  if (catalog_ == NULL) {
+    return false;
+  }
+  catalog_->ShardRange(shard, num_shards, &first_locus_, &last_locus_);
+  Reset();
+  return true;
+}
+/*
+  Read through the regions file and check that regions of each chromosome
+  are in one block, ordered by start. Resets the reader
+*/
+bool RegionReader::IsSorted(){
+  Reset();
+  std::set<std::string> finished_chroms;
+  std::string chrom = "";
+  int32_t start = -1;
+  bool sorted = true;
+  Locus locus;
+  while (sorted && GetNextRegion(&locus)) {
+    if (locus.chrom != chrom) {
+      finished_chroms.insert(chrom);
+      if (finished_chroms.count(locus.chrom) > 0) {
+	sorted = false;
+      }
+      chrom = locus.chrom;
+    } else if (locus.start < start) {
+      sorted = false;
+    }
+    start = locus.start;
+    locus.Reset();
+  }
+  Reset();
+  return sorted;
+}
+
+bool RegionReader::AutoStreamRegions(const Options& options){
+  return (options.io_threads > 0 && options.num_threads == 1 &&
+	  !options.stream_regions && IsSorted());
+}
+
 RegionReader::~RegionReader() {
-  freader->close();
-  delete freader;
+  if (freader != NULL) {
+    freader->close();
+    delete freader;
+  }
+  delete catalog_;
 }
@@ -21,11 +21,19 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef SRC_REGION_READER_H__
 #define SRC_REGION_READER_H__
 
+#include <stdint.h>
+
 #include <fstream>
 #include <string>
 
 #include "src/locus.h"
+#include "src/locus_catalog.h"
+#include "src/options.h"
 
+/*
+  Reads loci from a BED regions file, or from a binary catalog written by
+  "GangSTR catalog-build"
+ */
 class RegionReader {
  public:
   RegionReader(const std::string& filename);
@@ -33,9 +41,21 @@ class RegionReader {
 
   bool GetNextRegion(Locus* locus);
   void Reset();
+  // Whether each chromosome's regions are together and in start order
+  bool IsSorted();
+  // Whether to follow the regions with --stream-regions although it was
+  // not asked for: I/O threads only read ahead within one stream, so with
+  // one genotyping thread and sorted regions. Resets the reader
+  bool AutoStreamRegions(const Options& options);
+  // Only read loci of shard (0-based) of num_shards. Catalogs only
+  bool SetShard(const int32_t& shard, const int32_t& num_shards);
 
  private:
   std::ifstream* freader;
+  LocusCatalog* catalog_;   // NULL for a BED file
+  uint64_t first_locus_;    // Catalog loci to read, [first, last)
+  uint64_t last_locus_;
+  uint64_t next_locus_;
 };
 
 #endif  // SRC_REGION_READER_H__
@@ -237,6 +237,7 @@ Aligner::Aligner(void)
     , gap_extending_penalty_(1)
     , translated_reference_(NULL)
     , reference_length_(0)
+    , query_profile_(NULL)
 {
   BuildDefaultMatrix();
 }
@@ -256,6 +257,7 @@ Aligner::Aligner(
     , gap_extending_penalty_(gap_extending_penalty)
     , translated_reference_(NULL)
     , reference_length_(0)
+    , query_profile_(NULL)
 {
   BuildDefaultMatrix();
 }
@@ -274,6 +276,7 @@ Aligner::Aligner(const int8_t* score_matrix,
     , gap_extending_penalty_(1)
     , translated_reference_(NULL)
     , reference_length_(0)
+    , query_profile_(NULL)
 {
   score_matrix_ = new int8_t[score_matrix_size_ * score_matrix_size_];
   memcpy(score_matrix_, score_matrix, sizeof(int8_t) * score_matrix_size_ * score_matrix_size_);
@@ -402,9 +405,69 @@ bool Aligner::Align(const char* query, const char* ref, const int& ref_len,
   return true;
 }
 
+bool Aligner::SetQuery(const char* query, const int& length) {
+  if (!translation_matrix_) return false;
+  if (length == 0) return false;
+
+  CleanQuery();
+  translated_query_.resize(length);
+  TranslateBase(query, length, &translated_query_[0]);
+
+  // The profile keeps a pointer to translated_query_
+  const int8_t score_size = 2;
+  query_profile_ = ssw_init(&translated_query_[0], length, score_matrix_,
+                            score_matrix_size_, score_size);
+  return true;
+}
+
+void Aligner::CleanQuery(void) {
+  if (query_profile_) init_destroy(query_profile_);
+  query_profile_ = NULL;
+  translated_query_.clear();
+}
+
+bool Aligner::AlignQuery(const char* ref, const int& ref_len,
+                         const Filter& filter, Alignment* alignment, const int32_t maskLen)
+{
+  if (!query_profile_) return false;
+  if (ref_len == 0) return false;
+
+  if ((int)translated_ref_buffer_.size() < ref_len) {
+    translated_ref_buffer_.resize(ref_len);
+  }
+  TranslateBase(ref, ref_len, &translated_ref_buffer_[0]);
+  return AlignQueryTranslated(&translated_ref_buffer_[0], ref_len, filter, alignment, maskLen);
+}
+
+bool Aligner::AlignQueryTranslated(const int8_t* ref, const int& ref_len,
+                                   const Filter& filter, Alignment* alignment, const int32_t maskLen)
+{
+  if (!query_profile_) return false;
+  if (ref_len == 0) return false;
+
+  uint8_t flag = 0;
+  SetFlag(filter, &flag);
+  s_align* s_al = ssw_align(query_profile_, ref, ref_len,
+                                 static_cast<int>(gap_opening_penalty_),
+				 static_cast<int>(gap_extending_penalty_),
+				 flag, filter.score_filter, filter.distance_filter, maskLen);
+
+  int query_len = translated_query_.size();
+  alignment->Clear();
+  ConvertAlignment(*s_al, query_len, alignment);
+  if (filter.report_cigar) {
+    alignment->mismatches = CalculateNumberMismatch(&*alignment, ref,
+                                                    &translated_query_[0], query_len);
+  }
+
+  align_destroy(s_al);
+  return true;
+}
+
 void Aligner::Clear(void) {
   ClearMatrices();
   CleanReferenceSequence();
+  CleanQuery();
 }
 
 void Aligner::SetAllDefault(void) {
@@ -9,6 +9,8 @@
 #include <string>
 #include <vector>
 
+struct _profile;
+
 namespace StripedSmithWaterman {
 
 struct Alignment {
@@ -156,6 +158,47 @@ class Aligner {
   bool Align(const char* query, const char* ref, const int& ref_len,
              const Filter& filter, Alignment* alignment, const int32_t maskLen) const;
 
+  // =========
+  // @function Build the query profile once, so that the same query can be
+  //             aligned against many references by AlignQuery.
+  //           [NOTICE] If there exists a query, it will be replaced.
+  // @param    query     The query sequence.
+  // @param    length    The length of the query.
+  // @return   True: succeed; false: fail.
+  // =========
+  bool SetQuery(const char* query, const int& length);
+
+  void CleanQuery(void);
+
+  // =========
+  // @function Align the query that is set by SetQuery against the reference.
+  //           Translation buffers are reused between calls. The number of
+  //           mismatches is only computed when filter.report_cigar is set.
+  // @param    ref       The reference sequence.
+  //                     [NOTICE] It is not necessary null terminated.
+  // @param    ref_len   The length of the reference sequence.
+  // @param    filter    The filter for the alignment.
+  // @param    alignment The container contains the result.
+  // @param    maskLen   See Align.
+  // @return   True: succeed; false: fail.
+  // =========
+  bool AlignQuery(const char* ref, const int& ref_len,
+                  const Filter& filter, Alignment* alignment, const int32_t maskLen);
+
+  // =========
+  // @function Same as AlignQuery, but the reference is already translated
+  //           to the numeric alphabet (A/C/G/T -> 0..3, others -> 4), so
+  //           references shared by many queries are translated only once.
+  // @param    ref       The translated reference sequence.
+  // @param    ref_len   The length of the reference sequence.
+  // @param    filter    The filter for the alignment.
+  // @param    alignment The container contains the result.
+  // @param    maskLen   See Align.
+  // @return   True: succeed; false: fail.
+  // =========
+  bool AlignQueryTranslated(const int8_t* ref, const int& ref_len,
+                            const Filter& filter, Alignment* alignment, const int32_t maskLen);
+
   // @function Clear up all containers and thus the aligner is disabled.
   //             To rebuild the aligner please use Build functions.
   void Clear(void);
@@ -202,6 +245,11 @@ class Aligner {
   int8_t* translated_reference_;
   int32_t reference_length_;
 
+  // Query profile built by SetQuery and buffers reused by AlignQuery
+  _profile* query_profile_;
+  std::vector<int8_t> translated_query_;
+  std::vector<int8_t> translated_ref_buffer_;
+
   int TranslateBase(const char* bases, const int& length, int8_t* translated) const;
   void SetAllDefault(void);
   void BuildDefaultMatrix(void);
@@ -0,0 +1,140 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <time.h>
+
+#include <iomanip>
+#include <sstream>
+
+#include "src/common.h"
+#include "src/stats.h"
+
+using namespace std;
+
+namespace {
+const char* TIMER_NAMES[NUM_STATS_TIMERS] = {
+  "total_sec", "flanks_sec", "extract_sec", "realign_sec", "rescue_sec",
+  "optimize_sec", "bootstrap_sec"
+};
+const char* COUNTER_NAMES[NUM_STATS_COUNTERS] = {
+  "reads_fetched", "bytes_decompressed", "reads_realigned", "ssw_calls",
+  "likelihood_evals", "nlopt_evals", "discrete_evals", "discrete_bound_evals",
+  "discrete_table_alleles", "rescues_attempted", "rescues_found", "bootstrap_replicates"
+};
+}  // namespace
+
+__thread LocusStats* LocusStats::current_ = NULL;
+
+LocusStats::LocusStats() {
+  Reset();
+}
+
+void LocusStats::Reset() {
+  for (int i = 0; i < NUM_STATS_TIMERS; i++) {
+    seconds[i] = 0;
+  }
+  for (int i = 0; i < NUM_STATS_COUNTERS; i++) {
+    counts[i] = 0;
+  }
+}
+
+void LocusStats::Add(const LocusStats& other) {
+  for (int i = 0; i < NUM_STATS_TIMERS; i++) {
+    seconds[i] += other.seconds[i];
+  }
+  for (int i = 0; i < NUM_STATS_COUNTERS; i++) {
+    counts[i] += other.counts[i];
+  }
+}
+
+double LocusStats::Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+StatsWriter::StatsWriter(const std::string& path) {
+  num_loci_ = 0;
+  num_genotyped_ = 0;
+  closed_ = false;
+  writer_.open(path.c_str());
+  if (!writer_.is_open()) {
+    PrintMessageDieOnError("Could not open stats file " + path, M_ERROR);
+  }
+  writer_ << "chrom\tstart\tend\tgenotyped";
+  for (int i = 0; i < NUM_STATS_TIMERS; i++) {
+    writer_ << "\t" << TIMER_NAMES[i];
+  }
+  for (int i = 0; i < NUM_STATS_COUNTERS; i++) {
+    writer_ << "\t" << COUNTER_NAMES[i];
+  }
+  writer_ << "\n";
+  writer_ << std::fixed << std::setprecision(6);
+}
+
+void StatsWriter::WriteLocus(const Locus& locus, const bool& genotyped, const LocusStats& stats) {
+  writer_ << locus.chrom << "\t" << locus.start << "\t" << locus.end << "\t"
+	  << (genotyped ? 1 : 0);
+  for (int i = 0; i < NUM_STATS_TIMERS; i++) {
+    writer_ << "\t" << stats.seconds[i];
+  }
+  for (int i = 0; i < NUM_STATS_COUNTERS; i++) {
+    writer_ << "\t" << stats.counts[i];
+  }
+  writer_ << "\n";
+  totals_.Add(stats);
+  num_loci_++;
+  if (genotyped) {
+    num_genotyped_++;
+  }
+}
+
+/*
+  Stage times are summed over loci, so with --threads they add up to
+  more than the wall time
+ */
+void StatsWriter::Close() {
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+  writer_.close();
+  stringstream ss;
+  ss << "Run summary: " << num_genotyped_ << " of " << num_loci_ << " loci genotyped";
+  PrintMessageDieOnError(ss.str(), M_PROGRESS);
+  for (int i = 0; i < NUM_STATS_TIMERS; i++) {
+    ss.str("");
+    ss << "\t" << TIMER_NAMES[i] << "\t" << std::fixed << std::setprecision(3) << totals_.seconds[i];
+    if (i != STATS_TOTAL_TIME && totals_.seconds[STATS_TOTAL_TIME] > 0) {
+      ss << " (" << std::setprecision(1)
+	 << 100.0 * totals_.seconds[i] / totals_.seconds[STATS_TOTAL_TIME] << "%)";
+    }
+    PrintMessageDieOnError(ss.str(), M_PROGRESS);
+  }
+  for (int i = 0; i < NUM_STATS_COUNTERS; i++) {
+    ss.str("");
+    ss << "\t" << COUNTER_NAMES[i] << "\t" << totals_.counts[i];
+    PrintMessageDieOnError(ss.str(), M_PROGRESS);
+  }
+}
+
+StatsWriter::~StatsWriter() {
+  Close();
+}
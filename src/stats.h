@@ -0,0 +1,173 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SRC_STATS_H__
+#define SRC_STATS_H__
+
+#include <stdint.h>
+
+#include <fstream>
+#include <string>
+
+#include "src/locus.h"
+
+// Timed stages. Total covers the whole locus; extraction includes
+// realignment and mate rescue
+enum StatsTimer {
+  STATS_TOTAL_TIME = 0,
+  STATS_FLANKS_TIME,
+  STATS_EXTRACT_TIME,
+  STATS_REALIGN_TIME,
+  STATS_RESCUE_TIME,
+  STATS_OPTIMIZE_TIME,
+  STATS_BOOTSTRAP_TIME,
+  NUM_STATS_TIMERS
+};
+
+enum StatsCounter {
+  STATS_READS_FETCHED = 0,
+  STATS_BYTES_DECOMPRESSED,
+  STATS_READS_REALIGNED,
+  STATS_SSW_CALLS,
+  STATS_LIKELIHOOD_EVALS,
+  STATS_NLOPT_EVALS,
+  STATS_DISCRETE_EVALS,
+  STATS_DISCRETE_BOUND_EVALS,
+  STATS_DISCRETE_TABLE_ALLELES,
+  STATS_RESCUES_ATTEMPTED,
+  STATS_RESCUES_FOUND,
+  STATS_BOOTSTRAP_REPLICATES,
+  NUM_STATS_COUNTERS
+};
+
+/*
+  Stage timers and counters of one locus. Each thread has a current
+  LocusStats (NULL unless --stats is on) that the STATS_* hooks below
+  add to, so the hooks need no locking. With stats off they cost one
+  thread-local load and return.
+ */
+class LocusStats {
+ public:
+  LocusStats();
+  void Reset();
+  void Add(const LocusStats& other);
+
+  // Stats of the calling thread, NULL if none
+  static LocusStats* Current() { return current_; }
+  static void SetCurrent(LocusStats* stats) { current_ = stats; }
+  // Monotonic clock, in seconds
+  static double Now();
+
+  double seconds[NUM_STATS_TIMERS];
+  int64_t counts[NUM_STATS_COUNTERS];
+
+ private:
+  // Thread-local like MARGIN in realignment.h, but one instance for
+  // the whole program
+  static __thread LocusStats* current_;
+};
+
+// Sets the calling thread's current stats while in scope
+class StatsScope {
+ public:
+  StatsScope(LocusStats* stats) : previous_(LocusStats::Current()) {
+    if (stats != previous_) {
+      LocusStats::SetCurrent(stats);
+    }
+  }
+  ~StatsScope() {
+    if (LocusStats::Current() != previous_) {
+      LocusStats::SetCurrent(previous_);
+    }
+  }
+ private:
+  LocusStats* previous_;
+};
+
+// Adds the time spent in scope to a stage of the current stats
+class ScopedStatsTimer {
+ public:
+  ScopedStatsTimer(const StatsTimer& timer) : stats_(LocusStats::Current()), timer_(timer) {
+    start_ = (stats_ == NULL ? 0 : LocusStats::Now());
+  }
+  ~ScopedStatsTimer() {
+    if (stats_ != NULL) {
+      stats_->seconds[timer_] += LocusStats::Now() - start_;
+    }
+  }
+ private:
+  LocusStats* stats_;
+  StatsTimer timer_;
+  double start_;
+};
+
+inline void StatsCount(const StatsCounter& counter, const int64_t& count) {
+  LocusStats* stats = LocusStats::Current();
+  if (stats != NULL) {
+    stats->counts[counter] += count;
+  }
+}
+
+inline void StatsAdd(const LocusStats& other) {
+  LocusStats* stats = LocusStats::Current();
+  if (stats != NULL) {
+    stats->Add(other);
+  }
+}
+
+// Hooks compile to nothing with ./configure --disable-stats
+#ifndef GANGSTR_NO_STATS
+#define STATS_SCOPE(stats) StatsScope stats_scope_(stats)
+#define STATS_TIMER(timer) ScopedStatsTimer stats_timer_(timer)
+#define STATS_COUNT(counter, count) StatsCount(counter, count)
+#define STATS_ADD(other) StatsAdd(other)
+#else
+#define STATS_SCOPE(stats)
+#define STATS_TIMER(timer)
+#define STATS_COUNT(counter, count)
+#define STATS_ADD(other)
+#endif
+
+/*
+  Writes one row of stats per locus to <outprefix>.stats.tsv and prints
+  a summary of the whole run when closed
+ */
+class StatsWriter {
+ public:
+  StatsWriter(const std::string& path);
+  virtual ~StatsWriter();
+
+  void WriteLocus(const Locus& locus, const bool& genotyped, const LocusStats& stats);
+  // Print the run summary and close the file
+  void Close();
+
+ private:
+  // Private unimplemented copy constructor and assignment operator to prevent operations
+  StatsWriter(const StatsWriter& other);
+  StatsWriter& operator=(const StatsWriter& other);
+
+  std::ofstream writer_;
+  LocusStats totals_;
+  int64_t num_loci_;
+  int64_t num_genotyped_;
+  bool closed_;
+};
+
+#endif  // SRC_STATS_H__
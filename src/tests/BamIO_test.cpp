@@ -0,0 +1,284 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "src/tests/BamIO_test.h"
+#include "src/locus.h"
+#include "src/region_reader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+// Registers the fixture into the 'registry'
+CPPUNIT_TEST_SUITE_REGISTRATION(BamIOTest);
+
+void BamIOTest::setUp() {
+  // This gets set during "make check"
+  // env variable set in ./src/Makefile.am
+  test_dir = getenv("GANGSTR_TEST_DIR");
+  bam_files.clear();
+  bam_files.push_back(test_dir + "/47_nc_70.sorted.bam");
+  bam_files.push_back(test_dir + "/53_nc_12.sorted.bam");
+  bam_files.push_back(test_dir + "/53_nc_80.sorted.bam");
+  bam_files.push_back(test_dir + "/54_nc_12.sorted.bam");
+  bam_files.push_back(test_dir + "/54_nc_40.sorted.bam");
+  bam_files.push_back(test_dir + "/test.sorted.bam");
+  bam_files.push_back(test_dir + "/test.spanning.bam");
+  bam_files.push_back(test_dir + "/test.enclosing.bam");
+  bam_files.push_back(test_dir + "/test.frr.bam");
+  bam_files.push_back(test_dir + "/test.discarded.bam");
+  bam_files.push_back(test_dir + "/test.spanning.single.bam");
+  bam_files.push_back(test_dir + "/test.enclosing.single.bam");
+  bam_files.push_back(test_dir + "/test.frr.single.bam");
+}
+
+void BamIOTest::tearDown() {}
+
+std::string BamIOTest::WriteLoci(const bool& sorted) {
+  const char* beds[] = {"ATXN7.bed", "HTT.bed", "ATXN3.bed", "CACNA1A.bed", "ATXN10.bed"};
+  std::string path = std::string(P_tmpdir) + (sorted ? "/gangstr_sorted.bed" : "/gangstr_unsorted.bed");
+  std::ofstream out(path.c_str());
+  for (size_t i = 0; i < sizeof(beds) / sizeof(beds[0]); i++) {
+    RegionReader region_reader(test_dir + "/" + beds[i]);
+    Locus locus;
+    CPPUNIT_ASSERT(region_reader.GetNextRegion(&locus));
+    // Neighbouring loci whose regions overlap, some by the same start
+    std::vector<int32_t> starts;
+    for (int32_t offset = -6000; offset <= 6000; offset += 250) {
+      starts.push_back(locus.start + offset);
+    }
+    starts.push_back(locus.start);
+    std::sort(starts.begin(), starts.end());
+    if (!sorted && i == 0) {
+      std::swap(starts[3], starts[10]);
+    }
+    for (size_t j = 0; j < starts.size(); j++) {
+      out << locus.chrom << "\t" << starts[j] << "\t" << starts[j] + locus.end - locus.start
+	  << "\t" << locus.period << "\t" << locus.motif << "\n";
+    }
+  }
+  out.close();
+  return path;
+}
+
+void BamIOTest::ReadRegion(BamCramMultiReader* reader, const bool& use_view,
+			   std::vector<std::string>* alignments) {
+  alignments->clear();
+  BamAlignment aln;
+  BamAlignmentView view;
+  while (use_view ? reader->GetNextAlignment(&view) : reader->GetNextAlignment(aln)) {
+    if (!use_view) {
+      view.Reset(aln);
+    }
+    std::stringstream ss;
+    ss << view.Name() << " " << view.Position() << " " << view.GetEndPosition()
+       << " " << view.Filename() << " " << view.QueryBases();
+    alignments->push_back(ss.str());
+  }
+}
+
+int32_t BamIOTest::CompareWindowRegions(const std::vector<std::string>& files,
+					const std::string& bed) {
+  BamCramMultiReader seek_reader(files);
+  BamCramMultiReader window_reader(files);
+  RegionReader region_reader(bed);
+  Locus locus;
+  std::vector<std::string> expected, found;
+  int32_t num_locus = 0, num_alignments = 0;
+  while (region_reader.GetNextRegion(&locus)) {
+    int32_t start = locus.start - options.regionsize;
+    int32_t end = locus.end + options.regionsize;
+    bool seek_set = seek_reader.SetRegion(locus.chrom, start, end);
+    CPPUNIT_ASSERT_EQUAL(seek_set, window_reader.SetWindowRegion(locus.chrom, start, end));
+    if (seek_set) {
+      ReadRegion(&seek_reader, false, &expected);
+      // Views point into the window, copies are taken from it
+      ReadRegion(&window_reader, num_locus % 2 == 0, &found);
+      CPPUNIT_ASSERT_MESSAGE(locus.chrom, expected == found);
+      num_alignments += (int32_t)found.size();
+      // Mate rescue seeks the same reader between windows
+      if (num_locus % 5 == 0) {
+	CPPUNIT_ASSERT(window_reader.SetRegion(locus.chrom, start / 2, start / 2 + 100));
+	ReadRegion(&window_reader, true, &found);
+      }
+    }
+    num_locus++;
+    locus.Reset();
+  }
+  return num_alignments;
+}
+
+void BamIOTest::test_AutoStreamRegions() {
+  RegionReader sorted_reader(WriteLoci(true));
+  RegionReader unsorted_reader(WriteLoci(false));
+  CPPUNIT_ASSERT(sorted_reader.IsSorted());
+  CPPUNIT_ASSERT(!unsorted_reader.IsSorted());
+
+  options.io_threads = 2;
+  options.num_threads = 1;
+  options.stream_regions = false;
+  CPPUNIT_ASSERT(sorted_reader.AutoStreamRegions(options));
+  CPPUNIT_ASSERT(!unsorted_reader.AutoStreamRegions(options));
+  options.num_threads = 2;
+  CPPUNIT_ASSERT(!sorted_reader.AutoStreamRegions(options));
+  options.num_threads = 1;
+  options.io_threads = 0;
+  CPPUNIT_ASSERT(!sorted_reader.AutoStreamRegions(options));
+  // Already on
+  options.io_threads = 2;
+  options.stream_regions = true;
+  CPPUNIT_ASSERT(!sorted_reader.AutoStreamRegions(options));
+}
+
+void BamIOTest::test_WindowRegion() {
+  // Loci the condition above streams: the window serves them the same
+  // alignments as seeking to each region
+  std::string bed = WriteLoci(true);
+  options.io_threads = 2;
+  options.num_threads = 1;
+  options.stream_regions = false;
+  RegionReader region_reader(bed);
+  CPPUNIT_ASSERT(region_reader.AutoStreamRegions(options));
+
+  int32_t num_alignments = 0;
+  for (size_t i = 0; i < bam_files.size(); i++) {
+    num_alignments += CompareWindowRegions(std::vector<std::string>(1, bam_files[i]), bed);
+  }
+  // Files merged by position, as for the read extraction tests
+  std::vector<std::string> files;
+  files.push_back(test_dir + "/test.spanning.bam");
+  files.push_back(test_dir + "/test.enclosing.bam");
+  files.push_back(test_dir + "/test.frr.bam");
+  num_alignments += CompareWindowRegions(files, bed);
+  CPPUNIT_ASSERT(num_alignments > 0);
+
+  // Regions out of order restart the window
+  num_alignments = 0;
+  for (size_t i = 0; i < bam_files.size(); i++) {
+    num_alignments += CompareWindowRegions(std::vector<std::string>(1, bam_files[i]),
+					   WriteLoci(false));
+  }
+  CPPUNIT_ASSERT(num_alignments > 0);
+}
+
+std::string BamIOTest::WriteCram(const std::string& bam, const std::string& fasta) {
+  std::string base = bam.substr(bam.rfind('/') + 1);
+  std::string path = std::string(P_tmpdir) + "/gangstr_" + base.substr(0, base.size() - 4) + ".cram";
+  samFile* in = sam_open(bam.c_str(), "r");
+  CPPUNIT_ASSERT(in != NULL);
+  bam_hdr_t* header = sam_hdr_read(in);
+  CPPUNIT_ASSERT(header != NULL);
+  samFile* out = sam_open(path.c_str(), "wc");
+  CPPUNIT_ASSERT(out != NULL);
+  CPPUNIT_ASSERT_EQUAL(0, hts_set_fai_filename(out, fasta.c_str()));
+  CPPUNIT_ASSERT_EQUAL(0, sam_hdr_write(out, header));
+  bam1_t* b = bam_init1();
+  int32_t num_reads = 0;
+  while (sam_read1(in, header, b) >= 0) {
+    CPPUNIT_ASSERT(sam_write1(out, header, b) >= 0);
+    num_reads++;
+  }
+  CPPUNIT_ASSERT(num_reads > 0);
+  bam_destroy1(b);
+  bam_hdr_destroy(header);
+  CPPUNIT_ASSERT_EQUAL(0, sam_close(out));
+  sam_close(in);
+  CPPUNIT_ASSERT_EQUAL(0, sam_index_build(path.c_str(), 0));
+  return path;
+}
+
+void BamIOTest::ReadFields(BamCramMultiReader* reader, std::vector<std::string>* alignments) {
+  alignments->clear();
+  BamAlignmentView view;
+  while (reader->GetNextAlignment(&view)) {
+    std::stringstream ss;
+    ss << view.Name() << " " << view.RefID() << " " << view.Position() << " "
+       << view.GetEndPosition() << " " << view.MapQuality() << " "
+       << view.MateRefID() << " " << view.MatePosition() << " " << view.TemplateLength() << " "
+       << view.IsMapped() << view.IsMateMapped() << view.IsReverseStrand()
+       << view.IsFirstMate() << view.IsSecondary() << view.IsSupplementary() << " "
+       << view.StartsWithSoftClip() << view.EndsWithSoftClip() << " "
+       << view.QueryBases() << " " << view.Qualities();
+    alignments->push_back(ss.str());
+  }
+}
+
+void BamIOTest::test_CramInput() {
+  // The CACNA1A test BAMs are aligned to the 5 kb region FASTA
+  const std::string fasta = test_dir + "/CACNA1A_5k_region.fa";
+  const char* bam_names[] = {"54_nc_12.sorted.bam", "54_nc_40.sorted.bam"};
+  std::vector<std::string> bams, crams;
+  for (size_t i = 0; i < sizeof(bam_names) / sizeof(bam_names[0]); i++) {
+    bams.push_back(test_dir + "/" + bam_names[i]);
+    crams.push_back(WriteCram(bams.back(), fasta));
+  }
+  // One file at a time and merged, over the whole region and windows of it
+  for (size_t num_files = 1; num_files <= bams.size(); num_files++) {
+    std::vector<std::string> bam_files(bams.begin(), bams.begin() + num_files);
+    std::vector<std::string> cram_files(crams.begin(), crams.begin() + num_files);
+    BamCramMultiReader bam_reader(bam_files);
+    BamCramMultiReader cram_reader(cram_files, fasta);
+    std::vector<std::string> expected, found;
+    int32_t num_alignments = 0;
+    for (int32_t start = 0; start < 10038; start += 750) {
+      int32_t end = (start == 0 ? 10038 : start + 1000);
+      CPPUNIT_ASSERT(bam_reader.SetRegion("19", start, end));
+      CPPUNIT_ASSERT(cram_reader.SetRegion("19", start, end));
+      ReadFields(&bam_reader, &expected);
+      ReadFields(&cram_reader, &found);
+      CPPUNIT_ASSERT_EQUAL(expected.size(), found.size());
+      for (size_t i = 0; i < expected.size(); i++) {
+	CPPUNIT_ASSERT_EQUAL(expected[i], found[i]);
+      }
+      num_alignments += (int32_t)found.size();
+    }
+    CPPUNIT_ASSERT(num_alignments > 0);
+
+    // Consecutive sliding windows, with seeks of the main handle in
+    // between as mate rescue does
+    int32_t num_window_alignments = 0;
+    for (int32_t start = 0; start < 10038; start += 400) {
+      int32_t end = start + 600;
+      CPPUNIT_ASSERT(bam_reader.SetWindowRegion("19", start, end));
+      CPPUNIT_ASSERT(cram_reader.SetWindowRegion("19", start, end));
+      ReadFields(&bam_reader, &expected);
+      ReadFields(&cram_reader, &found);
+      CPPUNIT_ASSERT_EQUAL(expected.size(), found.size());
+      for (size_t i = 0; i < expected.size(); i++) {
+	CPPUNIT_ASSERT_EQUAL(expected[i], found[i]);
+      }
+      num_window_alignments += (int32_t)found.size();
+      if (start % 1200 == 0) {
+	CPPUNIT_ASSERT(bam_reader.SetRegion("19", start / 2, start / 2 + 100));
+	CPPUNIT_ASSERT(cram_reader.SetRegion("19", start / 2, start / 2 + 100));
+	ReadFields(&bam_reader, &expected);
+	ReadFields(&cram_reader, &found);
+	CPPUNIT_ASSERT(expected == found);
+      }
+    }
+    CPPUNIT_ASSERT(num_window_alignments > 0);
+  }
+  for (size_t i = 0; i < crams.size(); i++) {
+    remove(crams[i].c_str());
+    remove((crams[i] + ".crai").c_str());
+  }
+}
@@ -0,0 +1,67 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SRC_TESTS_BAMIO_H__
+#define SRC_TESTS_BAMIO_H__
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "src/bam_io.h"
+#include "src/options.h"
+
+#include <string>
+#include <vector>
+
+class BamIOTest: public CppUnit::TestFixture {
+  CPPUNIT_TEST_SUITE(BamIOTest);
+  CPPUNIT_TEST(test_AutoStreamRegions);
+  CPPUNIT_TEST(test_WindowRegion);
+  CPPUNIT_TEST(test_CramInput);
+  CPPUNIT_TEST_SUITE_END();
+
+ public:
+  void setUp();
+  void tearDown();
+ private:
+  void test_AutoStreamRegions();
+  void test_WindowRegion();
+  // Write a BED file of loci stepping across each test locus. Loci of a
+  // chromosome are in start order unless sorted is false
+  std::string WriteLoci(const bool& sorted);
+  // Alignments of the current region as "name pos end file", read either
+  // through views or through copies
+  void ReadRegion(BamCramMultiReader* reader, const bool& use_view,
+		  std::vector<std::string>* alignments);
+  // Same alignments from SetRegion and SetWindowRegion for every region
+  // of bed, returns the number of alignments compared
+  int32_t CompareWindowRegions(const std::vector<std::string>& files, const std::string& bed);
+  void test_CramInput();
+  // Convert a test BAM to an indexed CRAM against fasta, returns its path.
+  // There is no CRAM test data in the tree, so tests write their own
+  std::string WriteCram(const std::string& bam, const std::string& fasta);
+  // Fields GangSTR decodes from every alignment of the current region, as
+  // one string per alignment without the file name
+  void ReadFields(BamCramMultiReader* reader, std::vector<std::string>* alignments);
+  std::string test_dir;
+  std::vector<std::string> bam_files;
+  Options options;
+};
+
+#endif //  SRC_TESTS_BAMIO_H_
@@ -20,6 +20,9 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "src/tests/Genotyper_test.h"
 #include "src/bam_io.h"
+#include "src/ref_genome.h"
+
+#include <set>
 
 // Registers the fixture into the 'registry'
 CPPUNIT_TEST_SUITE_REGISTRATION(GenotyperTest);
@@ -98,3 +101,24 @@ void GenotyperTest::test_ProcessLocus() {
   CPPUNIT_ASSERT_EQUAL(genotyper.ProcessLocus(bamreader, &locus), true);
   */
 }
+
+void GenotyperTest::test_PackedReference() {
+  std::string fastafile = test_dir + "/test.fa";
+  RefGenome refgenome(fastafile);
+  PackedReference packed_ref;
+  std::set<std::string> chroms;
+  chroms.insert("3");
+  CPPUNIT_ASSERT_EQUAL(packed_ref.Load(fastafile, chroms), true);
+  CPPUNIT_ASSERT_EQUAL(packed_ref.HasChrom("3"), true);
+  CPPUNIT_ASSERT_EQUAL(packed_ref.HasChrom("19"), false);
+  RefGenome packed_genome(fastafile, &packed_ref);
+  // Includes ranges clamped at the chromosome ends
+  int32_t starts[] = {-10, 0, 1, 101, 201, 230, 5000};
+  int32_t ends[] = {5, 99, 1, 200, 329, 330, 5200};
+  for (size_t i = 0; i < sizeof(starts) / sizeof(starts[0]); i++) {
+    std::string expected, seq;
+    refgenome.GetSequence("3", starts[i], ends[i], &expected);
+    CPPUNIT_ASSERT_EQUAL(packed_genome.GetSequence("3", starts[i], ends[i], &seq), true);
+    CPPUNIT_ASSERT_EQUAL(expected, seq);
+  }
+}
@@ -31,6 +31,7 @@ class GenotyperTest: public CppUnit::TestFixture {
   CPPUNIT_TEST_SUITE(GenotyperTest);
   CPPUNIT_TEST(test_SetFlanks);
   CPPUNIT_TEST(test_ProcessLocus);
+  CPPUNIT_TEST(test_PackedReference);
   CPPUNIT_TEST_SUITE_END();
 
  public:
@@ -39,6 +40,7 @@ class GenotyperTest: public CppUnit::TestFixture {
  private:
   void test_SetFlanks();
   void test_ProcessLocus();
+  void test_PackedReference();
   Locus locus;
   std::string test_dir;
 };
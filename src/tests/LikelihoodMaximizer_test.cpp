@@ -21,6 +21,8 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 #include "src/tests/LikelihoodMaximizer_test.h"
 
 #include "src/bam_io.h"
+#include "src/mathops.h"
+#include "src/stats.h"
 #include <math.h>
 
 #include <iostream>
@@ -206,4 +208,387 @@ void LikelihoodMaximizerTest::test_OptimizeLikelihood() {
   //CPPUNIT_ASSERT_EQUAL(roundf(min_negLike * 100)/100, roundf(1725.53*100)/100); 
 }
 
+void LikelihoodMaximizerTest::test_GenotypeCache() {
+  // Cached genotype likelihoods must match uncached ones for the original
+  // and the resampled reads, and must not carry over to the next locus
+  int64_t hits, misses;
+  for (int l = 0; l < 2; l++) {
+    likelihood_maximizer_->Reset();
+    likelihood_maximizer_->GetGenotypeCacheStats(&hits, &misses);
+    CPPUNIT_ASSERT_EQUAL(hits + misses, (int64_t) 0);
+    if (l == 0) {
+      for (int i = 0; i < 5; i++) {
+	likelihood_maximizer_->AddEnclosingData(10);
+	likelihood_maximizer_->AddEnclosingData(14);
+      }
+      likelihood_maximizer_->AddSpanningData(380);
+      likelihood_maximizer_->AddFlankingData(8);
+    } else {
+      likelihood_maximizer_->AddEnclosingData(20);
+      likelihood_maximizer_->AddEnclosingData(22);
+      likelihood_maximizer_->AddSpanningData(350);
+      likelihood_maximizer_->AddSpanningData(360);
+      likelihood_maximizer_->AddFRRData(30);
+      likelihood_maximizer_->AddFRRData(40);
+    }
+    for (int r = 0; r < 3; r++) {
+      bool resampled_reads = (r > 0);
+      if (resampled_reads) {
+	likelihood_maximizer_->ResampleReadPool();
+      }
+      for (int32_t allele1 = 5; allele1 <= 50; allele1 += 5) {
+	for (int32_t allele2 = 5; allele2 <= 50; allele2 += 5) {
+	  double cached, uncached;
+	  CPPUNIT_ASSERT(likelihood_maximizer_->GetCachedGenotypeNegLogLikelihood(allele1, allele2,
+										  read_len, motif_len, ref_count,
+										  resampled_reads, &cached));
+	  CPPUNIT_ASSERT(likelihood_maximizer_->GetGenotypeNegLogLikelihood(allele1, allele2,
+									    read_len, motif_len, ref_count,
+									    resampled_reads, &uncached));
+	  CPPUNIT_ASSERT_DOUBLES_EQUAL(uncached, cached, 1e-9);
+	}
+      }
+    }
+    // <a, b> and <b, a> share an entry
+    likelihood_maximizer_->GetGenotypeCacheStats(&hits, &misses);
+    CPPUNIT_ASSERT_EQUAL(misses, (int64_t) 3 * 55);
+    CPPUNIT_ASSERT_EQUAL(hits, (int64_t) 3 * 45);
+  }
+}
+
+void LikelihoodMaximizerTest::test_DiscreteOptimize() {
+  // --optimizer discrete must return the brute force optimum, ties going
+  // to the smaller allele. Brute force covers [1, 150], so it also checks
+  // that no better genotype lies outside the search window
+  options.optimizer = "discrete";
+  options.coverage = 30;
+  const int32_t max_allele = 150;
+  for (int l = 0; l < 4; l++) {
+    LikelihoodMaximizer lm(options);
+    lm.Reset();
+    if (l == 0) {
+      // Heterozygous, enclosed
+      for (int i = 0; i < 5; i++) {
+	lm.AddEnclosingData(10);
+	lm.AddEnclosingData(14);
+      }
+      lm.AddSpanningData(390);
+    } else if (l == 1) {
+      // Homozygous with stutter
+      for (int i = 0; i < 6; i++) {
+	lm.AddEnclosingData(12);
+      }
+      lm.AddEnclosingData(11);
+      lm.AddEnclosingData(13);
+    } else if (l == 2) {
+      // Short allele and an allele longer than a read
+      for (int i = 0; i < 5; i++) {
+	lm.AddEnclosingData(12);
+	lm.AddFlankingData(20 + 2 * i);
+	lm.AddFRRData(10 * i);
+      }
+      lm.AddSpanningData(390);
+    } else {
+      // Only spanning reads
+      lm.AddSpanningData(320);
+      lm.AddSpanningData(340);
+      lm.AddSpanningData(330);
+    }
+    int32_t lower, upper;
+    lm.GetDiscreteSearchWindow(read_len, motif_len, ref_count, 1, max_allele, &lower, &upper);
+    CPPUNIT_ASSERT(lower >= 1 && lower <= upper && upper <= max_allele);
+
+    // Diploid
+    int32_t allele1, allele2;
+    double min_negLike;
+    lm.OptimizeLikelihood(read_len, motif_len, ref_count, false, 2, 0, 0.0,
+			  &allele1, &allele2, &min_negLike);
+    double best = 0, gt_ll;
+    int32_t best1 = -1, best2 = -1, window_best1 = -1, window_best2 = -1;
+    double window_best = 0;
+    for (int32_t a = 1; a <= max_allele; a++) {
+      for (int32_t b = a; b <= max_allele; b++) {
+	lm.GetGenotypeNegLogLikelihood(a, b, read_len, motif_len, ref_count, false, &gt_ll);
+	if (best1 < 0 || gt_ll < best) {
+	  best = gt_ll;
+	  best1 = a;
+	  best2 = b;
+	}
+	if (a >= lower && b <= upper && (window_best1 < 0 || gt_ll < window_best)) {
+	  window_best = gt_ll;
+	  window_best1 = a;
+	  window_best2 = b;
+	}
+      }
+    }
+    CPPUNIT_ASSERT_EQUAL(window_best1, allele1);
+    CPPUNIT_ASSERT_EQUAL(window_best2, allele2);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(window_best, min_negLike, 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(best, min_negLike, 1e-9);
+
+    // One allele fixed, as in bootstrap replicates
+    int32_t fix_allele = allele2;
+    lm.OptimizeLikelihood(read_len, motif_len, ref_count, false, 1, fix_allele, 0.0,
+			  &allele1, &allele2, &min_negLike);
+    best1 = -1;
+    for (int32_t a = lower; a <= upper; a++) {
+      lm.GetGenotypeNegLogLikelihood(a, fix_allele, read_len, motif_len, ref_count, false, &gt_ll);
+      if (best1 < 0 || gt_ll < best) {
+	best = gt_ll;
+	best1 = a;
+      }
+    }
+    CPPUNIT_ASSERT_EQUAL(std::min(best1, fix_allele), allele1);
+    CPPUNIT_ASSERT_EQUAL(std::max(best1, fix_allele), allele2);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(best, min_negLike, 1e-9);
+  }
+}
+
+void LikelihoodMaximizerTest::test_DiscreteBounds() {
+  // The slack covers the error of fast_log_sum_exp, which only depends
+  // on the difference of its arguments
+  for (double diff = 0; diff >= -40; diff -= 0.0001) {
+    double exact = log(0.5) + log1p(exp(diff));
+    CPPUNIT_ASSERT(fast_log_sum_exp(log(0.5), log(0.5) + diff) - exact <= DISCRETE_LSE_SLACK);
+  }
+
+  options.optimizer = "discrete";
+  options.coverage = 30;
+  LikelihoodMaximizer lm(options);
+  lm.Reset();
+  for (int i = 0; i < 5; i++) {
+    lm.AddEnclosingData(12);
+    lm.AddFlankingData(20 + 2 * i);
+    lm.AddFRRData(10 * i);
+  }
+  lm.AddSpanningData(390);
+  int32_t lower, upper;
+  lm.GetDiscreteSearchWindow(read_len, motif_len, ref_count, 1, OPTIMIZER_UPPER_BOUND,
+			     &lower, &upper);
+  int32_t width = upper - lower + 1;
+  const discrete_bounds* bounds = lm.GetDiscreteBounds(read_len, motif_len, ref_count,
+						       lower, upper);
+  CPPUNIT_ASSERT(bounds == lm.GetDiscreteBounds(read_len, motif_len, ref_count, lower, upper));
+  CPPUNIT_ASSERT(bounds->num_leaves >= width && bounds->num_leaves < 2 * width);
+
+  // Bounds of node pairs of the top levels are at most the likelihood of
+  // every genotype of the pair
+  for (int32_t node1 = 1; node1 < 16 && node1 < bounds->num_leaves; node1++) {
+    for (int32_t node2 = node1; node2 < 2 * node1 && node2 < bounds->num_leaves; node2++) {
+      if (bounds->node_lo[node2] > upper) {
+	continue;
+      }
+      double bound;
+      CPPUNIT_ASSERT(lm.GetGenotypeNegLogLikelihoodBound(*bounds,
+			&bounds->max_ll[node1 * bounds->num_rows],
+			bounds->node_lo[node1], bounds->node_hi[node1],
+			&bounds->max_ll[node2 * bounds->num_rows],
+			bounds->node_lo[node2], bounds->node_hi[node2], false, &bound));
+      for (int32_t a = bounds->node_lo[node1]; a <= bounds->node_hi[node1]; a++) {
+	for (int32_t b = bounds->node_lo[node2]; b <= bounds->node_hi[node2]; b++) {
+	  double gt_ll;
+	  lm.GetGenotypeNegLogLikelihood(a, b, read_len, motif_len, ref_count, false, &gt_ll);
+	  CPPUNIT_ASSERT(bound <= gt_ll);
+	}
+      }
+    }
+  }
+
+  // The search scores a small part of the window, and gives the same
+  // confidence intervals with shared tables in bootstrap threads
+  options.num_boot_samp = 20;
+  double lob1[2], hib1[2], lob2[2], hib2[2];
+  for (int i = 0; i < 2; i++) {
+    options.num_boot_threads = (i == 0) ? 1 : 3;
+    LocusStats stats;
+    STATS_SCOPE(&stats);
+    LikelihoodMaximizer boot_lm(options);
+    boot_lm.Reset();
+    for (int j = 0; j < 5; j++) {
+      boot_lm.AddEnclosingData(12);
+      boot_lm.AddFlankingData(20 + 2 * j);
+      boot_lm.AddFRRData(10 * j);
+    }
+    boot_lm.AddSpanningData(390);
+    int32_t allele1, allele2, num_replicates;
+    double min_negLike;
+    CPPUNIT_ASSERT(boot_lm.OptimizeLikelihood(read_len, motif_len, ref_count, false, 2, 0, 0.0,
+					      &allele1, &allele2, &min_negLike));
+    CPPUNIT_ASSERT(stats.counts[STATS_DISCRETE_EVALS] > 0);
+    CPPUNIT_ASSERT(4 * stats.counts[STATS_DISCRETE_EVALS] < width * (width + 1) / 2);
+    CPPUNIT_ASSERT_EQUAL((int64_t)width, stats.counts[STATS_DISCRETE_TABLE_ALLELES]);
+    CPPUNIT_ASSERT(boot_lm.GetConfidenceInterval(read_len, motif_len, ref_count, allele1, allele2,
+						 locus, &lob1[i], &hib1[i], &lob2[i], &hib2[i],
+						 &num_replicates));
+    // Replicates reuse the table of the locus
+    CPPUNIT_ASSERT_EQUAL((int64_t)width, stats.counts[STATS_DISCRETE_TABLE_ALLELES]);
+  }
+  CPPUNIT_ASSERT_EQUAL(lob1[0], lob1[1]);
+  CPPUNIT_ASSERT_EQUAL(hib1[0], hib1[1]);
+  CPPUNIT_ASSERT_EQUAL(lob2[0], lob2[1]);
+  CPPUNIT_ASSERT_EQUAL(hib2[0], hib2[1]);
+}
 
+void LikelihoodMaximizerTest::test_GetConfidenceIntervalThreads() {
+  // Bootstrap CIs must not depend on the number of bootstrap threads
+  options.num_boot_samp = 20;
+  double lob1[2], hib1[2], lob2[2], hib2[2];
+  int32_t num_replicates;
+  for (int i = 0; i < 2; i++) {
+    options.num_boot_threads = (i == 0) ? 1 : 3;
+    LikelihoodMaximizer lm(options);
+    lm.Reset();
+    for (int j = 0; j < 5; j++) {
+      lm.AddEnclosingData(10);
+      lm.AddEnclosingData(14);
+    }
+    lm.AddSpanningData(380);
+    int32_t allele1, allele2;
+    double min_negLike;
+    lm.OptimizeLikelihood(read_len, motif_len, ref_count, false, 2, 0, 0.0,
+			  &allele1, &allele2, &min_negLike);
+    if (!lm.GetConfidenceInterval(read_len, motif_len, ref_count, allele1, allele2,
+				  locus, &lob1[i], &hib1[i], &lob2[i], &hib2[i], &num_replicates)) {
+      CPPUNIT_FAIL( "Running GetConfidenceInterval failed." );
+    }
+    CPPUNIT_ASSERT_EQUAL(num_replicates, 21);
+  }
+  CPPUNIT_ASSERT_EQUAL(lob1[0], lob1[1]);
+  CPPUNIT_ASSERT_EQUAL(hib1[0], hib1[1]);
+  CPPUNIT_ASSERT_EQUAL(lob2[0], lob2[1]);
+  CPPUNIT_ASSERT_EQUAL(hib2[0], hib2[1]);
+}
+
+void LikelihoodMaximizerTest::test_GetConfidenceIntervalAdaptive() {
+  // An adaptive run that stops after n replicates gives the CIs of a
+  // fixed run of n replicates, and stops early on well supported loci
+  double lob1[2], hib1[2], lob2[2], hib2[2];
+  int32_t num_replicates[2];
+  for (int i = 0; i < 2; i++) {
+    options.adaptive_boot = (i == 0);
+    options.boot_batch = 10;
+    options.num_boot_samp = (i == 0) ? 200 : num_replicates[0] - 1;
+    options.num_boot_threads = (i == 0) ? 3 : 1;
+    LikelihoodMaximizer lm(options);
+    lm.Reset();
+    for (int j = 0; j < 20; j++) {
+      lm.AddEnclosingData(10);
+      lm.AddEnclosingData(14);
+    }
+    int32_t allele1, allele2;
+    double min_negLike;
+    lm.OptimizeLikelihood(read_len, motif_len, ref_count, false, 2, 0, 0.0,
+			  &allele1, &allele2, &min_negLike);
+    if (!lm.GetConfidenceInterval(read_len, motif_len, ref_count, allele1, allele2,
+				  locus, &lob1[i], &hib1[i], &lob2[i], &hib2[i],
+				  &num_replicates[i])) {
+      CPPUNIT_FAIL( "Running GetConfidenceInterval failed." );
+    }
+  }
+  CPPUNIT_ASSERT(num_replicates[0] >= (BOOT_STABLE_BATCHES + 1) * 10);
+  CPPUNIT_ASSERT(num_replicates[0] < 201);
+  CPPUNIT_ASSERT_EQUAL(num_replicates[0], num_replicates[1]);
+  CPPUNIT_ASSERT_EQUAL(lob1[0], lob1[1]);
+  CPPUNIT_ASSERT_EQUAL(hib1[0], hib1[1]);
+  CPPUNIT_ASSERT_EQUAL(lob2[0], lob2[1]);
+  CPPUNIT_ASSERT_EQUAL(hib2[0], hib2[1]);
+}
+
+void LikelihoodMaximizerTest::test_ScreenGenotype() {
+  int32_t allele1, allele2;
+  // Heterozygous, with one stutter read and consistent spanning reads
+  likelihood_maximizer_->Reset();
+  for (int i = 0; i < 6; i++) {
+    likelihood_maximizer_->AddEnclosingData(10);
+    likelihood_maximizer_->AddEnclosingData(14);
+  }
+  likelihood_maximizer_->AddEnclosingData(11);
+  likelihood_maximizer_->AddSpanningData(390);
+  likelihood_maximizer_->AddSpanningData(398);
+  CPPUNIT_ASSERT_EQUAL(likelihood_maximizer_->ScreenGenotype(motif_len, ref_count, 2,
+							     &allele1, &allele2), true);
+  CPPUNIT_ASSERT_EQUAL(allele1, 10);
+  CPPUNIT_ASSERT_EQUAL(allele2, 14);
+  // An FRR means an allele longer than the reads
+  likelihood_maximizer_->AddFRRData(5);
+  CPPUNIT_ASSERT_EQUAL(likelihood_maximizer_->ScreenGenotype(motif_len, ref_count, 2,
+							     &allele1, &allele2), false);
+
+  // Homozygous
+  likelihood_maximizer_->Reset();
+  for (int i = 0; i < 12; i++) {
+    likelihood_maximizer_->AddEnclosingData(10);
+  }
+  likelihood_maximizer_->AddEnclosingData(9);
+  CPPUNIT_ASSERT_EQUAL(likelihood_maximizer_->ScreenGenotype(motif_len, ref_count, 2,
+							     &allele1, &allele2), true);
+  CPPUNIT_ASSERT_EQUAL(allele1, 10);
+  CPPUNIT_ASSERT_EQUAL(allele2, 10);
+  // A flanking read longer than both calls
+  likelihood_maximizer_->AddFlankingData(20);
+  CPPUNIT_ASSERT_EQUAL(likelihood_maximizer_->ScreenGenotype(motif_len, ref_count, 2,
+							     &allele1, &allele2), false);
+
+  // Third allele
+  likelihood_maximizer_->Reset();
+  for (int i = 0; i < 5; i++) {
+    likelihood_maximizer_->AddEnclosingData(10);
+    likelihood_maximizer_->AddEnclosingData(14);
+    likelihood_maximizer_->AddEnclosingData(20);
+  }
+  CPPUNIT_ASSERT_EQUAL(likelihood_maximizer_->ScreenGenotype(motif_len, ref_count, 2,
+							     &allele1, &allele2), false);
+
+  // Too few enclosing reads
+  likelihood_maximizer_->Reset();
+  for (int i = 0; i < 5; i++) {
+    likelihood_maximizer_->AddEnclosingData(10);
+  }
+  CPPUNIT_ASSERT_EQUAL(likelihood_maximizer_->ScreenGenotype(motif_len, ref_count, 2,
+							     &allele1, &allele2), false);
+}
+
+void LikelihoodMaximizerTest::test_LocusStats() {
+  // Counts of one locus are the same whether its bootstrap replicates
+  // run in one thread or are added up from several
+  options.num_boot_samp = 20;
+  LocusStats stats[2];
+  for (int i = 0; i < 2; i++) {
+    options.num_boot_threads = (i == 0) ? 1 : 3;
+    CPPUNIT_ASSERT(LocusStats::Current() == NULL);
+    STATS_SCOPE(&stats[i]);
+    CPPUNIT_ASSERT(LocusStats::Current() == &stats[i]);
+    LikelihoodMaximizer lm(options);
+    lm.Reset();
+    for (int j = 0; j < 5; j++) {
+      lm.AddEnclosingData(10);
+      lm.AddEnclosingData(14);
+    }
+    lm.AddSpanningData(380);
+    int32_t allele1, allele2, num_replicates;
+    double min_negLike, lob1, hib1, lob2, hib2;
+    CPPUNIT_ASSERT(lm.OptimizeLikelihood(read_len, motif_len, ref_count, false, 2, 0, 0.0,
+					 &allele1, &allele2, &min_negLike));
+    int64_t optimize_evals = stats[i].counts[STATS_LIKELIHOOD_EVALS];
+    CPPUNIT_ASSERT(optimize_evals > 0);
+    CPPUNIT_ASSERT_EQUAL((int64_t)0, stats[i].counts[STATS_BOOTSTRAP_REPLICATES]);
+    CPPUNIT_ASSERT(lm.GetConfidenceInterval(read_len, motif_len, ref_count, allele1, allele2,
+					    locus, &lob1, &hib1, &lob2, &hib2, &num_replicates));
+    CPPUNIT_ASSERT_EQUAL((int64_t)num_replicates, stats[i].counts[STATS_BOOTSTRAP_REPLICATES]);
+    // Each replicate optimizes again
+    CPPUNIT_ASSERT(stats[i].counts[STATS_LIKELIHOOD_EVALS] > optimize_evals);
+  }
+  CPPUNIT_ASSERT(LocusStats::Current() == NULL);
+  for (int c = 0; c < NUM_STATS_COUNTERS; c++) {
+    CPPUNIT_ASSERT_EQUAL(stats[0].counts[c], stats[1].counts[c]);
+  }
+  // Nothing is counted without a current LocusStats
+  LocusStats total;
+  total.Add(stats[0]);
+  STATS_COUNT(STATS_LIKELIHOOD_EVALS, 1);
+  STATS_ADD(stats[1]);
+  CPPUNIT_ASSERT_EQUAL(stats[0].counts[STATS_LIKELIHOOD_EVALS], total.counts[STATS_LIKELIHOOD_EVALS]);
+  total.Add(stats[1]);
+  CPPUNIT_ASSERT_EQUAL(2 * stats[0].counts[STATS_BOOTSTRAP_REPLICATES],
+		       total.counts[STATS_BOOTSTRAP_REPLICATES]);
+}
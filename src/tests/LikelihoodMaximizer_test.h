@@ -37,7 +37,14 @@ class LikelihoodMaximizerTest: public CppUnit::TestFixture {
   CPPUNIT_TEST(test_AddSpanningData);
   CPPUNIT_TEST(test_AddFRRData);
   CPPUNIT_TEST(test_GetGenotypeNegLogLikelihood);
+  CPPUNIT_TEST(test_GenotypeCache);
   CPPUNIT_TEST(test_OptimizeLikelihood);
+  CPPUNIT_TEST(test_DiscreteOptimize);
+  CPPUNIT_TEST(test_DiscreteBounds);
+  CPPUNIT_TEST(test_GetConfidenceIntervalThreads);
+  CPPUNIT_TEST(test_GetConfidenceIntervalAdaptive);
+  CPPUNIT_TEST(test_ScreenGenotype);
+  CPPUNIT_TEST(test_LocusStats);
   CPPUNIT_TEST_SUITE_END();
 
  public:
@@ -48,7 +55,14 @@ class LikelihoodMaximizerTest: public CppUnit::TestFixture {
   void test_AddSpanningData();
   void test_AddFRRData();
   void test_GetGenotypeNegLogLikelihood();
+  void test_GenotypeCache();
   void test_OptimizeLikelihood();
+  void test_DiscreteOptimize();
+  void test_DiscreteBounds();
+  void test_GetConfidenceIntervalThreads();
+  void test_GetConfidenceIntervalAdaptive();
+  void test_ScreenGenotype();
+  void test_LocusStats();
 
  private:
   LikelihoodMaximizer* likelihood_maximizer_;
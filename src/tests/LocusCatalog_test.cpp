@@ -0,0 +1,218 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "src/tests/LocusCatalog_test.h"
+#include "src/ref_genome.h"
+#include "src/region_reader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+// Registers the fixture into the 'registry'
+CPPUNIT_TEST_SUITE_REGISTRATION(LocusCatalogTest);
+
+void LocusCatalogTest::setUp() {
+  // This gets set during "make check"
+  // env variable set in ./src/Makefile.am
+  test_dir = getenv("GANGSTR_TEST_DIR");
+  reffa = test_dir + "/test.fa";
+  bed_path = std::string(P_tmpdir) + "/gangstr_catalog.bed";
+  catalog_path = std::string(P_tmpdir) + "/gangstr_catalog.bin";
+}
+
+void LocusCatalogTest::tearDown() {
+  remove(bed_path.c_str());
+  remove(catalog_path.c_str());
+}
+
+std::string LocusCatalogTest::WriteLoci(const int32_t& num_loci) {
+  const char* motifs[] = {"CAG", "A", "AC", "AAAT", "GGCCCC"};
+  std::ofstream out(bed_path.c_str());
+  for (int32_t i = 0; i < num_loci; i++) {
+    // test.fa has one 401 bp chromosome
+    int32_t start = 3 + (i * 37) % 390;
+    int32_t end = std::min(start + 3 + i % 20, 399);
+    std::string motif = motifs[i % 5];
+    out << "3\t" << start << "\t" << end << "\t" << motif.size() << "\t" << motif;
+    // Off-target regions weigh on the cost of some loci
+    if (i % 4 == 1) {
+      out << "\t3:10-" << 10 + i * 20;
+      if (i % 8 == 1) {
+	out << ",3:200-300";
+      }
+    }
+    out << "\n";
+  }
+  out.close();
+  return bed_path;
+}
+
+bool LocusCatalogTest::OpenData(const std::string& data) {
+  std::ofstream out(catalog_path.c_str(), std::ios::binary);
+  out << data;
+  out.close();
+  LocusCatalog catalog;
+  return catalog.Open(catalog_path);
+}
+
+void LocusCatalogTest::test_RoundTrip() {
+  const int32_t flank_len = 50;
+  CPPUNIT_ASSERT(LocusCatalog::Build(WriteLoci(30), reffa, flank_len, catalog_path));
+  CPPUNIT_ASSERT(LocusCatalog::IsCatalog(catalog_path));
+  CPPUNIT_ASSERT(!LocusCatalog::IsCatalog(bed_path));
+  LocusCatalog catalog;
+  CPPUNIT_ASSERT(catalog.Open(catalog_path));
+  CPPUNIT_ASSERT_EQUAL((uint64_t)30, catalog.size());
+
+  // Each locus matches the BED line, and its flanks the ones fetched
+  // from the reference for it, as Genotyper::SetFlanks does
+  RegionReader bed_reader(bed_path);
+  RegionReader catalog_reader(catalog_path);
+  RefGenome refgenome(reffa);
+  Locus expected, found, from_reader;
+  int32_t num_flanked = 0, num_clamped = 0;
+  for (uint64_t i = 0; i < catalog.size(); i++) {
+    expected.Reset();
+    found.Reset();
+    from_reader.Reset();
+    CPPUNIT_ASSERT(bed_reader.GetNextRegion(&expected));
+    catalog.GetLocus(i, &found);
+    CPPUNIT_ASSERT(catalog_reader.GetNextRegion(&from_reader));
+    const Locus* loci[] = {&found, &from_reader};
+    for (size_t j = 0; j < 2; j++) {
+      const Locus& locus = *loci[j];
+      CPPUNIT_ASSERT_EQUAL(expected.chrom, locus.chrom);
+      CPPUNIT_ASSERT_EQUAL(expected.start, locus.start);
+      CPPUNIT_ASSERT_EQUAL(expected.end, locus.end);
+      CPPUNIT_ASSERT_EQUAL(expected.period, locus.period);
+      CPPUNIT_ASSERT_EQUAL(expected.motif, locus.motif);
+      CPPUNIT_ASSERT_EQUAL(expected.offtarget_set, locus.offtarget_set);
+      CPPUNIT_ASSERT_EQUAL(expected.offtarget_regions.size(), locus.offtarget_regions.size());
+      for (size_t k = 0; k < expected.offtarget_regions.size(); k++) {
+	CPPUNIT_ASSERT_EQUAL(expected.offtarget_regions[k].chrom, locus.offtarget_regions[k].chrom);
+	CPPUNIT_ASSERT_EQUAL(expected.offtarget_regions[k].start, locus.offtarget_regions[k].start);
+	CPPUNIT_ASSERT_EQUAL(expected.offtarget_regions[k].end, locus.offtarget_regions[k].end);
+      }
+      CPPUNIT_ASSERT_EQUAL(found.flank_len, locus.flank_len);
+      CPPUNIT_ASSERT_EQUAL(found.pre_flank, locus.pre_flank);
+      CPPUNIT_ASSERT_EQUAL(found.post_flank, locus.post_flank);
+    }
+    CPPUNIT_ASSERT_EQUAL(catalog.record(i).ref_count, (expected.end - expected.start + 1) / expected.period);
+    if (found.flank_len < 0) {
+      // Left to the reference
+      CPPUNIT_ASSERT(found.pre_flank.empty() && found.post_flank.empty());
+      continue;
+    }
+    CPPUNIT_ASSERT_EQUAL(flank_len, found.flank_len);
+    std::string pre_flank, post_flank;
+    CPPUNIT_ASSERT(refgenome.GetSequence(expected.chrom, expected.start - flank_len - 1,
+					 expected.start - 2, &pre_flank));
+    CPPUNIT_ASSERT(refgenome.GetSequence(expected.chrom, expected.end,
+					 expected.end + flank_len - 1, &post_flank));
+    CPPUNIT_ASSERT_EQUAL(pre_flank, found.pre_flank);
+    CPPUNIT_ASSERT_EQUAL(post_flank, found.post_flank);
+    // Shorter flanks are cut from the catalog ones, clamped at the
+    // chromosome ends like the reference ones
+    const int32_t short_len = 20;
+    CPPUNIT_ASSERT(refgenome.GetSequence(expected.chrom, expected.start - short_len - 1,
+					 expected.start - 2, &pre_flank));
+    CPPUNIT_ASSERT(refgenome.GetSequence(expected.chrom, expected.end,
+					 expected.end + short_len - 1, &post_flank));
+    std::string short_pre = found.pre_flank, short_post = found.post_flank;
+    if ((int32_t)short_pre.size() > short_len) {
+      short_pre.erase(0, short_pre.size() - short_len);
+    }
+    if ((int32_t)short_post.size() > short_len) {
+      short_post.resize(short_len);
+    }
+    CPPUNIT_ASSERT_EQUAL(pre_flank, short_pre);
+    CPPUNIT_ASSERT_EQUAL(post_flank, short_post);
+    if (found.start - flank_len - 1 < 0 || found.end + flank_len > 401) {
+      num_clamped++;
+    }
+    num_flanked++;
+  }
+  CPPUNIT_ASSERT(!bed_reader.GetNextRegion(&expected));
+  CPPUNIT_ASSERT(!catalog_reader.GetNextRegion(&from_reader));
+  CPPUNIT_ASSERT(num_flanked > 0);
+  CPPUNIT_ASSERT(num_clamped > 0);
+}
+
+void LocusCatalogTest::test_InvalidFiles() {
+  CPPUNIT_ASSERT(LocusCatalog::Build(WriteLoci(10), reffa, 50, catalog_path));
+  std::ifstream in(catalog_path.c_str(), std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  in.close();
+  CPPUNIT_ASSERT(OpenData(data));
+
+  std::string bad_magic = data;
+  bad_magic[4] = 'X';
+  CPPUNIT_ASSERT(!OpenData(bad_magic));
+
+  CatalogHeader header;
+  memcpy(&header, data.data(), sizeof(header));
+  header.version = LOCUS_CATALOG_VERSION + 1;
+  std::string bad_version = data;
+  bad_version.replace(0, sizeof(header), (const char*)&header, sizeof(header));
+  CPPUNIT_ASSERT(!OpenData(bad_version));
+
+  // Cut in the strings, in the records and in the header
+  const size_t lengths[] = {data.size() - 1, sizeof(CatalogHeader) + sizeof(CatalogLocusRecord),
+			    sizeof(CatalogHeader) - 1, 0};
+  for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+    CPPUNIT_ASSERT(!OpenData(data.substr(0, lengths[i])));
+  }
+  LocusCatalog missing;
+  CPPUNIT_ASSERT(!missing.Open(catalog_path + ".missing"));
+}
+
+void LocusCatalogTest::test_ShardRange() {
+  CPPUNIT_ASSERT(LocusCatalog::Build(WriteLoci(40), reffa, 50, catalog_path));
+  LocusCatalog catalog;
+  CPPUNIT_ASSERT(catalog.Open(catalog_path));
+  const int32_t shard_counts[] = {1, 2, 3, 7, 16, 40, 64};
+  for (size_t n = 0; n < sizeof(shard_counts) / sizeof(shard_counts[0]); n++) {
+    const int32_t num_shards = shard_counts[n];
+    // Shards are contiguous and in order, so together they cover each
+    // locus exactly once
+    uint64_t next = 0;
+    for (int32_t shard = 0; shard < num_shards; shard++) {
+      uint64_t first, last;
+      catalog.ShardRange(shard, num_shards, &first, &last);
+      CPPUNIT_ASSERT(first <= last);
+      if (first < last) {
+	CPPUNIT_ASSERT_EQUAL(next, first);
+	next = last;
+      }
+    }
+    CPPUNIT_ASSERT_EQUAL(catalog.size(), next);
+  }
+  // A single shard is the whole catalog
+  uint64_t first, last;
+  catalog.ShardRange(0, 1, &first, &last);
+  CPPUNIT_ASSERT_EQUAL((uint64_t)0, first);
+  CPPUNIT_ASSERT_EQUAL(catalog.size(), last);
+}
@@ -0,0 +1,56 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SRC_TESTS_LOCUSCATALOG_H__
+#define SRC_TESTS_LOCUSCATALOG_H__
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "src/locus.h"
+#include "src/locus_catalog.h"
+
+#include <string>
+
+class LocusCatalogTest: public CppUnit::TestFixture {
+  CPPUNIT_TEST_SUITE(LocusCatalogTest);
+  CPPUNIT_TEST(test_RoundTrip);
+  CPPUNIT_TEST(test_InvalidFiles);
+  CPPUNIT_TEST(test_ShardRange);
+  CPPUNIT_TEST_SUITE_END();
+
+ public:
+  void setUp();
+  void tearDown();
+ private:
+  void test_RoundTrip();
+  void test_InvalidFiles();
+  void test_ShardRange();
+  // Write a BED file of num_loci loci on chromosome 3 of test.fa,
+  // including loci too close to its ends for full flanks
+  std::string WriteLoci(const int32_t& num_loci);
+  // Write data to a file in P_tmpdir and return whether Open accepts it
+  bool OpenData(const std::string& data);
+  std::string test_dir;
+  std::string reffa;
+  std::string bed_path;
+  std::string catalog_path;
+};
+
+#endif //  SRC_TESTS_LOCUSCATALOG_H__
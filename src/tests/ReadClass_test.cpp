@@ -26,7 +26,7 @@ using namespace std;
 CPPUNIT_TEST_SUITE_REGISTRATION(ReadClassTest);
 
 void ReadClassTest::setUp() {
-  Options options;
+  options = Options();
 
   options.dist_mean = 400;
   options.dist_sdev = 50;
@@ -69,6 +69,23 @@ void ReadClassTest::test_AddData() {
   CPPUNIT_ASSERT_EQUAL((int)frr_class_.GetDataSize(), 1);
 }
 
+void ReadClassTest::test_AddDataCount() {
+  // Adding a value with a count must match adding it repeatedly
+  double class_ll, class_ll_count;
+  span_class_.AddData(400);
+  span_class_.AddData(400);
+  span_class_.AddData(400);
+  span_class_.AddData(450);
+  span_class_.GetClassLogLikelihood(20, 50, read_len, motif_len, ref_count, ploidy, &class_ll);
+  span_class_.Reset();
+  span_class_.AddData(450);
+  span_class_.AddData(400, 3);
+  span_class_.AddData(380, 0);
+  CPPUNIT_ASSERT_EQUAL((int)span_class_.GetDataSize(), 4);
+  span_class_.GetClassLogLikelihood(20, 50, read_len, motif_len, ref_count, ploidy, &class_ll_count);
+  CPPUNIT_ASSERT_DOUBLES_EQUAL(class_ll, class_ll_count, 1e-9);
+}
+
 void ReadClassTest::test_Reset() {
   int32_t test_data1 = 10;
   int32_t test_data2 = 20;
@@ -202,3 +219,45 @@ void ReadClassTest::test_GetAlleleLogLikelihood() {
   // CPPUNIT_FAIL("test_GetAlleleLogLikelihood not implemented");
 }
 
+
+void ReadClassTest::test_ClassProbCache() {
+  // Cached class probabilities must match the ones of a class that has
+  // not cached anything, also when read and motif length change from one
+  // locus to the next and when a cached value is asked for again
+  int32_t read_lens[2] = {100, 150};
+  int32_t motif_lens[2] = {3, 5};
+  ReadClass* cached[3] = {&encl_class_, &span_class_, &frr_class_};
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < 2; i++) {
+      for (int j = 0; j < 2; j++) {
+	for (int32_t allele = 1; allele <= 120; allele += 7) {
+	  EnclosingClass fresh_encl;
+	  SpanningClass fresh_span;
+	  FRRClass fresh_frr;
+	  ReadClass* fresh[3] = {&fresh_encl, &fresh_span, &fresh_frr};
+	  for (int k = 0; k < 3; k++) {
+	    fresh[k]->SetOptions(options);
+	    double cached_prob, fresh_prob;
+	    CPPUNIT_ASSERT(cached[k]->GetCachedLogClassProb(allele, read_lens[i], motif_lens[j],
+							    &cached_prob));
+	    CPPUNIT_ASSERT(fresh[k]->GetLogClassProb(allele, read_lens[i], motif_lens[j],
+						     &fresh_prob));
+	    CPPUNIT_ASSERT_EQUAL(fresh_prob, cached_prob);
+	  }
+	}
+      }
+    }
+  }
+
+  // New options invalidate the cache
+  double old_prob, new_prob, fresh_prob;
+  span_class_.GetCachedLogClassProb(20, read_len, motif_len, &old_prob);
+  options.dist_mean = 500;
+  span_class_.SetOptions(options);
+  span_class_.GetCachedLogClassProb(20, read_len, motif_len, &new_prob);
+  SpanningClass fresh_span;
+  fresh_span.SetOptions(options);
+  ((ReadClass*) &fresh_span)->GetLogClassProb(20, read_len, motif_len, &fresh_prob);
+  CPPUNIT_ASSERT_EQUAL(fresh_prob, new_prob);
+  CPPUNIT_ASSERT(old_prob != new_prob);
+}
@@ -30,6 +30,7 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 class ReadClassTest: public CppUnit::TestFixture {
   CPPUNIT_TEST_SUITE(ReadClassTest);
   CPPUNIT_TEST(test_AddData);
+  CPPUNIT_TEST(test_AddDataCount);
   CPPUNIT_TEST(test_Reset);
   CPPUNIT_TEST(test_SpanClassProb);
   CPPUNIT_TEST(test_SpanReadProb);
@@ -39,12 +40,14 @@ class ReadClassTest: public CppUnit::TestFixture {
   CPPUNIT_TEST(test_EnclosingReadProb);
   CPPUNIT_TEST(test_GetClassLogLikelihood);
   CPPUNIT_TEST(test_GetAlleleLogLikelihood);
+  CPPUNIT_TEST(test_ClassProbCache);
   CPPUNIT_TEST_SUITE_END();
 
  public:
   void setUp();
   void tearDown();
   void test_AddData();
+  void test_AddDataCount();
   void test_Reset();
   void test_SpanClassProb();
   void test_SpanReadProb();
@@ -54,7 +57,9 @@ class ReadClassTest: public CppUnit::TestFixture {
   void test_EnclosingReadProb();
   void test_GetClassLogLikelihood();
   void test_GetAlleleLogLikelihood();
+  void test_ClassProbCache();
  private:
+  Options options;
   EnclosingClass encl_class_;
   SpanningClass span_class_;
   FRRClass frr_class_;
@@ -21,9 +21,16 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 #include "src/bam_io.h"
 #include "src/stringops.h"
 #include "src/likelihood_maximizer.h"
+#include "src/region_reader.h"
 
 #include "src/tests/ReadExtractor_test.h"
 
+#include <stdio.h>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <sstream>
 #include <vector>
 
 // Registers the fixture into the 'registry'
@@ -99,27 +106,28 @@ void ReadExtractorTest::test_ProcessReadPairs() {
   std::vector<std::string> files(0);
   files.push_back(bam_file);
   BamCramMultiReader bamreader(files);
-  std::map<std::string, ReadPair> read_pairs;
+  ReadPairTable read_pairs;
   // Test each pair
   if (!read_extractor_->ProcessReadPairs(&bamreader, locus, regionsize, min_match, &read_pairs)) {
     CPPUNIT_FAIL("ProcessReadPairs returned false unexpectedly.");
   }
-  for (std::map<std::string, ReadPair>::const_iterator iter = read_pairs.begin();
-       iter != read_pairs.end(); iter++) {
+  for (size_t i = 0; i < read_pairs.size(); i++) {
+    const std::string key = read_pairs.Key(i);
+    const ReadPair& read_pair = read_pairs.at(i);
     std::stringstream msg;
-    msg << "Misclassified " << iter->first
-	<< " Found read type " << iter->second.read_type
-	<< " Found data value " << iter->second.data_value;
-    if (read_type_answers.find(iter->first) != read_type_answers.end()) {
-      CPPUNIT_ASSERT_EQUAL_MESSAGE(msg.str(), read_type_answers[iter->first], iter->second.read_type);
-      if (read_type_answers[iter->first] == RC_SPAN) {
-	bool correct = abs(data_answers[iter->first]-iter->second.data_value) <= 2; // wiggle room for start coords?
+    msg << "Misclassified " << key
+	<< " Found read type " << read_pair.read_type
+	<< " Found data value " << read_pair.data_value;
+    if (read_type_answers.find(key) != read_type_answers.end()) {
+      CPPUNIT_ASSERT_EQUAL_MESSAGE(msg.str(), read_type_answers[key], read_pair.read_type);
+      if (read_type_answers[key] == RC_SPAN) {
+	bool correct = abs(data_answers[key]-read_pair.data_value) <= 2; // wiggle room for start coords?
 	CPPUNIT_ASSERT_MESSAGE(msg.str(), correct);
-      } else if (read_type_answers[iter->first] == RC_ENCL) {
+      } else if (read_type_answers[key] == RC_ENCL) {
 	// for enclose, must be exactly right
-	CPPUNIT_ASSERT_EQUAL_MESSAGE(msg.str(), data_answers[iter->first], iter->second.data_value);
-      } else if (read_type_answers[iter->first] == RC_FRR) {
-	bool correct = abs(data_answers[iter->first]-iter->second.data_value) <= 102; // account for read length bug + wiggle room
+	CPPUNIT_ASSERT_EQUAL_MESSAGE(msg.str(), data_answers[key], read_pair.data_value);
+      } else if (read_type_answers[key] == RC_FRR) {
+	bool correct = abs(data_answers[key]-read_pair.data_value) <= 102; // account for read length bug + wiggle room
 	CPPUNIT_ASSERT_MESSAGE(msg.str(), correct);
       } else {
 	CPPUNIT_FAIL("Shouldn't get here");
@@ -243,9 +251,11 @@ void ReadExtractorTest::test_RescueMate() {
   bamreader.SetRegion(locus.chrom, locus.start - BUFFER, locus.end + BUFFER);
   // Loop through alignments, do several example cases
   BamAlignment aln;
-  BamAlignment matealn;
+  BamAlignmentView matealn;
   while (bamreader.GetNextAlignment(aln)) {
-    read_extractor_->RescueMate(&bamreader, aln, &matealn);
+    ReadSummary read;
+    read.Set(aln);
+    read_extractor_->RescueMate(&bamreader, aln.Filename(), aln.Name(), read, &matealn);
     std::stringstream msg;
     msg << "RescueMate failed for " << aln.Name();
     if (aln.Name() == "ATXN7_52_cov60_dist500_DIP_const70_70_constAllele_3065_3556_0:0:0_0:0:0_136") {
@@ -261,3 +271,247 @@ void ReadExtractorTest::test_RescueMate() {
 }
 
 
+
+void ReadExtractorTest::test_ReadPairTable() {
+  ReadPairTable read_pairs;
+  ReadPair read_pair;
+  CPPUNIT_ASSERT(read_pairs.Find(1, "read") == NULL);
+  // Enough pairs to grow the table a few times
+  for (int32_t i = 0; i < 5000; i++) {
+    std::stringstream ss;
+    ss << "read" << i;
+    read_pair.data_value = i;
+    read_pairs.Insert(1 + i % 2, ss.str(), read_pair);
+  }
+  CPPUNIT_ASSERT_EQUAL((size_t)5000, read_pairs.size());
+  CPPUNIT_ASSERT_EQUAL(17, read_pairs.Find(2, "read17")->data_value);
+  CPPUNIT_ASSERT(read_pairs.Find(1, "read17") == NULL);
+  CPPUNIT_ASSERT_EQUAL(std::string("2_read17"), read_pairs.Key(17));
+
+  // Same order as std::map keys "<file index>_<name>"
+  read_pairs.Insert(10, "read0", read_pair);
+  std::vector<size_t> order;
+  read_pairs.SortedOrder(&order);
+  for (size_t i = 1; i < order.size(); i++) {
+    CPPUNIT_ASSERT(read_pairs.Key(order[i-1]) < read_pairs.Key(order[i]));
+  }
+
+  read_pairs.Clear();
+  CPPUNIT_ASSERT_EQUAL((size_t)0, read_pairs.size());
+  CPPUNIT_ASSERT(read_pairs.Find(2, "read17") == NULL);
+}
+
+void ReadExtractorTest::test_MateCache() {
+  MateCache cache(2);
+  BamAlignment mate;
+  cache.Put("a.bam", "read1", 0, 100, mate);
+  cache.Put("a.bam", "read2", 0, 200, mate);
+  CPPUNIT_ASSERT(cache.Get("a.bam", "read1", 0, 100, &mate));
+  CPPUNIT_ASSERT(!cache.Get("a.bam", "read1", 1, 100, &mate));
+  // Same read name in another file
+  CPPUNIT_ASSERT(!cache.Get("b.bam", "read1", 0, 100, &mate));
+  // read2 is now the least recently used one
+  cache.Put("a.bam", "read3", 0, 300, mate);
+  CPPUNIT_ASSERT_EQUAL((size_t)2, cache.size());
+  CPPUNIT_ASSERT(!cache.Get("a.bam", "read2", 0, 200, &mate));
+  CPPUNIT_ASSERT(cache.Get("a.bam", "read1", 0, 100, &mate));
+  CPPUNIT_ASSERT(cache.Get("a.bam", "read3", 0, 300, &mate));
+
+  MateCache no_cache(0);
+  no_cache.Put("a.bam", "read1", 0, 100, mate);
+  CPPUNIT_ASSERT(!no_cache.Get("a.bam", "read1", 0, 100, &mate));
+}
+
+void ReadExtractorTest::CompareRescueMates(const std::vector<std::string>& files,
+					   const Locus& test_locus) {
+  BamCramMultiReader bamreader(files, "", BamCramMultiReader::ORDER_ALNS_BY_FILE);
+  if (!bamreader.SetRegion(test_locus.chrom, test_locus.start - regionsize,
+			   test_locus.end + regionsize)) {
+    return;
+  }
+  // Every primary read of the region with a mapped mate
+  std::vector<MateRequest> requests;
+  BamAlignmentView aln;
+  while (bamreader.GetNextAlignment(&aln) && requests.size() < (size_t)MAX_RESCUE_PER_LOCUS) {
+    if (aln.IsSupplementary() || aln.IsSecondary() || aln.MateRefID() < 0) {
+      continue;
+    }
+    requests.push_back(MateRequest());
+    requests.back().pair_index = requests.size() - 1;
+    requests.back().name = std::string(aln.NameData(), read_extractor_->trimmed_name_length(aln));
+    requests.back().file = aln.Filename();
+    requests.back().read.Set(aln);
+  }
+
+  // One region query per read
+  std::vector<bool> found(requests.size(), false);
+  std::vector<std::string> mates(requests.size());
+  BamAlignmentView mate;
+  for (size_t i = 0; i < requests.size(); i++) {
+    if (requests[i].read.mate_ref_id < 0) {
+      continue;
+    }
+    found[i] = read_extractor_->RescueMate(&bamreader, requests[i].file, requests[i].name,
+					   requests[i].read, &mate);
+    if (found[i]) {
+      std::stringstream ss;
+      ss << mate.Name() << " " << mate.RefID() << " " << mate.Position() << " " << mate.Filename();
+      mates[i] = ss.str();
+    }
+  }
+
+  // Batched, with an empty cache and then from the cache
+  ReadExtractor read_extractor(options);
+  for (int32_t pass = 0; pass < 2; pass++) {
+    std::vector<MateRequest> batch = requests;
+    CPPUNIT_ASSERT(read_extractor.RescueMates(&bamreader, &batch));
+    for (size_t i = 0; i < batch.size(); i++) {
+      std::stringstream msg;
+      msg << "RescueMates differs for " << batch[i].file << " " << batch[i].name;
+      CPPUNIT_ASSERT_EQUAL_MESSAGE(msg.str(), (bool)found[i], batch[i].found);
+      if (batch[i].found) {
+	BamAlignmentView batch_mate(batch[i].mate);
+	std::stringstream ss;
+	ss << batch_mate.Name() << " " << batch_mate.RefID() << " " << batch_mate.Position()
+	   << " " << batch_mate.Filename();
+	CPPUNIT_ASSERT_EQUAL_MESSAGE(msg.str(), mates[i], ss.str());
+      }
+    }
+  }
+}
+
+void ReadExtractorTest::test_RescueMates() {
+  const char* bam_names[] = {"47_nc_70.sorted.bam", "53_nc_12.sorted.bam", "53_nc_80.sorted.bam",
+			     "54_nc_12.sorted.bam", "54_nc_40.sorted.bam", "test.sorted.bam",
+			     "test.spanning.bam", "test.enclosing.bam", "test.frr.bam"};
+  const char* beds[] = {"ATXN7.bed", "HTT.bed", "ATXN3.bed", "CACNA1A.bed", "ATXN10.bed"};
+  for (size_t b = 0; b < sizeof(beds) / sizeof(beds[0]); b++) {
+    RegionReader region_reader(test_dir + "/" + beds[b]);
+    Locus test_locus;
+    CPPUNIT_ASSERT(region_reader.GetNextRegion(&test_locus));
+    for (size_t i = 0; i < sizeof(bam_names) / sizeof(bam_names[0]); i++) {
+      CompareRescueMates(std::vector<std::string>(1, test_dir + "/" + bam_names[i]), test_locus);
+    }
+    // Files that may share read names: mates must come from the read's file
+    std::vector<std::string> files;
+    files.push_back(test_dir + "/53_nc_12.sorted.bam");
+    files.push_back(test_dir + "/53_nc_80.sorted.bam");
+    CompareRescueMates(files, test_locus);
+  }
+}
+
+void ReadExtractorTest::test_FindReadMotif() {
+  CPPUNIT_ASSERT_EQUAL(std::string("AGC"), canonical_motif("gca"));
+  CPPUNIT_ASSERT_EQUAL(std::string("AGC"), canonical_motif("CTG"));
+
+  std::string motif;
+  std::string seq = "";
+  for (int i = 0; i < 50; i++) {
+    seq += "CTG";
+  }
+  // A few sequencing errors
+  seq[10] = 'A';
+  seq[70] = 'T';
+  CPPUNIT_ASSERT(find_read_motif(seq, IRR_MAX_PERIOD, &motif));
+  CPPUNIT_ASSERT_EQUAL(std::string("AGC"), motif);
+  CPPUNIT_ASSERT(find_read_motif(std::string(100, 'T'), IRR_MAX_PERIOD, &motif));
+  CPPUNIT_ASSERT_EQUAL(std::string("A"), motif);
+  CPPUNIT_ASSERT(!find_read_motif("ACGTTGCATGCATCGATCGATGCTAGCTAGCTAGCTGATCGATGCTAGCTAGCTAGCTAGCTGACTGATCG",
+				  IRR_MAX_PERIOD, &motif));
+}
+
+void ReadExtractorTest::test_IRRCatalog() {
+  std::string ctg = "";
+  for (int i = 0; i < 50; i++) {
+    ctg += "ctg";
+  }
+  CPPUNIT_ASSERT(is_frr_sequence(ctg, std::string(ctg.size(), 'I'), "ctg"));
+  CPPUNIT_ASSERT(!is_frr_sequence(ctg, std::string(ctg.size(), 'I'), "cag"));
+
+  // Enough records for several sorted runs, added out of order
+  const std::string motifs[] = {"AGC", "A", "AAAG", "AAT"};
+  const std::string chroms[] = {"chr2", "chr1", "chrX"};
+  std::vector<IRRRecord> records;
+  std::string path = std::string(P_tmpdir) + "/gangstr_test.irr";
+  IRRCatalogWriter writer(path, 7);
+  for (int32_t i = 0; i < 200; i++) {
+    IRRRecord record;
+    record.motif = motifs[(i * 7) % 4];
+    record.mate_chrom = chroms[(i * 5) % 3];
+    record.mate_position = (i * 7919) % 1000;
+    record.file_index = i % 2;
+    std::stringstream name;
+    name << "read" << i;
+    record.name = name.str();
+    record.chrom = (i % 3 == 0 ? "*" : chroms[i % 3]);
+    record.position = (record.chrom == "*" ? -1 : i * 10);
+    record.read_length = 100 + i % 3;
+    writer.Add(record);
+    records.push_back(record);
+  }
+  CPPUNIT_ASSERT(writer.num_runs() > 1);
+  CPPUNIT_ASSERT(writer.Finish());
+  std::ifstream runs((path + ".run0.tmp").c_str());
+  CPPUNIT_ASSERT(!runs.is_open());
+
+  IRRCatalog catalog;
+  CPPUNIT_ASSERT(catalog.Load(path));
+  CPPUNIT_ASSERT_EQUAL((uint64_t)records.size(), catalog.size());
+  std::vector<IRRRecord> found;
+  for (size_t m = 0; m < 5; m++) {
+    std::string motif = (m < 4 ? motifs[m] : "AC");
+    for (size_t c = 0; c < 4; c++) {
+      std::string chrom = (c < 3 ? chroms[c] : "chr3");
+      for (int32_t start = -50; start < 1000; start += 150) {
+	int32_t end = start + 200;
+	catalog.Find(motif, chrom, start, end, &found);
+	std::multiset<std::string> expected, actual;
+	for (size_t i = 0; i < records.size(); i++) {
+	  const IRRRecord& record = records[i];
+	  if (record.motif == motif && record.mate_chrom == chrom &&
+	      record.mate_position >= start && record.mate_position <= end) {
+	    std::stringstream ss;
+	    ss << record.name << " " << record.file_index << " " << record.chrom << " "
+	       << record.position << " " << record.mate_position << " " << record.read_length;
+	    expected.insert(ss.str());
+	  }
+	}
+	for (size_t i = 0; i < found.size(); i++) {
+	  const IRRRecord& record = found[i];
+	  CPPUNIT_ASSERT_EQUAL(motif, record.motif);
+	  CPPUNIT_ASSERT_EQUAL(chrom, record.mate_chrom);
+	  // In catalog order
+	  if (i > 0) {
+	    CPPUNIT_ASSERT(found[i-1].mate_position <= record.mate_position);
+	  }
+	  std::stringstream ss;
+	  ss << record.name << " " << record.file_index << " " << record.chrom << " "
+	     << record.position << " " << record.mate_position << " " << record.read_length;
+	  actual.insert(ss.str());
+	}
+	CPPUNIT_ASSERT(expected == actual);
+      }
+    }
+  }
+
+  // Files that are not catalogs, or cut short, are rejected
+  std::ifstream in(path.c_str(), std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  in.close();
+  std::string bad_path = path + ".bad";
+  std::string bad_magic = data;
+  bad_magic[0] = 'X';
+  std::string truncated = data.substr(0, data.size() - 10);
+  const std::string* bad_files[] = {&bad_magic, &truncated};
+  for (size_t i = 0; i < 2; i++) {
+    std::ofstream out(bad_path.c_str(), std::ios::binary);
+    out << *bad_files[i];
+    out.close();
+    IRRCatalog bad_catalog;
+    CPPUNIT_ASSERT(!bad_catalog.Load(bad_path));
+  }
+  IRRCatalog missing;
+  CPPUNIT_ASSERT(!missing.Load(path + ".missing"));
+  remove(bad_path.c_str());
+  remove(path.c_str());
+}
@@ -36,6 +36,11 @@ class ReadExtractorTest: public CppUnit::TestFixture {
   CPPUNIT_TEST(test_FindSpanningRead);
   CPPUNIT_TEST(test_ProcessSingleRead);
   CPPUNIT_TEST(test_RescueMate);
+  CPPUNIT_TEST(test_ReadPairTable);
+  CPPUNIT_TEST(test_MateCache);
+  CPPUNIT_TEST(test_RescueMates);
+  CPPUNIT_TEST(test_FindReadMotif);
+  CPPUNIT_TEST(test_IRRCatalog);
   CPPUNIT_TEST_SUITE_END();
 
  public:
@@ -48,6 +53,14 @@ class ReadExtractorTest: public CppUnit::TestFixture {
   void test_FindSpanningRead();
   void test_ProcessSingleRead();
   void test_RescueMate();
+  void test_ReadPairTable();
+  void test_MateCache();
+  void test_RescueMates();
+  // RescueMates finds the same mates as RescueMate for each read of the
+  // region around test_locus, with and without the mate cache
+  void CompareRescueMates(const std::vector<std::string>& files, const Locus& test_locus);
+  void test_FindReadMotif();
+  void test_IRRCatalog();
   void LoadAnswers(const std::string& answers_file,
 		   std::map<std::string, ReadType>* read_type_answers,
 		   std::map<std::string, int32_t>* data_answers);
@@ -19,6 +19,7 @@ along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "src/tests/Realignment_test.h"
+#include "src/stringops.h"
 #include <math.h>
 #include <sstream>
 
@@ -107,6 +108,155 @@ void RealignmentTest::test_ExpansionAwareRealign() {
   */
 }
 
+void RealignmentTest::test_RepeatGraphAlign() {
+  std::string pre_flank = "ACTAGCTACTCATCCAGTTGACCTAGGATC";
+  std::string post_flank = "ATCATCGACTACGACTTGCAATGGCTAACG";
+  std::string motif = "CAG";
+  std::vector<std::string> reads;
+  // Enclosing, pre flank, post flank and repeat-only reads
+  reads.push_back(ConstructSeq(pre_flank.substr(20), post_flank.substr(0, 10), motif, 6));
+  reads.push_back(ConstructSeq(pre_flank.substr(10), "", motif, 9));
+  reads.push_back(ConstructSeq("", post_flank.substr(0, 15), motif, 8));
+  reads.push_back(ConstructSeq("", "", motif, 12));
+  // Mismatch, deletion and insertion in the repeat
+  std::string seq = ConstructSeq(pre_flank.substr(20), post_flank.substr(0, 10), motif, 7);
+  seq[16] = 'T';
+  reads.push_back(seq);
+  reads.push_back(seq.substr(0, 20) + seq.substr(22));
+  reads.push_back(seq.substr(0, 20) + "GG" + seq.substr(20));
+
+  for (size_t r = 0; r < reads.size(); r++) {
+    const std::string& read = reads[r];
+    int32_t max_nCopy = (int32_t)(read.size() / motif.size()) + 1;
+    std::vector<RepeatGraphHit> hits;
+    CPPUNIT_ASSERT(repeat_graph_align(read, pre_flank, post_flank, motif, 5, max_nCopy, &hits));
+    CPPUNIT_ASSERT_EQUAL((size_t)max_nCopy + 1, hits.size());
+    for (int32_t n = 0; n <= max_nCopy; n++) {
+      // Same score as aligning against the template with n copies
+      int32_t pos, end, score, mismatches;
+      CPPUNIT_ASSERT(striped_smith_waterman(ConstructSeq(pre_flank, post_flank, motif, n),
+					    read, read, &pos, &end, &score, &mismatches));
+      CPPUNIT_ASSERT_EQUAL(score, hits[n].score);
+    }
+  }
+  // An enclosing read matches both flanks at its own copy number
+  std::vector<RepeatGraphHit> hits;
+  seq = ConstructSeq(pre_flank, post_flank, motif, 10).substr(10, 60);
+  CPPUNIT_ASSERT(repeat_graph_align(seq, pre_flank, post_flank, motif, 5, 21, &hits));
+  CPPUNIT_ASSERT_EQUAL((int32_t)seq.size()*SSW_MATCH_SCORE, hits[10].score);
+  CPPUNIT_ASSERT_EQUAL(10, hits[10].start_pos);
+}
+
+void RealignmentTest::test_RepeatGraphTieBreak() {
+  std::string pre_flank = "ACTAGCTACTCATCCAGTTGACCTAGGATC";
+  std::string post_flank = "ATCATCGACTACGACTTGCAATGGCTAACG";
+  std::string motif = "CAG";
+  // Reads with many equal-scoring placements: pure repeat in and out of
+  // phase, and repeat runs longer or shorter than the template
+  std::vector<std::string> reads;
+  reads.push_back(ConstructSeq("", "", motif, 12));
+  reads.push_back(ConstructSeq("", "", motif, 12).substr(1));
+  reads.push_back(ConstructSeq(pre_flank.substr(20), "", motif, 9));
+  reads.push_back(ConstructSeq("", post_flank.substr(0, 15), motif, 8));
+  reads.push_back(ConstructSeq(pre_flank.substr(25), post_flank.substr(0, 5), motif, 6));
+  for (size_t r = 0; r < reads.size(); r++) {
+    const std::string& read = reads[r];
+    int32_t max_nCopy = (int32_t)(read.size() / motif.size()) + 1;
+    std::vector<RepeatGraphHit> hits;
+    CPPUNIT_ASSERT(repeat_graph_align(read, pre_flank, post_flank, motif, 5, max_nCopy, &hits));
+    for (int32_t n = 0; n <= max_nCopy; n++) {
+      // Same alignment as SSW picks among the ties
+      int32_t pos, end, score, mismatches;
+      CPPUNIT_ASSERT(striped_smith_waterman(ConstructSeq(pre_flank, post_flank, motif, n),
+					    read, read, &pos, &end, &score, &mismatches));
+      CPPUNIT_ASSERT_EQUAL(score, hits[n].score);
+      CPPUNIT_ASSERT_EQUAL(pos, hits[n].start_pos);
+      CPPUNIT_ASSERT_EQUAL(end, hits[n].end_pos);
+    }
+  }
+
+  // Reads with errors where equal-scoring alignments end together but
+  // start at different positions. SSW and the graph pick different
+  // starts; both must end where SSW does and realize the score.
+  std::vector<std::pair<std::string, int32_t> > ties;
+  ties.push_back(std::pair<std::string, int32_t>
+		 ("GGATCCAGACTCAGCAGCAGCAGCACCAGCAGCAGCAGCAGCAGCAG", 4));
+  ties.push_back(std::pair<std::string, int32_t>
+		 ("GGATCCACCAGCAACTGCAGCAGCAGCAGCAGCAGATCATCGACTACGACT", 8));
+  ties.push_back(std::pair<std::string, int32_t>
+		 ("TAGGATCCAGCATCAGTAGCAGCAGCAGCAGCAGCAGCAGCGGCAGC", 5));
+  for (size_t t = 0; t < ties.size(); t++) {
+    const std::string& read = ties[t].first;
+    int32_t n = ties[t].second;
+    std::vector<RepeatGraphHit> hits;
+    CPPUNIT_ASSERT(repeat_graph_align(read, pre_flank, post_flank, motif, 5, n, &hits));
+    std::string tmpl = ConstructSeq(pre_flank, post_flank, motif, n);
+    int32_t pos, end, score, mismatches;
+    CPPUNIT_ASSERT(striped_smith_waterman(tmpl, read, read, &pos, &end, &score, &mismatches));
+    CPPUNIT_ASSERT(pos != hits[n].start_pos);
+    CPPUNIT_ASSERT_EQUAL(score, hits[n].score);
+    CPPUNIT_ASSERT_EQUAL(end, hits[n].end_pos);
+    std::string window = tmpl.substr(hits[n].start_pos, hits[n].end_pos - hits[n].start_pos + 1);
+    int32_t w_pos, w_end, w_score;
+    CPPUNIT_ASSERT(striped_smith_waterman(window, read, read, &w_pos, &w_end, &w_score, &mismatches));
+    CPPUNIT_ASSERT_EQUAL(score, w_score);
+  }
+
+  // Long repeat reads run past REPEAT_GRAPH_MIN_COPIES and take the
+  // graph path: their reported alignment is the one SSW gives
+  std::string seq = ConstructSeq(pre_flank.substr(22), "", motif, 30);
+  seq[40] = 'T';
+  int32_t nCopy, start_pos, end_pos, score;
+  FlankMatchState fm_start, fm_end;
+  CPPUNIT_ASSERT(expansion_aware_realign(seq, seq, pre_flank, post_flank, motif, 5,
+					 &nCopy, &start_pos, &end_pos, &score,
+					 &fm_start, &fm_end));
+  int32_t pos, end, ssw_score, mismatches;
+  CPPUNIT_ASSERT(striped_smith_waterman(ConstructSeq(pre_flank, post_flank, motif, nCopy),
+					seq, seq, &pos, &end, &ssw_score, &mismatches));
+  CPPUNIT_ASSERT_EQUAL(ssw_score, score);
+  CPPUNIT_ASSERT_EQUAL(pos, start_pos);
+  CPPUNIT_ASSERT_EQUAL(end, end_pos);
+}
+
+void RealignmentTest::test_LocusTemplates() {
+  Locus locus;
+  locus.pre_flank = "ACTAGCTACTCATCCAGTTGACCTAGGATC";
+  locus.post_flank = "ATCATCGACTACGACTTGCAATGGCTAACG";
+  locus.motif = "CAG";
+  LocusTemplates templates;
+  templates.Build(locus, 60);
+  CPPUNIT_ASSERT(templates.Covers(60));
+  CPPUNIT_ASSERT(!templates.Covers(61));
+  CPPUNIT_ASSERT_EQUAL(21, templates.MaxCopies());
+  std::string tmpl = ConstructSeq(locus.pre_flank, locus.post_flank, locus.motif, 7);
+  CPPUNIT_ASSERT_EQUAL((int32_t)tmpl.size(), templates.TemplateLength(7));
+  for (size_t i = 0; i < tmpl.size(); i++) {
+    CPPUNIT_ASSERT_EQUAL(nt_code(tmpl[i]), templates.Template(7)[i]);
+  }
+
+  // Same realignment with and without templates
+  std::vector<std::string> reads;
+  reads.push_back(ConstructSeq(locus.pre_flank.substr(20), locus.post_flank.substr(0, 10),
+			       locus.motif, 6));
+  reads.push_back(ConstructSeq(locus.pre_flank.substr(10), "", locus.motif, 12));
+  reads.push_back(ConstructSeq("", "", locus.motif, 20));
+  for (size_t r = 0; r < reads.size(); r++) {
+    int32_t nCopy, start_pos, end_pos, score, t_nCopy, t_start_pos, t_end_pos, t_score;
+    FlankMatchState fm_start, fm_end, t_fm_start, t_fm_end;
+    CPPUNIT_ASSERT(expansion_aware_realign(reads[r], reads[r], locus.pre_flank, locus.post_flank,
+					   locus.motif, min_match, &nCopy, &start_pos, &end_pos,
+					   &score, &fm_start, &fm_end));
+    CPPUNIT_ASSERT(expansion_aware_realign(reads[r], reads[r], locus.pre_flank, locus.post_flank,
+					   locus.motif, min_match, &t_nCopy, &t_start_pos, &t_end_pos,
+					   &t_score, &t_fm_start, &t_fm_end, &templates));
+    CPPUNIT_ASSERT_EQUAL(nCopy, t_nCopy);
+    CPPUNIT_ASSERT_EQUAL(start_pos, t_start_pos);
+    CPPUNIT_ASSERT_EQUAL(end_pos, t_end_pos);
+    CPPUNIT_ASSERT_EQUAL(score, t_score);
+  }
+}
+
 void RealignmentTest::test_SmithWaterman() {
   /*
   std::string seq1, seq2;
@@ -256,6 +406,41 @@ void RealignmentTest::test_SmithWaterman() {
 //     , score_matrix.at(i).at(j));
 // }
 
+void RealignmentTest::test_PackedMotifCopies() {
+  std::string motif = "cag";
+  std::string seqs[3] = {ConstructSeq("acttagcta", "ttgactca", "cag", 12),
+			 ConstructSeq("acttagcta", "ttgactca", "ctg", 30) + "cagcag",
+			 "acgtnacgtacgttgca"};
+  for (int i = 0; i < 3; i++) {
+    // 4-bit BAM encoding
+    std::string seq = seqs[i];
+    std::vector<uint8_t> packed((seq.size() + 1) / 2, 0);
+    for (size_t j = 0; j < seq.size(); j++) {
+      uint8_t code = 15;
+      switch (seq[j]) {
+      case 'a': code = 1; break;
+      case 'c': code = 2; break;
+      case 'g': code = 4; break;
+      case 't': code = 8; break;
+      }
+      packed[j / 2] |= code << ((~j & 1) << 2);
+    }
+    int32_t stretch, total, stretch_rev, total_rev;
+    int32_t exp_stretch, exp_total, exp_stretch_rev, exp_total_rev;
+    find_longest_stretch(seq, motif, &exp_stretch, &exp_total);
+    find_longest_stretch(reverse_complement(seq), motif, &exp_stretch_rev, &exp_total_rev);
+    CPPUNIT_ASSERT(packed_motif_copies(&packed[0], (int32_t)seq.size(), motif,
+				       &stretch, &total, &stretch_rev, &total_rev));
+    CPPUNIT_ASSERT_EQUAL(exp_stretch, stretch);
+    CPPUNIT_ASSERT_EQUAL(exp_total, total);
+    CPPUNIT_ASSERT_EQUAL(exp_stretch_rev, stretch_rev);
+    CPPUNIT_ASSERT_EQUAL(exp_total_rev, total_rev);
+  }
+  int32_t stretch, total, stretch_rev, total_rev;
+  uint8_t packed[2] = {0x12, 0x48};
+  CPPUNIT_ASSERT(!packed_motif_copies(packed, 4, "CAG", &stretch, &total, &stretch_rev, &total_rev));
+}
+
 void RealignmentTest::test_ClassifyRealignedRead() {
   /*
   std::string pre_flank = "ACTAGCTACTCATCCA";
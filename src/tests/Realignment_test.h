@@ -31,6 +31,10 @@ class RealignmentTest: public CppUnit::TestFixture {
   CPPUNIT_TEST_SUITE(RealignmentTest);
   CPPUNIT_TEST(test_ExpansionAwareRealign);
   CPPUNIT_TEST(test_SmithWaterman);
+  CPPUNIT_TEST(test_RepeatGraphAlign);
+  CPPUNIT_TEST(test_RepeatGraphTieBreak);
+  CPPUNIT_TEST(test_LocusTemplates);
+  CPPUNIT_TEST(test_PackedMotifCopies);
   // CPPUNIT_TEST(test_CreateScoreMatrix);
   // CPPUNIT_TEST(test_CalcScore);
   CPPUNIT_TEST(test_ClassifyRealignedRead);
@@ -42,6 +46,10 @@ class RealignmentTest: public CppUnit::TestFixture {
  private:
   void test_ExpansionAwareRealign();
   void test_SmithWaterman();
+  void test_RepeatGraphAlign();
+  void test_RepeatGraphTieBreak();
+  void test_LocusTemplates();
+  void test_PackedMotifCopies();
   // void test_CreateScoreMatrix();
   // void test_CalcScore();
   void test_ClassifyRealignedRead();
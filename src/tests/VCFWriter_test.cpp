@@ -0,0 +1,293 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "src/tests/VCFWriter_test.h"
+#include "src/common.h"
+
+#include "htslib/hts.h"
+#include "htslib/kseq.h"
+#include "htslib/kstring.h"
+#include "htslib/tbx.h"
+#include "htslib/vcf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+// Registers the fixture into the 'registry'
+CPPUNIT_TEST_SUITE_REGISTRATION(VCFWriterTest);
+
+// Same command line as in tests/vcf_writer.vcf
+const std::string TEST_COMMAND = "GangSTR --bam test.bam --ref test.fa --regions test.bed --out test";
+
+void VCFWriterTest::setUp() {
+  // This gets set during "make check"
+  // env variable set in ./src/Makefile.am
+  test_dir = getenv("GANGSTR_TEST_DIR");
+  out_prefix = std::string(P_tmpdir) + "/gangstr_vcf_writer";
+}
+
+void VCFWriterTest::tearDown() {
+  const char* suffixes[] = {".vcf", ".vcf.gz", ".vcf.gz.tbi", ".bcf", ".bcf.csi"};
+  for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+    remove((out_prefix + suffixes[i]).c_str());
+  }
+}
+
+void VCFWriterTest::GetLoci(std::vector<Locus>* loci) {
+  // chrom, start, end, motif, allele1, allele2 and the CI bounds
+  const char* motifs[] = {"cag", "ac", "a", "aaat", "ggcccc", "ctg"};
+  const int32_t coords[][8] = {{100, 111, 4, 4, 4, 4, 4, 4},
+			       {150, 159, 5, 7, 5, 5, 6, 9},
+			       {200, 203, 6, 4, 5, 8, 3, 4},
+			       {250, 261, 1, 10, 0, 2, 8, 14},
+			       {300, 329, 2, 5, 1, 3, 5, 5},
+			       {350, 361, 4, 4, -1, -1, -1, -1}};
+  loci->clear();
+  for (size_t i = 0; i < sizeof(coords) / sizeof(coords[0]); i++) {
+    Locus locus;
+    locus.chrom = "3";
+    locus.start = coords[i][0];
+    locus.end = coords[i][1];
+    locus.motif = motifs[i];
+    locus.period = locus.motif.size();
+    locus.allele1 = coords[i][2];
+    locus.allele2 = coords[i][3];
+    locus.lob1 = coords[i][4];
+    locus.hib1 = coords[i][5];
+    locus.lob2 = coords[i][6];
+    locus.hib2 = coords[i][7];
+    locus.enclosing_reads = 10 * i;
+    locus.spanning_reads = i;
+    locus.frr_reads = (i == 3 ? 12 : 0);
+    locus.flanking_reads = 2 * i + 1;
+    locus.depth = 13 * i + 1;
+    locus.min_neg_lik = 12.3456789 * i;
+    if (i != 5) {
+      locus.insert_size_mean = 500.25 - i;
+      locus.insert_size_stddev = 50.0 / (i + 1);
+      locus.num_bootstraps = 101 - 10 * i;
+    }
+    loci->push_back(locus);
+  }
+}
+
+void VCFWriterTest::WriteLoci(const std::string& path, const std::string& format,
+			      const int32_t& num_copies) {
+  std::vector<Locus> loci;
+  GetLoci(&loci);
+  VCFWriter writer(path, TEST_COMMAND, format, test_dir + "/test.fa");
+  for (int32_t i = 0; i < num_copies; i++) {
+    for (size_t j = 0; j < loci.size(); j++) {
+      writer.WriteRecord(loci[j]);
+    }
+  }
+}
+
+std::string VCFWriterTest::ReadFile(const std::string& path) {
+  std::ifstream in(path.c_str(), std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+void VCFWriterTest::test_PlainText() {
+  const std::string expected = ReadFile(test_dir + "/vcf_writer.vcf");
+  CPPUNIT_ASSERT(!expected.empty());
+  WriteLoci(out_prefix + ".vcf", "vcf", 1);
+  CPPUNIT_ASSERT(expected == ReadFile(out_prefix + ".vcf"));
+
+  // Enough records to fill the buffer several times
+  const size_t header_size = expected.find("\n3\t") + 1;
+  const std::string records = expected.substr(header_size);
+  const int32_t num_copies = (int32_t)(3 * VCF_BUFFER_SIZE / records.size()) + 1;
+  WriteLoci(out_prefix + ".vcf", "vcf", num_copies);
+  std::string found = ReadFile(out_prefix + ".vcf");
+  CPPUNIT_ASSERT_EQUAL(header_size + num_copies * records.size(), found.size());
+  CPPUNIT_ASSERT(expected.compare(0, header_size, found, 0, header_size) == 0);
+  for (int32_t i = 0; i < num_copies; i++) {
+    CPPUNIT_ASSERT(records.compare(0, records.size(), found,
+				   header_size + i * records.size(), records.size()) == 0);
+  }
+}
+
+/*
+  A fatal error exits without destroying the writer. The records it
+  buffered must still reach the file
+ */
+void VCFWriterTest::test_FlushOnError() {
+  const std::string expected = ReadFile(test_dir + "/vcf_writer.vcf");
+  pid_t pid = fork();
+  CPPUNIT_ASSERT(pid >= 0);
+  if (pid == 0) {
+    std::vector<Locus> loci;
+    GetLoci(&loci);
+    VCFWriter writer(out_prefix + ".vcf", TEST_COMMAND, "vcf", test_dir + "/test.fa");
+    for (size_t i = 0; i < loci.size(); i++) {
+      writer.WriteRecord(loci[i]);
+    }
+    PrintMessageDieOnError("Expected error from test_FlushOnError", M_ERROR);
+    _exit(0);
+  }
+  int status;
+  CPPUNIT_ASSERT_EQUAL(pid, waitpid(pid, &status, 0));
+  CPPUNIT_ASSERT(WIFEXITED(status));
+  CPPUNIT_ASSERT_EQUAL(1, WEXITSTATUS(status));
+  CPPUNIT_ASSERT(expected == ReadFile(out_prefix + ".vcf"));
+}
+
+/*
+  Compressed outputs hold the same records as plain text, and their
+  indexes find them
+ */
+void VCFWriterTest::test_CompressedOutput() {
+  const std::string expected = ReadFile(test_dir + "/vcf_writer.vcf");
+  std::vector<std::string> expected_lines;
+  std::stringstream ss(expected);
+  std::string line;
+  while (std::getline(ss, line)) {
+    if (line[0] != '#') {
+      expected_lines.push_back(line);
+    }
+  }
+
+  // vcf.gz: the same text, bgzip compressed and tabix indexed
+  const std::string gz_path = out_prefix + ".vcf.gz";
+  WriteLoci(gz_path, "vcf.gz", 1);
+  htsFile* gz_file = hts_open(gz_path.c_str(), "r");
+  CPPUNIT_ASSERT(gz_file != NULL);
+  kstring_t str = {0, 0, NULL};
+  std::string text;
+  while (hts_getline(gz_file, KS_SEP_LINE, &str) >= 0) {
+    text += std::string(str.s, str.l) + "\n";
+  }
+  CPPUNIT_ASSERT(expected == text);
+  tbx_t* tbx = tbx_index_load(gz_path.c_str());
+  CPPUNIT_ASSERT(tbx != NULL);
+  hts_itr_t* itr = tbx_itr_querys(tbx, "3:140-260");
+  CPPUNIT_ASSERT(itr != NULL);
+  std::vector<std::string> found_lines;
+  while (tbx_itr_next(gz_file, tbx, itr, &str) >= 0) {
+    found_lines.push_back(std::string(str.s, str.l));
+  }
+  CPPUNIT_ASSERT_EQUAL((size_t)3, found_lines.size());
+  for (size_t i = 0; i < found_lines.size(); i++) {
+    CPPUNIT_ASSERT_EQUAL(expected_lines[i + 1], found_lines[i]);
+  }
+  tbx_itr_destroy(itr);
+  tbx_destroy(tbx);
+  hts_close(gz_file);
+
+  // BCF: the same records, CSI indexed
+  const std::string bcf_path = out_prefix + ".bcf";
+  WriteLoci(bcf_path, "bcf", 1);
+  htsFile* bcf_file = hts_open(bcf_path.c_str(), "r");
+  CPPUNIT_ASSERT(bcf_file != NULL);
+  bcf_hdr_t* header = bcf_hdr_read(bcf_file);
+  CPPUNIT_ASSERT(header != NULL);
+  CPPUNIT_ASSERT_EQUAL(1, bcf_hdr_nsamples(header));
+  bcf1_t* record = bcf_init();
+  size_t num_records = 0;
+  while (bcf_read(bcf_file, header, record) == 0) {
+    CPPUNIT_ASSERT(num_records < expected_lines.size());
+    // Compare the fixed columns; numbers in INFO and FORMAT are
+    // reformatted by htslib
+    std::vector<std::string> items;
+    std::stringstream line_ss(expected_lines[num_records]);
+    std::string item;
+    while (std::getline(line_ss, item, '\t')) {
+      items.push_back(item);
+    }
+    bcf_unpack(record, BCF_UN_STR);
+    CPPUNIT_ASSERT_EQUAL(items[0], std::string(bcf_seqname(header, record)));
+    CPPUNIT_ASSERT_EQUAL(atoi(items[1].c_str()), (int)record->pos + 1);
+    CPPUNIT_ASSERT_EQUAL(items[3], std::string(record->d.allele[0]));
+    std::string alt = (record->n_allele > 1 ? "" : ".");
+    for (int i = 1; i < record->n_allele; i++) {
+      alt += std::string(i > 1 ? "," : "") + record->d.allele[i];
+    }
+    CPPUNIT_ASSERT_EQUAL(items[4], alt);
+    num_records++;
+  }
+  CPPUNIT_ASSERT_EQUAL(expected_lines.size(), num_records);
+  hts_idx_t* idx = bcf_index_load(bcf_path.c_str());
+  CPPUNIT_ASSERT(idx != NULL);
+  itr = bcf_itr_querys(idx, header, "3:140-260");
+  CPPUNIT_ASSERT(itr != NULL);
+  num_records = 0;
+  while (bcf_itr_next(bcf_file, itr, record) >= 0) {
+    CPPUNIT_ASSERT_EQUAL(atoi(expected_lines[num_records + 1].c_str() + 2), (int)record->pos + 1);
+    num_records++;
+  }
+  CPPUNIT_ASSERT_EQUAL((size_t)3, num_records);
+  hts_itr_destroy(itr);
+  hts_idx_destroy(idx);
+  bcf_destroy(record);
+  bcf_hdr_destroy(header);
+  hts_close(bcf_file);
+  free(str.s);
+}
+
+/*
+  Loci called by --screen have no confidence interval, unless
+  --screen-check bootstrapped them with the full model
+ */
+void VCFWriterTest::test_ScreenedLocus() {
+  std::vector<Locus> loci;
+  GetLoci(&loci);
+  loci.resize(2);
+  loci[0].screened = true;
+  loci[0].num_bootstraps = 0;
+  loci[0].lob1 = loci[0].hib1 = loci[0].lob2 = loci[0].hib2 = -1;
+  loci[1].screened = true;
+  {
+    VCFWriter writer(out_prefix + ".vcf", TEST_COMMAND, "vcf", test_dir + "/test.fa");
+    for (size_t i = 0; i < loci.size(); i++) {
+      writer.WriteRecord(loci[i]);
+    }
+  }
+  std::ifstream in((out_prefix + ".vcf").c_str());
+  std::string line;
+  std::vector<std::string> cis;
+  while (std::getline(in, line)) {
+    if (line[0] == '#') {
+      continue;
+    }
+    std::vector<std::string> items;
+    std::stringstream line_ss(line);
+    std::string item;
+    while (std::getline(line_ss, item, '\t')) {
+      items.push_back(item);
+    }
+    CPPUNIT_ASSERT_EQUAL((size_t)10, items.size());
+    CPPUNIT_ASSERT(items[7].find(";SCREEN") != std::string::npos);
+    CPPUNIT_ASSERT_EQUAL(std::string("GT:DP:GB:CI:RC:Q:INS"), items[8]);
+    std::stringstream sample_ss(items[9]);
+    for (int i = 0; i < 4; i++) {
+      std::getline(sample_ss, item, ':');
+    }
+    cis.push_back(item);
+  }
+  CPPUNIT_ASSERT_EQUAL((size_t)2, cis.size());
+  CPPUNIT_ASSERT_EQUAL(std::string("."), cis[0]);
+  CPPUNIT_ASSERT_EQUAL(std::string("5-5,6-9"), cis[1]);
+}
@@ -0,0 +1,58 @@
+/*
+Copyright (C) 2017 Melissa Gymrek <mgymrek@ucsd.edu>
+and Nima Mousavi (mousavi@ucsd.edu)
+
+This file is part of GangSTR.
+
+GangSTR is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+GangSTR is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SRC_TESTS_VCFWRITER_H__
+#define SRC_TESTS_VCFWRITER_H__
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "src/locus.h"
+#include "src/vcf_writer.h"
+
+#include <string>
+#include <vector>
+
+class VCFWriterTest: public CppUnit::TestFixture {
+  CPPUNIT_TEST_SUITE(VCFWriterTest);
+  CPPUNIT_TEST(test_PlainText);
+  CPPUNIT_TEST(test_CompressedOutput);
+  CPPUNIT_TEST(test_FlushOnError);
+  CPPUNIT_TEST(test_ScreenedLocus);
+  CPPUNIT_TEST_SUITE_END();
+
+ public:
+  void setUp();
+  void tearDown();
+ private:
+  void test_PlainText();
+  void test_CompressedOutput();
+  void test_FlushOnError();
+  void test_ScreenedLocus();
+  // Loci of tests/vcf_writer.vcf, which holds what the unbuffered
+  // writer printed for them
+  void GetLoci(std::vector<Locus>* loci);
+  // Write loci, num_copies times over, in format to path
+  void WriteLoci(const std::string& path, const std::string& format, const int32_t& num_copies);
+  std::string ReadFile(const std::string& path);
+  std::string test_dir;
+  std::string out_prefix;
+};
+
+#endif //  SRC_TESTS_VCFWRITER_H__
@@ -18,86 +18,239 @@ You should have received a copy of the GNU General Public License
 along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stdlib.h>
+
 #include <string>
 #include <sstream>
 
+#include "htslib/faidx.h"
+#include "htslib/kstring.h"
+#include "htslib/tbx.h"
+#include "src/common.h"
 #include "src/vcf_writer.h"
 
 using namespace std;
 
 VCFWriter::VCFWriter(const std::string& _vcffile,
-		     const std::string& full_command) {
-  writer_.open(_vcffile.c_str());
-  // Write header
-  writer_ << "##fileformat=VCFv4.1" << std::endl;
-  writer_ << "##command=" << full_command << std::endl;
-  writer_ << "##INFO=<ID=END,Number=1,Type=Integer,Description=\"End position of variant\">" << endl;
-  writer_ << "##INFO=<ID=RU,Number=1,Type=String,Description=\"Repeat motif\">" << endl;
-  writer_ << "##INFO=<ID=REF,Number=1,Type=Float,Description=\"Reference copy number\">" << endl;
-  writer_ << "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">" << endl;
-  writer_ << "##FORMAT=<ID=DP,Number=1,Type=Integer,Description=\"Read Depth\">" << endl;
-  writer_ << "##FORMAT=<ID=GB,Number=1,Type=String,Description=\"Genotype given in bp difference from reference\">" << endl;
-  writer_ << "##FORMAT=<ID=CI,Number=1,Type=String,Description=\"Confidence intervals\">" << endl;
-  writer_ << "##FORMAT=<ID=RC,Number=1,Type=String,Description=\"Number of reads in each class (enclosing, spanning, FRR, bounding\">" << endl;
-  writer_ << "##FORMAT=<ID=Q,Number=1,Type=Float,Description=\"Min. negative likelihood\">" << endl;
-  writer_ << "##FORMAT=<ID=INS,Number=1,Type=String,Description=\"Insert size mean and stddev\">" << endl;
-  writer_ << "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\tsample" << endl;
-  writer_.flush();
+		     const std::string& full_command,
+		     const std::string& format,
+		     const std::string& reffa) {
+  vcffile_ = _vcffile;
+  format_ = format;
+  text_out_ = NULL;
+  bcf_out_ = NULL;
+  bcf_header_ = NULL;
+  bcf_record_ = NULL;
+  bcf_line_.l = bcf_line_.m = 0;
+  bcf_line_.s = NULL;
+  pthread_mutex_init(&mutex_, NULL);
+  AddErrorHook(&VCFWriter::FlushOnError, this);
+
+  std::vector<std::string> header_lines;
+  header_lines.push_back("##fileformat=VCFv4.1");
+  header_lines.push_back("##command=" + full_command);
+  header_lines.push_back("##INFO=<ID=END,Number=1,Type=Integer,Description=\"End position of variant\">");
+  header_lines.push_back("##INFO=<ID=RU,Number=1,Type=String,Description=\"Repeat motif\">");
+  header_lines.push_back("##INFO=<ID=REF,Number=1,Type=Float,Description=\"Reference copy number\">");
+  header_lines.push_back("##INFO=<ID=NBOOT,Number=1,Type=Integer,Description=\"Number of bootstrap replicates used for the confidence intervals\">");
+  header_lines.push_back("##INFO=<ID=SCREEN,Number=0,Type=Flag,Description=\"Passed the --screen first pass for reference-like loci\">");
+  header_lines.push_back("##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">");
+  header_lines.push_back("##FORMAT=<ID=DP,Number=1,Type=Integer,Description=\"Read Depth\">");
+  header_lines.push_back("##FORMAT=<ID=GB,Number=1,Type=String,Description=\"Genotype given in bp difference from reference\">");
+  header_lines.push_back("##FORMAT=<ID=CI,Number=1,Type=String,Description=\"Confidence intervals\">");
+  header_lines.push_back("##FORMAT=<ID=RC,Number=1,Type=String,Description=\"Number of reads in each class (enclosing, spanning, FRR, bounding\">");
+  header_lines.push_back("##FORMAT=<ID=Q,Number=1,Type=Float,Description=\"Min. negative likelihood\">");
+  header_lines.push_back("##FORMAT=<ID=INS,Number=1,Type=String,Description=\"Insert size mean and stddev\">");
+
+  if (format_ == "bcf") {
+    OpenBCF(header_lines, reffa);
+    return;
+  }
+  // Mode "u" writes plain text through the same interface
+  text_out_ = bgzf_open(vcffile_.c_str(), (format_ == "vcf.gz" ? "w" : "wu"));
+  if (text_out_ == NULL) {
+    PrintMessageDieOnError("Failed to open VCF output file " + vcffile_, M_ERROR);
+  }
+  buffer_.reserve(VCF_BUFFER_SIZE + VCF_BUFFER_SIZE / 4);
+  for (size_t i = 0; i < header_lines.size(); i++) {
+    buffer_ += header_lines[i] + "\n";
+  }
+  buffer_ += "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\tsample\n";
+}
+
+void VCFWriter::OpenBCF(const std::vector<std::string>& header_lines, const std::string& reffa) {
+  bcf_out_ = hts_open(vcffile_.c_str(), "wb");
+  if (bcf_out_ == NULL) {
+    PrintMessageDieOnError("Failed to open BCF output file " + vcffile_, M_ERROR);
+  }
+  bcf_header_ = bcf_hdr_init("w");
+  bcf_hdr_set_version(bcf_header_, "VCFv4.1");
+  // The first line is ##fileformat, set above
+  for (size_t i = 1; i < header_lines.size(); i++) {
+    bcf_hdr_append(bcf_header_, header_lines[i].c_str());
+  }
+  // BCF records refer to contigs by their index in the header
+  faidx_t* fai = fai_load(reffa.c_str());
+  if (fai == NULL) {
+    PrintMessageDieOnError("BCF output needs the reference index of " + reffa, M_ERROR);
+  }
+  for (int i = 0; i < faidx_nseq(fai); i++) {
+    stringstream contig;
+    contig << "##contig=<ID=" << faidx_iseq(fai, i)
+	   << ",length=" << faidx_seq_len(fai, faidx_iseq(fai, i)) << ">";
+    bcf_hdr_append(bcf_header_, contig.str().c_str());
+  }
+  fai_destroy(fai);
+  bcf_hdr_add_sample(bcf_header_, "sample");
+  bcf_hdr_sync(bcf_header_);
+  if (bcf_hdr_write(bcf_out_, bcf_header_) != 0) {
+    PrintMessageDieOnError("Failed to write the BCF header", M_ERROR);
+  }
+  bcf_record_ = bcf_init();
 }
 
 void VCFWriter::WriteRecord(const Locus& locus) {
   int ref_size = (locus.end-locus.start+1)/locus.period;
-  stringstream ref_allele;
-  stringstream alt_alleles;
-  stringstream gt_str;
+  std::string ref_allele;
+  std::string alt_alleles;
+  const char* gt_str;
+  ref_allele.reserve(ref_size * locus.motif.size());
   for (int i=0; i<ref_size; i++) {
-    ref_allele << locus.motif;
+    ref_allele += locus.motif;
   }
   if (locus.allele1 != ref_size) {
     for (int i=0; i<locus.allele1; i++) {
-      alt_alleles << locus.motif;
+      alt_alleles += locus.motif;
     }
   }
   if (locus.allele2 != ref_size) {
     if (locus.allele1 != ref_size) {
-      alt_alleles << ",";
+      alt_alleles += ",";
     }
     for (int i=0; i<locus.allele2; i++) {
-      alt_alleles << locus.motif;
+      alt_alleles += locus.motif;
     }
   }
   if (locus.allele1 == ref_size && locus.allele2 == ref_size) {
-    alt_alleles << ".";
-    gt_str << "0/0";
+    alt_alleles += ".";
+    gt_str = "0/0";
   } else if (locus.allele1 == ref_size) {
-    gt_str << "0/1";
+    gt_str = "0/1";
   } else if (locus.allele2 == ref_size) {
-    gt_str << "1/0";
+    gt_str = "1/0";
+  } else {
+    gt_str = "1/2";
+  }
+  line_ss_.str("");
+  line_ss_.clear();
+  line_ss_ << locus.chrom << "\t"
+	   << locus.start << "\t"
+	   << ".\t"
+	   << ref_allele << "\t"
+	   << alt_alleles << "\t"
+	   << "." << "\t"
+	   << "." << "\t"
+	   << "END=" << locus.end << ";"
+	   << "RU=" << locus.motif << ";"
+	   << "REF=" << ref_size << ";"
+	   << "NBOOT=" << locus.num_bootstraps << (locus.screened ? ";SCREEN" : "") << "\t"
+	   << "GT:DP:GB:CI:RC:Q:INS" << "\t"
+	   << gt_str << ":"
+	   << locus.depth << ":"
+	   << locus.allele1 << "," << locus.allele2 << ":";
+  // Loci called by the screen have no bootstrap, so no interval
+  if (locus.screened && locus.num_bootstraps == 0) {
+    line_ss_ << ".:";
   } else {
-    gt_str << "1/2";
-  }
-  writer_ << locus.chrom << "\t"
-	  << locus.start << "\t"
-	  << ".\t"
-	  << ref_allele.str() << "\t"
-	  << alt_alleles.str() << "\t"
-	  << "." << "\t"
-	  << "." << "\t"
-	  << "END=" << locus.end << ";"
-	  << "RU=" << locus.motif << ";"
-	  << "REF=" << ref_size << "\t"
-	  << "GT:DP:GB:CI:RC:Q:INS" << "\t"
-	  << gt_str.str() << ":"
-	  << locus.depth << ":"
-	  << locus.allele1 << "," << locus.allele2 << ":"
-	  << locus.lob1 << "-" << locus.hib1 << "," << locus.lob2 << "-" << locus.hib2 << ":"
-	  << locus.enclosing_reads << "," << locus.spanning_reads << "," << locus.frr_reads << "," << locus.flanking_reads << ":"
-	  << locus.min_neg_lik << ":"
-	  << locus.insert_size_mean << "," << locus.insert_size_stddev
-	  << endl;
-  writer_.flush();
+    line_ss_ << locus.lob1 << "-" << locus.hib1 << "," << locus.lob2 << "-" << locus.hib2 << ":";
+  }
+  line_ss_ << locus.enclosing_reads << "," << locus.spanning_reads << "," << locus.frr_reads << "," << locus.flanking_reads << ":"
+	   << locus.min_neg_lik << ":"
+	   << locus.insert_size_mean << "," << locus.insert_size_stddev;
+
+  pthread_mutex_lock(&mutex_);
+  if (bcf_out_ != NULL) {
+    // vcf_parse splits the line in place, so it gets a copy
+    const std::string line = line_ss_.str();
+    bcf_line_.l = 0;
+    kputsn(line.data(), line.size(), &bcf_line_);
+    if (vcf_parse(&bcf_line_, bcf_header_, bcf_record_) != 0 ||
+	bcf_write(bcf_out_, bcf_header_, bcf_record_) != 0) {
+      PrintMessageDieOnError("Failed to write BCF record", M_ERROR);
+    }
+  } else {
+    buffer_ += line_ss_.str();
+    buffer_ += "\n";
+    if (buffer_.size() >= VCF_BUFFER_SIZE) {
+      FlushBuffer();
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+void VCFWriter::FlushBuffer() {
+  if (buffer_.empty()) {
+    return;
+  }
+  if (bgzf_write(text_out_, buffer_.data(), buffer_.size()) != (ssize_t)buffer_.size()) {
+    PrintMessageDieOnError("Failed to write VCF output file " + vcffile_, M_ERROR);
+  }
+  buffer_.clear();
+}
+
+/*
+  Another thread may be in the middle of WriteRecord. If the output is
+  busy, the error was raised while writing it, or records are still
+  arriving: either way the buffer is left alone rather than waited for
+ */
+void VCFWriter::FlushOnError(void* data) {
+  VCFWriter* writer = (VCFWriter*)data;
+  if (pthread_mutex_trylock(&writer->mutex_) != 0) {
+    return;
+  }
+  if (writer->text_out_ != NULL) {
+    writer->FlushBuffer();
+    bgzf_flush(writer->text_out_);
+  }
+  if (writer->bcf_out_ != NULL) {
+    bgzf_flush(writer->bcf_out_->fp.bgzf);
+  }
+  pthread_mutex_unlock(&writer->mutex_);
+}
+
+/*
+  Index compressed output once it is complete. Indexing needs the loci
+  sorted by position, so a failure is only a warning
+ */
+void VCFWriter::Close() {
+  if (text_out_ != NULL) {
+    FlushBuffer();
+    if (bgzf_close(text_out_) != 0) {
+      PrintMessageDieOnError("Failed to close VCF output file " + vcffile_, M_ERROR);
+    }
+    text_out_ = NULL;
+    if (format_ == "vcf.gz" && tbx_index_build(vcffile_.c_str(), 0, &tbx_conf_vcf) != 0) {
+      PrintMessageDieOnError("Could not index " + vcffile_ + ". Is the regions file sorted?", M_WARNING);
+    }
+  }
+  if (bcf_out_ != NULL) {
+    if (hts_close(bcf_out_) != 0) {
+      PrintMessageDieOnError("Failed to close BCF output file " + vcffile_, M_ERROR);
+    }
+    bcf_out_ = NULL;
+    bcf_destroy(bcf_record_);
+    bcf_hdr_destroy(bcf_header_);
+    free(bcf_line_.s);
+    bcf_line_.s = NULL;
+    // Default CSI bin size
+    if (bcf_index_build(vcffile_.c_str(), 14) != 0) {
+      PrintMessageDieOnError("Could not index " + vcffile_ + ". Is the regions file sorted?", M_WARNING);
+    }
+  }
 }
 
 VCFWriter::~VCFWriter() {
-  writer_.close();
+  Close();
+  RemoveErrorHook(&VCFWriter::FlushOnError, this);
+  pthread_mutex_destroy(&mutex_);
 }
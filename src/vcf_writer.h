@@ -18,23 +18,61 @@ You should have received a copy of the GNU General Public License
 along with GangSTR.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#ifndef SRC_VCF_WRITER_H
+#ifndef SRC_VCF_WRITER_H__
 #define SRC_VCF_WRITER_H__
 
+#include <pthread.h>
+
 #include <iostream>
-#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
 
+#include "htslib/bgzf.h"
+#include "htslib/vcf.h"
 #include "src/locus.h"
 
 using namespace std;
 
+// Formatted records are written out once this many bytes are buffered
+const size_t VCF_BUFFER_SIZE = 4 << 20;
+
+/*
+  Writes records as plain VCF, bgzip compressed VCF (format "vcf.gz",
+  tabix indexed at close) or BCF (format "bcf", CSI indexed at close).
+  Text records are kept in a userspace buffer and written in large
+  chunks, so a locus doesn't cost a write of its own. Records buffered
+  when a fatal error ends the program are still written out.
+ */
 class VCFWriter {
  public:
-  VCFWriter(const std::string& _vcffile, const std::string& full_command);
+  VCFWriter(const std::string& _vcffile, const std::string& full_command,
+	    const std::string& format = "vcf", const std::string& reffa = "");
   void WriteRecord(const Locus& locus);
+  // Write out buffered records, close and index the file
+  void Close();
   virtual ~VCFWriter();
  private:
-  ofstream writer_;
+  // Private unimplemented copy constructor and assignment operator to prevent operations
+  VCFWriter(const VCFWriter& other);
+  VCFWriter& operator=(const VCFWriter& other);
+
+  // Set up BCF output. Contigs are taken from the reference index
+  void OpenBCF(const std::vector<std::string>& header_lines, const std::string& reffa);
+  void FlushBuffer();
+  // Error hook: write out what is buffered, without closing the file
+  static void FlushOnError(void* data);
+
+  std::string vcffile_;
+  std::string format_;
+  BGZF* text_out_;         // VCF and vcf.gz output
+  std::string buffer_;
+  htsFile* bcf_out_;       // BCF output
+  bcf_hdr_t* bcf_header_;
+  bcf1_t* bcf_record_;
+  kstring_t bcf_line_;
+  std::stringstream line_ss_;
+  pthread_mutex_t mutex_;  // Guards the output against FlushOnError
 };
 
 #endif  // SRC_VCF_WRITER_H__